@@ -0,0 +1,49 @@
+#ifndef PHY_BENCH_H
+#define PHY_BENCH_H
+
+#include <chrono>
+#include "precision.h"
+
+namespace Bench
+{
+    typedef std::chrono::high_resolution_clock Clock;
+
+    class Timer
+    {
+        Clock::time_point start;
+    public:
+        Timer() : start(Clock::now()) {}
+
+        void reset()
+        {
+            start = Clock::now();
+        }
+
+        double elapsedNs() const
+        {
+            return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - start).count();
+        }
+    };
+
+    // A small deterministic generator, so every run builds the same scene.
+    class Random
+    {
+        unsigned state;
+    public:
+        Random(unsigned seed = 12345) : state(seed) {}
+
+        unsigned next()
+        {
+            state = state * 1664525u + 1013904223u;
+            return state >> 8;
+        }
+
+        Phy::real range(Phy::real min, Phy::real max)
+        {
+            return min + (max - min) * (Phy::real)next() / (Phy::real)(1u << 24);
+        }
+    };
+}
+
+#endif
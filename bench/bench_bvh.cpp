@@ -0,0 +1,220 @@
+// Compares FlatBVH against the pointer based BVHNode tree: building,
+// querying potential contacts, and removing and reinserting moving
+// bodies. Heap allocations are counted by replacing operator new.
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+#include "collide_bvh.h"
+#include "bench.h"
+
+#define FRAMES 20
+#define MOVING_PERCENT 10
+#define MAX_PAIRS 1000000
+
+static unsigned long long allocations = 0;
+
+// Every form is replaced, so each new is paired with its own delete.
+static void *allocate(size_t size)
+{
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t size)
+{
+    return allocate(size);
+}
+
+void *operator new[](size_t size)
+{
+    return allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+typedef Phy::BoundingSphere Sphere;
+typedef Phy::BVHNode<Sphere> PointerTree;
+typedef Phy::FlatBVH<Sphere> FlatTree;
+
+struct Scene
+{
+    std::vector<Phy::RigidBody> bodies;
+    std::vector<Sphere> volumes;
+    Phy::real extent;
+
+    Scene(unsigned count)
+        : bodies(count)
+    {
+        Bench::Random random;
+        // Keep the density, and so the pairs per body, the same at every size.
+        extent = Phy::real(4) * real_pow(Phy::real(count), Phy::real(1.0/3.0));
+        for(unsigned i = 0; i < count; i++)
+        {
+            volumes.push_back(Sphere(
+                Phy::Vector3(random.range(0, extent), random.range(0, extent), random.range(0, extent)),
+                random.range(0.5, 1.5)));
+        }
+    }
+
+    void move(unsigned i, Bench::Random &random)
+    {
+        volumes[i].center += Phy::Vector3(random.range(-1, 1), random.range(-1, 1), random.range(-1, 1));
+    }
+};
+
+// Maps each body to its leaf in the pointer tree.
+static void collectLeaves(PointerTree *node, Scene &scene, std::vector<PointerTree*> &leaves)
+{
+    if(node->isLeaf())
+    {
+        leaves[node->body - &scene.bodies[0]] = node;
+        return;
+    }
+    collectLeaves(node->children[0], scene, leaves);
+    collectLeaves(node->children[1], scene, leaves);
+}
+
+static unsigned long long pairKey(const Phy::PotentialContact &c, const Scene &scene)
+{
+    unsigned long long a = c.body[0] - &scene.bodies[0];
+    unsigned long long b = c.body[1] - &scene.bodies[0];
+    if(a > b) std::swap(a, b);
+    return (a << 32) | b;
+}
+
+static bool samePairs(const Phy::PotentialContact *x, const Scene &xScene,
+                      const Phy::PotentialContact *y, const Scene &yScene,
+                      unsigned count)
+{
+    std::vector<unsigned long long> a(count), b(count);
+    for(unsigned i = 0; i < count; i++)
+    {
+        a[i] = pairKey(x[i], xScene);
+        b[i] = pairKey(y[i], yScene);
+    }
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    return a == b;
+}
+
+static void bench(unsigned count)
+{
+    std::vector<Phy::PotentialContact> pointerPairs(MAX_PAIRS), flatPairs(MAX_PAIRS);
+
+    // Building
+    Scene pointerScene(count);
+    Bench::Timer timer;
+    unsigned long long before = allocations;
+    PointerTree *pointer = new PointerTree(NULL, pointerScene.volumes[0], &pointerScene.bodies[0]);
+    for(unsigned i = 1; i < count; i++)
+    {
+        pointer->insert(&pointerScene.bodies[i], pointerScene.volumes[i]);
+    }
+    double pointerBuild = timer.elapsedNs();
+    unsigned long long pointerBuildAllocs = allocations - before;
+
+    Scene flatScene(count);
+    std::vector<unsigned> flatLeaves(count);
+    timer.reset();
+    before = allocations;
+    FlatTree flat(count);
+    for(unsigned i = 0; i < count; i++)
+    {
+        flatLeaves[i] = flat.insert(&flatScene.bodies[i], flatScene.volumes[i]);
+    }
+    double flatBuild = timer.elapsedNs();
+    unsigned long long flatBuildAllocs = allocations - before;
+
+    // Churn: each frame a share of the bodies move and are reinserted.
+    Bench::Random pointerRandom(7), flatRandom(7);
+    double pointerChurn = 0, flatChurn = 0;
+    unsigned long long pointerChurnAllocs = 0, flatChurnAllocs = 0;
+    unsigned moving = count * MOVING_PERCENT / 100;
+    std::vector<PointerTree*> pointerLeaves(count);
+    for(unsigned f = 0; f < FRAMES; f++)
+    {
+        for(unsigned m = 0; m < moving; m++)
+        {
+            unsigned i = 1 + pointerRandom.next() % (count - 1);
+            pointerScene.move(i, pointerRandom);
+
+            // Removing a leaf moves its sibling's contents up into the
+            // parent, so the map is rebuilt (untimed) before each removal.
+            collectLeaves(pointer, pointerScene, pointerLeaves);
+            before = allocations;
+            timer.reset();
+            delete pointerLeaves[i];
+            pointer->insert(&pointerScene.bodies[i], pointerScene.volumes[i]);
+            pointerChurn += timer.elapsedNs();
+            pointerChurnAllocs += allocations - before;
+        }
+
+        before = allocations;
+        timer.reset();
+        for(unsigned m = 0; m < moving; m++)
+        {
+            unsigned i = 1 + flatRandom.next() % (count - 1);
+            flatScene.move(i, flatRandom);
+            flat.remove(flatLeaves[i]);
+            flatLeaves[i] = flat.insert(&flatScene.bodies[i], flatScene.volumes[i]);
+        }
+        flatChurn += timer.elapsedNs();
+        flatChurnAllocs += allocations - before;
+    }
+
+    // Querying
+    timer.reset();
+    unsigned pointerCount = pointer->getPotentialContacts(&pointerPairs[0], MAX_PAIRS);
+    double pointerQuery = timer.elapsedNs();
+
+    timer.reset();
+    unsigned flatCount = flat.getPotentialContacts(&flatPairs[0], MAX_PAIRS);
+    double flatQuery = timer.elapsedNs();
+
+    bool same = pointerCount == flatCount &&
+        samePairs(&pointerPairs[0], pointerScene, &flatPairs[0], flatScene, flatCount);
+
+    printf("%u bodies, %u moving per frame\n", count, moving);
+    printf("  %-8s %12s %8s %14s %12s %12s %8s\n",
+           "tree", "build ns", "allocs", "churn ns/frame", "allocs/frame", "query ns", "pairs");
+    printf("  %-8s %12.0f %8llu %14.0f %12.1f %12.0f %8u\n", "pointer",
+           pointerBuild, pointerBuildAllocs, pointerChurn / FRAMES,
+           double(pointerChurnAllocs) / FRAMES, pointerQuery, pointerCount);
+    printf("  %-8s %12.0f %8llu %14.0f %12.1f %12.0f %8u %s\n", "flat",
+           flatBuild, flatBuildAllocs, flatChurn / FRAMES,
+           double(flatChurnAllocs) / FRAMES, flatQuery, flatCount,
+           same ? "same pairs" : "DIFFERENT PAIRS");
+
+    delete pointer;
+}
+
+int main()
+{
+    bench(1000);
+    bench(10000);
+    return 0;
+}
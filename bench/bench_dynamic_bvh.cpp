@@ -0,0 +1,148 @@
+// Moves every body a little each frame and compares keeping a FlatBVH
+// up to date by removing and reinserting every body, against using it as
+// a dynamic tree with enlarged leaves. Checks that filtering the dynamic
+// tree's pairs by the exact volumes gives the exact tree's pairs.
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "collide_bvh.h"
+#include "bench.h"
+
+#define FRAMES 120
+#define MAX_PAIRS 1000000
+
+typedef Phy::BoundingSphere Sphere;
+typedef Phy::FlatBVH<Sphere> Tree;
+
+static const Phy::real duration = (Phy::real)1.0/60;
+
+struct Scene
+{
+    std::vector<Phy::RigidBody> bodies;
+    std::vector<Sphere> volumes;
+    std::vector<Phy::Vector3> velocities;
+
+    Scene(unsigned count, Phy::real speed)
+        : bodies(count)
+    {
+        Bench::Random random;
+        Phy::real extent = Phy::real(4) * real_pow(Phy::real(count), Phy::real(1.0/3.0));
+        for(unsigned i = 0; i < count; i++)
+        {
+            volumes.push_back(Sphere(
+                Phy::Vector3(random.range(0, extent), random.range(0, extent), random.range(0, extent)),
+                random.range(0.5, 1.5)));
+            velocities.push_back(Phy::Vector3(random.range(-speed, speed),
+                                              random.range(-speed, speed),
+                                              random.range(-speed, speed)));
+        }
+    }
+
+    void step()
+    {
+        for(unsigned i = 0; i < volumes.size(); i++)
+        {
+            volumes[i].center.addScaledVector(velocities[i], duration);
+        }
+    }
+
+    unsigned index(const Phy::RigidBody *body) const
+    {
+        return (unsigned)(body - &bodies[0]);
+    }
+};
+
+static unsigned long long pairKey(unsigned a, unsigned b)
+{
+    if(a > b) std::swap(a, b);
+    return ((unsigned long long)a << 32) | b;
+}
+
+static void bench(unsigned count, Phy::real speed, Phy::real margin)
+{
+    std::vector<Phy::PotentialContact> exactPairs(MAX_PAIRS), fatPairs(MAX_PAIRS);
+    Scene scene(count, speed);
+
+    Tree exact(count), dynamic(count, margin);
+    std::vector<unsigned> exactLeaves(count), dynamicLeaves(count);
+    for(unsigned i = 0; i < count; i++)
+    {
+        exactLeaves[i] = exact.insert(&scene.bodies[i], scene.volumes[i]);
+        dynamicLeaves[i] = dynamic.insert(&scene.bodies[i], scene.volumes[i]);
+    }
+
+    double exactNs = 0, dynamicNs = 0, exactQueryNs = 0, dynamicQueryNs = 0;
+    unsigned long long reinserts = 0, exactPairTotal = 0, fatPairTotal = 0;
+    bool same = true;
+    Bench::Timer timer;
+    for(unsigned f = 0; f < FRAMES; f++)
+    {
+        scene.step();
+
+        timer.reset();
+        for(unsigned i = 0; i < count; i++)
+        {
+            exact.remove(exactLeaves[i]);
+            exactLeaves[i] = exact.insert(&scene.bodies[i], scene.volumes[i]);
+        }
+        exactNs += timer.elapsedNs();
+
+        timer.reset();
+        for(unsigned i = 0; i < count; i++)
+        {
+            if(dynamic.update(dynamicLeaves[i], scene.volumes[i])) reinserts++;
+        }
+        dynamicNs += timer.elapsedNs();
+
+        timer.reset();
+        unsigned exactCount = exact.getPotentialContacts(&exactPairs[0], MAX_PAIRS);
+        exactQueryNs += timer.elapsedNs();
+
+        timer.reset();
+        unsigned fatCount = dynamic.getPotentialContacts(&fatPairs[0], MAX_PAIRS);
+        dynamicQueryNs += timer.elapsedNs();
+
+        exactPairTotal += exactCount;
+        fatPairTotal += fatCount;
+
+        // The enlarged pairs, filtered by the bodies' real volumes.
+        std::vector<unsigned long long> a, b;
+        for(unsigned i = 0; i < exactCount; i++)
+        {
+            a.push_back(pairKey(scene.index(exactPairs[i].body[0]),
+                                scene.index(exactPairs[i].body[1])));
+        }
+        for(unsigned i = 0; i < fatCount; i++)
+        {
+            unsigned i0 = scene.index(fatPairs[i].body[0]);
+            unsigned i1 = scene.index(fatPairs[i].body[1]);
+            if(scene.volumes[i0].overlaps(&scene.volumes[i1])) b.push_back(pairKey(i0, i1));
+        }
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        if(a != b) same = false;
+    }
+
+    printf("%6u %6.1f %6.2f %14.0f %14.0f %10.1f %12.0f %12.0f %8.1f %8.1f %4d %4d %s\n",
+           count, speed, margin,
+           exactNs / FRAMES, dynamicNs / FRAMES, double(reinserts) / FRAMES,
+           exactQueryNs / FRAMES, dynamicQueryNs / FRAMES,
+           double(exactPairTotal) / FRAMES, double(fatPairTotal) / FRAMES,
+           exact.getHeight(), dynamic.getHeight(),
+           same ? "ok" : "MISMATCH");
+}
+
+int main()
+{
+    printf("%6s %6s %6s %14s %14s %10s %12s %12s %8s %8s %4s %4s\n",
+           "bodies", "speed", "margin", "reinsert ns", "update ns", "moved",
+           "exact q ns", "fat q ns", "pairs", "fat", "h", "fat h");
+    bench(1000, 1, 0.1);
+    bench(1000, 1, 0.25);
+    bench(10000, 1, 0.1);
+    bench(10000, 1, 0.25);
+    bench(10000, 5, 0.25);
+    return 0;
+}
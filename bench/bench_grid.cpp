@@ -0,0 +1,113 @@
+// Times ParticleGridContacts on clouds of particles of growing size,
+// and checks its contacts against a brute force pass over every pair
+// for the sizes where that is affordable.
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "pworld.h"
+#include "bench.h"
+
+#define RUNS 5
+#define BRUTE_FORCE_LIMIT 8000
+
+static const Phy::real radius = 0.5;
+
+struct Cloud
+{
+    std::vector<Phy::Particle> storage;
+    Phy::ParticleWorld::Particles particles;
+
+    // Particles at a fixed density, so the contacts per particle stay
+    // the same at every size.
+    Cloud(unsigned count)
+        : storage(count)
+    {
+        Bench::Random random;
+        Phy::real extent = real_pow(Phy::real(count) * 2, Phy::real(1.0/3.0));
+        for(unsigned i = 0; i < count; i++)
+        {
+            Phy::Particle &p = storage[i];
+            p.position = Phy::Vector3(random.range(0, extent),
+                                      random.range(0, extent),
+                                      random.range(0, extent));
+            p.setMass(1);
+            particles.push_back(&p);
+        }
+    }
+};
+
+static unsigned bruteForce(const Cloud &cloud, std::vector<unsigned long long> &keys)
+{
+    keys.clear();
+    Phy::real diameter = radius * 2;
+    for(unsigned i = 0; i < cloud.particles.size(); i++)
+    {
+        for(unsigned j = i + 1; j < cloud.particles.size(); j++)
+        {
+            Phy::Vector3 d = cloud.particles[i]->position - cloud.particles[j]->position;
+            if(d.squareMagnitude() < diameter * diameter)
+            {
+                keys.push_back(((unsigned long long)i << 32) | j);
+            }
+        }
+    }
+    return (unsigned)keys.size();
+}
+
+static void bench(unsigned count)
+{
+    Cloud cloud(count);
+    Phy::ParticleGridContacts grid;
+    grid.init(&cloud.particles, radius, 0);
+
+    unsigned maxContacts = count * 16;
+    std::vector<Phy::ParticleContact> contacts(maxContacts);
+    unsigned used = 0;
+    double ns = 0;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        Bench::Timer timer;
+        used = grid.addContact(&contacts[0], maxContacts);
+        ns += timer.elapsedNs();
+    }
+    ns /= RUNS;
+
+    // A smaller limit must be respected.
+    unsigned limited = grid.addContact(&contacts[0], used / 2);
+
+    const char *check = "-";
+    if(count <= BRUTE_FORCE_LIMIT)
+    {
+        std::vector<unsigned long long> expected, found;
+        bruteForce(cloud, expected);
+        used = grid.addContact(&contacts[0], maxContacts);
+        const Phy::Particle *first = &cloud.storage[0];
+        for(unsigned i = 0; i < used; i++)
+        {
+            unsigned long long a = contacts[i].particle[0] - first;
+            unsigned long long b = contacts[i].particle[1] - first;
+            if(a > b) std::swap(a, b);
+            found.push_back((a << 32) | b);
+        }
+        std::sort(expected.begin(), expected.end());
+        std::sort(found.begin(), found.end());
+        check = (expected == found) ? "ok" : "MISMATCH";
+    }
+
+    printf("%8u %10u %14.0f %10.1f %8s %s\n", count, used, ns, ns / count,
+           check, limited == used / 2 ? "ok" : "OVER LIMIT");
+}
+
+int main()
+{
+    printf("%8s %10s %14s %10s %8s %s\n",
+           "count", "contacts", "ns", "ns/part", "pairs", "limit");
+    bench(1000);
+    bench(4000);
+    bench(8000);
+    bench(32000);
+    bench(128000);
+    return 0;
+}
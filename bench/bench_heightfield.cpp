@@ -0,0 +1,149 @@
+// Times contact generation against a 513 x 513 heightfield, the size of
+// a terrain page, for particles, spheres and boxes scattered over it.
+// Most of them sit around the surface, half touching it, and the rest
+// are well above it, where the tile bounds should turn them away
+// without looking at any cells. Reports the best of several runs in ns
+// per object, with the contacts found and a checksum of their
+// penetrations.
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include "collide_fine.h"
+#include "pworld.h"
+#include "bench.h"
+
+#define SIZE 513
+#define OBJECTS 100000
+#define RUNS 5
+#define MAX_CONTACTS (OBJECTS * 8)
+
+static const Phy::real worldSize = 1500;
+static const Phy::real maxHeight = 100;
+
+static Phy::HeightField field;
+static std::vector<Phy::Particle> particles(OBJECTS);
+static Phy::ParticleWorld::Particles particlePointers(OBJECTS);
+static std::vector<Phy::RigidBody> bodies(OBJECTS);
+static std::vector<Phy::CollisionSphere> spheres(OBJECTS);
+static std::vector<Phy::CollisionBox> boxes(OBJECTS);
+static std::vector<Phy::Contact> contacts(MAX_CONTACTS);
+static std::vector<Phy::ParticleContact> particleContacts(OBJECTS);
+
+static void build()
+{
+    // Rolling hills, with finer bumps on them.
+    std::vector<unsigned short> samples(SIZE * SIZE);
+    for(unsigned z = 0; z < SIZE; z++)
+    {
+        for(unsigned x = 0; x < SIZE; x++)
+        {
+            double h = 0.5 + 0.3 * sin(x * 0.02) * cos(z * 0.015) + 0.1 * sin(x * 0.11 + z * 0.07);
+            samples[z * SIZE + x] = (unsigned short)(h * 65535);
+        }
+    }
+    field.setHeights(&samples[0], SIZE);
+    field.setScale(worldSize, worldSize, maxHeight);
+
+    Bench::Random random;
+    for(unsigned i = 0; i < OBJECTS; i++)
+    {
+        Phy::real x = random.range(1, worldSize - 1);
+        Phy::real z = random.range(1, worldSize - 1);
+        Phy::real height;
+        field.getHeight(x, z, &height);
+        Phy::real y = (i % 4 == 0) ? height + random.range(20, 60) : height + random.range(-1, 1);
+
+        particles[i].position = Phy::Vector3(x, y, z);
+        particlePointers[i] = &particles[i];
+
+        Phy::RigidBody &body = bodies[i];
+        body.setPosition(x, y, z);
+        body.setOrientation(random.range(-1, 1), random.range(-1, 1),
+                            random.range(-1, 1), random.range(-1, 1));
+        body.calculateDerivedData();
+
+        Phy::CollisionSphere &sphere = spheres[i];
+        sphere.body = &body;
+        sphere.offset.setOrientationAndPos(Phy::Quaternion(), Phy::Vector3());
+        sphere.radius = random.range(0.5, 2);
+        sphere.calculateInternals();
+
+        Phy::CollisionBox &box = boxes[i];
+        box.body = &body;
+        box.offset = sphere.offset;
+        box.halfSize = Phy::Vector3(random.range(0.5, 2), random.range(0.5, 2),
+                                    random.range(0.5, 2));
+        box.calculateInternals();
+    }
+}
+
+static Phy::CollisionData data;
+
+static void report(const char *name, double best, unsigned count, double checksum)
+{
+    printf("%-16s %8.2f ns/object  contacts %7u  checksum %.12g\n", name,
+           best / OBJECTS, count, checksum);
+}
+
+static double checksum()
+{
+    double sum = 0;
+    for(unsigned i = 0; i < data.contactCount; i++) sum += contacts[i].penetration;
+    return sum;
+}
+
+int main()
+{
+    build();
+    data.contactArray = &contacts[0];
+    data.friction = (Phy::real)0.9;
+    data.restitution = (Phy::real)0.1;
+    data.tolerance = (Phy::real)0.1;
+
+    Phy::HeightFieldContacts ground;
+    ground.init(&particlePointers, &field, (Phy::real)0.2);
+    double best = 1e30;
+    unsigned used = 0;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        Bench::Timer timer;
+        used = ground.addContact(&particleContacts[0], OBJECTS);
+        double ns = timer.elapsedNs();
+        if(ns < best) best = ns;
+    }
+    double sum = 0;
+    for(unsigned i = 0; i < used; i++) sum += particleContacts[i].penetration;
+    report("particles", best, used, sum);
+
+    best = 1e30;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        data.reset(MAX_CONTACTS);
+        Bench::Timer timer;
+        for(unsigned i = 0; i < OBJECTS; i++)
+        {
+            Phy::CollisionDetector::sphereAndHeightField(spheres[i], field, &data);
+        }
+        double ns = timer.elapsedNs();
+        if(ns < best) best = ns;
+    }
+    report("spheres", best, data.contactCount, checksum());
+
+    best = 1e30;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        data.reset(MAX_CONTACTS);
+        Bench::Timer timer;
+        for(unsigned i = 0; i < OBJECTS; i++)
+        {
+            Phy::CollisionDetector::boxAndHeightField(boxes[i], field, &data);
+        }
+        double ns = timer.elapsedNs();
+        if(ns < best) best = ns;
+    }
+    report("boxes", best, data.contactCount, checksum());
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+// Resolves the contacts of many independent ropes with the serial
+// ParticleContactResolver and with island mode on 1 to N threads, and
+// checks that island mode leaves every rope where the serial resolver
+// leaves it when given that rope on its own.
+//
+// usage: bench_islands [max threads]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+
+#include "plinks.h"
+#include "workers.h"
+#include "bench.h"
+
+#define ROPE_COUNT 200
+#define ROPE_LINKS 10
+#define RUNS 5
+#define TOLERANCE 1e-9
+
+static const Phy::real duration = (Phy::real)1.0/60;
+
+struct RopeScene
+{
+    std::vector<Phy::Particle> particles;
+    std::vector<Phy::ParticleRod> rods;
+    std::vector<Phy::ParticleRodConstraint> anchors;
+    std::vector<Phy::ParticleContact> contacts;
+
+    RopeScene()
+        : particles(ROPE_COUNT * ROPE_LINKS),
+          rods(ROPE_COUNT * (ROPE_LINKS-1)),
+          anchors(ROPE_COUNT),
+          contacts(ROPE_COUNT * ROPE_LINKS)
+    {
+        for(unsigned r = 0; r < ROPE_COUNT; r++)
+        {
+            Phy::Particle *rope = &particles[r * ROPE_LINKS];
+            anchors[r].particle = rope;
+            anchors[r].anchor = Phy::Vector3(Phy::real(r) * 2, 20, 0);
+            anchors[r].length = 1;
+
+            for(unsigned l = 0; l + 1 < ROPE_LINKS; l++)
+            {
+                Phy::ParticleRod &rod = rods[r * (ROPE_LINKS-1) + l];
+                rod.particle[0] = rope + l;
+                rod.particle[1] = rope + l + 1;
+                rod.length = 1;
+            }
+        }
+        reset();
+    }
+
+    // Puts every particle slightly off its rest position, so all the
+    // links generate a contact.
+    void reset()
+    {
+        Bench::Random random;
+        for(unsigned r = 0; r < ROPE_COUNT; r++)
+        {
+            for(unsigned l = 0; l < ROPE_LINKS; l++)
+            {
+                Phy::Particle &p = particles[r * ROPE_LINKS + l];
+                p.position = Phy::Vector3(Phy::real(r) * 2 + random.range(-0.2, 0.2),
+                                          Phy::real(19) - Phy::real(l) * 1.1,
+                                          random.range(-0.2, 0.2));
+                p.velocity = Phy::Vector3(random.range(-1, 1), random.range(-1, 1), 0);
+                p.acceleration = Phy::Vector3(0, -9.81, 0);
+                p.damping = 0.99;
+                p.setMass(1);
+                p.clearAccumulator();
+            }
+        }
+    }
+
+    // Writes the contacts of one rope and returns how many there are.
+    unsigned generateRopeContacts(unsigned r, Phy::ParticleContact *contact)
+    {
+        unsigned used = anchors[r].addContact(contact, 1);
+        for(unsigned l = 0; l + 1 < ROPE_LINKS; l++)
+        {
+            used += rods[r * (ROPE_LINKS-1) + l].addContact(contact + used, 1);
+        }
+        return used;
+    }
+
+    unsigned generateContacts()
+    {
+        unsigned used = 0;
+        for(unsigned r = 0; r < ROPE_COUNT; r++)
+        {
+            used += generateRopeContacts(r, &contacts[used]);
+        }
+        return used;
+    }
+};
+
+static Phy::real maxDifference(const std::vector<Phy::Particle> &a,
+                               const std::vector<Phy::Particle> &b)
+{
+    Phy::real error = 0;
+    for(unsigned i = 0; i < a.size(); i++)
+    {
+        Phy::Vector3 d = a[i].position - b[i].position;
+        if(real_abs(d.x) > error) error = real_abs(d.x);
+        if(real_abs(d.y) > error) error = real_abs(d.y);
+        if(real_abs(d.z) > error) error = real_abs(d.z);
+    }
+    return error;
+}
+
+// Returns the average ns per resolve and leaves the resolved state in the scene.
+static double resolve(RopeScene &scene, Phy::WorkerPool *workers,
+                      Phy::ParticleContactSelection selection, unsigned *iterationsUsed)
+{
+    Phy::ParticleContactResolver resolver(0);
+    resolver.setWorkerPool(workers);
+    resolver.setSelection(selection);
+
+    double ns = 0;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        scene.reset();
+        unsigned used = scene.generateContacts();
+        resolver.setIterations(used * 2);
+
+        Bench::Timer timer;
+        resolver.resolveContacts(&scene.contacts[0], used, duration);
+        ns += timer.elapsedNs();
+    }
+    *iterationsUsed = resolver.getIterationsUsed();
+    return ns / RUNS;
+}
+
+// Runs the serial resolver on each rope separately, with the same
+// iterations per contact as the whole scene gets.
+static void resolvePerRope(RopeScene &scene)
+{
+    Phy::ParticleContactResolver resolver(0);
+    scene.reset();
+    for(unsigned r = 0; r < ROPE_COUNT; r++)
+    {
+        unsigned used = scene.generateRopeContacts(r, &scene.contacts[0]);
+        resolver.setIterations(used * 2);
+        resolver.resolveContacts(&scene.contacts[0], used, duration);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned maxThreads = std::thread::hardware_concurrency();
+    if(argc > 1) maxThreads = (unsigned)atoi(argv[1]);
+    if(maxThreads < 1) maxThreads = 1;
+
+    RopeScene serialScene;
+    unsigned iterations;
+    double serialNs = resolve(serialScene, NULL, Phy::SELECT_LINEAR_SCAN, &iterations);
+
+    RopeScene referenceScene;
+    resolvePerRope(referenceScene);
+
+    printf("%u ropes of %u particles, %u hardware threads\n",
+           ROPE_COUNT, ROPE_LINKS, std::thread::hardware_concurrency());
+    printf("%-10s %14s %10s %8s %12s\n", "mode", "ns/resolve", "iterations", "speedup", "max error");
+    printf("%-10s %14.0f %10u %7.2fx %12s\n", "serial", serialNs, iterations, 1.0, "-");
+
+    for(unsigned selection = Phy::SELECT_LINEAR_SCAN;
+        selection <= Phy::SELECT_PRIORITY_QUEUE;
+        selection++)
+    {
+        for(unsigned threads = 1; threads <= maxThreads; threads++)
+        {
+            Phy::WorkerPool workers(threads);
+            RopeScene scene;
+            double ns = resolve(scene, &workers, (Phy::ParticleContactSelection)selection,
+                                &iterations);
+            Phy::real error = maxDifference(scene.particles, referenceScene.particles);
+
+            char name[32];
+            sprintf(name, "%s/%u", selection == Phy::SELECT_LINEAR_SCAN ? "islands" : "queue",
+                    threads);
+            printf("%-10s %14.0f %10u %7.2fx %12g %s\n", name, ns, iterations,
+                   serialNs/ns, error, error <= TOLERANCE ? "ok" : "MISMATCH");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+// Times the core maths operations the rest of the library leans on:
+// transforming points into and out of body space, composing
+// transforms, vector arithmetic and calculateDerivedData, at the
+// library's precision and, for the plain maths, at float. Build it
+// once as it is and once with PHY_SCALAR_MATH defined to compare the
+// SIMD and scalar versions; the checksums of the two builds match.
+
+#include <cstdio>
+#include <vector>
+
+#include "body.h"
+#include "bench.h"
+
+#define COUNT 10000
+#define REPEATS 20
+#define RUNS 5
+
+static std::vector<Phy::RigidBody> bodies(COUNT);
+static std::vector<Phy::Vector3> points(COUNT);
+static std::vector<Phy::Vector3> results(COUNT);
+static std::vector<Phy::Matrix4> transforms(COUNT);
+static std::vector<Phy::Vector3f> pointsf(COUNT);
+static std::vector<Phy::Vector3f> resultsf(COUNT);
+static std::vector<Phy::Matrix4f> transformsf(COUNT);
+
+static double checksum()
+{
+    double sum = 0;
+    for(unsigned i = 0; i < COUNT; i++)
+    {
+        sum += results[i].x + results[i].y * 3 + results[i].z * 7;
+        sum += resultsf[i].x + resultsf[i].y * 3 + resultsf[i].z * 7;
+    }
+    return sum;
+}
+
+enum Op
+{
+    OP_WORLD_SPACE = 0,
+    OP_LOCAL_SPACE,
+    OP_DIRECTION,
+    OP_INVERSE_DIRECTION,
+    OP_MATRIX_PRODUCT,
+    OP_VECTOR,
+    OP_DERIVED_DATA,
+    OP_FLOAT_INVERSE,
+    OP_FLOAT_VECTOR,
+    OPS
+};
+
+static const char *opNames[OPS] =
+{
+    "getPointInWorldSpace", "getPointInLocalSpace", "transformDirection",
+    "transformInverseDirection", "Matrix4 * Matrix4", "vector arithmetic",
+    "calculateDerivedData", "float transformInverse", "float vector arithmetic"
+};
+
+static void runOp(unsigned op)
+{
+    unsigned i;
+    switch(op)
+    {
+    case OP_WORLD_SPACE:
+        for(i = 0; i < COUNT; i++) results[i] = bodies[i].getPointInWorldSpace(points[i]);
+        break;
+    case OP_LOCAL_SPACE:
+        for(i = 0; i < COUNT; i++) results[i] = bodies[i].getPointInLocalSpace(points[i]);
+        break;
+    case OP_DIRECTION:
+        for(i = 0; i < COUNT; i++) results[i] = transforms[i].transformDirection(points[i]);
+        break;
+    case OP_INVERSE_DIRECTION:
+        for(i = 0; i < COUNT; i++) results[i] = transforms[i].transformInverseDirection(points[i]);
+        break;
+    case OP_MATRIX_PRODUCT:
+        for(i = 0; i < COUNT; i++)
+        {
+            Phy::Matrix4 m = transforms[i] * transforms[(i + 1) % COUNT];
+            results[i] = m.transform(points[i]);
+        }
+        break;
+    case OP_VECTOR:
+        for(i = 0; i < COUNT; i++)
+        {
+            Phy::Vector3 v = points[i] - points[(i + 7) % COUNT];
+            v.addScaledVector(points[(i + 1) % COUNT], Phy::real(0.5));
+            results[i] = v * (v * points[i]) + v;
+        }
+        break;
+    case OP_DERIVED_DATA:
+        for(i = 0; i < COUNT; i++) bodies[i].calculateDerivedData();
+        for(i = 0; i < COUNT; i++) results[i] = bodies[i].getPointInWorldSpace(points[i]);
+        break;
+    case OP_FLOAT_INVERSE:
+        for(i = 0; i < COUNT; i++) resultsf[i] = transformsf[i].transformInverse(pointsf[i]);
+        break;
+    case OP_FLOAT_VECTOR:
+        for(i = 0; i < COUNT; i++)
+        {
+            Phy::Vector3f v = pointsf[i] - pointsf[(i + 7) % COUNT];
+            v.addScaledVector(pointsf[(i + 1) % COUNT], 0.5f);
+            resultsf[i] = v * (v * pointsf[i]) + v;
+        }
+        break;
+    }
+}
+
+int main()
+{
+#ifdef PHY_SIMD_CORE
+    printf("core maths: simd\n");
+#else
+    printf("core maths: scalar\n");
+#endif
+
+    Bench::Random random;
+    for(unsigned i = 0; i < COUNT; i++)
+    {
+        Phy::RigidBody &body = bodies[i];
+        body.setPosition(random.range(-50, 50), random.range(-50, 50), random.range(-50, 50));
+        body.setOrientation(random.range(-1, 1), random.range(-1, 1),
+                            random.range(-1, 1), random.range(-1, 1));
+        body.setMass(random.range(1, 10));
+        body.setInertiaTensor(Phy::Matrix3(random.range(1, 4), 0, 0,
+                                           0, random.range(1, 4), 0,
+                                           0, 0, random.range(1, 4)));
+        body.calculateDerivedData();
+        points[i] = Phy::Vector3(random.range(-2, 2), random.range(-2, 2), random.range(-2, 2));
+        transforms[i] = body.getTransform();
+
+        pointsf[i] = Phy::Vector3f(float(points[i].x), float(points[i].y), float(points[i].z));
+        for(unsigned k = 0; k < 12; k++) transformsf[i].data[k] = float(transforms[i].data[k]);
+    }
+
+    double best[OPS];
+    for(unsigned op = 0; op < OPS; op++) best[op] = 1e30;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        for(unsigned op = 0; op < OPS; op++)
+        {
+            Bench::Timer timer;
+            for(unsigned r = 0; r < REPEATS; r++) runOp(op);
+            double ns = timer.elapsedNs();
+            if(ns < best[op]) best[op] = ns;
+        }
+    }
+    for(unsigned op = 0; op < OPS; op++)
+    {
+        runOp(op);
+        printf("%-26s %10.2f ns/op   checksum %.17g\n", opNames[op],
+               best[op] / (double(COUNT) * REPEATS), checksum());
+    }
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Compares ParticleWorld (a vector of Particle pointers) against
+// ParticleWorldSoA on the integration step, and the SoA world at double
+// precision against the same world at float precision.
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "pworld.h"
+#include "pworld_soa.h"
+#include "bench.h"
+
+#define STEPS 100
+
+static const Phy::real duration = (Phy::real)1.0/60;
+
+static double benchPointerWorld(unsigned count)
+{
+    Bench::Random random;
+    Phy::ParticleWorld world(1);
+
+    // Allocate the particles one by one and shuffle them, the way a
+    // game that spawns and kills debris ends up with them in the heap.
+    std::vector<Phy::Particle*> particles(count);
+    for(unsigned i = 0; i < count; i++)
+    {
+        Phy::Particle *p = new Phy::Particle();
+        p->position = Phy::Vector3(random.range(-50, 50), random.range(0, 50), random.range(-50, 50));
+        p->velocity = Phy::Vector3(random.range(-5, 5), random.range(-5, 5), random.range(-5, 5));
+        p->acceleration = Phy::Vector3(0, -9.81, 0);
+        p->damping = 0.99;
+        p->setMass(random.range(1, 10));
+        p->clearAccumulator();
+        particles[i] = p;
+    }
+    for(unsigned i = count; i > 1; i--)
+    {
+        std::swap(particles[i-1], particles[random.next() % i]);
+    }
+    world.getParticles() = particles;
+
+    Bench::Timer timer;
+    for(unsigned s = 0; s < STEPS; s++)
+    {
+        world.startFrame();
+        world.integrate(duration);
+    }
+    double ns = timer.elapsedNs();
+
+    for(unsigned i = 0; i < count; i++) delete particles[i];
+    return ns / STEPS;
+}
+
+template<class T>
+static double benchSoAWorld(unsigned count)
+{
+    typedef Phy::Vector3T<T> Vector;
+
+    Bench::Random random;
+    Phy::ParticleWorldSoAT<T> world;
+    world.reserve(count);
+
+    for(unsigned i = 0; i < count; i++)
+    {
+        world.addParticle(
+            Vector(T(random.range(-50, 50)), T(random.range(0, 50)), T(random.range(-50, 50))),
+            Vector(T(random.range(-5, 5)), T(random.range(-5, 5)), T(random.range(-5, 5))),
+            Vector(0, T(-9.81), 0),
+            T(0.99),
+            T(1.0/random.range(1, 10)));
+    }
+
+    Bench::Timer timer;
+    for(unsigned s = 0; s < STEPS; s++)
+    {
+        world.startFrame();
+        world.integrate(T(duration));
+    }
+    return timer.elapsedNs() / STEPS;
+}
+
+int main()
+{
+    unsigned counts[] = { 1000, 10000, 100000 };
+
+    printf("%10s %16s %16s %8s %16s\n", "particles", "pointer ns/step", "soa ns/step", "speedup",
+           "float soa ns");
+    for(unsigned i = 0; i < sizeof(counts)/sizeof(counts[0]); i++)
+    {
+        double pointerNs = benchPointerWorld(counts[i]);
+        double soaNs = benchSoAWorld<Phy::real>(counts[i]);
+        double floatNs = benchSoAWorld<float>(counts[i]);
+        printf("%10u %16.0f %16.0f %7.2fx %16.0f\n", counts[i], pointerNs, soaNs,
+               pointerNs/soaNs, floatNs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Compares the contact selection strategies of ParticleContactResolver
+// on rope and cloth scenes, and checks that they resolve the contacts
+// in the same order.
+
+#include <cstdio>
+#include <vector>
+
+#include "plinks.h"
+#include "bench.h"
+
+#define RUNS 3
+#define TOLERANCE 1e-9
+
+static const Phy::real duration = (Phy::real)1.0/60;
+
+/*
+ * Particles on a width x height grid joined by rods to their right and
+ * lower neighbours, with the top row pinned. A width of one is a rope.
+ */
+struct LinkScene
+{
+    unsigned width;
+    unsigned height;
+    std::vector<Phy::Particle> particles;
+    std::vector<Phy::ParticleRod> rods;
+    std::vector<Phy::ParticleRodConstraint> anchors;
+    std::vector<Phy::ParticleContact> contacts;
+
+    LinkScene(unsigned width, unsigned height)
+        : width(width), height(height), particles(width * height)
+    {
+        for(unsigned y = 0; y < height; y++)
+        {
+            for(unsigned x = 0; x < width; x++)
+            {
+                Phy::Particle *p = &particles[y * width + x];
+                if(y == 0)
+                {
+                    Phy::ParticleRodConstraint anchor;
+                    anchor.particle = p;
+                    anchor.anchor = Phy::Vector3(Phy::real(x), 1, 0);
+                    anchor.length = 1;
+                    anchors.push_back(anchor);
+                }
+                if(x + 1 < width) addRod(p, p + 1);
+                if(y + 1 < height) addRod(p, p + width);
+            }
+        }
+        contacts.resize(rods.size() + anchors.size());
+        reset();
+    }
+
+    void addRod(Phy::Particle *a, Phy::Particle *b)
+    {
+        Phy::ParticleRod rod;
+        rod.particle[0] = a;
+        rod.particle[1] = b;
+        rod.length = 1;
+        rods.push_back(rod);
+    }
+
+    void reset()
+    {
+        Bench::Random random;
+        for(unsigned y = 0; y < height; y++)
+        {
+            for(unsigned x = 0; x < width; x++)
+            {
+                Phy::Particle &p = particles[y * width + x];
+                p.position = Phy::Vector3(Phy::real(x) + random.range(-0.1, 0.1),
+                                          -Phy::real(y) * 1.05,
+                                          random.range(-0.1, 0.1));
+                p.velocity = Phy::Vector3(0, random.range(-1, 0), 0);
+                p.acceleration = Phy::Vector3(0, -9.81, 0);
+                p.damping = 0.99;
+                p.setMass(1);
+                p.clearAccumulator();
+            }
+        }
+    }
+
+    unsigned generateContacts()
+    {
+        unsigned used = 0;
+        for(unsigned i = 0; i < anchors.size(); i++)
+        {
+            used += anchors[i].addContact(&contacts[used], 1);
+        }
+        for(unsigned i = 0; i < rods.size(); i++)
+        {
+            used += rods[i].addContact(&contacts[used], 1);
+        }
+        return used;
+    }
+};
+
+static double resolve(LinkScene &scene, Phy::ParticleContactSelection selection,
+                      unsigned *contactCount, unsigned *iterationsUsed)
+{
+    Phy::ParticleContactResolver resolver(0);
+    resolver.setSelection(selection);
+
+    double ns = 0;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        scene.reset();
+        unsigned used = scene.generateContacts();
+        resolver.setIterations(used * 2);
+
+        Bench::Timer timer;
+        resolver.resolveContacts(&scene.contacts[0], used, duration);
+        ns += timer.elapsedNs();
+        *contactCount = used;
+    }
+    *iterationsUsed = resolver.getIterationsUsed();
+    return ns / RUNS;
+}
+
+static void benchScene(const char *name, unsigned width, unsigned height)
+{
+    LinkScene linear(width, height);
+    LinkScene queue(width, height);
+    unsigned contacts, linearIterations, queueIterations;
+
+    double linearNs = resolve(linear, Phy::SELECT_LINEAR_SCAN, &contacts, &linearIterations);
+    double queueNs = resolve(queue, Phy::SELECT_PRIORITY_QUEUE, &contacts, &queueIterations);
+
+    Phy::real error = 0;
+    for(unsigned i = 0; i < linear.particles.size(); i++)
+    {
+        Phy::Vector3 d = linear.particles[i].position - queue.particles[i].position;
+        if(real_abs(d.x) > error) error = real_abs(d.x);
+        if(real_abs(d.y) > error) error = real_abs(d.y);
+        if(real_abs(d.z) > error) error = real_abs(d.z);
+    }
+
+    printf("%-12s %8u %14.0f %14.0f %7.2fx %10g %s\n", name, contacts,
+           linearNs, queueNs, linearNs/queueNs, error,
+           (error <= TOLERANCE && linearIterations == queueIterations) ? "ok" : "MISMATCH");
+}
+
+int main()
+{
+    printf("%-12s %8s %14s %14s %8s %10s\n",
+           "scene", "contacts", "linear ns", "queue ns", "speedup", "max error");
+    benchScene("rope 250", 1, 250);
+    benchScene("rope 1000", 1, 1000);
+    benchScene("rope 4000", 1, 4000);
+    benchScene("cloth 16", 16, 16);
+    benchScene("cloth 32", 32, 32);
+    return 0;
+}
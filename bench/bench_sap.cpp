@@ -0,0 +1,146 @@
+// Runs the sweep and prune broadphase and the bounding volume trees on
+// the same stacks of boxes, which settle and move only a little each
+// frame, and checks that they report the same pairs.
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "collide_bvh.h"
+#include "collide_sap.h"
+#include "bench.h"
+
+#define FRAMES 120
+#define MAX_PAIRS 1000000
+
+struct Stacks
+{
+    std::vector<Phy::RigidBody> bodies;
+    std::vector<Phy::Vector3> centers;
+    std::vector<Phy::Vector3> halfSizes;
+    Bench::Random random;
+
+    // Stacks of one to eight boxes scattered over a square floor.
+    Stacks(unsigned stackCount)
+    {
+        Phy::real extent = real_sqrt(Phy::real(stackCount)) * 3;
+        for(unsigned s = 0; s < stackCount; s++)
+        {
+            Phy::real x = random.range(0, extent);
+            Phy::real z = random.range(0, extent);
+            unsigned height = 1 + random.next() % 8;
+            for(unsigned c = 0; c < height; c++)
+            {
+                centers.push_back(Phy::Vector3(x, 0.5 + c, z));
+                halfSizes.push_back(Phy::Vector3(0.5, 0.5, 0.5));
+            }
+        }
+        bodies.resize(centers.size());
+    }
+
+    // Nudges every box sideways, as a settling stack would.
+    void step(Phy::real jitter)
+    {
+        for(unsigned i = 0; i < centers.size(); i++)
+        {
+            centers[i].x += random.range(-jitter, jitter);
+            centers[i].z += random.range(-jitter, jitter);
+        }
+    }
+
+    unsigned getCount() const
+    {
+        return (unsigned)centers.size();
+    }
+
+    Phy::BoundingBox getBox(unsigned i) const
+    {
+        return Phy::BoundingBox(centers[i], halfSizes[i]);
+    }
+
+    unsigned index(const Phy::RigidBody *body) const
+    {
+        return (unsigned)(body - &bodies[0]);
+    }
+};
+
+static void sortedKeys(const Stacks &stacks, const Phy::PotentialContact *pairs,
+                       unsigned count, std::vector<unsigned long long> &keys)
+{
+    keys.clear();
+    for(unsigned i = 0; i < count; i++)
+    {
+        unsigned long long a = stacks.index(pairs[i].body[0]);
+        unsigned long long b = stacks.index(pairs[i].body[1]);
+        if(a > b) std::swap(a, b);
+        keys.push_back((a << 32) | b);
+    }
+    std::sort(keys.begin(), keys.end());
+}
+
+static void bench(unsigned stackCount, Phy::real jitter)
+{
+    Stacks stacks(stackCount);
+    unsigned count = stacks.getCount();
+    std::vector<Phy::PotentialContact> pairs(MAX_PAIRS);
+    std::vector<unsigned long long> sapKeys, treeKeys, pointerKeys;
+
+    Phy::SweepAndPrune sap(count);
+    Phy::FlatBVH<Phy::BoundingBox> tree(count);
+    std::vector<unsigned> proxies(count), leaves(count);
+    for(unsigned i = 0; i < count; i++)
+    {
+        proxies[i] = sap.insert(&stacks.bodies[i], stacks.getBox(i));
+        leaves[i] = tree.insert(&stacks.bodies[i], stacks.getBox(i));
+    }
+    sap.selectAxis();
+
+    double sapNs = 0, treeNs = 0, pointerNs = 0;
+    unsigned long long pairTotal = 0;
+    bool same = true;
+    Bench::Timer timer;
+    for(unsigned f = 0; f < FRAMES; f++)
+    {
+        stacks.step(jitter);
+
+        timer.reset();
+        for(unsigned i = 0; i < count; i++) sap.update(proxies[i], stacks.getBox(i));
+        unsigned sapCount = sap.getPotentialContacts(&pairs[0], MAX_PAIRS);
+        sapNs += timer.elapsedNs();
+        sortedKeys(stacks, &pairs[0], sapCount, sapKeys);
+
+        timer.reset();
+        for(unsigned i = 0; i < count; i++) tree.update(leaves[i], stacks.getBox(i));
+        unsigned treeCount = tree.getPotentialContacts(&pairs[0], MAX_PAIRS);
+        treeNs += timer.elapsedNs();
+        sortedKeys(stacks, &pairs[0], treeCount, treeKeys);
+
+        // The pointer tree cannot move bodies, so it is rebuilt.
+        timer.reset();
+        Phy::BVHNode<Phy::BoundingBox> *root =
+            new Phy::BVHNode<Phy::BoundingBox>(NULL, stacks.getBox(0), &stacks.bodies[0]);
+        for(unsigned i = 1; i < count; i++) root->insert(&stacks.bodies[i], stacks.getBox(i));
+        unsigned pointerCount = root->getPotentialContacts(&pairs[0], MAX_PAIRS);
+        pointerNs += timer.elapsedNs();
+        sortedKeys(stacks, &pairs[0], pointerCount, pointerKeys);
+        delete root;
+
+        pairTotal += sapCount;
+        if(sapKeys != treeKeys || sapKeys != pointerKeys) same = false;
+    }
+
+    printf("%6u %6.3f %8.1f %14.0f %14.0f %14.0f %s\n", count, jitter,
+           double(pairTotal) / FRAMES, sapNs / FRAMES, treeNs / FRAMES,
+           pointerNs / FRAMES, same ? "same pairs" : "DIFFERENT PAIRS");
+}
+
+int main()
+{
+    printf("%6s %6s %8s %14s %14s %14s\n", "boxes", "jitter", "pairs",
+           "sap ns", "flat bvh ns", "pointer ns");
+    bench(250, 0.001);
+    bench(250, 0.05);
+    bench(2000, 0.001);
+    bench(2000, 0.05);
+    return 0;
+}
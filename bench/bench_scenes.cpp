@@ -0,0 +1,380 @@
+// Headless replay of the standard scenes, linking only the physics
+// sources: rope bridges like the one in the demo, clouds of particles
+// falling into a pile, and a broadphase tree churned by moving bodies.
+//
+// Prints one JSON object per scene and size, one per line, with the
+// mean cost of each phase of a step in ns, the contacts per step and
+// the resolver iterations per step, so runs can be compared by script.
+//
+// usage: bench_scenes [all|bridge|cloud|bvh] [frames] [trace.json]
+//
+// Built with PHY_PROFILE defined, the library's own scopes and counters
+// are recorded too, and written as a Chrome trace to the given file.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "pworld.h"
+#include "collide_bvh.h"
+#include "profile.h"
+#include "bench.h"
+
+#define DEFAULT_FRAMES 600
+#define MAX_PAIRS 1000000
+
+// The demo's physics rate.
+static const Phy::real duration = (Phy::real)1.0/120;
+
+enum Phase
+{
+    PHASE_FORCES = 0,
+    PHASE_INTEGRATE,
+    PHASE_CONTACTS,
+    PHASE_RESOLVE,
+    PHASE_COUNT
+};
+
+static const char *phaseNames[PHASE_COUNT] =
+{
+    "forces", "integrate", "contacts", "resolve"
+};
+
+struct Stats
+{
+    double phaseNs[PHASE_COUNT];
+    unsigned long long contacts;
+    unsigned long long iterations;
+
+    Stats()
+        : contacts(0), iterations(0)
+    {
+        for(unsigned p = 0; p < PHASE_COUNT; p++) phaseNs[p] = 0;
+    }
+};
+
+/*
+ * Runs the same phases as ParticleWorld::runPhysics, timing each.
+ */
+class TimedParticleWorld : public Phy::ParticleWorld
+{
+public:
+    TimedParticleWorld(unsigned maxContacts, unsigned iterations = 0)
+        : Phy::ParticleWorld(maxContacts, iterations)
+    {
+    }
+
+    void runPhysics(Phy::real duration, Stats &stats)
+    {
+        Bench::Timer timer;
+        registry.updateForces(duration);
+        stats.phaseNs[PHASE_FORCES] += timer.elapsedNs();
+
+        timer.reset();
+        integrate(duration);
+        stats.phaseNs[PHASE_INTEGRATE] += timer.elapsedNs();
+
+        timer.reset();
+        unsigned usedContacts = generateContacts();
+        stats.phaseNs[PHASE_CONTACTS] += timer.elapsedNs();
+        stats.contacts += usedContacts;
+
+        timer.reset();
+        if(usedContacts)
+        {
+            if(calculateIterations) resolver.setIterations(usedContacts * 2);
+            resolver.resolveContacts(contacts.gather(), usedContacts, duration);
+            stats.iterations += resolver.getIterationsUsed();
+        }
+        stats.phaseNs[PHASE_RESOLVE] += timer.elapsedNs();
+    }
+};
+
+static void report(const char *scene, unsigned size, unsigned frames,
+                   const Stats &stats, unsigned phaseCount = PHASE_COUNT,
+                   const char **names = phaseNames)
+{
+    double total = 0;
+    for(unsigned p = 0; p < phaseCount; p++) total += stats.phaseNs[p];
+
+    printf("{\"scene\":\"%s\",\"size\":%u,\"frames\":%u,\"step_ns\":%.0f,\"phases_ns\":{",
+           scene, size, frames, total / frames);
+    for(unsigned p = 0; p < phaseCount; p++)
+    {
+        printf("%s\"%s\":%.0f", p ? "," : "", names[p], stats.phaseNs[p] / frames);
+    }
+    printf("},\"contacts_per_step\":%.1f,\"iterations_per_step\":%.1f}\n",
+           double(stats.contacts) / frames, double(stats.iterations) / frames);
+    fflush(stdout);
+}
+
+/*
+ * Copies of the demo's rope bridge side by side, each with the extra
+ * mass walking back and forth across its deck.
+ */
+struct BridgeScene
+{
+    unsigned count;
+    TimedParticleWorld world;
+    std::vector<Phy::Particle> particles;
+    std::vector<Phy::ParticleCable> cables;
+    std::vector<Phy::ParticleCableConstraint> supports;
+    std::vector<Phy::ParticleRod> rods;
+    Phy::GroundContacts ground;
+
+    BridgeScene(unsigned count)
+        : count(count), world(count * 120),
+          particles(count * 12), cables(count * 10),
+          supports(count * 12), rods(count * 6)
+    {
+        for(unsigned b = 0; b < count; b++)
+        {
+            Phy::real offset = Phy::real(b) * 4;
+            Phy::Particle *p = &particles[b * 12];
+            for(unsigned i = 0; i < 12; i++)
+            {
+                p[i].position = Phy::Vector3(Phy::real(i/2)*2 - 5, 4,
+                                             Phy::real(i%2)*2 - 1 + offset);
+                p[i].velocity = Phy::Vector3(0, 0, 0);
+                p[i].damping = 0.9;
+                p[i].acceleration = Phy::Vector3(0, -9.81, 0);
+                p[i].setMass(1);
+                p[i].clearAccumulator();
+                world.getParticles().push_back(p + i);
+            }
+
+            for(unsigned i = 0; i < 10; i++)
+            {
+                Phy::ParticleCable &cable = cables[b * 10 + i];
+                cable.particle[0] = p + i;
+                cable.particle[1] = p + i + 2;
+                cable.maxLength = 1.9;
+                cable.restitution = 0.3;
+                world.getContactGenerators().push_back(&cable);
+            }
+
+            for(unsigned i = 0; i < 12; i++)
+            {
+                Phy::ParticleCableConstraint &support = supports[b * 12 + i];
+                support.particle = p + i;
+                support.anchor = Phy::Vector3(Phy::real(i/2)*2.2 - 5.5, 6,
+                                              Phy::real(i%2)*1.6 - 0.8 + offset);
+                if(i < 6) support.maxLength = Phy::real(i/2)*0.5 + 3;
+                else support.maxLength = 5.5 - Phy::real(i/2)*0.5;
+                support.restitution = 0.5;
+                world.getContactGenerators().push_back(&support);
+            }
+
+            for(unsigned i = 0; i < 6; i++)
+            {
+                Phy::ParticleRod &rod = rods[b * 6 + i];
+                rod.particle[0] = p + i*2;
+                rod.particle[1] = p + i*2 + 1;
+                rod.length = 2;
+                world.getContactGenerators().push_back(&rod);
+            }
+        }
+
+        ground.init(&world.getParticles());
+        world.getContactGenerators().push_back(&ground);
+    }
+
+    // Puts the extra mass on the near rail, at x from 0 to 5.
+    void placeMass(Phy::real x)
+    {
+        int cell = int(x);
+        if(cell > 4) cell = 4;
+        Phy::real proportion = x - cell;
+        for(unsigned b = 0; b < count; b++)
+        {
+            Phy::Particle *p = &particles[b * 12];
+            for(unsigned i = 0; i < 12; i++) p[i].setMass(1);
+            p[cell*2].setMass(1 + 10*(1 - proportion));
+            p[cell*2 + 2].setMass(1 + 10*proportion);
+        }
+    }
+};
+
+static void benchBridge(unsigned count, unsigned frames)
+{
+    BridgeScene scene(count);
+    Stats stats;
+    for(unsigned f = 0; f < frames; f++)
+    {
+        // Cross the deck once every 240 steps.
+        Phy::real t = Phy::real(f % 480) / 240;
+        scene.placeMass(t < 1 ? t * 5 : (2 - t) * 5);
+
+        scene.world.startFrame();
+        scene.world.runPhysics(duration, stats);
+    }
+    report("bridge", count, frames, stats);
+}
+
+/*
+ * A block of particles dropped onto the ground, colliding with each
+ * other through the hashed grid.
+ */
+struct CloudScene
+{
+    TimedParticleWorld world;
+    std::vector<Phy::Particle> particles;
+    Phy::ParticleGravity gravity;
+    Phy::ParticleGridContacts grid;
+    Phy::GroundContacts ground;
+
+    CloudScene(unsigned count)
+        : world(count * 8), particles(count), gravity(Phy::Vector3(0, -9.81, 0))
+    {
+        Bench::Random random;
+        unsigned side = 1;
+        while(side * side * side < count) side++;
+        for(unsigned i = 0; i < count; i++)
+        {
+            Phy::Particle &p = particles[i];
+            p.position = Phy::Vector3(
+                Phy::real(i % side) * 1.2 + random.range(-0.1, 0.1),
+                Phy::real(i / (side * side)) * 1.2 + 1,
+                Phy::real((i / side) % side) * 1.2 + random.range(-0.1, 0.1));
+            p.velocity = Phy::Vector3(0, 0, 0);
+            p.acceleration = Phy::Vector3(0, 0, 0);
+            p.damping = 0.95;
+            p.setMass(1);
+            p.clearAccumulator();
+            world.getParticles().push_back(&p);
+            world.getForceRegistry().add(&p, &gravity);
+        }
+
+        grid.init(&world.getParticles(), 0.5, 0.2);
+        ground.init(&world.getParticles());
+        world.getContactGenerators().push_back(&grid);
+        world.getContactGenerators().push_back(&ground);
+        world.getResolver().setSelection(Phy::SELECT_PRIORITY_QUEUE);
+    }
+};
+
+static void benchCloud(unsigned count, unsigned frames)
+{
+    CloudScene scene(count);
+    Stats stats;
+    for(unsigned f = 0; f < frames; f++)
+    {
+        scene.world.startFrame();
+        scene.world.runPhysics(duration, stats);
+    }
+    report("cloud", count, frames, stats);
+}
+
+/*
+ * Boxes wandering through a volume, kept in a dynamic FlatBVH: each step
+ * updates every leaf and then collects the potential contacts.
+ */
+enum TreePhase
+{
+    TREE_MOVE = 0,
+    TREE_UPDATE,
+    TREE_QUERY,
+    TREE_PHASE_COUNT
+};
+
+static const char *treePhaseNames[TREE_PHASE_COUNT] =
+{
+    "move", "update", "query"
+};
+
+static void benchBVH(unsigned count, unsigned frames)
+{
+    std::vector<Phy::RigidBody> bodies(count);
+    std::vector<Phy::BoundingBox> boxes;
+    std::vector<Phy::Vector3> velocities;
+    std::vector<unsigned> leaves(count);
+    std::vector<Phy::PotentialContact> pairs(MAX_PAIRS);
+
+    Bench::Random random;
+    Phy::real extent = Phy::real(3) * real_pow(Phy::real(count), Phy::real(1.0/3.0));
+    Phy::FlatBVH<Phy::BoundingBox> tree(count, 0.2);
+    for(unsigned i = 0; i < count; i++)
+    {
+        Phy::Vector3 halfSize(random.range(0.3, 0.8), random.range(0.3, 0.8),
+                              random.range(0.3, 0.8));
+        boxes.push_back(Phy::BoundingBox(
+            Phy::Vector3(random.range(0, extent), random.range(0, extent),
+                         random.range(0, extent)), halfSize));
+        velocities.push_back(Phy::Vector3(random.range(-2, 2), random.range(-2, 2),
+                                          random.range(-2, 2)));
+        leaves[i] = tree.insert(&bodies[i], boxes[i]);
+    }
+
+    Stats stats;
+    Bench::Timer timer;
+    for(unsigned f = 0; f < frames; f++)
+    {
+        // Bounce off the walls of the volume.
+        timer.reset();
+        for(unsigned i = 0; i < count; i++)
+        {
+            Phy::Vector3 move = velocities[i] * duration;
+            boxes[i].minimum += move;
+            boxes[i].maximum += move;
+            if(boxes[i].minimum.x < 0 || boxes[i].maximum.x > extent) velocities[i].x = -velocities[i].x;
+            if(boxes[i].minimum.y < 0 || boxes[i].maximum.y > extent) velocities[i].y = -velocities[i].y;
+            if(boxes[i].minimum.z < 0 || boxes[i].maximum.z > extent) velocities[i].z = -velocities[i].z;
+        }
+        stats.phaseNs[TREE_MOVE] += timer.elapsedNs();
+
+        timer.reset();
+        for(unsigned i = 0; i < count; i++)
+        {
+            tree.update(leaves[i], boxes[i]);
+        }
+        stats.phaseNs[TREE_UPDATE] += timer.elapsedNs();
+
+        timer.reset();
+        stats.contacts += tree.getPotentialContacts(&pairs[0], MAX_PAIRS);
+        stats.phaseNs[TREE_QUERY] += timer.elapsedNs();
+    }
+    report("bvh", count, frames, stats, TREE_PHASE_COUNT, treePhaseNames);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *scene = argc > 1 ? argv[1] : "all";
+    unsigned frames = argc > 2 ? (unsigned)atoi(argv[2]) : DEFAULT_FRAMES;
+    if(frames == 0) frames = DEFAULT_FRAMES;
+    bool all = strcmp(scene, "all") == 0;
+
+#ifdef PHY_PROFILE
+    const char *trace = argc > 3 ? argv[3] : NULL;
+    if(trace) Phy::Profiler::start();
+#endif
+
+    if(all || strcmp(scene, "bridge") == 0)
+    {
+        benchBridge(1, frames);
+        benchBridge(100, frames);
+    }
+    if(all || strcmp(scene, "cloud") == 0)
+    {
+        benchCloud(1000, frames);
+        benchCloud(8000, frames);
+    }
+    if(all || strcmp(scene, "bvh") == 0)
+    {
+        benchBVH(1000, frames);
+        benchBVH(10000, frames);
+    }
+
+#ifdef PHY_PROFILE
+    if(trace)
+    {
+        Phy::Profiler::stop();
+        if(!Phy::Profiler::writeChromeTrace(trace))
+        {
+            fprintf(stderr, "could not write %s\n", trace);
+            return 1;
+        }
+    }
+#endif
+    return 0;
+}
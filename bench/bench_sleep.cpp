@@ -0,0 +1,182 @@
+// Steps a level of resting box stacks on a static ground with and
+// without island sleeping, nudging one stack now and then, and reports
+// the cost per frame of startFrame, the force generators and
+// integration, and of the island update itself. The ground touches
+// every stack but must not join them into one island, so a nudge only
+// wakes the stack it hits.
+
+#include <cstdio>
+#include <vector>
+
+#include "world.h"
+#include "collide_sap.h"
+#include "bench.h"
+
+#define FRAMES 600
+#define SETTLE_FRAMES 180
+#define PUSH_INTERVAL 20
+#define MAX_PAIRS 1000000
+
+static const Phy::real duration = (Phy::real)1.0/60;
+
+/*
+ * Gravity balanced by the support under the body, standing in for the
+ * contact resolution that would hold a resting stack up.
+ */
+class SupportedWeight : public Phy::ForceGenerator
+{
+public:
+    virtual void updateForce(Phy::RigidBody *body, Phy::real)
+    {
+        Phy::Vector3 weight(0, -9.81 * body->getMass(), 0);
+        body->addForce(weight);
+        body->addForce(weight * -1);
+    }
+
+    virtual bool isConstant() const
+    {
+        return true;
+    }
+};
+
+struct Level
+{
+    Phy::World world;
+    SupportedWeight weight;
+    Phy::SweepAndPrune broadphase;
+    std::vector<unsigned> stackBase;
+    unsigned ground;
+    Phy::real extent;
+    std::vector<Phy::PotentialContact> pairs;
+    Bench::Random random;
+
+    Level(unsigned stackCount)
+        : pairs(MAX_PAIRS)
+    {
+        Phy::World::RigidBodies &bodies = world.getRigidBodies();
+        extent = real_sqrt(Phy::real(stackCount)) * 3;
+        for(unsigned s = 0; s < stackCount; s++)
+        {
+            Phy::real x = random.range(0, extent);
+            Phy::real z = random.range(0, extent);
+            unsigned height = 1 + random.next() % 8;
+            stackBase.push_back((unsigned)bodies.size());
+            for(unsigned c = 0; c < height; c++)
+            {
+                Phy::RigidBody body;
+                body.setPosition(x, 0.5 + c, z);
+                body.setOrientation(1, 0, 0, 0);
+                body.setMass(1);
+                body.setInertiaTensor(Phy::Matrix3(6, 0, 0, 0, 6, 0, 0, 0, 6));
+                body.setDamping(0.5, 0.5);
+                body.calculateDerivedData();
+                bodies.push_back(body);
+            }
+        }
+        stackBase.push_back((unsigned)bodies.size());
+
+        // A slab of infinite mass under every stack.
+        ground = (unsigned)bodies.size();
+        Phy::RigidBody slab;
+        slab.setPosition(extent * 0.5, -0.5, extent * 0.5);
+        slab.setOrientation(1, 0, 0, 0);
+        slab.setInverseMass(0);
+        slab.calculateDerivedData();
+        bodies.push_back(slab);
+
+        // The bodies have no collision geometry for the world to find
+        // pairs from, so the island pass is run with the bench's own.
+        world.setAutomaticSleep(false);
+
+        // Registered once the vector has stopped growing.
+        for(unsigned i = 0; i < bodies.size(); i++)
+        {
+            if(i != ground) world.getForceRegistry().add(&bodies[i], &weight);
+            broadphase.insert(&bodies[i], getBox(i));
+        }
+        broadphase.selectAxis();
+    }
+
+    Phy::BoundingBox getBox(unsigned i)
+    {
+        if(i == ground)
+        {
+            return Phy::BoundingBox(world.getRigidBodies()[i].getPosition(),
+                                    Phy::Vector3(extent * 0.5 + 1, 0.5, extent * 0.5 + 1));
+        }
+
+        // Slightly enlarged, so boxes resting on each other touch.
+        return Phy::BoundingBox(world.getRigidBodies()[i].getPosition(),
+                                Phy::Vector3(0.51, 0.51, 0.51));
+    }
+
+    void pushStack()
+    {
+        unsigned s = random.next() % (unsigned)(stackBase.size() - 1);
+        Phy::RigidBody &top = world.getRigidBodies()[stackBase[s+1] - 1];
+        top.addForce(Phy::Vector3(random.range(-30, 30), 0, random.range(-30, 30)));
+    }
+
+    unsigned getAwakeCount()
+    {
+        unsigned awake = 0;
+        Phy::World::RigidBodies &bodies = world.getRigidBodies();
+        for(unsigned i = 0; i < bodies.size(); i++)
+        {
+            if(i != ground && bodies[i].getAwake()) awake++;
+        }
+        return awake;
+    }
+};
+
+static void bench(unsigned stackCount, bool sleeping)
+{
+    Level level(stackCount);
+    unsigned count = (unsigned)level.world.getRigidBodies().size();
+    unsigned stacked = count - 1;
+
+    double stepNs = 0, sleepNs = 0;
+    unsigned long long awakeTotal = 0;
+    Bench::Timer timer;
+    for(unsigned f = 0; f < SETTLE_FRAMES + FRAMES; f++)
+    {
+        bool measured = f >= SETTLE_FRAMES;
+
+        timer.reset();
+        level.world.startFrame();
+        if(f % PUSH_INTERVAL == 0) level.pushStack();
+        level.world.runPhysics(duration);
+        if(measured) stepNs += timer.elapsedNs();
+
+        // Only moved bodies need their broadphase volumes refreshed.
+        Phy::World::RigidBodies &bodies = level.world.getRigidBodies();
+        for(unsigned i = 0; i < count; i++)
+        {
+            if(bodies[i].getAwake()) level.broadphase.update(i, level.getBox(i));
+        }
+        unsigned numPairs = level.broadphase.getPotentialContacts(&level.pairs[0], MAX_PAIRS);
+
+        if(sleeping)
+        {
+            timer.reset();
+            level.world.updateSleep(&level.pairs[0], numPairs);
+            if(measured) sleepNs += timer.elapsedNs();
+        }
+        if(measured) awakeTotal += level.getAwakeCount();
+    }
+
+    printf("%6u %6s %10.1f %14.0f %14.0f %14.0f\n", stacked, sleeping ? "on" : "off",
+           double(awakeTotal) / FRAMES, stepNs / FRAMES, sleepNs / FRAMES,
+           (stepNs + sleepNs) / FRAMES);
+}
+
+int main()
+{
+    printf("%6s %6s %10s %14s %14s %14s\n",
+           "bodies", "sleep", "awake", "step ns", "islands ns", "total ns");
+    bench(250, false);
+    bench(250, true);
+    bench(2000, false);
+    bench(2000, true);
+    return 0;
+}
@@ -0,0 +1,376 @@
+// Times saving and restoring world snapshots, and rolling back: putting
+// a world back ten frames and stepping it forward again, as a networked
+// game does when a late input arrives. Four worlds are measured: 10000
+// particles hanging as ropes of rods under gravity, 200 boxes in stacks
+// like those of bench_stacks, a row of boxes that fall asleep before
+// boxes dropped on them wake them, so the rollbacks cross both, and
+// 100000 particles in a ParticleWorldSoA.
+//
+// For each world prints the snapshot size, the cost of a save and a
+// restore, the size and cost of a delta against the previous frame, the
+// cost of a step and of a ten frame rollback, and whether the frames
+// replayed after the rollback match the ones first stepped.
+//
+// usage: bench_snapshot [frames]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "pworld.h"
+#include "pworld_soa.h"
+#include "world.h"
+#include "bench.h"
+
+#define DEFAULT_FRAMES 150
+#define ROLLBACK 10
+#define ROPES 100
+#define ROPE_LENGTH 100
+#define BOX_STACKS 25
+#define STACK_HEIGHT 8
+#define SOA_PARTICLES 100000
+#define SLEEPERS 20
+// High enough for the dropped boxes to land after the row sleeps.
+#define DROP_HEIGHT 15
+
+static const Phy::real duration = (Phy::real)1.0/60;
+
+// The state of each of the last ROLLBACK + 1 frames, by frame.
+struct History
+{
+    Phy::Snapshot frames[ROLLBACK + 1];
+
+    Phy::Snapshot &get(unsigned frame)
+    {
+        return frames[frame % (ROLLBACK + 1)];
+    }
+};
+
+struct Timings
+{
+    double saveNs;
+    double restoreNs;
+    double deltaNs;
+    double applyNs;
+    double stepNs;
+    double rollbackNs;
+    unsigned long long deltaBytes;
+    unsigned snapshotBytes;
+    unsigned rollbacks;
+    bool replayMatches;
+
+    Timings()
+        : saveNs(0), restoreNs(0), deltaNs(0), applyNs(0), stepNs(0), rollbackNs(0),
+          deltaBytes(0), snapshotBytes(0), rollbacks(0), replayMatches(true)
+    {
+    }
+};
+
+static void report(const char *name, const Timings &timings, unsigned frames)
+{
+    printf("%-10s snapshot %8u bytes  save %8.0f ns  restore %8.0f ns\n"
+           "%-10s delta %8.0f bytes  make %8.0f ns  apply %8.0f ns\n"
+           "%-10s step %10.0f ns  rollback of %u frames %10.0f ns  replay %s\n",
+           name, timings.snapshotBytes, timings.saveNs / frames, timings.restoreNs / timings.rollbacks,
+           "", double(timings.deltaBytes) / (frames - 1), timings.deltaNs / (frames - 1),
+           timings.applyNs / (frames - 1),
+           "", timings.stepNs / frames, ROLLBACK, timings.rollbackNs / timings.rollbacks,
+           timings.replayMatches ? "matches" : "DIFFERS");
+}
+
+static bool sameState(const Phy::Snapshot &one, const Phy::Snapshot &two)
+{
+    return one.getSize() == two.getSize() &&
+           !memcmp(one.getData(), two.getData(), one.getSize());
+}
+
+/*
+ * Steps a world for the given number of frames, saving it every frame,
+ * and from frame ROLLBACK on rolls it back ROLLBACK frames and steps
+ * it forward again, checking each replayed frame against the saved
+ * one. WorldAdapter supplies save, restore and step.
+ */
+template<class WorldAdapter>
+static Timings run(WorldAdapter &world, unsigned frames)
+{
+    Timings timings;
+    History history;
+    Phy::Snapshot delta, applied, replayed;
+    Bench::Timer timer;
+
+    world.save(&history.get(0));
+    for(unsigned f = 1; f <= frames; f++)
+    {
+        timer.reset();
+        world.step();
+        timings.stepNs += timer.elapsedNs();
+
+        Phy::Snapshot &current = history.get(f);
+        timer.reset();
+        world.save(&current);
+        timings.saveNs += timer.elapsedNs();
+        current.setFrame(f);
+        timings.snapshotBytes = current.getSize();
+
+        if(f > 1)
+        {
+            const Phy::Snapshot &previous = history.get(f - 1);
+            timer.reset();
+            delta.makeDelta(previous, current);
+            timings.deltaNs += timer.elapsedNs();
+            timings.deltaBytes += delta.getSize();
+
+            timer.reset();
+            bool ok = applied.applyDelta(previous, delta);
+            timings.applyNs += timer.elapsedNs();
+            if(!ok || !sameState(applied, current)) timings.replayMatches = false;
+        }
+
+        if(f < ROLLBACK) continue;
+
+        // Roll back and replay up to the current frame.
+        timer.reset();
+        bool restored = world.restore(history.get(f - ROLLBACK));
+        timings.restoreNs += timer.elapsedNs();
+        if(!restored) timings.replayMatches = false;
+        for(unsigned r = f - ROLLBACK + 1; r <= f; r++)
+        {
+            world.step();
+        }
+        timings.rollbackNs += timer.elapsedNs();
+        timings.rollbacks++;
+
+        world.save(&replayed);
+        if(!sameState(replayed, current)) timings.replayMatches = false;
+    }
+    return timings;
+}
+
+struct Ropes
+{
+    std::vector<Phy::Particle> particles;
+    std::vector<Phy::ParticleRod> rods;
+    Phy::ParticleGravity gravity;
+    Phy::GroundContacts ground;
+    Phy::ParticleWorld world;
+    Phy::ParticleWorld::ForceGenerators forceGenerators;
+
+    Ropes()
+        : particles(ROPES * ROPE_LENGTH), rods(ROPES * (ROPE_LENGTH - 1)),
+          gravity(Phy::Vector3(0, -9.81, 0)), world(ROPES * ROPE_LENGTH)
+    {
+        for(unsigned r = 0; r < ROPES; r++)
+        {
+            for(unsigned i = 0; i < ROPE_LENGTH; i++)
+            {
+                // Each rope hangs from a fixed first particle, held out
+                // sideways so it swings.
+                Phy::Particle &particle = particles[r * ROPE_LENGTH + i];
+                particle.position = Phy::Vector3(r * 2, 120, i * 0.5);
+                particle.damping = 0.99;
+                particle.setInverseMass(i == 0 ? 0 : 1);
+                world.getParticles().push_back(&particle);
+                if(i) world.getForceRegistry().add(&particle, &gravity);
+            }
+            for(unsigned i = 0; i + 1 < ROPE_LENGTH; i++)
+            {
+                Phy::ParticleRod &rod = rods[r * (ROPE_LENGTH - 1) + i];
+                rod.particle[0] = &particles[r * ROPE_LENGTH + i];
+                rod.particle[1] = &particles[r * ROPE_LENGTH + i + 1];
+                rod.length = 0.5;
+                world.getContactGenerators().push_back(&rod);
+            }
+        }
+        world.getResolver().setSelection(Phy::SELECT_PRIORITY_QUEUE);
+        ground.init(&world.getParticles());
+        world.getContactGenerators().push_back(&ground);
+        forceGenerators.push_back(&gravity);
+    }
+
+    void save(Phy::Snapshot *snapshot)
+    {
+        world.saveState(snapshot, &forceGenerators);
+    }
+
+    bool restore(const Phy::Snapshot &snapshot)
+    {
+        return world.restoreState(snapshot, &forceGenerators);
+    }
+
+    void step()
+    {
+        world.startFrame();
+        world.runPhysics(duration);
+    }
+};
+
+struct Stacks
+{
+    Phy::World world;
+
+    Stacks()
+    {
+        Phy::World::RigidBodies &bodies = world.getRigidBodies();
+        Bench::Random random;
+        for(unsigned s = 0; s < BOX_STACKS; s++)
+        {
+            for(unsigned c = 0; c < STACK_HEIGHT; c++)
+            {
+                Phy::RigidBody body;
+                body.setPosition((s % 5) * 2 + random.range(-0.02, 0.02),
+                                 0.5 + c * 1.01,
+                                 (s / 5) * 2 + random.range(-0.02, 0.02));
+                body.setOrientation(1, 0, 0, 0);
+                body.setMass(1);
+                body.setInertiaTensor(Phy::Matrix3(1.0/6, 0, 0, 0, 1.0/6, 0, 0, 0, 1.0/6));
+                body.setDamping(0.95, 0.8);
+                body.setAcceleration(0, -9.81, 0);
+                body.setCanSleep(false);
+                body.calculateDerivedData();
+                bodies.push_back(body);
+            }
+        }
+        for(unsigned i = 0; i < bodies.size(); i++)
+        {
+            world.setBox(i, Phy::Vector3(0.5, 0.5, 0.5));
+        }
+        world.addPlane(Phy::Vector3(0, 1, 0), 0);
+    }
+
+    void save(Phy::Snapshot *snapshot)
+    {
+        world.saveState(snapshot);
+    }
+
+    bool restore(const Phy::Snapshot &snapshot)
+    {
+        return world.restoreState(snapshot);
+    }
+
+    void step()
+    {
+        world.runPhysics(duration);
+    }
+};
+
+/*
+ * A row of boxes that settle on the ground and fall asleep, and a box
+ * dropped onto each that lands after they have, waking them and
+ * knocking them aside. Rolling back across the landing restores the
+ * row asleep where it was, while the broadphase last saw it knocked
+ * aside.
+ */
+struct Sleepers
+{
+    Phy::World world;
+
+    Sleepers()
+    {
+        Phy::World::RigidBodies &bodies = world.getRigidBodies();
+        for(unsigned s = 0; s < SLEEPERS; s++)
+        {
+            for(unsigned d = 0; d < 2; d++)
+            {
+                Phy::RigidBody body;
+                body.setPosition(s * 3 + d * 0.6, d ? DROP_HEIGHT : 0.52, 0);
+                body.setOrientation(1, 0, 0, 0);
+                body.setMass(1);
+                body.setInertiaTensor(Phy::Matrix3(1.0/6, 0, 0, 0, 1.0/6, 0, 0, 0, 1.0/6));
+                body.setDamping(0.95, 0.8);
+                body.setAcceleration(0, -9.81, 0);
+                body.calculateDerivedData();
+                bodies.push_back(body);
+            }
+        }
+        for(unsigned i = 0; i < bodies.size(); i++)
+        {
+            world.setBox(i, Phy::Vector3(0.5, 0.5, 0.5));
+        }
+        world.addPlane(Phy::Vector3(0, 1, 0), 0);
+    }
+
+    void save(Phy::Snapshot *snapshot)
+    {
+        world.saveState(snapshot);
+    }
+
+    bool restore(const Phy::Snapshot &snapshot)
+    {
+        return world.restoreState(snapshot);
+    }
+
+    void step()
+    {
+        world.runPhysics(duration);
+    }
+};
+
+struct SoAParticles
+{
+    Phy::ParticleWorldSoA world;
+
+    SoAParticles()
+    {
+        Bench::Random random;
+        world.reserve(SOA_PARTICLES);
+        for(unsigned i = 0; i < SOA_PARTICLES; i++)
+        {
+            world.addParticle(Phy::Vector3(random.range(-100, 100), random.range(0, 100),
+                                           random.range(-100, 100)),
+                              Phy::Vector3(random.range(-5, 5), random.range(0, 10),
+                                           random.range(-5, 5)),
+                              Phy::Vector3(0, -9.81, 0), 0.99, 1);
+        }
+    }
+
+    void save(Phy::Snapshot *snapshot)
+    {
+        world.saveState(snapshot);
+    }
+
+    bool restore(const Phy::Snapshot &snapshot)
+    {
+        return world.restoreState(snapshot);
+    }
+
+    void step()
+    {
+        world.startFrame();
+        world.integrate(duration);
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    unsigned frames = argc > 1 ? (unsigned)atoi(argv[1]) : DEFAULT_FRAMES;
+    if(frames <= ROLLBACK) frames = DEFAULT_FRAMES;
+
+    bool matches = true;
+    {
+        Ropes ropes;
+        Timings timings = run(ropes, frames);
+        report("ropes", timings, frames);
+        matches = matches && timings.replayMatches;
+    }
+    {
+        Stacks stacks;
+        Timings timings = run(stacks, frames);
+        report("stacks", timings, frames);
+        matches = matches && timings.replayMatches;
+    }
+    {
+        Sleepers sleepers;
+        Timings timings = run(sleepers, frames);
+        report("sleepers", timings, frames);
+        matches = matches && timings.replayMatches;
+    }
+    {
+        SoAParticles soa;
+        Timings timings = run(soa, frames);
+        report("soa", timings, frames);
+        matches = matches && timings.replayMatches;
+    }
+
+    return matches ? 0 : 1;
+}
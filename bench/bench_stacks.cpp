@@ -0,0 +1,182 @@
+// Drops 1000 unit boxes, as stacks on a ground plane, into a World and
+// steps the full rigid body pipeline: integration, broadphase and
+// narrowphase contact generation, and the position and velocity
+// passes of the contact resolver. Each scene is run with the resolver
+// allowed four (the World's default), two and one iterations a
+// contact, and with fixed iteration limits, each with and without warm
+// starting from the contact cache.
+//
+// Prints one JSON object per run, with the mean cost of each phase of
+// a step in ns, the contacts and resolver iterations per step, and how
+// well the stacks held: the mean height lost and sideways drift of the
+// boxes, and the number that ended up more than half a box below where
+// they started. The World starts with room for few contacts, and the
+// most it needed in a step is reported too.
+//
+// usage: bench_stacks [frames]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "world.h"
+#include "bench.h"
+
+#define DEFAULT_FRAMES 200
+#define BODIES 1000
+#define INITIAL_CONTACTS 1024
+
+static const Phy::real duration = (Phy::real)1.0/60;
+
+enum Phase
+{
+    PHASE_INTEGRATE = 0,
+    PHASE_CONTACTS,
+    PHASE_RESOLVE,
+    PHASE_COUNT
+};
+
+static const char *phaseNames[PHASE_COUNT] =
+{
+    "integrate", "contacts", "resolve"
+};
+
+struct Scene
+{
+    Phy::World world;
+    std::vector<Phy::Vector3> start;
+
+    // With no iteration limit, the World picks one from the contact count.
+    Scene(unsigned height, unsigned iterations, unsigned perContact, bool warmStart)
+        : world(INITIAL_CONTACTS, iterations)
+    {
+        world.setIterationsPerContact(perContact);
+        world.setWarmStarting(warmStart);
+
+        Phy::World::RigidBodies &bodies = world.getRigidBodies();
+        unsigned stacks = BODIES / height;
+        unsigned side = 1;
+        while(side * side < stacks) side++;
+
+        Bench::Random random;
+        for(unsigned s = 0; s < stacks; s++)
+        {
+            Phy::real x = Phy::real(s % side) * 2;
+            Phy::real z = Phy::real(s / side) * 2;
+            for(unsigned c = 0; c < height; c++)
+            {
+                // Small gaps and offsets, so the stacks have to settle.
+                Phy::RigidBody body;
+                body.setPosition(x + random.range(-0.02, 0.02),
+                                 0.5 + c * 1.01,
+                                 z + random.range(-0.02, 0.02));
+                body.setOrientation(1, 0, 0, 0);
+                body.setMass(1);
+                body.setInertiaTensor(Phy::Matrix3(1.0/6, 0, 0, 0, 1.0/6, 0, 0, 0, 1.0/6));
+                body.setDamping(0.95, 0.8);
+                body.setAcceleration(0, -9.81, 0);
+                body.setCanSleep(false);
+                body.calculateDerivedData();
+                bodies.push_back(body);
+                start.push_back(body.getPosition());
+            }
+        }
+
+        for(unsigned i = 0; i < bodies.size(); i++)
+        {
+            world.setBox(i, Phy::Vector3(0.5, 0.5, 0.5));
+        }
+        world.addPlane(Phy::Vector3(0, 1, 0), 0);
+    }
+};
+
+static void bench(unsigned height, unsigned iterations, unsigned perContact,
+                  bool warmStart, unsigned frames)
+{
+    Scene scene(height, iterations, perContact, warmStart);
+    Phy::World &world = scene.world;
+    Phy::ContactResolver &resolver = world.getContactResolver();
+
+    double phaseNs[PHASE_COUNT] = { 0, 0, 0 };
+    unsigned long long contacts = 0, positionIterations = 0, velocityIterations = 0;
+    Bench::Timer timer;
+    for(unsigned f = 0; f < frames; f++)
+    {
+        world.startFrame();
+
+        timer.reset();
+        world.integrate(duration);
+        phaseNs[PHASE_INTEGRATE] += timer.elapsedNs();
+
+        timer.reset();
+        unsigned used = world.generateContacts();
+        phaseNs[PHASE_CONTACTS] += timer.elapsedNs();
+
+        timer.reset();
+        world.resolveContacts(used, duration);
+        phaseNs[PHASE_RESOLVE] += timer.elapsedNs();
+
+        contacts += used;
+        positionIterations += resolver.getPositionIterationsUsed();
+        velocityIterations += resolver.getVelocityIterationsUsed();
+    }
+
+    Phy::World::RigidBodies &bodies = world.getRigidBodies();
+    double heightLoss = 0, drift = 0;
+    unsigned fallen = 0;
+    for(unsigned i = 0; i < bodies.size(); i++)
+    {
+        Phy::Vector3 moved = bodies[i].getPosition() - scene.start[i];
+        heightLoss -= moved.y;
+        drift += real_sqrt(moved.x*moved.x + moved.z*moved.z);
+        if(moved.y < -0.5) fallen++;
+    }
+
+    double stepNs = 0;
+    for(unsigned p = 0; p < PHASE_COUNT; p++) stepNs += phaseNs[p];
+
+    char mode[32];
+    if(iterations) sprintf(mode, "fixed");
+    else sprintf(mode, "%u per contact", perContact);
+    printf("{\"scene\":\"stacks\",\"height\":%u,\"bodies\":%u,\"iterations\":\"%s\","
+           "\"warm_start\":%s,\"frames\":%u,\"step_ns\":%.0f,\"phases_ns\":{",
+           height, (unsigned)bodies.size(), mode,
+           warmStart ? "true" : "false", frames, stepNs / frames);
+    for(unsigned p = 0; p < PHASE_COUNT; p++)
+    {
+        printf("%s\"%s\":%.0f", p ? "," : "", phaseNames[p], phaseNs[p] / frames);
+    }
+    printf("},\"iteration_limit\":%u,\"contacts_per_step\":%.1f,"
+           "\"position_iterations_per_step\":%.1f,\"velocity_iterations_per_step\":%.1f,"
+           "\"height_loss\":%.4f,\"drift\":%.4f,\"fallen\":%u,\"contact_high_water\":%u}\n",
+           iterations, double(contacts) / frames,
+           double(positionIterations) / frames, double(velocityIterations) / frames,
+           heightLoss / bodies.size(), drift / bodies.size(), fallen,
+           world.getContactHighWaterMark());
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned frames = argc > 1 ? (unsigned)atoi(argv[1]) : DEFAULT_FRAMES;
+    if(frames == 0) frames = DEFAULT_FRAMES;
+
+    static const unsigned heights[] = { 5, 10 };
+    static const unsigned perContact[] = { 4, 2, 1 };
+    static const unsigned limits[] = { 1000, 250 };
+    for(unsigned h = 0; h < 2; h++)
+    {
+        for(unsigned w = 0; w < 2; w++)
+        {
+            for(unsigned p = 0; p < 3; p++)
+            {
+                bench(heights[h], 0, perContact[p], w == 1, frames);
+            }
+            for(unsigned l = 0; l < 2; l++)
+            {
+                bench(heights[h], limits[l], 4, w == 1, frames);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+// Builds the tree of a triangle mesh, from an OBJ or PHYM file given
+// on the command line or else a generated level of about half a
+// million triangles: a bumpy floor with walls and pillars on it. Times
+// the build, writing the tree cache and starting again from the cache,
+// then sphere and particle contact generation against the mesh, with
+// the contacts found and a checksum of their penetrations. A sample of
+// the particle queries is checked against testing every triangle.
+//
+// usage: bench_trimesh [mesh.obj | mesh.phym] [cache file]
+
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "collide_fine.h"
+#include "pworld.h"
+#include "bench.h"
+
+#define GRID 512
+#define OBJECTS 100000
+#define RUNS 5
+#define MAX_CONTACTS (OBJECTS * 8)
+#define CHECKS 1000
+#define DEFAULT_CACHE "bench_trimesh.bvh"
+
+static const Phy::real levelSize = 200;
+
+static void addQuad(std::vector<unsigned> &indices, unsigned a, unsigned b, unsigned c, unsigned d)
+{
+    unsigned quad[6] = { a, b, c, a, c, d };
+    indices.insert(indices.end(), quad, quad + 6);
+}
+
+// An axis aligned box of the given corners, without its bottom.
+static void addBlock(std::vector<Phy::Vector3> &vertices, std::vector<unsigned> &indices,
+                     const Phy::Vector3 &lower, const Phy::Vector3 &upper)
+{
+    unsigned base = (unsigned)vertices.size();
+    for(unsigned i = 0; i < 8; i++)
+    {
+        vertices.push_back(Phy::Vector3((i & 1) ? upper.x : lower.x,
+                                        (i & 2) ? upper.y : lower.y,
+                                        (i & 4) ? upper.z : lower.z));
+    }
+    addQuad(indices, base + 2, base + 6, base + 7, base + 3);
+    addQuad(indices, base + 0, base + 2, base + 3, base + 1);
+    addQuad(indices, base + 4, base + 5, base + 7, base + 6);
+    addQuad(indices, base + 0, base + 4, base + 6, base + 2);
+    addQuad(indices, base + 1, base + 3, base + 7, base + 5);
+}
+
+static void generateLevel(Phy::TriangleMesh &mesh)
+{
+    std::vector<Phy::Vector3> vertices;
+    std::vector<unsigned> indices;
+    Phy::real cell = levelSize / GRID;
+    for(unsigned z = 0; z <= GRID; z++)
+    {
+        for(unsigned x = 0; x <= GRID; x++)
+        {
+            Phy::real y = (Phy::real)(0.5 * sin(x * 0.1) * cos(z * 0.13));
+            vertices.push_back(Phy::Vector3(x * cell, y, z * cell));
+        }
+    }
+    for(unsigned z = 0; z < GRID; z++)
+    {
+        for(unsigned x = 0; x < GRID; x++)
+        {
+            unsigned a = z * (GRID + 1) + x;
+            addQuad(indices, a, a + GRID + 1, a + GRID + 2, a + 1);
+        }
+    }
+
+    Bench::Random random;
+    for(unsigned i = 0; i < 400; i++)
+    {
+        Phy::real x = random.range(0, levelSize - 4), z = random.range(0, levelSize - 4);
+        Phy::real width = random.range(0.5, 4), depth = random.range(0.5, 4);
+        addBlock(vertices, indices, Phy::Vector3(x, 0, z),
+                 Phy::Vector3(x + width, random.range(1, 10), z + depth));
+    }
+
+    mesh.setTriangles(&vertices[0], (unsigned)vertices.size(),
+                      &indices[0], (unsigned)indices.size() / 3);
+}
+
+static bool loadMesh(Phy::TriangleMesh &mesh, const char *filename)
+{
+    size_t length = strlen(filename);
+    if(length > 4 && !strcmp(filename + length - 4, ".obj")) return mesh.loadObj(filename);
+    return mesh.loadBinary(filename);
+}
+
+int main(int argc, char *argv[])
+{
+    Phy::TriangleMesh mesh;
+    if(argc > 1)
+    {
+        if(!loadMesh(mesh, argv[1]))
+        {
+            printf("couldn't load %s\n", argv[1]);
+            return 1;
+        }
+    }
+    else generateLevel(mesh);
+    const char *cacheFile = argc > 2 ? argv[2] : DEFAULT_CACHE;
+
+    // The mesh as loaded, to time starting from the cache with.
+    Phy::TriangleMesh fresh = mesh;
+
+    Bench::Timer timer;
+    mesh.build();
+    double buildNs = timer.elapsedNs();
+
+    timer.reset();
+    bool saved = mesh.saveTree(cacheFile);
+    double saveNs = timer.elapsedNs();
+
+    timer.reset();
+    bool cached = fresh.buildCached(cacheFile);
+    double loadNs = timer.elapsedNs();
+    remove(cacheFile);
+
+    printf("mesh %u triangles, %u nodes\n", mesh.getTriangleCount(), mesh.getNodeCount());
+    printf("build %.1f ms, save %.1f ms%s, start from cache %.1f ms%s\n",
+           buildNs / 1e6, saveNs / 1e6, saved ? "" : " (failed)",
+           loadNs / 1e6, cached ? "" : " (rebuilt)");
+
+    // Spheres and particles scattered over the level, most near the floor.
+    Phy::Vector3 lower(mesh.getNode(0).minimum[0], mesh.getNode(0).minimum[1],
+                       mesh.getNode(0).minimum[2]);
+    Phy::Vector3 upper(mesh.getNode(0).maximum[0], mesh.getNode(0).maximum[1],
+                       mesh.getNode(0).maximum[2]);
+    Phy::real floorHeight = lower.y + (upper.y - lower.y) * (Phy::real)0.1;
+    std::vector<Phy::RigidBody> bodies(OBJECTS);
+    std::vector<Phy::CollisionSphere> spheres(OBJECTS);
+    std::vector<Phy::Particle> particles(OBJECTS);
+    Phy::ParticleWorld::Particles particlePointers(OBJECTS);
+    Bench::Random random(54321);
+    for(unsigned i = 0; i < OBJECTS; i++)
+    {
+        Phy::Vector3 position(random.range(lower.x, upper.x),
+                              random.range(lower.y, floorHeight),
+                              random.range(lower.z, upper.z));
+        if(i % 4 == 0) position.y = random.range(lower.y, upper.y);
+
+        bodies[i].setPosition(position);
+        bodies[i].setOrientation(1, 0, 0, 0);
+        bodies[i].calculateDerivedData();
+        spheres[i].body = &bodies[i];
+        spheres[i].offset.setOrientationAndPos(Phy::Quaternion(), Phy::Vector3());
+        spheres[i].radius = random.range(0.1, 0.5);
+        spheres[i].calculateInternals();
+
+        particles[i].position = position;
+        particlePointers[i] = &particles[i];
+    }
+
+    std::vector<Phy::Contact> contacts(MAX_CONTACTS);
+    Phy::CollisionData data;
+    data.contactArray = &contacts[0];
+    data.friction = (Phy::real)0.9;
+    data.restitution = (Phy::real)0.1;
+    data.tolerance = (Phy::real)0.1;
+
+    double best = 1e30;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        data.reset(MAX_CONTACTS);
+        timer.reset();
+        for(unsigned i = 0; i < OBJECTS; i++)
+        {
+            Phy::CollisionDetector::sphereAndTriangleMesh(spheres[i], mesh, &data);
+        }
+        double ns = timer.elapsedNs();
+        if(ns < best) best = ns;
+    }
+    double sum = 0;
+    for(unsigned i = 0; i < data.contactCount; i++) sum += contacts[i].penetration;
+    printf("%-10s %8.2f ns/object  contacts %7u  checksum %.12g\n", "spheres",
+           best / OBJECTS, data.contactCount, sum);
+
+    const Phy::real particleRadius = (Phy::real)0.25;
+    std::vector<Phy::ParticleContact> particleContacts(OBJECTS);
+    Phy::TriangleMeshContacts meshContacts;
+    meshContacts.init(&particlePointers, &mesh, particleRadius, (Phy::real)0.2);
+    best = 1e30;
+    unsigned used = 0;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        timer.reset();
+        used = meshContacts.addContact(&particleContacts[0], OBJECTS);
+        double ns = timer.elapsedNs();
+        if(ns < best) best = ns;
+    }
+    sum = 0;
+    for(unsigned i = 0; i < used; i++) sum += particleContacts[i].penetration;
+    printf("%-10s %8.2f ns/object  contacts %7u  checksum %.12g\n", "particles",
+           best / OBJECTS, used, sum);
+
+    // Check the nearest points against every triangle.
+    unsigned mismatches = 0;
+    for(unsigned i = 0; i < CHECKS; i++)
+    {
+        const Phy::Vector3 &position = particles[i].position;
+        Phy::real nearest = particleRadius * particleRadius;
+        for(unsigned t = 0; t < mesh.getTriangleCount(); t++)
+        {
+            Phy::Vector3 corners[3];
+            mesh.getTriangle(t, corners);
+            Phy::Vector3 point = Phy::closestPointOnTriangle(position, corners[0],
+                                                             corners[1], corners[2]);
+            Phy::real distance = (position - point).squareMagnitude();
+            if(distance < nearest) nearest = distance;
+        }
+
+        Phy::Vector3 closest;
+        unsigned triangle;
+        bool found = mesh.getClosestPoint(position, particleRadius, &closest, &triangle);
+        bool expected = nearest < particleRadius * particleRadius;
+        if(found != expected ||
+           (found && fabs((position - closest).squareMagnitude() - nearest) > 1e-9))
+        {
+            mismatches++;
+        }
+    }
+    printf("checked %u particle queries against every triangle: %u mismatches\n",
+           CHECKS, mismatches);
+
+    return mismatches ? 1 : 0;
+}
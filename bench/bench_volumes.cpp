@@ -0,0 +1,186 @@
+// Compares bounding sphere and bounding box hierarchies on a boxy level:
+// floor tiles, walls and stacks of crates resting on each other. Both
+// FlatBVH and BVHNode are built over each volume type, and the pairs
+// are checked against a brute force pass over the same volumes.
+
+#include <cstdio>
+#include <vector>
+
+#include "collide_bvh.h"
+#include "bench.h"
+
+#define RUNS 5
+#define MAX_PAIRS 4000000
+
+struct Level
+{
+    std::vector<Phy::Vector3> centers;
+    std::vector<Phy::Vector3> halfSizes;
+
+    void addBox(const Phy::Vector3 &center, const Phy::Vector3 &halfSize)
+    {
+        centers.push_back(center);
+        halfSizes.push_back(halfSize);
+    }
+
+    // A grid of rooms, each 10 x 10 with walls on two sides and a few
+    // stacks of crates.
+    Level(unsigned rooms)
+    {
+        Bench::Random random;
+        const Phy::real room = 10;
+        Phy::real size = room * rooms;
+
+        for(Phy::real x = 1; x < size; x += 2)
+        {
+            for(Phy::real z = 1; z < size; z += 2)
+            {
+                addBox(Phy::Vector3(x, -0.25, z), Phy::Vector3(1, 0.25, 1));
+            }
+        }
+
+        for(unsigned rx = 0; rx < rooms; rx++)
+        {
+            for(unsigned rz = 0; rz < rooms; rz++)
+            {
+                Phy::real x0 = rx * room, z0 = rz * room;
+                addBox(Phy::Vector3(x0 + room*0.5, 1.5, z0 + 0.25), Phy::Vector3(room*0.5, 1.5, 0.25));
+                addBox(Phy::Vector3(x0 + 0.25, 1.5, z0 + room*0.5), Phy::Vector3(0.25, 1.5, room*0.5));
+
+                for(unsigned s = 0; s < 5; s++)
+                {
+                    Phy::real x = x0 + random.range(1.5, room - 1);
+                    Phy::real z = z0 + random.range(1.5, room - 1);
+                    unsigned height = 1 + random.next() % 4;
+                    for(unsigned c = 0; c < height; c++)
+                    {
+                        addBox(Phy::Vector3(x, 0.5 + c, z), Phy::Vector3(0.5, 0.5, 0.5));
+                    }
+                }
+            }
+        }
+    }
+
+    unsigned getCount() const
+    {
+        return (unsigned)centers.size();
+    }
+
+    Phy::BoundingBox getBox(unsigned i) const
+    {
+        return Phy::BoundingBox(centers[i], halfSizes[i]);
+    }
+
+    Phy::BoundingSphere getSphere(unsigned i) const
+    {
+        return Phy::BoundingSphere(centers[i], halfSizes[i].magnitude());
+    }
+};
+
+static Phy::BoundingBox volume(const Level &level, unsigned i, const Phy::BoundingBox *)
+{
+    return level.getBox(i);
+}
+
+static Phy::BoundingSphere volume(const Level &level, unsigned i, const Phy::BoundingSphere *)
+{
+    return level.getSphere(i);
+}
+
+template <class BoundingVolumeClass>
+static unsigned bruteForce(const Level &level)
+{
+    std::vector<BoundingVolumeClass> volumes;
+    for(unsigned i = 0; i < level.getCount(); i++)
+    {
+        volumes.push_back(volume(level, i, (BoundingVolumeClass*)0));
+    }
+    unsigned count = 0;
+    for(unsigned i = 0; i < volumes.size(); i++)
+    {
+        for(unsigned j = i + 1; j < volumes.size(); j++)
+        {
+            if(volumes[i].overlaps(&volumes[j])) count++;
+        }
+    }
+    return count;
+}
+
+template <class BoundingVolumeClass>
+static void benchFlat(const char *name, const Level &level,
+                      std::vector<Phy::RigidBody> &bodies,
+                      std::vector<Phy::PotentialContact> &pairs)
+{
+    double buildNs = 0, queryNs = 0;
+    unsigned count = 0;
+    int height = 0;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        Bench::Timer timer;
+        Phy::FlatBVH<BoundingVolumeClass> tree(level.getCount());
+        for(unsigned i = 0; i < level.getCount(); i++)
+        {
+            tree.insert(&bodies[i], volume(level, i, (BoundingVolumeClass*)0));
+        }
+        buildNs += timer.elapsedNs();
+
+        timer.reset();
+        count = tree.getPotentialContacts(&pairs[0], MAX_PAIRS);
+        queryNs += timer.elapsedNs();
+        height = tree.getHeight();
+    }
+
+    unsigned expected = bruteForce<BoundingVolumeClass>(level);
+    printf("  %-16s %12.0f %12.0f %8u %6d %s\n", name, buildNs / RUNS, queryNs / RUNS,
+           count, height, count == expected ? "ok" : "MISSED PAIRS");
+}
+
+template <class BoundingVolumeClass>
+static void benchPointer(const char *name, const Level &level,
+                         std::vector<Phy::RigidBody> &bodies,
+                         std::vector<Phy::PotentialContact> &pairs)
+{
+    double buildNs = 0, queryNs = 0;
+    unsigned count = 0;
+    for(unsigned run = 0; run < RUNS; run++)
+    {
+        Bench::Timer timer;
+        Phy::BVHNode<BoundingVolumeClass> *root = new Phy::BVHNode<BoundingVolumeClass>(
+            NULL, volume(level, 0, (BoundingVolumeClass*)0), &bodies[0]);
+        for(unsigned i = 1; i < level.getCount(); i++)
+        {
+            root->insert(&bodies[i], volume(level, i, (BoundingVolumeClass*)0));
+        }
+        buildNs += timer.elapsedNs();
+
+        timer.reset();
+        count = root->getPotentialContacts(&pairs[0], MAX_PAIRS);
+        queryNs += timer.elapsedNs();
+        delete root;
+    }
+
+    unsigned expected = bruteForce<BoundingVolumeClass>(level);
+    printf("  %-16s %12.0f %12.0f %8u %6s %s\n", name, buildNs / RUNS, queryNs / RUNS,
+           count, "-", count == expected ? "ok" : "MISSED PAIRS");
+}
+
+static void bench(unsigned rooms)
+{
+    Level level(rooms);
+    std::vector<Phy::RigidBody> bodies(level.getCount());
+    std::vector<Phy::PotentialContact> pairs(MAX_PAIRS);
+
+    printf("%u x %u rooms, %u boxes\n", rooms, rooms, level.getCount());
+    printf("  %-16s %12s %12s %8s %6s\n", "tree", "build ns", "query ns", "pairs", "height");
+    benchFlat<Phy::BoundingSphere>("flat sphere", level, bodies, pairs);
+    benchFlat<Phy::BoundingBox>("flat box", level, bodies, pairs);
+    benchPointer<Phy::BoundingSphere>("pointer sphere", level, bodies, pairs);
+    benchPointer<Phy::BoundingBox>("pointer box", level, bodies, pairs);
+}
+
+int main()
+{
+    bench(5);
+    bench(10);
+    return 0;
+}
@@ -0,0 +1,289 @@
+// Steps long ropes and a bridge in a ParticleWorld with its links kept
+// as contacts and with both XPBD link solvers, serially and on a worker
+// pool, and prints the cost of a step and how far the links have
+// stretched: the largest and the average stretch over the last frame,
+// as a fraction of the links' lengths. The XPBD solvers are run with
+// the same budget of relaxations spent as iterations of one step and
+// as substeps of one iteration each.
+//
+// The rope is pinned at one end and starts out straight and level, so
+// it falls and swings. The bridge is two ropes joined by rungs and
+// braces, pinned at both ends, that sags under its own weight. The
+// contact resolver is given twice as many iterations as there are
+// contacts, as ParticleWorld does by default, and picks its contacts
+// with the priority queue.
+//
+// Before that, a short chain of compliant links is left to hang until
+// it settles, under each XPBD solver, and its length is compared with
+// the length the compliance gives it: each link stretches by its
+// compliance times the weight it holds.
+//
+// usage: bench_xpbd [segments] [frames] [relaxations]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+
+#include "pworld.h"
+#include "workers.h"
+#include "bench.h"
+
+#define DEFAULT_SEGMENTS 10000
+#define DEFAULT_FRAMES 60
+#define DEFAULT_RELAXATIONS 8
+
+static const Phy::real duration = (Phy::real)1.0/60;
+static const Phy::real linkLength = (Phy::real)0.1;
+
+struct LinkScene
+{
+    std::vector<Phy::Particle> particles;
+    std::vector<Phy::ParticleRod> rods;
+    std::vector<Phy::ParticleRodConstraint> anchors;
+    Phy::ParticleWorld world;
+
+    LinkScene(unsigned particleCount)
+        : particles(particleCount), world(particleCount * 2)
+    {
+        for(unsigned i = 0; i < particleCount; i++)
+        {
+            Phy::Particle &p = particles[i];
+            p.velocity.clear();
+            p.acceleration = Phy::Vector3(0, (Phy::real)-9.81, 0);
+            p.damping = (Phy::real)0.99;
+            p.setMass(1);
+            p.clearAccumulator();
+        }
+    }
+
+    void addRod(unsigned a, unsigned b, Phy::real length)
+    {
+        Phy::ParticleRod rod;
+        rod.particle[0] = &particles[a];
+        rod.particle[1] = &particles[b];
+        rod.length = length;
+        rods.push_back(rod);
+    }
+
+    void addAnchor(unsigned particle)
+    {
+        Phy::ParticleRodConstraint anchor;
+        anchor.particle = &particles[particle];
+        anchor.anchor = particles[particle].position;
+        anchor.length = 0;
+        anchors.push_back(anchor);
+    }
+
+    // Hands the particles and links to the world, once they are all made.
+    void finish()
+    {
+        unsigned i;
+        for(i = 0; i < particles.size(); i++) world.getParticles().push_back(&particles[i]);
+        for(i = 0; i < anchors.size(); i++) world.getContactGenerators().push_back(&anchors[i]);
+        for(i = 0; i < rods.size(); i++) world.getContactGenerators().push_back(&rods[i]);
+        world.getResolver().setSelection(Phy::SELECT_PRIORITY_QUEUE);
+    }
+
+    void stretch(Phy::real *largest, Phy::real *average) const
+    {
+        *largest = 0;
+        *average = 0;
+        for(unsigned i = 0; i < rods.size(); i++)
+        {
+            const Phy::ParticleRod &rod = rods[i];
+            Phy::real length = (rod.particle[0]->position - rod.particle[1]->position).magnitude();
+            Phy::real error = real_abs(length - rod.length) / rod.length;
+            if(error > *largest) *largest = error;
+            *average += error;
+        }
+        if(!rods.empty()) *average /= Phy::real(rods.size());
+    }
+};
+
+// A rope of the given number of segments, pinned at its first particle.
+struct Rope : public LinkScene
+{
+    Rope(unsigned segments)
+        : LinkScene(segments + 1)
+    {
+        for(unsigned i = 0; i <= segments; i++)
+        {
+            particles[i].position = Phy::Vector3(Phy::real(i) * linkLength, 0, 0);
+            if(i) addRod(i - 1, i, linkLength);
+        }
+        addAnchor(0);
+        finish();
+    }
+};
+
+/*
+ * Two ropes side by side, joined by a rung at every particle and a
+ * brace across every square, pinned at both ends. The ropes are a
+ * little longer than the gap they span, so the bridge sags.
+ */
+struct Bridge : public LinkScene
+{
+    Bridge(unsigned segments)
+        : LinkScene((segments / 4 + 1) * 2)
+    {
+        unsigned length = segments / 4;
+        Phy::real brace = real_sqrt(2) * linkLength;
+        for(unsigned i = 0; i <= length; i++)
+        {
+            Phy::real x = Phy::real(i) * linkLength * (Phy::real)0.95;
+            particles[i*2].position = Phy::Vector3(x, 0, 0);
+            particles[i*2 + 1].position = Phy::Vector3(x, 0, linkLength);
+            addRod(i*2, i*2 + 1, linkLength);
+            if(i)
+            {
+                addRod(i*2 - 2, i*2, linkLength);
+                addRod(i*2 - 1, i*2 + 1, linkLength);
+                addRod(i*2 - 2, i*2 + 1, brace);
+            }
+        }
+        addAnchor(0);
+        addAnchor(1);
+        addAnchor(length*2);
+        addAnchor(length*2 + 1);
+        finish();
+    }
+};
+
+template<class Scene>
+static void run(const char *name, unsigned segments, unsigned frames, unsigned iterations,
+                unsigned substeps, Phy::ParticleLinkSolver solver, Phy::WorkerPool *workers)
+{
+    Scene scene(segments);
+    scene.world.setLinkSolver(solver);
+    scene.world.getXPBDSolver().setIterations(iterations);
+    scene.world.getXPBDSolver().setSubsteps(substeps);
+    scene.world.getXPBDSolver().setWorkerPool(workers);
+
+    static const char *solverNames[] = { "contacts", "jacobi", "gauss-seidel" };
+    double ns = 0;
+    for(unsigned frame = 0; frame < frames; frame++)
+    {
+        Bench::Timer timer;
+        scene.world.startFrame();
+        scene.world.runPhysics(duration);
+        ns += timer.elapsedNs();
+    }
+
+    Phy::real largest, average;
+    scene.stretch(&largest, &average);
+    if(solver == Phy::LINKS_AS_CONTACTS) iterations = substeps = 0;
+    printf("%-8s %-14s %7u %5u %8u %12.0f %12.6f %12.6f\n", name, solverNames[solver],
+           workers ? workers->getThreadCount() : 1, iterations, substeps,
+           ns / frames, largest, average);
+}
+
+/*
+ * Hangs the given number of particles of unit mass in a chain of rods
+ * of unit length and the given compliance from an anchor, under a
+ * gravity of 10, and returns the length of the chain once settled.
+ */
+static Phy::real settledLength(unsigned links, Phy::real compliance,
+                               Phy::ParticleLinkSolver solver)
+{
+    std::vector<Phy::Particle> particles(links);
+    std::vector<Phy::ParticleRod> rods(links - 1);
+    Phy::ParticleRodConstraint anchor;
+    Phy::ParticleWorld world(links * 2);
+
+    for(unsigned i = 0; i < links; i++)
+    {
+        Phy::Particle &p = particles[i];
+        p.position = Phy::Vector3(0, -Phy::real(i + 1), 0);
+        p.velocity.clear();
+        p.acceleration = Phy::Vector3(0, -10, 0);
+        p.damping = (Phy::real)0.9;
+        p.setMass(1);
+        p.clearAccumulator();
+        world.getParticles().push_back(&p);
+        if(i)
+        {
+            rods[i - 1].particle[0] = &particles[i - 1];
+            rods[i - 1].particle[1] = &p;
+            rods[i - 1].length = 1;
+            world.getContactGenerators().push_back(&rods[i - 1]);
+        }
+    }
+    anchor.particle = &particles[0];
+    anchor.anchor = Phy::Vector3(0, 0, 0);
+    anchor.length = 1;
+    world.getContactGenerators().push_back(&anchor);
+
+    world.setLinkSolver(solver);
+    world.getXPBDSolver().setCompliance(compliance, compliance);
+    world.getXPBDSolver().setIterations(DEFAULT_RELAXATIONS);
+    for(unsigned frame = 0; frame < 3600; frame++)
+    {
+        world.startFrame();
+        world.runPhysics(duration);
+    }
+    return -particles[links - 1].position.y;
+}
+
+static void benchCompliance()
+{
+    static const Phy::real compliance = (Phy::real)0.01;
+    printf("%-8s %14s %14s %14s\n", "links", "expected", "jacobi", "gauss-seidel");
+    for(unsigned links = 1; links <= 4; links *= 4)
+    {
+        // Link i from the bottom holds the weight of i particles.
+        Phy::real expected = Phy::real(links) +
+            compliance * 10 * Phy::real(links * (links + 1) / 2);
+        printf("%-8u %14.4f %14.4f %14.4f\n", links, expected,
+               settledLength(links, compliance, Phy::LINKS_XPBD_JACOBI),
+               settledLength(links, compliance, Phy::LINKS_XPBD_GAUSS_SEIDEL));
+    }
+    printf("\n");
+}
+
+template<class Scene>
+static void benchScene(const char *name, unsigned segments, unsigned frames,
+                       unsigned budget, Phy::WorkerPool *workers)
+{
+    run<Scene>(name, segments, frames, 0, 1, Phy::LINKS_AS_CONTACTS, NULL);
+
+    // The budget as iterations, then as substeps.
+    for(unsigned split = 0; split < 2; split++)
+    {
+        unsigned iterations = split ? 1 : budget;
+        unsigned substeps = split ? budget : 1;
+        run<Scene>(name, segments, frames, iterations, substeps, Phy::LINKS_XPBD_JACOBI, NULL);
+        run<Scene>(name, segments, frames, iterations, substeps,
+                   Phy::LINKS_XPBD_GAUSS_SEIDEL, NULL);
+        if(workers->getThreadCount() > 1)
+        {
+            run<Scene>(name, segments, frames, iterations, substeps,
+                       Phy::LINKS_XPBD_JACOBI, workers);
+            run<Scene>(name, segments, frames, iterations, substeps,
+                       Phy::LINKS_XPBD_GAUSS_SEIDEL, workers);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned segments = argc > 1 ? (unsigned)atoi(argv[1]) : DEFAULT_SEGMENTS;
+    unsigned frames = argc > 2 ? (unsigned)atoi(argv[2]) : DEFAULT_FRAMES;
+    unsigned budget = argc > 3 ? (unsigned)atoi(argv[3]) : DEFAULT_RELAXATIONS;
+    if(segments < 4) segments = DEFAULT_SEGMENTS;
+    if(frames == 0) frames = DEFAULT_FRAMES;
+    if(budget == 0) budget = DEFAULT_RELAXATIONS;
+
+    unsigned threads = std::thread::hardware_concurrency();
+    if(threads == 0) threads = 1;
+    Phy::WorkerPool workers(threads);
+
+    benchCompliance();
+
+    printf("%u segments, %u frames, %u XPBD relaxations a step\n", segments, frames, budget);
+    printf("%-8s %-14s %7s %5s %8s %12s %12s %12s\n", "scene", "links", "threads",
+           "iters", "substeps", "step ns", "max stretch", "avg stretch");
+    benchScene<Rope>("rope", segments, frames, budget, &workers);
+    benchScene<Bridge>("bridge", segments, frames, budget, &workers);
+    return 0;
+}
@@ -0,0 +1,31 @@
+@echo off
+
+if not exist ..\build mkdir ..\build
+
+set CFLAGS=/nologo /O2 /Zi /EHsc /I..\src
+set PHY_SRC=..\src\body.cpp ..\src\collide_coarse.cpp ..\src\collide_fine.cpp ..\src\collide_sap.cpp ..\src\contacts.cpp ..\src\core.cpp ..\src\fgen.cpp ..\src\heightfield.cpp ..\src\integrator.cpp ..\src\particle.cpp ..\src\pcontacts.cpp ..\src\pfgen.cpp ..\src\plinks.cpp ..\src\profile.cpp ..\src\pworld.cpp ..\src\pworld_soa.cpp ..\src\pxpbd.cpp ..\src\simd.cpp ..\src\sleep.cpp ..\src\snapshot.cpp ..\src\timestep.cpp ..\src\trimesh.cpp ..\src\workers.cpp ..\src\world.cpp
+
+pushd ..\build
+
+    cl %CFLAGS% ..\bench\bench_pworld_soa.cpp %PHY_SRC% /Fe.\bench_pworld_soa
+    cl %CFLAGS% ..\bench\bench_integrator.cpp %PHY_SRC% /Fe.\bench_integrator
+    cl %CFLAGS% ..\bench\bench_islands.cpp %PHY_SRC% /Fe.\bench_islands
+    cl %CFLAGS% ..\bench\bench_resolver.cpp %PHY_SRC% /Fe.\bench_resolver
+    cl %CFLAGS% ..\bench\bench_bvh.cpp %PHY_SRC% /Fe.\bench_bvh
+    cl %CFLAGS% ..\bench\bench_dynamic_bvh.cpp %PHY_SRC% /Fe.\bench_dynamic_bvh
+    cl %CFLAGS% ..\bench\bench_volumes.cpp %PHY_SRC% /Fe.\bench_volumes
+    cl %CFLAGS% ..\bench\bench_sap.cpp %PHY_SRC% /Fe.\bench_sap
+    cl %CFLAGS% ..\bench\bench_grid.cpp %PHY_SRC% /Fe.\bench_grid
+    cl %CFLAGS% ..\bench\bench_sleep.cpp %PHY_SRC% /Fe.\bench_sleep
+    cl %CFLAGS% ..\bench\bench_stacks.cpp %PHY_SRC% /Fe.\bench_stacks
+    cl %CFLAGS% ..\bench\bench_narrowphase.cpp %PHY_SRC% /Fe.\bench_narrowphase
+    cl %CFLAGS% ..\bench\bench_heightfield.cpp %PHY_SRC% /Fe.\bench_heightfield
+    cl %CFLAGS% ..\bench\bench_trimesh.cpp %PHY_SRC% /Fe.\bench_trimesh
+    cl %CFLAGS% ..\bench\bench_snapshot.cpp %PHY_SRC% /Fe.\bench_snapshot
+    cl %CFLAGS% ..\bench\bench_xpbd.cpp %PHY_SRC% /Fe.\bench_xpbd
+    cl %CFLAGS% ..\bench\bench_scenes.cpp %PHY_SRC% /Fe.\bench_scenes
+    cl %CFLAGS% /DPHY_PROFILE ..\bench\bench_scenes.cpp %PHY_SRC% /Fe.\bench_scenes_profile
+    cl %CFLAGS% ..\bench\bench_math.cpp %PHY_SRC% /Fe.\bench_math
+    cl %CFLAGS% /DPHY_SCALAR_MATH ..\bench\bench_math.cpp %PHY_SRC% /Fe.\bench_math_scalar
+
+popd
@@ -96,6 +96,12 @@ namespace Phy
         transformMatrix.data[11] = position.z;
     }
 
+    RigidBody::RigidBody()
+        : inverseMass(0), linearDamping(0), angularDamping(0),
+          isAwake(true), derivedDataDirty(true), motion(sleepEpsilon*2), canSleep(true)
+    {
+    }
+
     void RigidBody::calculateDerivedData()
     {
         orientation.normalize();
@@ -106,7 +112,30 @@ namespace Phy
                                 orientation,
                                 inverseInertiaTensor,
                                 transformMatrix);
+        derivedDataDirty = false;
+    }
 
+    void RigidBody::calculateDerivedData(RigidBody *bodies, unsigned count)
+    {
+        for(unsigned n = 0; n < count; n++)
+        {
+            RigidBody &body = bodies[n];
+            if(!body.derivedDataDirty) continue;
+
+            body.orientation.normalize();
+            _calculateTransformMatrix(body.transformMatrix, body.position,
+                                      body.orientation);
+            _transformInertiaTensor(body.inverseInertiaTensorWorld,
+                                    body.orientation,
+                                    body.inverseInertiaTensor,
+                                    body.transformMatrix);
+            body.derivedDataDirty = false;
+        }
+    }
+
+    bool RigidBody::getDerivedDataDirty() const
+    {
+        return derivedDataDirty;
     }
 
     void RigidBody::integrate(real duration)
@@ -140,11 +169,23 @@ namespace Phy
 
         calculateDerivedData();
         clearAccumulators();
+
+        updateMotion(real_pow((real)0.5, duration));
+    }
+
+    void RigidBody::updateMotion(real bias)
+    {
+        real currentMotion = velocity.squareMagnitude() + rotation.squareMagnitude();
+        motion = bias*motion + (1-bias)*currentMotion;
+
+        // Cap the average, so a fast body can settle in a bounded time.
+        if(motion > 10*sleepEpsilon) motion = 10*sleepEpsilon;
     }
 
     void RigidBody::setPosition(const Vector3 &position)
     {
         RigidBody::position = position;
+        derivedDataDirty = true;
     }
 
     void RigidBody::setPosition(const real x, const real y, const real z)
@@ -152,6 +193,7 @@ namespace Phy
         position.x = x;
         position.y = y;
         position.z = z;
+        derivedDataDirty = true;
     }
 
     void RigidBody::getPosition(Vector3 *position) const
@@ -244,6 +286,7 @@ namespace Phy
     {
         RigidBody::orientation = orientation;
         RigidBody::orientation.normalize();
+        derivedDataDirty = true;
     }
 
     void RigidBody::setOrientation(const real r, const real i, const real j, const real k)
@@ -253,6 +296,7 @@ namespace Phy
         orientation.j = j;
         orientation.k = k;
         orientation.normalize();
+        derivedDataDirty = true;
     }
 
     void RigidBody::getOrientation(Quaternion *orientation) const
@@ -312,7 +356,7 @@ namespace Phy
 
     bool RigidBody::hasFiniteMass() const
     {
-        return inverseMass >= 0.0f;
+        return inverseMass > 0.0f;
     }
 
     void RigidBody::setDamping(const real linearDamping,
@@ -345,6 +389,46 @@ namespace Phy
     void RigidBody::setInertiaTensor(const Matrix3 &inertiaTensor)
     {
         inverseInertiaTensor.setInverse(inertiaTensor);
+        derivedDataDirty = true;
+    }
+
+    void RigidBody::setAwake(const bool awake)
+    {
+        if(awake)
+        {
+            isAwake = true;
+            motion = sleepEpsilon*2;
+        }
+        else
+        {
+            isAwake = false;
+            velocity.clear();
+            rotation.clear();
+            clearAccumulators();
+            // Leave the derived data matching where the body stopped.
+            calculateDerivedData();
+        }
+    }
+
+    bool RigidBody::getAwake() const
+    {
+        return isAwake;
+    }
+
+    void RigidBody::setCanSleep(const bool canSleep)
+    {
+        RigidBody::canSleep = canSleep;
+        if(!canSleep && !isAwake) setAwake();
+    }
+
+    bool RigidBody::getCanSleep() const
+    {
+        return canSleep;
+    }
+
+    real RigidBody::getMotion() const
+    {
+        return motion;
     }
 
     void RigidBody::clearAccumulators()
@@ -356,7 +440,7 @@ namespace Phy
     void RigidBody::addForce(const Vector3 &force)
     {
         forceAccum += force;
-        isAwake = true;
+        if(!isAwake) setAwake();
     }
 
     void RigidBody::addForcePoint(const Vector3 &force, const Vector3 &point)
@@ -368,7 +452,7 @@ namespace Phy
         forceAccum += force;
         torqueAccum += pt % force;
 
-        isAwake = true;
+        if(!isAwake) setAwake();
     }
 
     void RigidBody::addForceAtBodyPoint(const Vector3 &force, const Vector3 &point)
@@ -376,14 +460,12 @@ namespace Phy
         // convert to coordinates relative to center of mass
         Vector3 pt = getPointInWorldSpace(point);
         addForcePoint(force, pt);
-
-        isAwake = true;
     }
 
     void RigidBody::addTorque(const Vector3 &torque)
     {
         torqueAccum += torque;
-        isAwake = true;
+        if(!isAwake) setAwake();
     }
 
     Vector3 RigidBody::getPointInLocalSpace(const Vector3 &point) const
@@ -400,4 +482,14 @@ namespace Phy
     {
         return transformMatrix;
     }
+
+    Vector3 RigidBody::getLastFrameAcceleration() const
+    {
+        return lastFrameAcceleration;
+    }
+
+    void RigidBody::getInverseInertiaTensorWorld(Matrix3 *inverseInertiaTensor) const
+    {
+        *inverseInertiaTensor = inverseInertiaTensorWorld;
+    }
 }
@@ -8,6 +8,8 @@ namespace Phy
 
     class RigidBody
     {
+        // The batch integrator steps arrays of bodies in place.
+        friend class BatchIntegrator;
     protected:
         real inverseMass;
         real linearDamping;
@@ -34,13 +36,35 @@ namespace Phy
         Matrix4 transformMatrix;
         Matrix3 inverseInertiaTensorWorld;
         bool isAwake;
+        /* Set when the position, orientation or inertia tensor changed
+         * after the derived data was last calculated. */
+        bool derivedDataDirty;
         // #######################################################
+
+        /* A running average of the body's squared linear and angular
+         * speed, used to decide when it has come to rest. */
+        real motion;
+        // Bodies that cannot sleep are never put to sleep.
+        bool canSleep;
     public:
+        RigidBody();
 
         void calculateDerivedData();
 
+        /* Calculates the derived data of the bodies in the array that
+         * need it, in one pass, and skips the rest. Called once a step,
+         * it processes each body at most once however many times the
+         * body was moved. */
+        static void calculateDerivedData(RigidBody *bodies, unsigned count);
+        bool getDerivedDataDirty() const;
+
         void integrate(real duration);
 
+        /* Folds this frame's velocities into the motion average. The
+         * bias is the weight kept by the old average, pow(0.5, duration)
+         * for a half life of one second. */
+        void updateMotion(real bias);
+
         void setPosition(const Vector3 &position);
         void setPosition(const real x, const real y, const real z);
         void getPosition(Vector3 *position) const;
@@ -84,6 +108,18 @@ namespace Phy
 
         void setInertiaTensor(const Matrix3 &inertiaTensor);
 
+        /* Wakes the body, giving it enough motion not to fall straight
+         * back to sleep, or puts it to sleep, stopping it in place.
+         * Sleeping bodies are skipped by integration, by World::startFrame
+         * and by the force registry. */
+        void setAwake(const bool awake=true);
+        bool getAwake() const;
+
+        void setCanSleep(const bool canSleep=true);
+        bool getCanSleep() const;
+
+        real getMotion() const;
+
         void clearAccumulators();
         void addForce(const Vector3 &force);
         void addForcePoint(const Vector3 &force, const Vector3 &point);
@@ -94,6 +130,10 @@ namespace Phy
         Vector3 getPointInWorldSpace(const Vector3 &point) const;
 
         Matrix4 getTransform() const;
+
+        // The acceleration the body had over the last integration step.
+        Vector3 getLastFrameAcceleration() const;
+        void getInverseInertiaTensorWorld(Matrix3 *inverseInertiaTensor) const;
  
     };
 
@@ -0,0 +1,503 @@
+#ifndef PHY_COLLIDE_BVH_H
+#define PHY_COLLIDE_BVH_H
+
+#include <vector>
+#include "collide_coarse.h"
+#include "profile.h"
+
+namespace Phy
+{
+
+    /* A bounding volume hierarchy with the same contract as BVHNode,
+     * but whose nodes live in one contiguous array and refer to each
+     * other by index. Released nodes go on a free list and are reused
+     * by later inserts, so once the array has grown to the largest tree
+     * seen, inserting and removing bodies never allocates.
+     *
+     * All traversals are iterative: insertion and refitting walk parent
+     * indices, and queries use an explicit stack.
+     *
+     * The tree can also be used as a dynamic tree for moving bodies.
+     * With a margin set, each leaf stores its volume enlarged by that
+     * margin, and update() only reinserts a leaf once its body's volume
+     * is no longer contained in it. Bodies that move a little each frame
+     * then cost a containment test rather than a remove and insert.
+     *
+     * Inserts and reinserts keep the tree in shape with rotations: every
+     * refit tries swapping a child with a grandchild at each node it
+     * passes, so the volumes stay tight however the bodies arrived and
+     * moved. Swaps are scored by getSurface(), the same cost insertion
+     * descends by with getGrowth(). Besides the BVHNode contract, the
+     * volume class must provide getSurface(), getEnlarged(margin) and
+     * contains(other).
+     */
+    template<class BoundingVolumeClass>
+    class FlatBVH
+    {
+    public:
+        // Marks a missing parent or child, and the end of the free list.
+        static const unsigned NULL_NODE = 0xffffffff;
+
+        struct Node
+        {
+            /* holds a single bounding volume encompassing all the
+             * descendants of this node */
+            BoundingVolumeClass volume;
+
+            /* Holds the rigid body at this node of the hierarchy.
+             * Only leaf nodes can have a rigid body defined */
+            RigidBody *body;
+
+            unsigned parent;
+            // Free nodes link to the next free node through children[0].
+            unsigned children[2];
+
+            // Leaves have a height of zero, free nodes of -1.
+            int height;
+
+            Node(const BoundingVolumeClass &volume, RigidBody *body, unsigned parent)
+                : volume(volume), body(body), parent(parent), height(0)
+            {
+                children[0] = children[1] = NULL_NODE;
+            }
+
+            bool isLeaf() const
+            {
+                return (body != NULL);
+            }
+        };
+
+    protected:
+        struct NodePair
+        {
+            unsigned a;
+            unsigned b;
+        };
+
+        std::vector<Node> nodes;
+        unsigned root;
+        unsigned freeList;
+        unsigned leafCount;
+
+        // How far leaf volumes are enlarged beyond their bodies.
+        real margin;
+
+        // Traversal stack for queries, kept to avoid reallocating.
+        mutable std::vector<NodePair> stack;
+
+        unsigned allocateNode(const BoundingVolumeClass &volume, RigidBody *body,
+                              unsigned parent);
+        void freeNode(unsigned node);
+
+        /* Links an allocated leaf into the tree, and unlinks it again
+         * without releasing it. */
+        void insertLeaf(unsigned leaf);
+        void removeLeaf(unsigned leaf);
+
+        /* Recalculates the volumes and heights from the given node up
+         * to the root, rotating each node on the way. */
+        void refit(unsigned node);
+
+        /* Swaps a child of the given node with one of its grandchildren
+         * on the other side, if that reduces the surface area of the
+         * volume the grandchild is in. */
+        void rotate(unsigned node);
+
+        void replaceChild(unsigned parent, unsigned oldChild, unsigned newChild);
+        void recalculate(unsigned node);
+
+    public:
+        FlatBVH(unsigned capacity = 0, real margin = 0);
+
+        /* Inserts the given rigid body, with the given bounding volume,
+         * into the hierarchy. Returns the index of its leaf, which stays
+         * valid until the leaf is removed.
+         */
+        unsigned insert(RigidBody *body, const BoundingVolumeClass &volume);
+
+        /* Removes a leaf returned by insert, replacing its parent with
+         * its sibling.
+         */
+        void remove(unsigned leaf);
+
+        /* Tells the tree the body at the given leaf now has the given
+         * bounding volume. The leaf is reinserted only if the volume has
+         * left the leaf's enlarged volume, in which case this returns
+         * true. The leaf index does not change.
+         */
+        bool update(unsigned leaf, const BoundingVolumeClass &volume);
+
+        /* Gives the leaf exactly the given volume, without enlarging
+         * it, and reinserts it. This puts back a volume read from the
+         * leaf's node, as when restoring a snapshot.
+         */
+        void setVolume(unsigned leaf, const BoundingVolumeClass &volume);
+
+        // Removes every body, keeping the node storage.
+        void clear();
+
+        /* Checks the potential contacts between all the bodies in the
+         * hierarchy, writing to the given array (up to the given limit).
+         * Returns the number of potential contacts it found. With a
+         * margin set, these are the pairs whose enlarged volumes overlap.
+         */
+        unsigned getPotentialContacts(PotentialContact *contacts, unsigned limit) const;
+
+        /* Sets the margin leaves are enlarged by. It applies to bodies
+         * inserted or reinserted after the call.
+         */
+        void setMargin(real margin);
+        real getMargin() const;
+
+        unsigned getRoot() const;
+        unsigned getLeafCount() const;
+        int getHeight() const;
+        const Node &getNode(unsigned node) const;
+    };
+
+    template <class BoundingVolumeClass>
+    const unsigned FlatBVH<BoundingVolumeClass>::NULL_NODE;
+
+    template <class BoundingVolumeClass>
+    FlatBVH<BoundingVolumeClass>::FlatBVH(unsigned capacity, real margin)
+        : root(NULL_NODE), freeList(NULL_NODE), leafCount(0), margin(margin)
+    {
+        // A tree of n leaves has 2n-1 nodes.
+        if(capacity > 0) nodes.reserve(capacity*2);
+    }
+
+    template <class BoundingVolumeClass>
+    unsigned FlatBVH<BoundingVolumeClass>::allocateNode(const BoundingVolumeClass &volume,
+                                                        RigidBody *body, unsigned parent)
+    {
+        if(freeList != NULL_NODE)
+        {
+            unsigned node = freeList;
+            freeList = nodes[node].children[0];
+            nodes[node] = Node(volume, body, parent);
+            return node;
+        }
+
+        nodes.push_back(Node(volume, body, parent));
+        return (unsigned)nodes.size() - 1;
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::freeNode(unsigned node)
+    {
+        nodes[node].body = NULL;
+        nodes[node].parent = NULL_NODE;
+        nodes[node].children[0] = freeList;
+        nodes[node].children[1] = NULL_NODE;
+        nodes[node].height = -1;
+        freeList = node;
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::replaceChild(unsigned parent,
+                                                    unsigned oldChild, unsigned newChild)
+    {
+        if(parent == NULL_NODE)
+        {
+            root = newChild;
+        }
+        else
+        {
+            Node &p = nodes[parent];
+            if(p.children[0] == oldChild) p.children[0] = newChild;
+            else p.children[1] = newChild;
+        }
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::recalculate(unsigned node)
+    {
+        Node &n = nodes[node];
+        const Node &c0 = nodes[n.children[0]];
+        const Node &c1 = nodes[n.children[1]];
+        n.volume = BoundingVolumeClass(c0.volume, c1.volume);
+        n.height = 1 + (c0.height > c1.height ? c0.height : c1.height);
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::rotate(unsigned node)
+    {
+        // Try swapping each child with each grandchild on the other
+        // side, and keep the swap that shrinks that side the most. The
+        // cost is the surface the insertion descent measures growth in.
+        real bestGain = 0;
+        unsigned bestSide = 0, bestGrandchild = 0;
+        bool found = false;
+        for(unsigned side = 0; side < 2; side++)
+        {
+            unsigned child = nodes[node].children[side];
+            unsigned other = nodes[node].children[1-side];
+            if(nodes[other].isLeaf()) continue;
+
+            real surface = nodes[other].volume.getSurface();
+            for(unsigned g = 0; g < 2; g++)
+            {
+                unsigned stay = nodes[other].children[1-g];
+                real gain = surface - BoundingVolumeClass(nodes[child].volume,
+                                                          nodes[stay].volume).getSurface();
+                if(gain > bestGain)
+                {
+                    bestGain = gain;
+                    bestSide = side;
+                    bestGrandchild = g;
+                    found = true;
+                }
+            }
+        }
+        if(!found) return;
+
+        unsigned child = nodes[node].children[bestSide];
+        unsigned other = nodes[node].children[1-bestSide];
+        unsigned grandchild = nodes[other].children[bestGrandchild];
+
+        nodes[node].children[bestSide] = grandchild;
+        nodes[grandchild].parent = node;
+        nodes[other].children[bestGrandchild] = child;
+        nodes[child].parent = other;
+
+        recalculate(other);
+        recalculate(node);
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::refit(unsigned node)
+    {
+        // Walk up to the root, recombining the children's volumes.
+        while(node != NULL_NODE)
+        {
+            recalculate(node);
+            rotate(node);
+            node = nodes[node].parent;
+        }
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::insertLeaf(unsigned leaf)
+    {
+        if(root == NULL_NODE)
+        {
+            root = leaf;
+            nodes[leaf].parent = NULL_NODE;
+            return;
+        }
+
+        // Work down to a leaf, always going into the child that would
+        // grow the least to incorporate the new body.
+        const BoundingVolumeClass &newVolume = nodes[leaf].volume;
+        unsigned node = root;
+        while(!nodes[node].isLeaf())
+        {
+            unsigned c0 = nodes[node].children[0];
+            unsigned c1 = nodes[node].children[1];
+            if(nodes[c0].volume.getGrowth(newVolume) <
+               nodes[c1].volume.getGrowth(newVolume))
+            {
+                node = c0;
+            }
+            else
+            {
+                node = c1;
+            }
+        }
+
+        // Replace that leaf with a branch holding it and the new leaf.
+        // allocateNode may grow the array, so no references are held
+        // across it.
+        unsigned oldParent = nodes[node].parent;
+        unsigned branch = allocateNode(nodes[node].volume, NULL, oldParent);
+        nodes[branch].children[0] = node;
+        nodes[branch].children[1] = leaf;
+        nodes[node].parent = branch;
+        nodes[leaf].parent = branch;
+        replaceChild(oldParent, node, branch);
+
+        refit(branch);
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::removeLeaf(unsigned leaf)
+    {
+        unsigned parent = nodes[leaf].parent;
+        nodes[leaf].parent = NULL_NODE;
+
+        if(parent == NULL_NODE)
+        {
+            root = NULL_NODE;
+            return;
+        }
+
+        // Our sibling takes our parent's place.
+        unsigned sibling = nodes[parent].children[0];
+        if(sibling == leaf) sibling = nodes[parent].children[1];
+        unsigned grandparent = nodes[parent].parent;
+        freeNode(parent);
+
+        nodes[sibling].parent = grandparent;
+        replaceChild(grandparent, parent, sibling);
+        refit(grandparent);
+    }
+
+    template <class BoundingVolumeClass>
+    unsigned FlatBVH<BoundingVolumeClass>::insert(RigidBody *newBody,
+                                                  const BoundingVolumeClass &newVolume)
+    {
+        unsigned leaf = allocateNode(margin > 0 ? newVolume.getEnlarged(margin) : newVolume,
+                                     newBody, NULL_NODE);
+        leafCount++;
+        insertLeaf(leaf);
+        return leaf;
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::remove(unsigned leaf)
+    {
+        removeLeaf(leaf);
+        freeNode(leaf);
+        leafCount--;
+    }
+
+    template <class BoundingVolumeClass>
+    bool FlatBVH<BoundingVolumeClass>::update(unsigned leaf,
+                                              const BoundingVolumeClass &volume)
+    {
+        if(nodes[leaf].volume.contains(&volume)) return false;
+
+        removeLeaf(leaf);
+        nodes[leaf].volume = margin > 0 ? volume.getEnlarged(margin) : volume;
+        insertLeaf(leaf);
+        return true;
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::setVolume(unsigned leaf,
+                                                 const BoundingVolumeClass &volume)
+    {
+        removeLeaf(leaf);
+        nodes[leaf].volume = volume;
+        insertLeaf(leaf);
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::clear()
+    {
+        nodes.clear();
+        root = NULL_NODE;
+        freeList = NULL_NODE;
+        leafCount = 0;
+    }
+
+    template <class BoundingVolumeClass>
+    unsigned FlatBVH<BoundingVolumeClass>::getPotentialContacts(
+            PotentialContact *contacts, unsigned limit) const
+    {
+        PHY_PROFILE_SCOPE("FlatBVH::getPotentialContacts");
+        if(root == NULL_NODE || limit == 0) return 0;
+        PHY_PROFILE_ONLY(unsigned visited = 0;)
+
+        // A pair with a == b asks for the contacts within that subtree,
+        // any other pair for the contacts between the two subtrees.
+        unsigned count = 0;
+        stack.clear();
+        NodePair start = { root, root };
+        stack.push_back(start);
+
+        while(!stack.empty() && count < limit)
+        {
+            NodePair pair = stack.back();
+            stack.pop_back();
+            PHY_PROFILE_ONLY(visited++;)
+            const Node &a = nodes[pair.a];
+            const Node &b = nodes[pair.b];
+
+            if(pair.a == pair.b)
+            {
+                if(a.isLeaf()) continue;
+                NodePair within0 = { a.children[0], a.children[0] };
+                NodePair within1 = { a.children[1], a.children[1] };
+                NodePair between = { a.children[0], a.children[1] };
+                stack.push_back(within1);
+                stack.push_back(within0);
+                stack.push_back(between);
+                continue;
+            }
+
+            if(!a.volume.overlaps(&b.volume)) continue;
+
+            // if we are both at leaf nodes, the we have a potential contact.
+            if(a.isLeaf() && b.isLeaf())
+            {
+                contacts[count].body[0] = a.body;
+                contacts[count].body[1] = b.body;
+                count++;
+                continue;
+            }
+
+            // Descend into the branch, or the larger of two branches.
+            if(b.isLeaf() ||
+               (!a.isLeaf() && a.volume.getSize() >= b.volume.getSize()))
+            {
+                NodePair first = { a.children[0], pair.b };
+                NodePair second = { a.children[1], pair.b };
+                stack.push_back(second);
+                stack.push_back(first);
+            }
+            else
+            {
+                NodePair first = { pair.a, b.children[0] };
+                NodePair second = { pair.a, b.children[1] };
+                stack.push_back(second);
+                stack.push_back(first);
+            }
+        }
+
+        // Each node pair taken off the stack counts as one visit.
+        PHY_PROFILE_COUNTER("bvh nodes visited", visited);
+        return count;
+    }
+
+    template <class BoundingVolumeClass>
+    void FlatBVH<BoundingVolumeClass>::setMargin(real margin)
+    {
+        FlatBVH::margin = margin;
+    }
+
+    template <class BoundingVolumeClass>
+    real FlatBVH<BoundingVolumeClass>::getMargin() const
+    {
+        return margin;
+    }
+
+    template <class BoundingVolumeClass>
+    unsigned FlatBVH<BoundingVolumeClass>::getRoot() const
+    {
+        return root;
+    }
+
+    template <class BoundingVolumeClass>
+    unsigned FlatBVH<BoundingVolumeClass>::getLeafCount() const
+    {
+        return leafCount;
+    }
+
+    template <class BoundingVolumeClass>
+    int FlatBVH<BoundingVolumeClass>::getHeight() const
+    {
+        if(root == NULL_NODE) return -1;
+        return nodes[root].height;
+    }
+
+    template <class BoundingVolumeClass>
+    const typename FlatBVH<BoundingVolumeClass>::Node &
+    FlatBVH<BoundingVolumeClass>::getNode(unsigned node) const
+    {
+        return nodes[node];
+    }
+
+}
+
+#endif
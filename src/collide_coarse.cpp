@@ -1,4 +1,5 @@
 #include "collide_coarse.h"
+#include "simd.h"
 
 namespace Phy
 {
@@ -49,4 +50,122 @@ namespace Phy
         return distanceSquared < (radius+other->radius)*(radius+other->radius);
     }
 
+    bool BoundingSphere::contains(const BoundingSphere *other) const
+    {
+        real radiusDiff = radius - other->radius;
+        if(radiusDiff < 0) return false;
+        return (center - other->center).squareMagnitude() <= radiusDiff*radiusDiff;
+    }
+
+    real BoundingSphere::getGrowth(const BoundingSphere &other) const
+    {
+        BoundingSphere newSphere(*this, other);
+
+        // We return a value proportional to the change in surface
+        // area of the sphere.
+        return newSphere.radius*newSphere.radius - radius*radius;
+    }
+
+    BoundingBox::BoundingBox(const Vector3 &center, const Vector3 &halfSize)
+    {
+        minimum = center - halfSize;
+        maximum = center + halfSize;
+    }
+
+#if defined(PHY_SIMD_SSE2) && defined(DOUBLE_PRECISION)
+
+    // Each Vector3 is four doubles (x, y, z, pad) and the pad is always
+    // zero, so a corner is handled as two halves and the pad lanes
+    // neither change nor affect the result.
+
+    BoundingBox::BoundingBox(const BoundingBox &one, const BoundingBox &two)
+    {
+        for(unsigned k = 0; k < 4; k += 2)
+        {
+            _mm_storeu_pd(&minimum.x + k, _mm_min_pd(_mm_loadu_pd(&one.minimum.x + k),
+                                                     _mm_loadu_pd(&two.minimum.x + k)));
+            _mm_storeu_pd(&maximum.x + k, _mm_max_pd(_mm_loadu_pd(&one.maximum.x + k),
+                                                     _mm_loadu_pd(&two.maximum.x + k)));
+        }
+    }
+
+    bool BoundingBox::overlaps(const BoundingBox *other) const
+    {
+        __m128d xy = _mm_and_pd(
+            _mm_cmple_pd(_mm_loadu_pd(&minimum.x), _mm_loadu_pd(&other->maximum.x)),
+            _mm_cmple_pd(_mm_loadu_pd(&other->minimum.x), _mm_loadu_pd(&maximum.x)));
+        __m128d zw = _mm_and_pd(
+            _mm_cmple_pd(_mm_loadu_pd(&minimum.z), _mm_loadu_pd(&other->maximum.z)),
+            _mm_cmple_pd(_mm_loadu_pd(&other->minimum.z), _mm_loadu_pd(&maximum.z)));
+        return _mm_movemask_pd(_mm_and_pd(xy, zw)) == 3;
+    }
+
+#else
+
+    static inline real realMin(real a, real b)
+    {
+        return a < b ? a : b;
+    }
+
+    static inline real realMax(real a, real b)
+    {
+        return a > b ? a : b;
+    }
+
+    BoundingBox::BoundingBox(const BoundingBox &one, const BoundingBox &two)
+    {
+        // Written as selects, which compile to min/max instructions
+        // rather than branches.
+        minimum = Vector3(realMin(one.minimum.x, two.minimum.x),
+                          realMin(one.minimum.y, two.minimum.y),
+                          realMin(one.minimum.z, two.minimum.z));
+        maximum = Vector3(realMax(one.maximum.x, two.maximum.x),
+                          realMax(one.maximum.y, two.maximum.y),
+                          realMax(one.maximum.z, two.maximum.z));
+    }
+
+    bool BoundingBox::overlaps(const BoundingBox *other) const
+    {
+        // Non-short-circuit ands, so there is a single branch.
+        return (minimum.x <= other->maximum.x) & (other->minimum.x <= maximum.x) &
+               (minimum.y <= other->maximum.y) & (other->minimum.y <= maximum.y) &
+               (minimum.z <= other->maximum.z) & (other->minimum.z <= maximum.z);
+    }
+
+#endif
+
+    bool BoundingBox::contains(const BoundingBox *other) const
+    {
+        return minimum.x <= other->minimum.x && other->maximum.x <= maximum.x &&
+               minimum.y <= other->minimum.y && other->maximum.y <= maximum.y &&
+               minimum.z <= other->minimum.z && other->maximum.z <= maximum.z;
+    }
+
+    static inline real halfSurfaceArea(const Vector3 &minimum, const Vector3 &maximum)
+    {
+        Vector3 size = maximum - minimum;
+        return size.x*size.y + size.y*size.z + size.z*size.x;
+    }
+
+    real BoundingBox::getGrowth(const BoundingBox &other) const
+    {
+        BoundingBox newBox(*this, other);
+        return halfSurfaceArea(newBox.minimum, newBox.maximum) -
+            halfSurfaceArea(minimum, maximum);
+    }
+
+    real BoundingBox::getSurface() const
+    {
+        return halfSurfaceArea(minimum, maximum);
+    }
+
+    BoundingBox BoundingBox::getEnlarged(real margin) const
+    {
+        Vector3 offset(margin, margin, margin);
+        BoundingBox box(*this);
+        box.minimum -= offset;
+        box.maximum += offset;
+        return box;
+    }
+
 }
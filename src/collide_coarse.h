@@ -19,6 +19,87 @@ namespace Phy
          * bounding sphere.
          */
         bool overlaps(const BoundingSphere *other) const;
+
+        // Checks whether the other bounding sphere lies entirely inside this one.
+        bool contains(const BoundingSphere *other) const;
+
+        /* Returns a copy of this bounding sphere grown by the given
+         * margin in every direction.
+         */
+        BoundingSphere getEnlarged(real margin) const
+        {
+            return BoundingSphere(center, radius + margin);
+        }
+
+        /* Reports how much this bounding sphere would have to grow
+         * by to incorporate the given bounding sphere. Note that this
+         * calculation returns a value not in any particular units (i.e.
+         * its not a volume growth). In fact the best implementation
+         * takes into account the growth in surface area.
+         */
+        real getGrowth(const BoundingSphere &other) const;
+
+        /* Returns the volume of this bounding volume. This is used
+         * to calculate how to recurse into the bounding volume tree.
+         * For a bounding sphere it is a simple calculation.
+         */
+        real getSize() const
+        {
+            return ((real)1.333333) * R_PI * radius * radius * radius;
+        }
+
+        /* Returns a value proportional to the surface area of this
+         * bounding sphere, in the units getGrowth uses.
+         */
+        real getSurface() const
+        {
+            return radius * radius;
+        }
+    };
+
+    /* An axis aligned bounding box, stored as its minimum and maximum
+     * corners. Merging and overlap tests need no square roots, and on
+     * x86 they work on two axes at a time.
+     */
+    struct BoundingBox
+    {
+        Vector3 minimum;
+        Vector3 maximum;
+    public:
+        // Creates a new bounding box at the given center and half size.
+        BoundingBox(const Vector3 &center, const Vector3 &halfSize);
+        // Creates a bounding box to enclose the two given bounding boxes.
+        BoundingBox(const BoundingBox &one, const BoundingBox &two);
+        /* Checks whether the bounding box overlaps with the other given
+         * bounding box. Boxes that only touch count as overlapping, so
+         * resting contacts are still reported.
+         */
+        bool overlaps(const BoundingBox *other) const;
+
+        // Checks whether the other bounding box lies entirely inside this one.
+        bool contains(const BoundingBox *other) const;
+
+        /* Reports how much this bounding box would have to grow by to
+         * incorporate the given bounding box, as the growth in half its
+         * surface area.
+         */
+        real getGrowth(const BoundingBox &other) const;
+
+        // Returns the volume of this bounding box.
+        real getSize() const
+        {
+            return (maximum.x - minimum.x) * (maximum.y - minimum.y) * (maximum.z - minimum.z);
+        }
+
+        /* Returns half the surface area of this bounding box, the
+         * cost getGrowth measures the growth of.
+         */
+        real getSurface() const;
+
+        /* Returns a copy of this bounding box grown by the given margin
+         * in every direction.
+         */
+        BoundingBox getEnlarged(real margin) const;
     };
 
     struct PotentialContact
@@ -70,6 +151,9 @@ namespace Phy
          */
         void insert(RigidBody *body, const BoundingVolumeClass &volume);
 
+        /* Deleting a node removes it from the hierarchy, along with
+         * all its descendants, and replaces its parent with its sibling.
+         */
         ~BVHNode();
 
     protected:
@@ -88,7 +172,7 @@ namespace Phy
     template <class BoundingVolumeClass>
     bool BVHNode<BoundingVolumeClass>::overlaps(const BVHNode<BoundingVolumeClass> *other) const
     {
-        return volume->overlaps(other->volume);
+        return volume.overlaps(&other->volume);
     }
 
     template <class BoundingVolumeClass>
@@ -143,6 +227,8 @@ namespace Phy
             parent->body = sibling->body;
             parent->children[0] = sibling->children[0];
             parent->children[1] = sibling->children[1];
+            if(parent->children[0]) parent->children[0]->parent = parent;
+            if(parent->children[1]) parent->children[1]->parent = parent;
 
             // Delete the sibling (we blank its parent and children to avoid processing/deleting them).
             sibling->parent = NULL;
@@ -191,7 +277,18 @@ namespace Phy
         if(isLeaf() || limit == 0) return 0;
 
         // Get the potential contacts of one of our children with the other
-        return children[0]->getPotentialContactsWith(children[1], contacts, limit);
+        unsigned count = children[0]->getPotentialContactsWith(children[1], contacts, limit);
+
+        // And the contacts within each child
+        if(limit > count)
+        {
+            count += children[0]->getPotentialContacts(contacts+count, limit-count);
+        }
+        if(limit > count)
+        {
+            count += children[1]->getPotentialContacts(contacts+count, limit-count);
+        }
+        return count;
     }
 
     template <class BoundingVolumeClass>
@@ -214,7 +311,7 @@ namespace Phy
         // Determine which node to descend into. If either is a leaf, then we descend the other.
         // If both are branches, then we use the one with the largest size
         if(other->isLeaf() ||
-           (!isLeaf() && volume->getSize() >= other->volume->getSize()))
+           (!isLeaf() && volume.getSize() >= other->volume.getSize()))
         {
             // Resurce into self
             unsigned count = children[0]->getPotentialContactsWith(other, contacts, limit);
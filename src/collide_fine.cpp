@@ -1,5 +1,8 @@
+#include <cstddef>
 #include "collide_fine.h"
 
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
 namespace Phy
 {
     void CollisionPrimitive::calculateInternals()
@@ -95,7 +98,923 @@ namespace Phy
 
     }
 
+    unsigned CollisionDetector::sphereAndHalfSpace(const CollisionSphere &sphere,
+                                                   const CollisionPlane &plane,
+                                                   CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
 
-}
+        // Cache the sphere position
+        Vector3 position = sphere.getAxis(3);
+
+        // Find the distance from the plane
+        real ballDistance = plane.direction * position - sphere.radius - plane.offset;
+
+        if(ballDistance >= 0) return 0;
+
+        // Create the contact - it has a normal in the plane direction.
+        Contact *contact = data->contacts;
+        contact->contactNormal = plane.direction;
+        contact->penetration = -ballDistance;
+        contact->contactPoint = position - plane.direction * (ballDistance + sphere.radius);
+        contact->setBodyData(sphere.body, NULL, data->friction, data->restitution);
+
+        data->addContacts(1);
+        return 1;
+    }
+
+    unsigned CollisionDetector::sphereAndTruePlane(const CollisionSphere &sphere,
+                                                   const CollisionPlane &plane,
+                                                   CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        // Cache the sphere position
+        Vector3 position = sphere.getAxis(3);
+
+        // Find the distance from the plane
+        real centerDistance = plane.direction * position - plane.offset;
+
+        // Check if we're within radius
+        if(centerDistance*centerDistance > sphere.radius*sphere.radius) return 0;
+
+        // Check which side of the plane we're on
+        Vector3 normal = plane.direction;
+        real penetration = -centerDistance;
+        if(centerDistance < 0)
+        {
+            normal *= -1;
+            penetration = -penetration;
+        }
+        penetration += sphere.radius;
+
+        // Create the contact - it has a normal in the plane direction.
+        Contact *contact = data->contacts;
+        contact->contactNormal = normal;
+        contact->penetration = penetration;
+        contact->contactPoint = position - plane.direction * centerDistance;
+        contact->setBodyData(sphere.body, NULL, data->friction, data->restitution);
+
+        data->addContacts(1);
+        return 1;
+    }
+
+    unsigned CollisionDetector::sphereAndSphere(const CollisionSphere &one,
+                                                const CollisionSphere &two,
+                                                CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        // Cache the sphere positions
+        Vector3 positionOne = one.getAxis(3);
+        Vector3 positionTwo = two.getAxis(3);
+
+        // Find the vector between the objects
+        Vector3 midline = positionOne - positionTwo;
+        real size = midline.magnitude();
+
+        // See if it is large enough.
+        if(size <= 0 || size >= one.radius+two.radius) return 0;
+
+        // We manually create the normal, because we have the
+        // size to hand.
+        Vector3 normal = midline * (((real)1.0)/size);
+
+        Contact *contact = data->contacts;
+        contact->contactNormal = normal;
+        contact->contactPoint = positionOne + midline * (real)0.5;
+        contact->penetration = (one.radius+two.radius - size);
+        contact->setBodyData(one.body, two.body, data->friction, data->restitution);
+
+        data->addContacts(1);
+        return 1;
+    }
+
+    unsigned CollisionDetector::boxAndHalfSpace(const CollisionBox &box,
+                                                const CollisionPlane &plane,
+                                                CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        // Check for intersection
+        if(!IntersectionTests::boxAndHalfSpace(box, plane)) return 0;
+
+        // We have an intersection, so find the intersection points. We can make
+        // do with only checking vertices. If the box is resting on a plane
+        // or on an edge, it will be reported as four or two contact points.
+
+        // Go through each combination of + and - for each half-size
+        static const real mults[8][3] = {{1,1,1},{-1,1,1},{1,-1,1},{-1,-1,1},
+                                         {1,1,-1},{-1,1,-1},{1,-1,-1},{-1,-1,-1}};
+
+        Contact *contact = data->contacts;
+        unsigned contactsUsed = 0;
+        for(unsigned i = 0; i < 8; i++)
+        {
+            // Calculate the position of each vertex
+            Vector3 vertexPos(mults[i][0], mults[i][1], mults[i][2]);
+            vertexPos.ComponentProduct(box.halfSize);
+            vertexPos = box.getTransform().transform(vertexPos);
+
+            // Calculate the distance from the plane
+            real vertexDistance = vertexPos * plane.direction;
+
+            // Compare this to the plane's distance
+            if(vertexDistance <= plane.offset)
+            {
+                // Create the contact data.
+
+                // The contact point is halfway between the vertex and the
+                // plane - we multiply the direction by half the separation
+                // distance and add the vertex location.
+                contact->contactPoint = plane.direction;
+                contact->contactPoint *= (plane.offset - vertexDistance) * (real)0.5;
+                contact->contactPoint += vertexPos;
+                contact->contactNormal = plane.direction;
+                contact->penetration = plane.offset - vertexDistance;
+
+                // Write the appropriate data, naming the contact after the vertex
+                contact->setBodyData(box.body, NULL, data->friction, data->restitution);
+                contact->feature = i;
+
+                // Move onto the next contact
+                contact++;
+                contactsUsed++;
+                if(contactsUsed == (unsigned)data->contactsLeft) break;
+            }
+        }
+
+        data->addContacts(contactsUsed);
+        return contactsUsed;
+    }
+
+    /* How much better than the best face so far a later axis has to
+     * be before boxAndBox picks it: a face of box two must be shallower
+     * by the relative bias, and an edge pair by the absolute one too. */
+    static const real FACE_BIAS = (real)0.95;
+    static const real EDGE_BIAS = (real)0.005;
+
+    // Marks the feature of an edge-edge contact, after the face contacts' range.
+    static const unsigned EDGE_FEATURE = 0x10000;
+
+    /*
+     * Fills in a contact between a face of box one and the vertex of
+     * box two that is deepest along the given axis of box one.
+     */
+    static void fillPointFaceBoxBox(const CollisionBox &one, const CollisionBox &two,
+                                    const Vector3 &toCenter, CollisionData *data,
+                                    unsigned best, real penetration)
+    {
+        // This method is called when we know that a vertex from
+        // box two is in contact with box one.
+
+        Contact *contact = data->contacts;
+
+        // We know which axis the collision is on (i.e. best),
+        // but we need to work out which of the two faces on
+        // this axis.
+        Vector3 normal = one.getAxis(best);
+        if(one.getAxis(best) * toCenter > 0)
+        {
+            normal = normal * -1.0;
+        }
+
+        // Work out which vertex of box two we're colliding with.
+        Vector3 vertex = two.halfSize;
+        if(two.getAxis(0) * normal < 0) vertex.x = -vertex.x;
+        if(two.getAxis(1) * normal < 0) vertex.y = -vertex.y;
+        if(two.getAxis(2) * normal < 0) vertex.z = -vertex.z;
+
+        // Create the contact data
+        contact->contactNormal = normal;
+        contact->penetration = penetration;
+        contact->contactPoint = two.getTransform() * vertex;
+        contact->setBodyData(one.body, two.body, data->friction, data->restitution);
+    }
+
+    /*
+     * Finds the point halfway between the closest points of two edges.
+     * If the edges are parallel, or the closest points fall outside
+     * the edges, the midpoint of one of the edges is used instead.
+     */
+    static inline Vector3 contactPoint(const Vector3 &pOne, const Vector3 &dOne, real oneSize,
+                                       const Vector3 &pTwo, const Vector3 &dTwo, real twoSize,
+                                       // If this is true, and the contact point is outside
+                                       // the edge (in the case of an edge-face contact) then
+                                       // we use one's midpoint, otherwise we use two's.
+                                       bool useOne)
+    {
+        real smOne = dOne.squareMagnitude();
+        real smTwo = dTwo.squareMagnitude();
+        real dpOneTwo = dTwo * dOne;
+
+        Vector3 toSt = pOne - pTwo;
+        real dpStaOne = dOne * toSt;
+        real dpStaTwo = dTwo * toSt;
+
+        real denom = smOne * smTwo - dpOneTwo * dpOneTwo;
+
+        // Zero denominator indicates parrallel lines
+        if(real_abs(denom) < 0.0001)
+        {
+            return useOne ? pOne : pTwo;
+        }
+
+        real mua = (dpOneTwo * dpStaTwo - smTwo * dpStaOne) / denom;
+        real mub = (smOne * dpStaTwo - dpOneTwo * dpStaOne) / denom;
+
+        // If either of the edges has the nearest point out
+        // of bounds, then the edges aren't crossed, we have
+        // an edge-face contact. Our point is on the edge, which
+        // we know from the useOne parameter.
+        if(mua > oneSize || mua < -oneSize ||
+           mub > twoSize || mub < -twoSize)
+        {
+            return useOne ? pOne : pTwo;
+        }
+
+        Vector3 cOne = pOne + dOne * mua;
+        Vector3 cTwo = pTwo + dTwo * mub;
+        return cOne * 0.5 + cTwo * 0.5;
+    }
+
+    /*
+     * Clips a convex polygon, given in the local coordinates of a box,
+     * against the plane sign * p[axis] = limit, keeping the part on the
+     * inside. Writes at most one more point than it is given. Each
+     * point carries an id: kept points keep theirs, and a point made by
+     * the clip is named after the clipping plane and the edge it cuts.
+     */
+    static unsigned clipPolygon(const Vector3 *in, const unsigned *inIds, unsigned count,
+                                unsigned axis, real sign, real limit, unsigned plane,
+                                Vector3 *out, unsigned *outIds)
+    {
+        unsigned written = 0;
+        for(unsigned i = 0; i < count; i++)
+        {
+            const Vector3 &a = in[i];
+            const Vector3 &b = in[(i + 1) % count];
+            real distanceA = sign * a[axis] - limit;
+            real distanceB = sign * b[axis] - limit;
+
+            if(distanceA <= 0)
+            {
+                outIds[written] = inIds[i];
+                out[written++] = a;
+            }
+            if((distanceA < 0 && distanceB > 0) || (distanceA > 0 && distanceB < 0))
+            {
+                outIds[written] = ((plane + 1) << 4) | (inIds[i] & 0xf);
+                out[written++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+            }
+        }
+        return written;
+    }
+
+    /*
+     * Fills in the contacts between the given face axis of the
+     * reference box and the face of the incident box that meets it.
+     * The incident face is clipped to the sides of the reference face,
+     * and every clipped corner below the reference face becomes a
+     * contact, so a box resting flat on another gets four contacts
+     * rather than one corner. The feature of each contact names the
+     * two faces and the point; refIsTwo tells the faces of the second
+     * box of the pair from those of the first. Returns the number of
+     * contacts written.
+     */
+    static unsigned fillFaceBoxBox(const CollisionBox &ref, const CollisionBox &inc,
+                                   const Vector3 &toCenter, unsigned axis, bool refIsTwo,
+                                   real penetration, CollisionData *data)
+    {
+        // The normal points from the incident box to the reference box.
+        Vector3 normal = ref.getAxis(axis);
+        if(normal * toCenter > 0) normal *= -1;
+
+        // The incident face is the one facing back along the normal.
+        unsigned incAxis = 0;
+        real incDot = inc.getAxis(0) * normal;
+        for(unsigned i = 1; i < 3; i++)
+        {
+            real dot = inc.getAxis(i) * normal;
+            if(real_abs(dot) > real_abs(incDot))
+            {
+                incAxis = i;
+                incDot = dot;
+            }
+        }
+
+        // Its corners, in the reference box's coordinates.
+        static const real corners[4][2] = {{1,1},{-1,1},{-1,-1},{1,-1}};
+        unsigned u = (incAxis + 1) % 3;
+        unsigned v = (incAxis + 2) % 3;
+        Vector3 polygon[8];
+        Vector3 clipped[8];
+        unsigned polygonIds[8];
+        unsigned clippedIds[8];
+        for(unsigned i = 0; i < 4; i++)
+        {
+            polygonIds[i] = i;
+            Vector3 corner;
+            corner[incAxis] = (incDot > 0) ? inc.halfSize[incAxis] : -inc.halfSize[incAxis];
+            corner[u] = corners[i][0] * inc.halfSize[u];
+            corner[v] = corners[i][1] * inc.halfSize[v];
+            polygon[i] = ref.getTransform().transformInverse(inc.getTransform().transform(corner));
+        }
+
+        // Clip to the four sides of the reference face.
+        unsigned refU = (axis + 1) % 3;
+        unsigned refV = (axis + 2) % 3;
+        unsigned count = 4;
+        count = clipPolygon(polygon, polygonIds, count, refU, 1, ref.halfSize[refU], 0,
+                            clipped, clippedIds);
+        count = clipPolygon(clipped, clippedIds, count, refU, -1, ref.halfSize[refU], 1,
+                            polygon, polygonIds);
+        count = clipPolygon(polygon, polygonIds, count, refV, 1, ref.halfSize[refV], 2,
+                            clipped, clippedIds);
+        count = clipPolygon(clipped, clippedIds, count, refV, -1, ref.halfSize[refV], 3,
+                            polygon, polygonIds);
+
+        // The reference face is the one facing the incident box.
+        real faceSign = (ref.getAxis(axis) * normal > 0) ? -1 : 1;
+
+        unsigned refFace = axis*2 + (faceSign < 0 ? 1 : 0) + (refIsTwo ? 6 : 0);
+        unsigned incFace = incAxis*2 + (incDot > 0 ? 0 : 1);
+        unsigned faces = (refFace << 12) | (incFace << 8);
+
+        Contact *contact = data->contacts;
+        unsigned contactsUsed = 0;
+        for(unsigned i = 0; i < count; i++)
+        {
+            if(contactsUsed == (unsigned)data->contactsLeft) break;
+
+            real depth = ref.halfSize[axis] - faceSign * polygon[i][axis];
+            if(depth <= 0) continue;
+
+            contact->contactNormal = normal;
+            contact->contactPoint = ref.getTransform().transform(polygon[i]);
+            contact->penetration = depth;
+            contact->setBodyData(ref.body, inc.body, data->friction, data->restitution);
+            contact->feature = faces | polygonIds[i];
+            contact++;
+            contactsUsed++;
+        }
+
+        // Rounding can clip away every point of a barely touching pair,
+        // which then still gets the deepest corner.
+        if(contactsUsed == 0)
+        {
+            fillPointFaceBoxBox(ref, inc, toCenter, data, axis, penetration);
+            data->contacts->feature = faces | 0xff;
+            contactsUsed = 1;
+        }
+
+        data->addContacts(contactsUsed);
+        return contactsUsed;
+    }
+
+    unsigned CollisionDetector::boxAndBox(const CollisionBox &one,
+                                          const CollisionBox &two,
+                                          CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        // The separating axis test is done in the frame of box one. The
+        // dot products of the axes of the two boxes are worked out once
+        // here, and every one of the fifteen axes reads its projections
+        // from them: one's faces use a row, two's faces a column, and
+        // each edge-edge axis two entries of each.
+        Vector3 oneAxis[3], twoAxis[3];
+        for(unsigned i = 0; i < 3; i++)
+        {
+            oneAxis[i] = one.getAxis(i);
+            twoAxis[i] = two.getAxis(i);
+        }
 
+        // Find the vector between the two centres, in one's frame.
+        Vector3 toCenter = two.getAxis(3) - one.getAxis(3);
+        real t[3];
+        real R[3][3];
+        real absR[3][3];
+        for(unsigned i = 0; i < 3; i++)
+        {
+            t[i] = toCenter * oneAxis[i];
+            for(unsigned j = 0; j < 3; j++)
+            {
+                R[i][j] = oneAxis[i] * twoAxis[j];
+                absR[i][j] = real_abs(R[i][j]);
+            }
+        }
+
+        const Vector3 &h1 = one.halfSize;
+        const Vector3 &h2 = two.halfSize;
+
+        // We start assuming there is no contact, and return as soon as
+        // an axis separates the boxes, keeping track of the axis with
+        // the smallest penetration otherwise.
+        real pen = REAL_MAX;
+        unsigned best = 0xffffff;
+
+        // The face axes of box one
+        for(unsigned i = 0; i < 3; i++)
+        {
+            real overlap = h1[i] +
+                h2.x*absR[i][0] + h2.y*absR[i][1] + h2.z*absR[i][2] -
+                real_abs(t[i]);
+            if(overlap < 0) return 0;
+            if(overlap < pen)
+            {
+                pen = overlap;
+                best = i;
+            }
+        }
+
+        // and of box two. Resting boxes often have a face of each at
+        // much the same depth, so the faces of two and then the edges
+        // only win if they are clearly better; otherwise the chosen
+        // face flips from frame to frame, and so does the manifold.
+        for(unsigned j = 0; j < 3; j++)
+        {
+            real overlap = h1.x*absR[0][j] + h1.y*absR[1][j] + h1.z*absR[2][j] + h2[j] -
+                real_abs(t[0]*R[0][j] + t[1]*R[1][j] + t[2]*R[2][j]);
+            if(overlap < 0) return 0;
+            if(overlap < pen * FACE_BIAS)
+            {
+                pen = overlap;
+                best = 3 + j;
+            }
+        }
+
+        // Store the best axis-major, in case we run into almost
+        // parallel edge collisions later
+        unsigned bestSingleAxis = best;
+
+        // The cross products of an edge of one with an edge of two
+        for(unsigned i = 0; i < 3; i++)
+        {
+            unsigned i1 = (i + 1) % 3;
+            unsigned i2 = (i + 2) % 3;
+            for(unsigned j = 0; j < 3; j++)
+            {
+                // Don't check almost parallel edges, whose cross
+                // product has almost no length.
+                real squareLength = 1 - R[i][j]*R[i][j];
+                if(squareLength < 0.0001) continue;
+
+                unsigned j1 = (j + 1) % 3;
+                unsigned j2 = (j + 2) % 3;
+                real oneProject = h1[i1]*absR[i2][j] + h1[i2]*absR[i1][j];
+                real twoProject = h2[j1]*absR[i][j2] + h2[j2]*absR[i][j1];
+                real distance = real_abs(t[i2]*R[i1][j] - t[i1]*R[i2][j]);
+
+                real overlap = (oneProject + twoProject - distance) / real_sqrt(squareLength);
+                if(overlap < 0) return 0;
+                if(overlap < pen * FACE_BIAS - EDGE_BIAS)
+                {
+                    pen = overlap;
+                    best = 6 + i*3 + j;
+                }
+            }
+        }
+
+        // Make sure we've got a result.
+        Assert(best != 0xffffff);
+
+        // We now know there's a collision, and we know which
+        // of the axes gave the smallest penetration. We now
+        // can deal with it in different ways depending on
+        // the case.
+        if(best < 3)
+        {
+            // We've got a face of box one against box two.
+            return fillFaceBoxBox(one, two, toCenter, best, false, pen, data);
+        }
+        else if(best < 6)
+        {
+            // We've got a face of box two against box one. We use the
+            // same algorithm as above, but swap around one and two (and
+            // therefore also the vector between their centres).
+            return fillFaceBoxBox(two, one, toCenter * -1.0, best-3, true, pen, data);
+        }
+
+        // We've got an edge-edge contact. Find out which axes
+        best -= 6;
+        unsigned oneAxisIndex = best / 3;
+        unsigned twoAxisIndex = best % 3;
+        Vector3 axis = oneAxis[oneAxisIndex] % twoAxis[twoAxisIndex];
+        axis.normalize();
+
+        // The axis should point from box two to box one.
+        if(axis * toCenter > 0) axis = axis * -1.0;
+
+        // We have the axes, but not the edges: each axis has 4 edges parallel
+        // to it, we need to find which of the 4 for each object. We do
+        // that by finding the point in the centre of the edge. We know
+        // its component in the direction of the box's collision axis is zero
+        // (its a mid-point) and we determine which of the extremes in each
+        // of the other axes is closest.
+        Vector3 ptOnOneEdge = one.halfSize;
+        Vector3 ptOnTwoEdge = two.halfSize;
+        for(unsigned i = 0; i < 3; i++)
+        {
+            if(i == oneAxisIndex) ptOnOneEdge[i] = 0;
+            else if(oneAxis[i] * axis > 0) ptOnOneEdge[i] = -ptOnOneEdge[i];
+
+            if(i == twoAxisIndex) ptOnTwoEdge[i] = 0;
+            else if(twoAxis[i] * axis < 0) ptOnTwoEdge[i] = -ptOnTwoEdge[i];
+        }
+
+        // Move them into world coordinates (they are already oriented
+        // correctly, since they have been derived from the axes).
+        ptOnOneEdge = one.getTransform() * ptOnOneEdge;
+        ptOnTwoEdge = two.getTransform() * ptOnTwoEdge;
+
+        // So we have a point and a direction for the colliding edges.
+        // We need to find out point of closest approach of the two
+        // line-segments.
+        Vector3 vertex = contactPoint(ptOnOneEdge, oneAxis[oneAxisIndex],
+                                      one.halfSize[oneAxisIndex],
+                                      ptOnTwoEdge, twoAxis[twoAxisIndex],
+                                      two.halfSize[twoAxisIndex],
+                                      bestSingleAxis > 2);
+
+        // We can fill the contact.
+        Contact *contact = data->contacts;
+        contact->penetration = pen;
+        contact->contactNormal = axis;
+        contact->contactPoint = vertex;
+        contact->setBodyData(one.body, two.body, data->friction, data->restitution);
+        contact->feature = EDGE_FEATURE | best;
+        data->addContacts(1);
+        return 1;
+    }
+
+    unsigned CollisionDetector::boxAndPoint(const CollisionBox &box,
+                                            const Vector3 &point,
+                                            CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        // Transform the point into box coordinates
+        Vector3 relPt = box.getTransform().transformInverse(point);
+
+        Vector3 normal;
+
+        // Check each axis, looking for the axis on which the
+        // penetration is least deep.
+        real minDepth = box.halfSize.x - real_abs(relPt.x);
+        if(minDepth < 0) return 0;
+        normal = box.getAxis(0) * ((relPt.x < 0) ? -1.0 : 1.0);
+
+        real depth = box.halfSize.y - real_abs(relPt.y);
+        if(depth < 0) return 0;
+        else if(depth < minDepth)
+        {
+            minDepth = depth;
+            normal = box.getAxis(1) * ((relPt.y < 0) ? -1.0 : 1.0);
+        }
+
+        depth = box.halfSize.z - real_abs(relPt.z);
+        if(depth < 0) return 0;
+        else if(depth < minDepth)
+        {
+            minDepth = depth;
+            normal = box.getAxis(2) * ((relPt.z < 0) ? -1.0 : 1.0);
+        }
+
+        // Compile the contact
+        Contact *contact = data->contacts;
+        contact->contactNormal = normal;
+        contact->contactPoint = point;
+        contact->penetration = minDepth;
+
+        // Note that we don't know what rigid body the point
+        // belongs to, so we just use NULL. Where this is called
+        // this value can be left, or filled in.
+        contact->setBodyData(box.body, NULL, data->friction, data->restitution);
+
+        data->addContacts(1);
+        return 1;
+    }
+
+    unsigned CollisionDetector::boxAndSphere(const CollisionBox &box,
+                                             const CollisionSphere &sphere,
+                                             CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        // Transform the centre of the sphere into box coordinates
+        Vector3 center = sphere.getAxis(3);
+        Vector3 relCenter = box.getTransform().transformInverse(center);
+
+        // Early out check to see if we can exclude the contact
+        if(real_abs(relCenter.x) - sphere.radius > box.halfSize.x ||
+           real_abs(relCenter.y) - sphere.radius > box.halfSize.y ||
+           real_abs(relCenter.z) - sphere.radius > box.halfSize.z)
+        {
+            return 0;
+        }
+
+        // Clamp each coordinate to the box.
+        Vector3 closestPt(0,0,0);
+        for(unsigned i = 0; i < 3; i++)
+        {
+            real dist = relCenter[i];
+            if(dist > box.halfSize[i]) dist = box.halfSize[i];
+            if(dist < -box.halfSize[i]) dist = -box.halfSize[i];
+            closestPt[i] = dist;
+        }
+
+        // Check we're in contact
+        real dist = (closestPt - relCenter).squareMagnitude();
+        if(dist > sphere.radius * sphere.radius) return 0;
+
+        Contact *contact = data->contacts;
+        if(dist <= 0)
+        {
+            // The centre is inside the box, so the sphere is pushed
+            // out through the nearest face, found as in boxAndPoint.
+            unsigned axis = 0;
+            real minDepth = box.halfSize.x - real_abs(relCenter.x);
+            for(unsigned i = 1; i < 3; i++)
+            {
+                real depth = box.halfSize[i] - real_abs(relCenter[i]);
+                if(depth < minDepth)
+                {
+                    minDepth = depth;
+                    axis = i;
+                }
+            }
+
+            real sign = (relCenter[axis] < 0) ? -1.0 : 1.0;
+            Vector3 facePt = relCenter;
+            facePt[axis] = box.halfSize[axis] * sign;
+
+            contact->contactNormal = box.getAxis(axis) * -sign;
+            contact->contactPoint = box.getTransform().transform(facePt);
+            contact->penetration = sphere.radius + minDepth;
+        }
+        else
+        {
+            Vector3 closestPtWorld = box.getTransform().transform(closestPt);
 
+            contact->contactNormal = (closestPtWorld - center);
+            contact->contactNormal.normalize();
+            contact->contactPoint = closestPtWorld;
+            contact->penetration = sphere.radius - real_sqrt(dist);
+        }
+        contact->setBodyData(box.body, sphere.body, data->friction, data->restitution);
+
+        data->addContacts(1);
+        return 1;
+    }
+
+    unsigned CollisionDetector::sphereAndHeightField(const CollisionSphere &sphere,
+                                                     const HeightField &field,
+                                                     CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        Vector3 position = sphere.getAxis(3);
+        real radius = sphere.radius;
+        real minX = position.x - radius, maxX = position.x + radius;
+        real minZ = position.z - radius, maxZ = position.z + radius;
+        if(!field.reaches(minX, minZ, maxX, maxZ, position.y - radius)) return 0;
+
+        Vector3 normal;
+        real penetration;
+        Vector3 point;
+
+        // A centre under the surface is pushed straight out along the
+        // normal there, since the nearest point may be on the far side.
+        real height;
+        Vector3 surfaceNormal;
+        if(field.getHeight(position.x, position.z, &height, &surfaceNormal) &&
+           position.y < height)
+        {
+            normal = surfaceNormal;
+            penetration = radius + (height - position.y) * surfaceNormal.y;
+            point = Vector3(position.x, height, position.z);
+        }
+        else
+        {
+            unsigned x0, z0, x1, z1;
+            if(!field.getCells(minX, minZ, maxX, maxZ, &x0, &z0, &x1, &z1)) return 0;
+
+            // Keep the nearest point of the triangles under the sphere.
+            real best = radius * radius;
+            bool found = false;
+            Vector3 corners[3];
+            for(unsigned z = z0; z <= z1; z++)
+            {
+                for(unsigned x = x0; x <= x1; x++)
+                {
+                    for(unsigned t = 0; t < 2; t++)
+                    {
+                        field.getTriangle(x, z, t, corners);
+                        Vector3 closest = closestPointOnTriangle(position, corners[0],
+                                                                 corners[1], corners[2]);
+                        real distance = (position - closest).squareMagnitude();
+                        if(distance < best)
+                        {
+                            best = distance;
+                            point = closest;
+                            found = true;
+                        }
+                    }
+                }
+            }
+            if(!found) return 0;
+
+            real distance = real_sqrt(best);
+            if(distance <= 0) return 0;
+            normal = (position - point) * ((real)1.0 / distance);
+            penetration = radius - distance;
+        }
+
+        Contact *contact = data->contacts;
+        contact->contactNormal = normal;
+        contact->contactPoint = point;
+        contact->penetration = penetration;
+        contact->setBodyData(sphere.body, NULL, data->friction, data->restitution);
+
+        data->addContacts(1);
+        return 1;
+    }
+
+    unsigned CollisionDetector::boxAndHeightField(const CollisionBox &box,
+                                                  const HeightField &field,
+                                                  CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        static const real mults[8][3] = {{1,1,1},{-1,1,1},{1,-1,1},{-1,-1,1},
+                                         {1,1,-1},{-1,1,-1},{1,-1,-1},{-1,-1,-1}};
+
+        // Find the vertices, and the area and lowest point they span.
+        Vector3 vertices[8];
+        Vector3 lower, upper;
+        for(unsigned i = 0; i < 8; i++)
+        {
+            Vector3 vertexPos(mults[i][0], mults[i][1], mults[i][2]);
+            vertexPos.ComponentProduct(box.halfSize);
+            vertices[i] = box.getTransform().transform(vertexPos);
+            for(unsigned k = 0; k < 3; k++)
+            {
+                if(i == 0 || vertices[i][k] < lower[k]) lower[k] = vertices[i][k];
+                if(i == 0 || vertices[i][k] > upper[k]) upper[k] = vertices[i][k];
+            }
+        }
+        if(!field.reaches(lower.x, lower.z, upper.x, upper.z, lower.y)) return 0;
+
+        // Each vertex below the surface is a contact with the plane of
+        // the triangle it is over.
+        Contact *contact = data->contacts;
+        unsigned contactsUsed = 0;
+        for(unsigned i = 0; i < 8; i++)
+        {
+            real height;
+            Vector3 normal;
+            if(!field.getHeight(vertices[i].x, vertices[i].z, &height, &normal)) continue;
+            if(vertices[i].y >= height) continue;
+
+            real depth = (height - vertices[i].y) * normal.y;
+            contact->contactPoint = vertices[i] + normal * (depth * (real)0.5);
+            contact->contactNormal = normal;
+            contact->penetration = depth;
+            contact->setBodyData(box.body, NULL, data->friction, data->restitution);
+            contact->feature = i;
+
+            contact++;
+            contactsUsed++;
+            if(contactsUsed == (unsigned)data->contactsLeft) break;
+        }
+
+        data->addContacts(contactsUsed);
+        return contactsUsed;
+    }
+
+    unsigned CollisionDetector::sphereAndTriangleMesh(const CollisionSphere &sphere,
+                                                      const TriangleMesh &mesh,
+                                                      CollisionData *data)
+    {
+        // Make sure we have contacts
+        if(data->contactsLeft <= 0) return 0;
+
+        static const unsigned INITIAL_TRIANGLES = 64;
+        static const real MERGE_COSINE = (real)0.999;
+
+        Vector3 position = sphere.getAxis(3);
+        real radius = sphere.radius;
+        Vector3 extent(radius, radius, radius);
+
+        // The scratch list grows to hold every triangle the sphere's
+        // bounds reach, and the query is repeated if it was too short.
+        std::vector<unsigned> &triangles = data->triangles;
+        if(triangles.empty()) triangles.resize(INITIAL_TRIANGLES);
+        unsigned found = mesh.getTriangles(position - extent, position + extent,
+                                           &triangles[0], (unsigned)triangles.size());
+        if(found > triangles.size())
+        {
+            triangles.resize(found);
+            found = mesh.getTriangles(position - extent, position + extent,
+                                      &triangles[0], found);
+        }
+
+        unsigned contactsUsed = 0;
+        for(unsigned i = 0; i < found; i++)
+        {
+            Vector3 corners[3];
+            mesh.getTriangle(triangles[i], corners);
+            Vector3 point = closestPointOnTriangle(position, corners[0], corners[1], corners[2]);
+            Vector3 normal = position - point;
+            real distance = normal.magnitude();
+            if(distance >= radius) continue;
+
+            // A centre on the triangle is pushed out of its front.
+            if(distance > 0) normal *= (real)1.0 / distance;
+            else normal = mesh.getNormal(triangles[i]);
+            real penetration = radius - distance;
+
+            unsigned merged = 0;
+            while(merged < contactsUsed &&
+                  data->contacts[merged].contactNormal * normal < MERGE_COSINE) merged++;
+            if(merged < contactsUsed)
+            {
+                if(data->contacts[merged].penetration >= penetration) continue;
+            }
+            else
+            {
+                if(contactsUsed == (unsigned)data->contactsLeft) continue;
+                contactsUsed++;
+            }
+
+            Contact *target = data->contacts + merged;
+            target->contactNormal = normal;
+            target->contactPoint = point;
+            target->penetration = penetration;
+            target->setBodyData(sphere.body, NULL, data->friction, data->restitution);
+            target->feature = triangles[i];
+        }
+
+        data->addContacts(contactsUsed);
+        return contactsUsed;
+    }
+
+    unsigned CollisionDetector::collidePairs(const PotentialContact *pairs, unsigned numPairs,
+                                             const RigidBody *bodies,
+                                             const CollisionShape *shapes,
+                                             const CollisionSphere *spheres,
+                                             const CollisionBox *boxes,
+                                             CollisionData *data)
+    {
+        unsigned used = 0;
+        for(unsigned i = 0; i < numPairs; i++)
+        {
+            if(!data->hasMoreContacts()) break;
+
+            const RigidBody *bodyOne = pairs[i].body[0];
+            const RigidBody *bodyTwo = pairs[i].body[1];
+            if(!bodyOne->getAwake() && !bodyTwo->getAwake()) continue;
+
+            const CollisionShape &one = shapes[bodyOne - bodies];
+            const CollisionShape &two = shapes[bodyTwo - bodies];
+
+            // Box pairs are the common case, so they are tested first.
+            if(one.type == SHAPE_BOX && two.type == SHAPE_BOX)
+            {
+                // In a fixed order, whichever way round the broadphase
+                // found them, so the same pair makes the same features.
+                if(one.index < two.index)
+                {
+                    used += boxAndBox(boxes[one.index], boxes[two.index], data);
+                }
+                else
+                {
+                    used += boxAndBox(boxes[two.index], boxes[one.index], data);
+                }
+            }
+            else if(one.type == SHAPE_BOX && two.type == SHAPE_SPHERE)
+            {
+                used += boxAndSphere(boxes[one.index], spheres[two.index], data);
+            }
+            else if(one.type == SHAPE_SPHERE && two.type == SHAPE_BOX)
+            {
+                used += boxAndSphere(boxes[two.index], spheres[one.index], data);
+            }
+            else if(one.type == SHAPE_SPHERE && two.type == SHAPE_SPHERE)
+            {
+                used += sphereAndSphere(spheres[one.index], spheres[two.index], data);
+            }
+        }
+        return used;
+    }
+}
@@ -1,7 +1,13 @@
 #ifndef PHY_COLLIDE_FINE_H
 #define PHY_COLLIDE_FINE_H
 
+#include <cstddef>
+#include <vector>
 #include "contacts.h"
+#include "contact_buffer.h"
+#include "collide_coarse.h"
+#include "heightfield.h"
+#include "trimesh.h"
 
 namespace Phy
 {
@@ -74,6 +80,7 @@ namespace Phy
      */
     class IntersectionTests
     {
+    public:
         static bool sphereAndHalfSpace(const CollisionSphere &sphere, const CollisionPlane &plane);
         static bool sphereAndSphere(const CollisionSphere &one, const CollisionSphere &two);
         static bool boxAndBox(const CollisionBox &one, const CollisionBox &two);
@@ -83,10 +90,19 @@ namespace Phy
     /*
      * A halper structure that contains information foe thw detector to use
      * in building its contact data.
+     *
+     * The contacts go either into a fixed array, which drops what does
+     * not fit, or into a ContactBuffer, which grows. With a buffer,
+     * hasMoreContacts makes sure the run being filled has room for the
+     * most contacts a single test writes, so call it before each test.
      */
     struct CollisionData
     {
+        // The most contacts any one of the detector's tests writes.
+        static const unsigned MAX_CONTACTS_PER_TEST = 8;
+
         Contact *contactArray;
+        ContactBuffer<Contact> *buffer;
         Contact *contacts;
         int contactsLeft;
         unsigned contactCount;
@@ -94,26 +110,71 @@ namespace Phy
         real restitution;
         real tolerance;
 
+        // The triangles a mesh test found, kept to avoid reallocating.
+        std::vector<unsigned> triangles;
+
+        CollisionData()
+            : contactArray(NULL), buffer(NULL), contacts(NULL),
+              contactsLeft(0), contactCount(0)
+        {
+        }
+
         bool hasMoreContacts()
         {
+            if(buffer && contactsLeft < (int)MAX_CONTACTS_PER_TEST)
+            {
+                unsigned available;
+                contacts = buffer->reserve(MAX_CONTACTS_PER_TEST, &available);
+                contactsLeft = (int)available;
+            }
             return contactsLeft > 0;
         }
 
+        // Starts filling the contact array again, up to the given size.
         void reset(unsigned maxContacts)
         {
+            buffer = NULL;
             contactsLeft = maxContacts;
             contactCount = 0;
             contacts = contactArray;
         }
 
+        // Starts filling the given buffer, emptying it.
+        void reset(ContactBuffer<Contact> *contactBuffer)
+        {
+            unsigned available;
+            buffer = contactBuffer;
+            buffer->reset();
+            contacts = buffer->reserve(MAX_CONTACTS_PER_TEST, &available);
+            contactsLeft = (int)available;
+            contactCount = 0;
+        }
+
         void addContacts(unsigned count)
         {
+            if(buffer) buffer->commit(count);
             contactsLeft -= count;
             contactCount += count;
             contacts += count;
         }
     };
 
+    // The kinds of primitive the batch tests can be given.
+    enum CollisionShapeType
+    {
+        SHAPE_NONE = 0,
+        SHAPE_SPHERE,
+        SHAPE_BOX
+    };
+
+    /* Names the primitive of a body: its kind, and its index into the
+     * array of primitives of that kind. */
+    struct CollisionShape
+    {
+        CollisionShapeType type;
+        unsigned index;
+    };
+
     /*
      * A wrapper class that holds the fine grained collision detection
      * routines.
@@ -147,6 +208,42 @@ namespace Phy
                                      const CollisionSphere &sphere,
                                      CollisionData *data);
 
+        /* Test a primitive against a heightfield, looking only at the
+         * cells under it, and only if a tile under it reaches up to
+         * it. A sphere gets one contact, with the nearest point of the
+         * terrain; a box gets one for each vertex below the surface.
+         */
+        static unsigned sphereAndHeightField(const CollisionSphere &sphere,
+                                             const HeightField &field,
+                                             CollisionData *data);
+        static unsigned boxAndHeightField(const CollisionBox &box,
+                                          const HeightField &field,
+                                          CollisionData *data);
+
+        /* Test a sphere against the triangles of a static mesh the
+         * mesh's tree finds under it. Each triangle the sphere reaches
+         * gives a contact at its nearest point, tagged with the
+         * triangle as its feature, except that contacts along the same
+         * normal, as on either side of an edge of a flat floor, are
+         * merged into the deepest. */
+        static unsigned sphereAndTriangleMesh(const CollisionSphere &sphere,
+                                              const TriangleMesh &mesh,
+                                              CollisionData *data);
+
+        /*
+         * Runs the test for each of the given pairs of bodies, as found
+         * by a broadphase, until the contact data is full. The shape of
+         * a body is shapes[body - bodies], naming a primitive in the
+         * spheres or boxes arrays. Pairs of two sleeping bodies, and
+         * bodies without a shape, are skipped. Returns the number of
+         * contacts written.
+         */
+        static unsigned collidePairs(const PotentialContact *pairs, unsigned numPairs,
+                                     const RigidBody *bodies, const CollisionShape *shapes,
+                                     const CollisionSphere *spheres,
+                                     const CollisionBox *boxes,
+                                     CollisionData *data);
+
     };
 
 }
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include "collide_sap.h"
+#include "profile.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    static inline real component(const Vector3 &vector, unsigned axis)
+    {
+        return (&vector.x)[axis];
+    }
+
+    SweepAndPrune::SweepAndPrune(unsigned capacity)
+        : axis(0), added(0)
+    {
+        proxies.reserve(capacity);
+        intervals.reserve(capacity);
+    }
+
+    unsigned SweepAndPrune::insert(RigidBody *body, const BoundingBox &volume)
+    {
+        Assert(body != NULL);
+
+        Proxy newProxy = { volume, body };
+        unsigned proxy;
+        if(!freeProxies.empty())
+        {
+            proxy = freeProxies.back();
+            freeProxies.pop_back();
+            proxies[proxy] = newProxy;
+        }
+        else
+        {
+            proxy = (unsigned)proxies.size();
+            proxies.push_back(newProxy);
+        }
+
+        // The interval's extent is filled in by the next sort.
+        Interval interval;
+        interval.proxy = proxy;
+        intervals.push_back(interval);
+        added++;
+
+        return proxy;
+    }
+
+    void SweepAndPrune::remove(unsigned proxy)
+    {
+        Assert(proxies[proxy].body != NULL);
+        proxies[proxy].body = NULL;
+        removedProxies.push_back(proxy);
+    }
+
+    void SweepAndPrune::update(unsigned proxy, const BoundingBox &volume)
+    {
+        proxies[proxy].volume = volume;
+    }
+
+    void SweepAndPrune::sort()
+    {
+        // Drop the intervals of removed bodies and refresh the rest.
+        unsigned live = 0;
+        for(unsigned i = 0; i < intervals.size(); i++)
+        {
+            Interval interval = intervals[i];
+            const Proxy &proxy = proxies[interval.proxy];
+            if(proxy.body == NULL) continue;
+
+            interval.min = component(proxy.volume.minimum, axis);
+            interval.max = component(proxy.volume.maximum, axis);
+            intervals[live++] = interval;
+        }
+        intervals.resize(live);
+
+        freeProxies.insert(freeProxies.end(), removedProxies.begin(), removedProxies.end());
+        removedProxies.clear();
+
+        // Many new intervals at the end would make the insertion sort
+        // quadratic, so sort those frames from scratch.
+        if(added * 4 > live)
+        {
+            std::sort(intervals.begin(), intervals.end());
+        }
+        else
+        {
+            for(unsigned i = 1; i < live; i++)
+            {
+                Interval interval = intervals[i];
+                unsigned j = i;
+                while(j > 0 && interval.min < intervals[j-1].min)
+                {
+                    intervals[j] = intervals[j-1];
+                    j--;
+                }
+                intervals[j] = interval;
+            }
+        }
+        added = 0;
+    }
+
+    unsigned SweepAndPrune::getPotentialContacts(PotentialContact *contacts, unsigned limit)
+    {
+        PHY_PROFILE_SCOPE("SweepAndPrune::getPotentialContacts");
+        sort();
+
+        unsigned count = 0;
+        unsigned n = (unsigned)intervals.size();
+        for(unsigned i = 0; i < n && count < limit; i++)
+        {
+            const Interval &a = intervals[i];
+            const Proxy &proxyA = proxies[a.proxy];
+
+            // Only the intervals that start before this one ends can
+            // overlap it along the sort axis.
+            for(unsigned j = i + 1; j < n && intervals[j].min <= a.max; j++)
+            {
+                const Proxy &proxyB = proxies[intervals[j].proxy];
+                if(!proxyA.volume.overlaps(&proxyB.volume)) continue;
+
+                contacts[count].body[0] = proxyA.body;
+                contacts[count].body[1] = proxyB.body;
+                count++;
+                if(count == limit) break;
+            }
+        }
+        return count;
+    }
+
+    void SweepAndPrune::selectAxis()
+    {
+        Vector3 sum, sumSquares;
+        unsigned count = 0;
+        for(unsigned i = 0; i < proxies.size(); i++)
+        {
+            if(proxies[i].body == NULL) continue;
+
+            const BoundingBox &volume = proxies[i].volume;
+            Vector3 center = (volume.minimum + volume.maximum) * ((real)0.5);
+            sum += center;
+            sumSquares += Vector3(center.x*center.x, center.y*center.y, center.z*center.z);
+            count++;
+        }
+        if(count == 0) return;
+
+        // Variance along each axis, scaled by the count.
+        Vector3 variance = sumSquares - Vector3(sum.x*sum.x, sum.y*sum.y, sum.z*sum.z) *
+            (((real)1)/count);
+
+        unsigned best = 0;
+        if(variance.y > component(variance, best)) best = 1;
+        if(variance.z > component(variance, best)) best = 2;
+        setAxis(best);
+    }
+
+    void SweepAndPrune::setAxis(unsigned newAxis)
+    {
+        Assert(newAxis < 3);
+        if(newAxis == axis) return;
+
+        axis = newAxis;
+        // The current order is for another axis.
+        added = (unsigned)intervals.size();
+    }
+
+    unsigned SweepAndPrune::getAxis() const
+    {
+        return axis;
+    }
+
+    unsigned SweepAndPrune::getProxyCount() const
+    {
+        return (unsigned)(proxies.size() - freeProxies.size() - removedProxies.size());
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef PHY_COLLIDE_SAP_H
+#define PHY_COLLIDE_SAP_H
+
+#include <vector>
+#include "collide_coarse.h"
+
+namespace Phy
+{
+    /*
+     * A sweep and prune (sort and sweep) broadphase over bounding boxes.
+     * Each body's extent along one axis is kept in an array sorted by
+     * its minimum. A query re-sorts the array and then sweeps it,
+     * testing each box only against the boxes that start before it
+     * ends.
+     *
+     * The array is re-sorted with an insertion sort. When bodies move
+     * little between frames, the order from the last frame is almost
+     * right and the sort is close to linear. After many inserts, the
+     * array is sorted from scratch instead.
+     *
+     * The pairs are written in the same form as BVHNode and FlatBVH
+     * report them, so the broadphases can be swapped.
+     */
+    class SweepAndPrune
+    {
+    protected:
+        struct Proxy
+        {
+            BoundingBox volume;
+            // NULL for released proxies.
+            RigidBody *body;
+        };
+
+        // A body's extent along the sort axis.
+        struct Interval
+        {
+            real min;
+            real max;
+            unsigned proxy;
+
+            bool operator<(const Interval &other) const
+            {
+                return min < other.min;
+            }
+        };
+
+        std::vector<Proxy> proxies;
+        std::vector<unsigned> freeProxies;
+        /* Proxies removed since the last sort. Their intervals are still
+         * in the array, so they are not reused until the sort drops them. */
+        std::vector<unsigned> removedProxies;
+        std::vector<Interval> intervals;
+
+        unsigned axis;
+        // Intervals appended since the last sort.
+        unsigned added;
+
+        // Refreshes the intervals from the proxies and restores the order.
+        void sort();
+
+    public:
+        SweepAndPrune(unsigned capacity = 0);
+
+        /* Adds the given rigid body with the given bounding volume.
+         * Returns a proxy that stays valid until it is removed.
+         */
+        unsigned insert(RigidBody *body, const BoundingBox &volume);
+
+        void remove(unsigned proxy);
+
+        // Sets the bounding volume of the body at the given proxy.
+        void update(unsigned proxy, const BoundingBox &volume);
+
+        /* Checks the potential contacts between all the bodies, writing
+         * to the given array (up to the given limit). Returns the number
+         * of potential contacts it found.
+         */
+        unsigned getPotentialContacts(PotentialContact *contacts, unsigned limit);
+
+        /* Picks the axis along which the bodies' centers are most
+         * spread out, which keeps the number of overlapping intervals
+         * low. Changing axis means the next query sorts from scratch.
+         */
+        void selectAxis();
+
+        void setAxis(unsigned axis);
+        unsigned getAxis() const;
+
+        unsigned getProxyCount() const;
+    };
+}
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef PHY_CONTACT_BUFFER_H
+#define PHY_CONTACT_BUFFER_H
+
+#include <vector>
+
+namespace Phy
+{
+
+    /* A per-frame buffer of contacts that grows as it is filled,
+     * rather than dropping what does not fit in a fixed array.
+     *
+     * The contacts live in chunks. A generator is handed the free run
+     * of one chunk, and when that runs short the buffer moves on to a
+     * chunk with room, allocating one as large as everything before it
+     * if it has to, so the contacts already written never move while
+     * the frame's contacts are being generated. reset() only rewinds
+     * to the first chunk, keeping the memory for the next frame.
+     *
+     * The resolvers want one array, so gather() joins the chunks. A
+     * frame that stayed in the first chunk costs nothing; one that
+     * spilled is copied once into a single chunk big enough for it,
+     * which the following frames then fill in place. The buffer keeps
+     * the most contacts it has held at once, to size the first chunk
+     * from.
+     */
+    template<class ContactClass>
+    class ContactBuffer
+    {
+    protected:
+        struct Chunk
+        {
+            ContactClass *contacts;
+            unsigned capacity;
+            unsigned used;
+        };
+
+        std::vector<Chunk> chunks;
+
+        // The chunk being filled.
+        unsigned current;
+
+        // The contacts in all the chunks, and the most there have been.
+        unsigned count;
+        unsigned highWaterMark;
+
+        // The size of all the chunks together.
+        unsigned capacity;
+
+        void addChunk(unsigned size);
+        void releaseChunks();
+
+        // The buffer owns its chunks, so it can't be copied.
+        ContactBuffer(const ContactBuffer &);
+        ContactBuffer &operator=(const ContactBuffer &);
+
+    public:
+        ContactBuffer(unsigned initialCapacity = 256);
+        ~ContactBuffer();
+
+        // Empties the buffer for a new frame, keeping its chunks.
+        void reset();
+
+        /* Returns the free run of a chunk with room for at least the
+         * given number of contacts, and writes the size of the run to
+         * available. Nothing is added until commit is called, so a
+         * generator can be run again into a larger run if it filled
+         * this one. */
+        ContactClass *reserve(unsigned minimum, unsigned *available);
+
+        // Adds the given number of contacts written to the last reserved run.
+        void commit(unsigned used);
+
+        /* Returns the contacts as one array, in the order they were
+         * added. The array stays valid until the next reserve. */
+        ContactClass *gather();
+
+        unsigned getCount() const;
+        unsigned getHighWaterMark() const;
+        unsigned getCapacity() const;
+        unsigned getChunkCount() const;
+    };
+
+    template <class ContactClass>
+    ContactBuffer<ContactClass>::ContactBuffer(unsigned initialCapacity)
+        : current(0), count(0), highWaterMark(0), capacity(0)
+    {
+        addChunk(initialCapacity ? initialCapacity : 1);
+    }
+
+    template <class ContactClass>
+    ContactBuffer<ContactClass>::~ContactBuffer()
+    {
+        releaseChunks();
+    }
+
+    template <class ContactClass>
+    void ContactBuffer<ContactClass>::addChunk(unsigned size)
+    {
+        Chunk chunk;
+        chunk.contacts = new ContactClass[size];
+        chunk.capacity = size;
+        chunk.used = 0;
+        chunks.push_back(chunk);
+        capacity += size;
+    }
+
+    template <class ContactClass>
+    void ContactBuffer<ContactClass>::releaseChunks()
+    {
+        for(unsigned i = 0; i < chunks.size(); i++)
+        {
+            delete[] chunks[i].contacts;
+        }
+        chunks.clear();
+        capacity = 0;
+    }
+
+    template <class ContactClass>
+    void ContactBuffer<ContactClass>::reset()
+    {
+        // Later chunks are emptied as they are moved on to.
+        current = 0;
+        chunks[0].used = 0;
+        count = 0;
+    }
+
+    template <class ContactClass>
+    ContactClass *ContactBuffer<ContactClass>::reserve(unsigned minimum, unsigned *available)
+    {
+        if(chunks[current].capacity - chunks[current].used < minimum)
+        {
+            // Move on to the next chunk that is big enough, or make one
+            // as big as all the others, so the chunks stay few.
+            unsigned next = current + 1;
+            while(next < chunks.size() && chunks[next].capacity < minimum) next++;
+            if(next == chunks.size())
+            {
+                addChunk(capacity > minimum ? capacity : minimum);
+            }
+
+            // Any skipped chunks are left empty.
+            for(unsigned i = current + 1; i <= next; i++) chunks[i].used = 0;
+            current = next;
+        }
+
+        Chunk &chunk = chunks[current];
+        *available = chunk.capacity - chunk.used;
+        return chunk.contacts + chunk.used;
+    }
+
+    template <class ContactClass>
+    void ContactBuffer<ContactClass>::commit(unsigned used)
+    {
+        chunks[current].used += used;
+        count += used;
+        if(count > highWaterMark) highWaterMark = count;
+    }
+
+    template <class ContactClass>
+    ContactClass *ContactBuffer<ContactClass>::gather()
+    {
+        if(current == 0) return chunks[0].contacts;
+
+        // Join the chunks in use into one that can hold all of them.
+        ContactClass *joined = new ContactClass[capacity];
+        unsigned size = capacity;
+        unsigned written = 0;
+        for(unsigned i = 0; i <= current; i++)
+        {
+            for(unsigned j = 0; j < chunks[i].used; j++)
+            {
+                joined[written++] = chunks[i].contacts[j];
+            }
+        }
+
+        releaseChunks();
+        Chunk chunk = { joined, size, written };
+        chunks.push_back(chunk);
+        capacity = size;
+        current = 0;
+        return joined;
+    }
+
+    template <class ContactClass>
+    unsigned ContactBuffer<ContactClass>::getCount() const
+    {
+        return count;
+    }
+
+    template <class ContactClass>
+    unsigned ContactBuffer<ContactClass>::getHighWaterMark() const
+    {
+        return highWaterMark;
+    }
+
+    template <class ContactClass>
+    unsigned ContactBuffer<ContactClass>::getCapacity() const
+    {
+        return capacity;
+    }
+
+    template <class ContactClass>
+    unsigned ContactBuffer<ContactClass>::getChunkCount() const
+    {
+        return (unsigned)chunks.size();
+    }
+
+}
+
+#endif
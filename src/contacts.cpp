@@ -0,0 +1,957 @@
+#include <cstddef>
+#include <algorithm>
+#include "contacts.h"
+#include "profile.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    void Contact::setBodyData(RigidBody *one, RigidBody *two,
+                              real friction, real restitution)
+    {
+        Contact::body[0] = one;
+        Contact::body[1] = two;
+        Contact::friction = friction;
+        Contact::restitution = restitution;
+        feature = 0;
+        impulse.clear();
+    }
+
+    void Contact::matchAwakeState()
+    {
+        // Collisions with the world never cause a body to wake up.
+        if(!body[1]) return;
+
+        bool body0awake = body[0]->getAwake();
+        bool body1awake = body[1]->getAwake();
+
+        // Wake up only the sleeping one
+        if(body0awake ^ body1awake)
+        {
+            if(body0awake) body[1]->setAwake();
+            else body[0]->setAwake();
+        }
+    }
+
+    void Contact::swapBodies()
+    {
+        contactNormal *= -1;
+        impulse *= -1;
+
+        RigidBody *temp = body[0];
+        body[0] = body[1];
+        body[1] = temp;
+    }
+
+    void Contact::calculateContactBasis()
+    {
+        Vector3 contactTangent[2];
+
+        // Check whether the Z-axis is nearer to the X or Y axis
+        if(real_abs(contactNormal.x) > real_abs(contactNormal.y))
+        {
+            // Scaling factor to ensure the results are normalised
+            const real s = ((real)1.0)/real_sqrt(contactNormal.z*contactNormal.z +
+                                                 contactNormal.x*contactNormal.x);
+
+            // The new X-axis is at right angles to the world Y-axis
+            contactTangent[0].x = contactNormal.z*s;
+            contactTangent[0].y = 0;
+            contactTangent[0].z = -contactNormal.x*s;
+        }
+        else
+        {
+            // Scaling factor to ensure the results are normalised
+            const real s = ((real)1.0)/real_sqrt(contactNormal.z*contactNormal.z +
+                                                 contactNormal.y*contactNormal.y);
+
+            // The new X-axis is at right angles to the world X-axis
+            contactTangent[0].x = 0;
+            contactTangent[0].y = -contactNormal.z*s;
+            contactTangent[0].z = contactNormal.y*s;
+        }
+
+        // The new Y-axis is at right angles to the new X- and Z- axes
+        contactTangent[1] = contactNormal % contactTangent[0];
+
+        // Make a matrix from the three vectors.
+        contactToWorld.setComponents(contactNormal, contactTangent[0], contactTangent[1]);
+    }
+
+    Vector3 Contact::calculateLocalVelocity(unsigned bodyIndex, real duration)
+    {
+        RigidBody *thisBody = body[bodyIndex];
+
+        // Work out the velocity of the contact point.
+        Vector3 velocity = thisBody->getRotation() % relativeContactPosition[bodyIndex];
+        velocity += thisBody->getVelocity();
+
+        // Turn the velocity into contact-coordinates.
+        Vector3 contactVelocity = contactToWorld.transformTranspose(velocity);
+
+        // Calculate the ammount of velocity that is due to forces without reactions.
+        Vector3 accVelocity = thisBody->getLastFrameAcceleration() * duration;
+
+        // Calculate the velocity in contact-coordinates.
+        accVelocity = contactToWorld.transformTranspose(accVelocity);
+
+        // We ignore any component of acceleration in the contact normal
+        // direction, we are only interested in planar acceleration
+        accVelocity.x = 0;
+
+        // Add the planar velocities - if there's enough friction they will
+        // be removed during velocity resolution
+        contactVelocity += accVelocity;
+
+        return contactVelocity;
+    }
+
+    void Contact::calculateDesiredDeltaVelocity(real duration)
+    {
+        const static real velocityLimit = (real)0.25;
+
+        // Calculate the acceleration induced velocity accumulated this frame
+        real velocityFromAcc = 0;
+
+        if(body[0]->getAwake())
+        {
+            velocityFromAcc += body[0]->getLastFrameAcceleration() * contactNormal * duration;
+        }
+
+        if(body[1] && body[1]->getAwake())
+        {
+            velocityFromAcc -= body[1]->getLastFrameAcceleration() * contactNormal * duration;
+        }
+
+        // If the velocity is very slow, limit the restitution
+        real thisRestitution = restitution;
+        if(real_abs(contactVelocity.x) < velocityLimit)
+        {
+            thisRestitution = (real)0.0;
+        }
+
+        // Combine the bounce velocity with the removed
+        // acceleration velocity.
+        desiredDeltaVelocity = -contactVelocity.x -
+            thisRestitution * (contactVelocity.x - velocityFromAcc);
+    }
+
+    void Contact::calculateInternals(real duration)
+    {
+        // Check if the first object is NULL, and swap if it is.
+        if(!body[0]) swapBodies();
+        Assert(body[0]);
+
+        // Calculate an set of axis at the contact point.
+        calculateContactBasis();
+
+        // Store the relative position of the contact relative to each body
+        relativeContactPosition[0] = contactPoint - body[0]->getPosition();
+        if(body[1])
+        {
+            relativeContactPosition[1] = contactPoint - body[1]->getPosition();
+        }
+
+        // Find the relative velocity of the bodies at the contact point.
+        contactVelocity = calculateLocalVelocity(0, duration);
+        if(body[1])
+        {
+            contactVelocity -= calculateLocalVelocity(1, duration);
+        }
+
+        // Calculate the desired change in velocity for resolution
+        calculateDesiredDeltaVelocity(duration);
+    }
+
+    void Contact::applyVelocityChange(Vector3 velocityChange[2],
+                                      Vector3 rotationChange[2])
+    {
+        // Get hold of the inverse mass and inverse inertia tensor, both in
+        // world coordinates.
+        Matrix3 inverseInertiaTensor[2];
+        body[0]->getInverseInertiaTensorWorld(&inverseInertiaTensor[0]);
+        if(body[1])
+        {
+            body[1]->getInverseInertiaTensorWorld(&inverseInertiaTensor[1]);
+        }
+
+        // We will calculate the impulse for each contact axis
+        Vector3 impulseContact;
+
+        if(friction == (real)0.0)
+        {
+            // Use the short format for frictionless contacts
+            impulseContact = calculateFrictionlessImpulse(inverseInertiaTensor);
+        }
+        else
+        {
+            // Otherwise we may have impulses that aren't in the direction of the
+            // contact, so we need the more complex version.
+            impulseContact = calculateFrictionImpulse(inverseInertiaTensor);
+        }
+
+        // Convert impulse to world coordinates
+        Vector3 worldImpulse = contactToWorld.transform(impulseContact);
+        impulse += worldImpulse;
+        applyImpulse(worldImpulse, inverseInertiaTensor, velocityChange, rotationChange);
+    }
+
+    void Contact::applyImpulse(const Vector3 &impulse, Matrix3 *inverseInertiaTensor,
+                               Vector3 velocityChange[2], Vector3 rotationChange[2])
+    {
+        // Split in the impulse into linear and rotational components
+        Vector3 impulsiveTorque = relativeContactPosition[0] % impulse;
+        rotationChange[0] = inverseInertiaTensor[0].transform(impulsiveTorque);
+        velocityChange[0].clear();
+        velocityChange[0].addScaledVector(impulse, body[0]->getInverseMass());
+
+        // Apply the changes
+        body[0]->addVelocity(velocityChange[0]);
+        body[0]->addRotation(rotationChange[0]);
+
+        if(body[1])
+        {
+            // Work out body one's linear and angular changes
+            Vector3 impulsiveTorque = impulse % relativeContactPosition[1];
+            rotationChange[1] = inverseInertiaTensor[1].transform(impulsiveTorque);
+            velocityChange[1].clear();
+            velocityChange[1].addScaledVector(impulse, -body[1]->getInverseMass());
+
+            // And apply them.
+            body[1]->addVelocity(velocityChange[1]);
+            body[1]->addRotation(rotationChange[1]);
+        }
+    }
+
+    Vector3 Contact::calculateFrictionlessImpulse(Matrix3 *inverseInertiaTensor)
+    {
+        Vector3 impulseContact;
+
+        // Build a vector that shows the change in velocity in
+        // world space for a unit impulse in the direction of the contact
+        // normal.
+        Vector3 deltaVelWorld = relativeContactPosition[0] % contactNormal;
+        deltaVelWorld = inverseInertiaTensor[0].transform(deltaVelWorld);
+        deltaVelWorld = deltaVelWorld % relativeContactPosition[0];
+
+        // Work out the change in velocity in contact coordiantes.
+        real deltaVelocity = deltaVelWorld * contactNormal;
+
+        // Add the linear component of velocity change
+        deltaVelocity += body[0]->getInverseMass();
+
+        // Check if we need to the second body's data
+        if(body[1])
+        {
+            // Go through the same transformation sequence again
+            Vector3 deltaVelWorld = relativeContactPosition[1] % contactNormal;
+            deltaVelWorld = inverseInertiaTensor[1].transform(deltaVelWorld);
+            deltaVelWorld = deltaVelWorld % relativeContactPosition[1];
+
+            // Add the change in velocity due to rotation
+            deltaVelocity += deltaVelWorld * contactNormal;
+
+            // Add the change in velocity due to linear motion
+            deltaVelocity += body[1]->getInverseMass();
+        }
+
+        // Calculate the required size of the impulse
+        impulseContact.x = desiredDeltaVelocity / deltaVelocity;
+        impulseContact.y = 0;
+        impulseContact.z = 0;
+        return impulseContact;
+    }
+
+    Vector3 Contact::calculateFrictionImpulse(Matrix3 *inverseInertiaTensor)
+    {
+        Vector3 impulseContact;
+        real inverseMass = body[0]->getInverseMass();
+
+        // The equivalent of a cross product in matrices is multiplication
+        // by a skew symmetric matrix - we build the matrix for converting
+        // between linear and angular quantities.
+        Matrix3 impulseToTorque;
+        impulseToTorque.setSkewSymmetric(relativeContactPosition[0]);
+
+        // Build the matrix to convert contact impulse to change in velocity
+        // in world coordinates.
+        Matrix3 deltaVelWorld = impulseToTorque;
+        deltaVelWorld *= inverseInertiaTensor[0];
+        deltaVelWorld *= impulseToTorque;
+        deltaVelWorld *= (real)-1;
+
+        // Check if we need to add body two's data
+        if(body[1])
+        {
+            // Set the cross product matrix
+            impulseToTorque.setSkewSymmetric(relativeContactPosition[1]);
+
+            // Calculate the velocity change matrix
+            Matrix3 deltaVelWorld2 = impulseToTorque;
+            deltaVelWorld2 *= inverseInertiaTensor[1];
+            deltaVelWorld2 *= impulseToTorque;
+            deltaVelWorld2 *= (real)-1;
+
+            // Add to the total delta velocity.
+            deltaVelWorld += deltaVelWorld2;
+
+            // Add to the inverse mass
+            inverseMass += body[1]->getInverseMass();
+        }
+
+        // Do a change of basis to convert into contact coordinates.
+        Matrix3 deltaVelocity = contactToWorld.transpose();
+        deltaVelocity *= deltaVelWorld;
+        deltaVelocity *= contactToWorld;
+
+        // Add in the linear velocity change
+        deltaVelocity.data[0] += inverseMass;
+        deltaVelocity.data[4] += inverseMass;
+        deltaVelocity.data[8] += inverseMass;
+
+        // Invert to get the impulse needed per unit velocity
+        Matrix3 impulseMatrix = deltaVelocity.inverse();
+
+        // Find the target velocities to kill
+        Vector3 velKill(desiredDeltaVelocity,
+                        -contactVelocity.y,
+                        -contactVelocity.z);
+
+        // Find the impulse to kill target velocities
+        impulseContact = impulseMatrix.transform(velKill);
+
+        // Check for exceeding friction
+        real planarImpulse = real_sqrt(impulseContact.y*impulseContact.y +
+                                       impulseContact.z*impulseContact.z);
+        if(planarImpulse > impulseContact.x * friction)
+        {
+            // We need to use dynamic friction
+            impulseContact.y /= planarImpulse;
+            impulseContact.z /= planarImpulse;
+
+            impulseContact.x = deltaVelocity.data[0] +
+                deltaVelocity.data[1]*friction*impulseContact.y +
+                deltaVelocity.data[2]*friction*impulseContact.z;
+            impulseContact.x = desiredDeltaVelocity / impulseContact.x;
+            impulseContact.y *= friction * impulseContact.x;
+            impulseContact.z *= friction * impulseContact.x;
+        }
+        return impulseContact;
+    }
+
+    void Contact::applyPositionChange(Vector3 linearChange[2],
+                                      Vector3 angularChange[2],
+                                      real penetration)
+    {
+        const real angularLimit = (real)0.2;
+        real angularMove[2];
+        real linearMove[2];
+
+        real totalInertia = 0;
+        real linearInertia[2];
+        real angularInertia[2];
+
+        // We need to work out the inertia of each object in the direction
+        // of the contact normal, due to angular inertia only.
+        for(unsigned i = 0; i < 2; i++) if(body[i])
+        {
+            Matrix3 inverseInertiaTensor;
+            body[i]->getInverseInertiaTensorWorld(&inverseInertiaTensor);
+
+            // Use the same procedure as for calculating frictionless
+            // velocity change to work out the angular inertia.
+            Vector3 angularInertiaWorld = relativeContactPosition[i] % contactNormal;
+            angularInertiaWorld = inverseInertiaTensor.transform(angularInertiaWorld);
+            angularInertiaWorld = angularInertiaWorld % relativeContactPosition[i];
+            angularInertia[i] = angularInertiaWorld * contactNormal;
+
+            // The linear component is simply the inverse mass
+            linearInertia[i] = body[i]->getInverseMass();
+
+            // Keep track of the total inertia from all components
+            totalInertia += linearInertia[i] + angularInertia[i];
+        }
+
+        // Two immovable bodies cannot be separated.
+        if(totalInertia <= 0)
+        {
+            for(unsigned i = 0; i < 2; i++)
+            {
+                linearChange[i].clear();
+                angularChange[i].clear();
+            }
+            return;
+        }
+
+        // Loop through again calculating and applying the changes
+        for(unsigned i = 0; i < 2; i++) if(body[i])
+        {
+            // The linear and angular movements required are in proportion to
+            // the two inverse inertias.
+            real sign = (i == 0) ? (real)1 : (real)-1;
+            angularMove[i] = sign * penetration * (angularInertia[i] / totalInertia);
+            linearMove[i] = sign * penetration * (linearInertia[i] / totalInertia);
+
+            // To avoid angular projections that are too great (when mass is large
+            // but inertia tensor is small) limit the angular move.
+            Vector3 projection = relativeContactPosition[i];
+            projection.addScaledVector(contactNormal,
+                                       -(relativeContactPosition[i] * contactNormal));
+
+            // Use the small angle approximation for the sine of the angle (i.e.
+            // the magnitude would be sine(angularLimit) * projection.magnitude
+            // but we approximate sine(angularLimit) to angularLimit).
+            real maxMagnitude = angularLimit * projection.magnitude();
+
+            if(angularMove[i] < -maxMagnitude)
+            {
+                real totalMove = angularMove[i] + linearMove[i];
+                angularMove[i] = -maxMagnitude;
+                linearMove[i] = totalMove - angularMove[i];
+            }
+            else if(angularMove[i] > maxMagnitude)
+            {
+                real totalMove = angularMove[i] + linearMove[i];
+                angularMove[i] = maxMagnitude;
+                linearMove[i] = totalMove - angularMove[i];
+            }
+
+            // We have the linear amount of movement required by turning
+            // the rigid body (in angularMove[i]). We now need to
+            // calculate the desired rotation to achieve that.
+            if(angularMove[i] == 0)
+            {
+                // Easy case - no angular movement means no rotation.
+                angularChange[i].clear();
+            }
+            else
+            {
+                // Work out the direction we'd like to rotate in.
+                Vector3 targetAngularDirection = relativeContactPosition[i] % contactNormal;
+
+                Matrix3 inverseInertiaTensor;
+                body[i]->getInverseInertiaTensorWorld(&inverseInertiaTensor);
+
+                // Work out the direction we'd need to rotate to achieve that
+                angularChange[i] = inverseInertiaTensor.transform(targetAngularDirection) *
+                    (angularMove[i] / angularInertia[i]);
+            }
+
+            // Velocity change is easier - it is just the linear movement
+            // along the contact normal.
+            linearChange[i] = contactNormal * linearMove[i];
+
+            // Now we can start to apply the values we've calculated.
+            // Apply the linear movement
+            Vector3 position = body[i]->getPosition();
+            position.addScaledVector(contactNormal, linearMove[i]);
+            body[i]->setPosition(position);
+
+            // And the change in orientation
+            Quaternion q = body[i]->getOrientation();
+            q.addScaledVector(angularChange[i], (real)1.0);
+            body[i]->setOrientation(q);
+
+            // Sleeping bodies are skipped by the batch derived data pass
+            // of the next integration, so update them now.
+            if(!body[i]->getAwake()) body[i]->calculateDerivedData();
+        }
+    }
+
+    ContactResolver::ContactResolver(unsigned iterations,
+                                     real velocityEpsilon,
+                                     real positionEpsilon)
+        : velocityIterationsUsed(0), positionIterationsUsed(0)
+    {
+        setIterations(iterations, iterations);
+        setEpsilon(velocityEpsilon, positionEpsilon);
+    }
+
+    ContactResolver::ContactResolver(unsigned velocityIterations,
+                                     unsigned positionIterations,
+                                     real velocityEpsilon,
+                                     real positionEpsilon)
+        : velocityIterationsUsed(0), positionIterationsUsed(0)
+    {
+        setIterations(velocityIterations, positionIterations);
+        setEpsilon(velocityEpsilon, positionEpsilon);
+    }
+
+    void ContactResolver::setIterations(unsigned iterations)
+    {
+        setIterations(iterations, iterations);
+    }
+
+    void ContactResolver::setIterations(unsigned velocityIterations,
+                                        unsigned positionIterations)
+    {
+        ContactResolver::velocityIterations = velocityIterations;
+        ContactResolver::positionIterations = positionIterations;
+    }
+
+    void ContactResolver::setVelocityIterations(unsigned velocityIterations)
+    {
+        ContactResolver::velocityIterations = velocityIterations;
+    }
+
+    void ContactResolver::setPositionIterations(unsigned positionIterations)
+    {
+        ContactResolver::positionIterations = positionIterations;
+    }
+
+    void ContactResolver::setEpsilon(real velocityEpsilon, real positionEpsilon)
+    {
+        ContactResolver::velocityEpsilon = velocityEpsilon;
+        ContactResolver::positionEpsilon = positionEpsilon;
+    }
+
+    unsigned ContactResolver::getVelocityIterationsUsed() const
+    {
+        return velocityIterationsUsed;
+    }
+
+    unsigned ContactResolver::getPositionIterationsUsed() const
+    {
+        return positionIterationsUsed;
+    }
+
+    void ContactResolver::resolveContacts(Contact *contacts, unsigned numContacts,
+                                          real duration)
+    {
+        PHY_PROFILE_SCOPE("ContactResolver::resolveContacts");
+        velocityIterationsUsed = 0;
+        positionIterationsUsed = 0;
+
+        // Make sure we have something to do.
+        if(numContacts == 0) return;
+
+        // Prepare the contacts for processing
+        prepareContacts(contacts, numContacts, duration);
+        buildBodyIndex(contacts, numContacts);
+
+        // Start from the impulses the contacts were given.
+        warmStart(contacts, numContacts, duration);
+
+        // Resolve the interpenetration problems with the contacts.
+        adjustPositions(contacts, numContacts);
+
+        // Resolve the velocity problems with the contacts.
+        adjustVelocities(contacts, numContacts, duration);
+
+        PHY_PROFILE_COUNTER("position iterations", positionIterationsUsed);
+        PHY_PROFILE_COUNTER("velocity iterations", velocityIterationsUsed);
+    }
+
+    void ContactResolver::prepareContacts(Contact *contacts, unsigned numContacts,
+                                          real duration)
+    {
+        // Generate contact velocity and axis information.
+        Contact *lastContact = contacts + numContacts;
+        for(Contact *contact = contacts; contact < lastContact; contact++)
+        {
+            // Calculate the internal contact data (inertia, basis, etc).
+            contact->calculateInternals(duration);
+        }
+    }
+
+    void ContactResolver::buildBodyIndex(const Contact *contacts, unsigned numContacts)
+    {
+        entries.clear();
+        for(unsigned i = 0; i < numContacts; i++)
+        {
+            for(unsigned b = 0; b < 2; b++) if(contacts[i].body[b])
+            {
+                BodyEntry entry = { contacts[i].body[b], i, b };
+                entries.push_back(entry);
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+
+        // Contact ends without a body get an empty run.
+        bodyStart.assign(numContacts*2, 0);
+        bodyEnd.assign(numContacts*2, 0);
+        unsigned run = 0;
+        for(unsigned k = 1; k <= entries.size(); k++)
+        {
+            if(k < entries.size() && entries[k].body == entries[run].body) continue;
+
+            for(unsigned e = run; e < k; e++)
+            {
+                unsigned end = entries[e].contact*2 + entries[e].end;
+                bodyStart[end] = run;
+                bodyEnd[end] = k;
+            }
+            run = k;
+        }
+    }
+
+    void ContactResolver::warmStart(Contact *c, unsigned numContacts,
+                                    real duration)
+    {
+        Vector3 velocityChange[2], rotationChange[2];
+        Matrix3 inverseInertiaTensor[2];
+
+        for(unsigned index = 0; index < numContacts; index++)
+        {
+            // A contact can only push its bodies apart.
+            if(c[index].impulse * c[index].contactNormal <= 0)
+            {
+                c[index].impulse.clear();
+                continue;
+            }
+
+            c[index].body[0]->getInverseInertiaTensorWorld(&inverseInertiaTensor[0]);
+            if(c[index].body[1])
+            {
+                c[index].body[1]->getInverseInertiaTensorWorld(&inverseInertiaTensor[1]);
+            }
+            c[index].applyImpulse(c[index].impulse, inverseInertiaTensor,
+                                  velocityChange, rotationChange);
+            updateVelocities(c, index, velocityChange, rotationChange, duration);
+        }
+    }
+
+    void ContactResolver::updateVelocities(Contact *c, unsigned index,
+                                           Vector3 velocityChange[2],
+                                           Vector3 rotationChange[2],
+                                           real duration)
+    {
+        Vector3 deltaVel;
+
+        // Only the contacts sharing a body with the given contact can
+        // have changed.
+        for(unsigned d = 0; d < 2; d++)
+        {
+            unsigned last = bodyEnd[index*2 + d];
+            for(unsigned k = bodyStart[index*2 + d]; k < last; k++)
+            {
+                unsigned i = entries[k].contact;
+                unsigned b = entries[k].end;
+
+                deltaVel = velocityChange[d] +
+                    rotationChange[d] % c[i].relativeContactPosition[b];
+
+                // The sign of the change is negative if we're dealing
+                // with the second body in a contact.
+                c[i].contactVelocity +=
+                    c[i].contactToWorld.transformTranspose(deltaVel) *
+                    (b ? (real)-1 : (real)1);
+                c[i].calculateDesiredDeltaVelocity(duration);
+            }
+        }
+    }
+
+    bool ContactResolver::comesBefore(unsigned a, unsigned b) const
+    {
+        // Ties go to the lower index, as they would in a scan.
+        if(keys[a] != keys[b]) return keys[a] > keys[b];
+        return a < b;
+    }
+
+    void ContactResolver::swapEntries(unsigned i, unsigned j)
+    {
+        unsigned a = heap[i];
+        unsigned b = heap[j];
+        heap[i] = b;
+        heap[j] = a;
+        heapPosition[b] = i;
+        heapPosition[a] = j;
+    }
+
+    void ContactResolver::siftUp(unsigned i)
+    {
+        while(i > 0)
+        {
+            unsigned up = (i - 1) / 2;
+            if(!comesBefore(heap[i], heap[up])) break;
+            swapEntries(i, up);
+            i = up;
+        }
+    }
+
+    void ContactResolver::siftDown(unsigned i)
+    {
+        unsigned size = (unsigned)heap.size();
+        for(;;)
+        {
+            unsigned best = i;
+            unsigned left = i*2 + 1;
+            unsigned right = left + 1;
+            if(left < size && comesBefore(heap[left], heap[best])) best = left;
+            if(right < size && comesBefore(heap[right], heap[best])) best = right;
+            if(best == i) break;
+            swapEntries(i, best);
+            i = best;
+        }
+    }
+
+    void ContactResolver::buildHeap(unsigned numContacts)
+    {
+        heap.resize(numContacts);
+        heapPosition.resize(numContacts);
+        for(unsigned i = 0; i < numContacts; i++)
+        {
+            heap[i] = i;
+            heapPosition[i] = i;
+        }
+        for(unsigned i = numContacts / 2; i > 0; i--)
+        {
+            siftDown(i - 1);
+        }
+    }
+
+    void ContactResolver::setKey(unsigned contact, real key)
+    {
+        keys[contact] = key;
+        siftUp(heapPosition[contact]);
+        siftDown(heapPosition[contact]);
+    }
+
+    void ContactResolver::adjustVelocities(Contact *c, unsigned numContacts,
+                                           real duration)
+    {
+        PHY_PROFILE_SCOPE("ContactResolver::adjustVelocities");
+        Vector3 velocityChange[2], rotationChange[2];
+
+        keys.resize(numContacts);
+        for(unsigned i = 0; i < numContacts; i++)
+        {
+            keys[i] = c[i].desiredDeltaVelocity;
+        }
+        buildHeap(numContacts);
+
+        // iteratively handle impacts in order of severity.
+        velocityIterationsUsed = 0;
+        while(velocityIterationsUsed < velocityIterations)
+        {
+            // Take the contact with maximum magnitude of probable velocity change.
+            unsigned index = heap[0];
+            if(!(keys[index] > velocityEpsilon)) break;
+
+            // Match the awake state at the contact
+            c[index].matchAwakeState();
+
+            // Do the resolution on the contact that came out top.
+            c[index].applyVelocityChange(velocityChange, rotationChange);
+
+            // With the change in velocity of the two bodies, the update of
+            // contact velocities means that some of the relative closing
+            // velocities need recomputing.
+            updateVelocities(c, index, velocityChange, rotationChange, duration);
+            for(unsigned d = 0; d < 2; d++)
+            {
+                unsigned last = bodyEnd[index*2 + d];
+                for(unsigned k = bodyStart[index*2 + d]; k < last; k++)
+                {
+                    unsigned i = entries[k].contact;
+                    setKey(i, c[i].desiredDeltaVelocity);
+                }
+            }
+            velocityIterationsUsed++;
+        }
+    }
+
+    void ContactResolver::adjustPositions(Contact *c, unsigned numContacts)
+    {
+        PHY_PROFILE_SCOPE("ContactResolver::adjustPositions");
+        Vector3 linearChange[2], angularChange[2];
+        Vector3 deltaPosition;
+
+        keys.resize(numContacts);
+        for(unsigned i = 0; i < numContacts; i++)
+        {
+            keys[i] = c[i].penetration;
+        }
+        buildHeap(numContacts);
+
+        // iteratively resolve interpenetrations in order of severity.
+        positionIterationsUsed = 0;
+        while(positionIterationsUsed < positionIterations)
+        {
+            // Take the biggest penetration
+            unsigned index = heap[0];
+            real max = keys[index];
+            if(!(max > positionEpsilon)) break;
+
+            // Match the awake state at the contact
+            c[index].matchAwakeState();
+
+            // Resolve the penetration.
+            c[index].applyPositionChange(linearChange, angularChange, max);
+
+            // Again this action may have changed the penetration of the
+            // contacts sharing a body with it, so we update them.
+            for(unsigned d = 0; d < 2; d++)
+            {
+                unsigned last = bodyEnd[index*2 + d];
+                for(unsigned k = bodyStart[index*2 + d]; k < last; k++)
+                {
+                    unsigned i = entries[k].contact;
+                    unsigned b = entries[k].end;
+
+                    deltaPosition = linearChange[d] +
+                        angularChange[d] % c[i].relativeContactPosition[b];
+
+                    // The sign of the change is positive if we're
+                    // dealing with the second body in a contact
+                    // and negative otherwise (because we're
+                    // subtracting the resolution)..
+                    c[i].penetration += (deltaPosition * c[i].contactNormal) *
+                        (b ? (real)1 : (real)-1);
+                    setKey(i, c[i].penetration);
+                }
+            }
+            positionIterationsUsed++;
+        }
+    }
+
+    ContactCache::ContactCache(real warmStartFactor, real matchDistance)
+    {
+        setWarmStartFactor(warmStartFactor);
+        setMatchDistance(matchDistance);
+    }
+
+    void ContactCache::setWarmStartFactor(real warmStartFactor)
+    {
+        ContactCache::warmStartFactor = warmStartFactor;
+    }
+
+    void ContactCache::setMatchDistance(real matchDistance)
+    {
+        ContactCache::matchDistance = matchDistance;
+    }
+
+    real ContactCache::makeKey(const Contact &contact, Point *key)
+    {
+        // Contacts with the scenery keep their body first.
+        bool swap = contact.body[1] &&
+            std::less<RigidBody*>()(contact.body[1], contact.body[0]);
+        key->body[0] = contact.body[swap ? 1 : 0];
+        key->body[1] = contact.body[swap ? 0 : 1];
+        key->feature = contact.feature;
+        return swap ? (real)-1 : (real)1;
+    }
+
+    unsigned ContactCache::warmStart(Contact *contacts, unsigned numContacts) const
+    {
+        PHY_PROFILE_SCOPE("ContactCache::warmStart");
+        if(points.empty()) return 0;
+
+        real matchDistanceSquared = matchDistance * matchDistance;
+        unsigned matched = 0;
+        for(unsigned i = 0; i < numContacts; i++)
+        {
+            Point key;
+            real sign = makeKey(contacts[i], &key);
+
+            std::vector<Point>::const_iterator point =
+                std::lower_bound(points.begin(), points.end(), key);
+            if(point == points.end() || key < *point) continue;
+
+            // A point that has slid too far is a different contact now.
+            Vector3 moved = contacts[i].contactPoint - point->contactPoint;
+            if(moved.squareMagnitude() > matchDistanceSquared) continue;
+
+            contacts[i].impulse = point->impulse * (sign * warmStartFactor);
+            matched++;
+        }
+
+        PHY_PROFILE_COUNTER("warm started contacts", matched);
+        return matched;
+    }
+
+    void ContactCache::store(const Contact *contacts, unsigned numContacts)
+    {
+        PHY_PROFILE_SCOPE("ContactCache::store");
+
+        // Everything from the last frame goes, so stale points cost
+        // nothing to drop.
+        nextPoints.resize(numContacts);
+        for(unsigned i = 0; i < numContacts; i++)
+        {
+            Point &point = nextPoints[i];
+            real sign = makeKey(contacts[i], &point);
+            point.contactPoint = contacts[i].contactPoint;
+            point.impulse = contacts[i].impulse * sign;
+        }
+        std::sort(nextPoints.begin(), nextPoints.end());
+        points.swap(nextPoints);
+    }
+
+    void ContactCache::clear()
+    {
+        points.clear();
+    }
+
+    unsigned ContactCache::getSize() const
+    {
+        return (unsigned)points.size();
+    }
+
+    // Written for the missing body of a contact with the scenery.
+    static const unsigned NO_BODY = 0xffffffff;
+
+    // The bodies and feature, then the contact point and impulse.
+    static const unsigned POINT_STATE_UNSIGNEDS = 3;
+    static const unsigned POINT_STATE_REALS = 6;
+
+    bool ContactCache::saveState(Snapshot *snapshot, const RigidBody *bodies, unsigned count) const
+    {
+        snapshot->writeUnsigned((unsigned)points.size());
+        for(unsigned i = 0; i < points.size(); i++)
+        {
+            const Point &point = points[i];
+            unsigned keys[POINT_STATE_UNSIGNEDS] = { NO_BODY, NO_BODY, point.feature };
+            for(unsigned b = 0; b < 2; b++)
+            {
+                if(!point.body[b]) continue;
+                if(point.body[b] < bodies || point.body[b] >= bodies + count) return false;
+                keys[b] = (unsigned)(point.body[b] - bodies);
+            }
+            real values[POINT_STATE_REALS] = {
+                point.contactPoint.x, point.contactPoint.y, point.contactPoint.z,
+                point.impulse.x, point.impulse.y, point.impulse.z
+            };
+            snapshot->write(keys, sizeof(keys));
+            snapshot->write(values, sizeof(values));
+        }
+        return true;
+    }
+
+    bool ContactCache::restoreState(SnapshotReader *reader, RigidBody *bodies, unsigned count)
+    {
+        unsigned size = reader->readUnsigned();
+        if(reader->getFailed()) return false;
+
+        // The bodies are in the same array as when saved, so the
+        // points come back in the same, sorted, order.
+        points.resize(size);
+        for(unsigned i = 0; i < size; i++)
+        {
+            unsigned keys[POINT_STATE_UNSIGNEDS];
+            real values[POINT_STATE_REALS];
+            if(!reader->read(keys, sizeof(keys)) || !reader->read(values, sizeof(values)))
+            {
+                points.clear();
+                return false;
+            }
+
+            Point &point = points[i];
+            for(unsigned b = 0; b < 2; b++)
+            {
+                if(keys[b] == NO_BODY) point.body[b] = NULL;
+                else if(keys[b] < count) point.body[b] = bodies + keys[b];
+                else
+                {
+                    points.clear();
+                    return false;
+                }
+            }
+            point.feature = keys[2];
+            point.contactPoint = Vector3(values[0], values[1], values[2]);
+            point.impulse = Vector3(values[3], values[4], values[5]);
+        }
+        return true;
+    }
+}
@@ -1,19 +1,335 @@
 #ifndef PHY_CONTACTS_H
 #define PHY_CONTACTS_H
 
+#include <vector>
+#include <functional>
 #include "body.h"
+#include "snapshot.h"
 
 namespace Phy
 {
+    class ContactResolver;
 
+    /*
+     * A contact represents two bodies in contact. Resolving a contact
+     * removes their interpenetration, and applies sufficient impulse to
+     * keep them apart. Colliding bodies may also rebound. Contacts can
+     * be used to represent positional joints, by making the contact
+     * constraint keep the bodies in their correct orientation.
+     *
+     * The contact has no callable functions, it just holds the contact
+     * details. To resolve a set of contacts, use the contact resolver.
+     */
     class Contact
     {
+        // The resolver needs access to the data set in calculateInternals.
+        friend class ContactResolver;
+    public:
+        /* Holds the bodies that are involved in the contact. The
+         * second of these can be NULL, for contacts with the scenery.
+         */
+        RigidBody *body[2];
+
+        // Holds the lateral friction coefficient at the contact.
+        real friction;
+
+        // Holds the normal restitution coefficient at the contact.
+        real restitution;
+
         // Hold the position of the contact in world coordinate
         Vector3 contactPoint;
-        // Hold the direction of the contact in world coordinate
+        /* Hold the direction of the contact in world coordinate. It
+         * points from the second body towards the first. */
         Vector3 contactNormal;
         // Hold the penetration at the contact point
         real penetration;
+
+        /* Identifies the features of the two shapes that made the
+         * contact (a vertex, a clipped edge, a pair of edges), so the
+         * same contact can be recognised in the next frame. */
+        unsigned feature;
+
+        /* The impulse applied to the first body at the contact, in
+         * world coordinates. A contact cache sets it before resolution
+         * to warm start the resolver, which then adds what it applies. */
+        Vector3 impulse;
+
+        /* Sets the data that doesn't normally depend on the position of
+         * the contact, and clears the feature and impulse. */
+        void setBodyData(RigidBody *one, RigidBody *two,
+                         real friction, real restitution);
+
+    protected:
+        /* A transform matrix that converts co-ordinates in the
+         * contact's frame of reference to world co-ordinates. The
+         * columns of this matrix form an orthonormal set of vectors.
+         */
+        Matrix3 contactToWorld;
+
+        // Holds the closing velocity at the point of contact.
+        Vector3 contactVelocity;
+
+        // Holds the required change in velocity for this contact to be resolved.
+        real desiredDeltaVelocity;
+
+        // Holds the world space position of the contact point relative to the center of each body.
+        Vector3 relativeContactPosition[2];
+
+        // Calculates internal data from state data.
+        void calculateInternals(real duration);
+
+        /* Reverses the contact. This involves swapping the two rigid
+         * bodies and reversing the contact normal. The internal values
+         * should then be recalculated using calculateInternals.
+         */
+        void swapBodies();
+
+        /* Updates the awake state of rigid bodies that are taking place
+         * in the given contact. A body will be made awake if it is in
+         * contact with a body that is awake.
+         */
+        void matchAwakeState();
+
+        // Calculates and sets the internal value for the desired delta velocity.
+        void calculateDesiredDeltaVelocity(real duration);
+
+        // Calculates and returns the velocity of the contact point on the given body.
+        Vector3 calculateLocalVelocity(unsigned bodyIndex, real duration);
+
+        /* Calculates an orthonormal basis for the contact point, based
+         * on the primary friction direction (for anisotropic friction)
+         * or a random orientation (for isotropic friction).
+         */
+        void calculateContactBasis();
+
+        // Performs an inertia-weighted impulse based resolution of this contact alone.
+        void applyVelocityChange(Vector3 velocityChange[2],
+                                 Vector3 rotationChange[2]);
+
+        // Applies the given world impulse to the bodies, returning the changes it made.
+        void applyImpulse(const Vector3 &impulse, Matrix3 *inverseInertiaTensor,
+                          Vector3 velocityChange[2], Vector3 rotationChange[2]);
+
+        // Performs an inertia weighted penetration resolution of this contact alone.
+        void applyPositionChange(Vector3 linearChange[2],
+                                 Vector3 angularChange[2],
+                                 real penetration);
+
+        // Calculates the impulse needed to resolve this contact, given that the contact has no friction.
+        Vector3 calculateFrictionlessImpulse(Matrix3 *inverseInertiaTensor);
+
+        // Calculates the impulse needed to resolve this contact, given that the contact has a non-zero coefficient of friction.
+        Vector3 calculateFrictionImpulse(Matrix3 *inverseInertiaTensor);
+    };
+
+    /*
+     * The contact resolution routine. One resolver instance can be
+     * shared for the whole simulation.
+     *
+     * Resolution runs in two passes. The position pass removes the
+     * interpenetration of the contacts, and then the velocity pass
+     * applies the impulses that stop them closing. Each iteration of a
+     * pass resolves the worst contact left, found from a heap, and
+     * updates the contacts that share a body with it. The number of iterations of each pass
+     * is limited separately: a pass stops at its limit, or sooner once
+     * no contact is worse than its epsilon.
+     */
+    class ContactResolver
+    {
+    protected:
+        // One end of a contact, filed under the body at that end.
+        struct BodyEntry
+        {
+            RigidBody *body;
+            unsigned contact;
+            unsigned end;
+
+            bool operator<(const BodyEntry &other) const
+            {
+                if(body != other.body)
+                {
+                    return std::less<RigidBody*>()(body, other.body);
+                }
+                return contact < other.contact;
+            }
+        };
+
+        /* The contact ends sorted by body, so that resolving a contact
+         * only updates the contacts sharing a body with it, rather than
+         * checking every contact. The entries of the body at end e of
+         * contact c are entries[bodyStart[c*2+e]] .. entries[bodyEnd[c*2+e]-1].
+         * Kept between frames to avoid reallocating.
+         */
+        std::vector<BodyEntry> entries;
+        std::vector<unsigned> bodyStart;
+        std::vector<unsigned> bodyEnd;
+
+        /* The contacts of a pass in an indexed binary heap, worst
+         * first, so each iteration finds the worst contact without
+         * checking every one. Ties go to the lower index, as in a scan
+         * of the array. Contact c is at heap[heapPosition[c]] and is
+         * ordered by keys[c]. Kept between frames to avoid reallocating.
+         */
+        std::vector<unsigned> heap;
+        std::vector<unsigned> heapPosition;
+        std::vector<real> keys;
+
+        unsigned velocityIterations;
+        unsigned positionIterations;
+
+        /* To avoid instability velocities smaller than this value are
+         * considered to be zero. Too small and the simulation may be
+         * unstable, too large and the bodies may interpenetrate
+         * visually. A good starting point is 0.01. */
+        real velocityEpsilon;
+
+        /* To avoid instability penetrations smaller than this value are
+         * considered to be not interpenetrating. A good starting point
+         * is 0.01. */
+        real positionEpsilon;
+
+        unsigned velocityIterationsUsed;
+        unsigned positionIterationsUsed;
+
+        // Sets up contacts ready for processing.
+        void prepareContacts(Contact *contactArray, unsigned numContacts,
+                             real duration);
+
+        // Files the ends of the prepared contacts under their bodies.
+        void buildBodyIndex(const Contact *contactArray, unsigned numContacts);
+
+        /* Applies the impulses the contacts start with, and updates the
+         * closing velocities of the contacts around them. */
+        void warmStart(Contact *contactArray, unsigned numContacts,
+                       real duration);
+
+        // Orders the first numContacts contacts by the keys already set.
+        void buildHeap(unsigned numContacts);
+        // Gives a contact a new key and moves it to its place in the heap.
+        void setKey(unsigned contact, real key);
+        bool comesBefore(unsigned a, unsigned b) const;
+        void swapEntries(unsigned i, unsigned j);
+        void siftUp(unsigned i);
+        void siftDown(unsigned i);
+
+        // Updates the contacts sharing a body with the given one after its bodies' velocities change.
+        void updateVelocities(Contact *contactArray, unsigned index,
+                              Vector3 velocityChange[2], Vector3 rotationChange[2],
+                              real duration);
+
+        // Resolves the velocity issues with the given array of constraints.
+        void adjustVelocities(Contact *contactArray, unsigned numContacts,
+                              real duration);
+
+        // Resolves the positional issues with the given array of constraints.
+        void adjustPositions(Contact *contactArray, unsigned numContacts);
+
+    public:
+        ContactResolver(unsigned iterations,
+                        real velocityEpsilon=(real)0.01,
+                        real positionEpsilon=(real)0.01);
+
+        ContactResolver(unsigned velocityIterations,
+                        unsigned positionIterations,
+                        real velocityEpsilon=(real)0.01,
+                        real positionEpsilon=(real)0.01);
+
+        // Sets the number of iterations of both passes.
+        void setIterations(unsigned iterations);
+        void setIterations(unsigned velocityIterations,
+                           unsigned positionIterations);
+        void setVelocityIterations(unsigned velocityIterations);
+        void setPositionIterations(unsigned positionIterations);
+        void setEpsilon(real velocityEpsilon, real positionEpsilon);
+
+        unsigned getVelocityIterationsUsed() const;
+        unsigned getPositionIterationsUsed() const;
+
+        /* Resolves a set of contacts for both penetration and velocity.
+         * Contacts that start with an impulse have it applied before
+         * the velocity pass. The bodies moved by the position pass are
+         * marked as needing their derived data recalculated.
+         */
+        void resolveContacts(Contact *contactArray, unsigned numContacts,
+                             real duration);
+    };
+
+    /*
+     * Keeps the contacts of one frame, keyed by the pair of bodies and
+     * the feature that made them, so that the impulses the resolver
+     * found for them can warm start the same contacts in the next
+     * frame. A resting contact then starts out nearly resolved, and
+     * stacks settle with a fraction of the resolver iterations.
+     *
+     * Only the contacts stored in the last frame are kept: a point that
+     * was not generated again is stale and is dropped with the rest of
+     * that frame, and one whose contact point has moved too far since
+     * is not matched.
+     */
+    class ContactCache
+    {
+    protected:
+        struct Point
+        {
+            RigidBody *body[2];
+            unsigned feature;
+            Vector3 contactPoint;
+            Vector3 impulse;
+
+            bool operator<(const Point &other) const
+            {
+                if(body[0] != other.body[0])
+                {
+                    return std::less<RigidBody*>()(body[0], other.body[0]);
+                }
+                if(body[1] != other.body[1])
+                {
+                    return std::less<RigidBody*>()(body[1], other.body[1]);
+                }
+                return feature < other.feature;
+            }
+        };
+
+        // The points of the last frame, sorted, and the buffer for the next.
+        std::vector<Point> points;
+        std::vector<Point> nextPoints;
+
+        // The share of the cached impulse a matched contact starts with.
+        real warmStartFactor;
+
+        // How far a contact point can move and still be matched.
+        real matchDistance;
+
+        /* Fills in the key of the given contact, with its bodies in a
+         * fixed order, and returns the sign its impulse takes in it. */
+        static real makeKey(const Contact &contact, Point *key);
+
+    public:
+        ContactCache(real warmStartFactor = (real)0.85,
+                     real matchDistance = (real)0.05);
+
+        void setWarmStartFactor(real warmStartFactor);
+        void setMatchDistance(real matchDistance);
+
+        /* Sets the impulse of each contact that matches one kept from
+         * the last frame, and returns how many matched. */
+        unsigned warmStart(Contact *contactArray, unsigned numContacts) const;
+
+        // Replaces the kept contacts with the given, resolved ones.
+        void store(const Contact *contactArray, unsigned numContacts);
+
+        // Forgets every kept contact.
+        void clear();
+
+        // Returns the number of contacts kept from the last frame.
+        unsigned getSize() const;
+
+        /* Writes the kept contacts to a snapshot, with their bodies as
+         * positions in the given array, and reads them back. Returns
+         * false if a body is not in the array or the snapshot doesn't
+         * hold what was expected. */
+        bool saveState(Snapshot *snapshot, const RigidBody *bodies, unsigned count) const;
+        bool restoreState(SnapshotReader *reader, RigidBody *bodies, unsigned count);
     };
 
 }
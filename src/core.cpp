@@ -2,7 +2,20 @@
 
 namespace Phy
 {
-    real Matrix4::getDeterminant() const
+    real sleepEpsilon = ((real)0.3);
+
+    void setSleepEpsilon(real value)
+    {
+        sleepEpsilon = value;
+    }
+
+    real getSleepEpsilon()
+    {
+        return sleepEpsilon;
+    }
+
+    template<class T>
+    T Matrix4T<T>::getDeterminant() const
     {
         return -data[8]*data[5]*data[2]+
             data[4]*data[9]*data[2]+
@@ -12,12 +25,13 @@ namespace Phy
             data[0]*data[5]*data[10];
     }
 
-    void Matrix4::setInverse(const Matrix4 &m)
+    template<class T>
+    void Matrix4T<T>::setInverse(const Matrix4T<T> &m)
     {
         // Make sure the determinant is non-zero.
-        real det = getDeterminant();
+        T det = getDeterminant();
         if (det == 0) return;
-        det = ((real)1.0)/det;
+        det = ((T)1.0)/det;
 
         data[0] = (-m.data[9]*m.data[6]+m.data[5]*m.data[10])*det;
         data[4] = (m.data[8]*m.data[6]-m.data[4]*m.data[10])*det;
@@ -51,4 +65,6 @@ namespace Phy
                    -m.data[0]*m.data[5]*m.data[11])*det;
     }
 
+    template class Matrix4T<float>;
+    template class Matrix4T<double>;
 }
@@ -4,23 +4,55 @@
 #define PHY_CORE_H
 
 #include "precision.h"
+#include "simd.h"
 
 namespace Phy
 {
+    /* Holds the value of the smoothed motion (squared linear plus
+     * angular speed) under which a body may be put to sleep. It is a
+     * single value for the whole simulation.
+     */
+    extern real sleepEpsilon;
 
-    class Vector3
+    void setSleepEpsilon(real value);
+    real getSleepEpsilon();
+
+    /*
+     * The core types are templated on their scalar type, so data kept
+     * at float precision can live next to data at double precision.
+     * Vector3, Quaternion, Matrix3 and Matrix4 (defined at the end of
+     * this file) are the types at the library's own precision, real;
+     * the f and d suffixed names fix the precision whatever real is.
+     */
+    template<class T>
+    class Vector3T
     {
     public:
-        real x;
-        real y;
-        real z;
+        T x;
+        T y;
+        T z;
     private:
-        real pad;
+        // Keeps the vector four lanes wide for SIMD. Always zero.
+        T pad;
     public:
-        Vector3() : x(0), y(0), z(0) {}
+        Vector3T() : x(0), y(0), z(0), pad(0) {}
+
+        Vector3T(const T x, const T y, const T z)
+            : x(x), y(y), z(z), pad(0) {}
 
-        Vector3(const real x, const real y, const real z)
-            : x(x), y(y), z(z) {}
+        T operator[](unsigned i) const
+        {
+            if(i == 0) return x;
+            if(i == 1) return y;
+            return z;
+        }
+
+        T& operator[](unsigned i)
+        {
+            if(i == 0) return x;
+            if(i == 1) return y;
+            return z;
+        }
 
         void clear()
         {
@@ -34,131 +66,208 @@ namespace Phy
             z = -z;
         }
 
-        real magnitude() const
+        T magnitude() const
         {
-            return real_sqrt(x*x+y*y+z*z);
+            return ScalarTraits<T>::sqrt(squareMagnitude());
         }
 
-        real squareMagnitude() const
+        T squareMagnitude() const
         {
+#ifdef PHY_SIMD_CORE
+            Packed4<T> v = Packed4<T>::load(&x);
+            return (v * v).sum3();
+#else
             return x*x+y*y+z*z;
+#endif
         }
 
         void normalize()
         {
-            real l = magnitude();
+            T l = magnitude();
             if(l > 0)
             {
-                (*this) *= ((real)1)/l;
+                (*this) *= ((T)1)/l;
             }
         }
 
-        void operator*=(const real value)
+#ifdef PHY_SIMD_CORE
+        // The SIMD versions of the arithmetic below.
+
+        Packed4<T> load() const
+        {
+            return Packed4<T>::load(&x);
+        }
+
+        static Vector3T<T> from(const Packed4<T> &lanes)
+        {
+            Vector3T<T> result;
+            lanes.store(&result.x);
+            return result;
+        }
+
+        void operator*=(const T value)
+        {
+            (load() * Packed4<T>::splat3(value)).store(&x);
+        }
+
+        Vector3T<T> operator*(const T value) const
+        {
+            return from(load() * Packed4<T>::splat3(value));
+        }
+
+        void operator+=(const Vector3T<T>& v)
+        {
+            (load() + v.load()).store(&x);
+        }
+
+        Vector3T<T> operator+(const Vector3T<T>& v) const
+        {
+            return from(load() + v.load());
+        }
+
+        void operator-=(const Vector3T<T>& v)
+        {
+            (load() - v.load()).store(&x);
+        }
+
+        Vector3T<T> operator-(const Vector3T<T>& v) const
+        {
+            return from(load() - v.load());
+        }
+
+        void addScaledVector(const Vector3T<T>& vector, T scale)
+        {
+            (load() + vector.load() * Packed4<T>::splat3(scale)).store(&x);
+        }
+
+        Vector3T<T> ComponentProduct(const Vector3T<T>& vector) const
+        {
+            return from(load() * vector.load());
+        }
+
+        void ComponentProduct(const Vector3T<T>& vector)
+        {
+            (load() * vector.load()).store(&x);
+        }
+
+        T ScalarProduct(const Vector3T<T>& vector) const
+        {
+            return (load() * vector.load()).sum3();
+        }
+
+        T operator*(const Vector3T<T>& vector) const
+        {
+            return (load() * vector.load()).sum3();
+        }
+#else
+        void operator*=(const T value)
         {
             x *= value;
             y *= value;
             z *= value;
         }
 
-        Vector3 operator*(const real value) const
+        Vector3T<T> operator*(const T value) const
         {
-            return Vector3(x*value, y*value, z*value);
+            return Vector3T<T>(x*value, y*value, z*value);
         }
 
-        void operator+=(const Vector3& v)
+        void operator+=(const Vector3T<T>& v)
         {
             x += v.x;
             y += v.y;
             z += v.z;
         }
 
-        Vector3 operator+(const Vector3& v) const
+        Vector3T<T> operator+(const Vector3T<T>& v) const
         {
-            return Vector3(x + v.x, y + v.y, z + v.z);
+            return Vector3T<T>(x + v.x, y + v.y, z + v.z);
         }
 
-        void operator-=(const Vector3& v)
+        void operator-=(const Vector3T<T>& v)
         {
             x -= v.x;
             y -= v.y;
             z -= v.z;
         }
 
-        Vector3 operator-(const Vector3& v) const
+        Vector3T<T> operator-(const Vector3T<T>& v) const
         {
-            return Vector3(x - v.x, y - v.y, z - v.z);
+            return Vector3T<T>(x - v.x, y - v.y, z - v.z);
         }
 
-        void addScaledVector(const Vector3& vector, real scale)
+        void addScaledVector(const Vector3T<T>& vector, T scale)
         {
             x += vector.x * scale;
             y += vector.y * scale;
             z += vector.z * scale;
         }
 
-        Vector3 ComponentProduct(const Vector3& vector) const
+        Vector3T<T> ComponentProduct(const Vector3T<T>& vector) const
         {
-            return Vector3(x * vector.x, y * vector.y, z * vector.z);
+            return Vector3T<T>(x * vector.x, y * vector.y, z * vector.z);
         }
 
-        void ComponentProduct(const Vector3& vector)
+        void ComponentProduct(const Vector3T<T>& vector)
         {
             x *= vector.x;
             y *= vector.y;
             z *= vector.z;
         }
 
-        real ScalarProduct(const Vector3& vector) const
+        T ScalarProduct(const Vector3T<T>& vector) const
         {
             return x*vector.x + y*vector.y + z*vector.z;
         }
 
-        real operator*(const Vector3& vector) const
+        T operator*(const Vector3T<T>& vector) const
         {
             return x*vector.x + y*vector.y + z*vector.z;
         }
+#endif
 
-        Vector3 vectorProduct(const Vector3& vector) const
+        Vector3T<T> vectorProduct(const Vector3T<T>& vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
+            return Vector3T<T>(y*vector.z-z*vector.y,
                            z*vector.x-x*vector.z,
                            x*vector.y-y*vector.x);
         }
 
-        void operator%=(const Vector3& vector)
+        void operator%=(const Vector3T<T>& vector)
         {
             (*this) = vectorProduct(vector);
         }
 
-        Vector3 operator%(const Vector3& vector) const
+        Vector3T<T> operator%(const Vector3T<T>& vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
+            return Vector3T<T>(y*vector.z-z*vector.y,
                            z*vector.x-x*vector.z,
                            x*vector.y-y*vector.x);
         }
 
     };
 
-    class Quaternion
+    template<class T>
+    class QuaternionT
     {
     public:
         union {
             struct {
-                real r, i, j, k;
+                T r, i, j, k;
             };
-            real data[4];
+            T data[4];
         };
 
-        Quaternion() : r(1), i(0), j(0), k(0) {}
+        QuaternionT() : r(1), i(0), j(0), k(0) {}
 
-        Quaternion(const real r, const real i, const real j, const real k)
+        QuaternionT(const T r, const T i, const T j, const T k)
             : r(r), i(i), j(j), k(k)
         {
         }
 
         void normalize()
         {
-            real d = r*r+i*i+j*j+k*k;
+            T d = r*r+i*i+j*j+k*k;
 
             // check for zero-length quaternion, and use the no-rotation
             // quaternion in that case.
@@ -168,16 +277,16 @@ namespace Phy
                 return;
             }
 
-            d = ((real)1.0)/real_sqrt(d);
+            d = ((T)1.0)/ScalarTraits<T>::sqrt(d);
             r *= d;
             i *= d;
             j *= d;
             k *= d;
         }
 
-        void operator *=(const Quaternion &multiplier)
+        void operator *=(const QuaternionT<T> &multiplier)
         {
-            Quaternion q = *this;
+            QuaternionT<T> q = *this;
             r = q.r*multiplier.r - q.i*multiplier.i -
                 q.j*multiplier.j - q.k*multiplier.k;
             i = q.r*multiplier.i + q.i*multiplier.r +
@@ -188,65 +297,110 @@ namespace Phy
                 q.i*multiplier.j - q.j*multiplier.i;
         }
 
-        void addScaledVector(const Vector3& vector, real scale)
+        void addScaledVector(const Vector3T<T>& vector, T scale)
         {
-            Quaternion q(0,
+            QuaternionT<T> q(0,
                 vector.x * scale,
                 vector.y * scale,
                 vector.z * scale);
             q *= *this;
-            r += q.r * ((real)0.5);
-            i += q.i * ((real)0.5);
-            j += q.j * ((real)0.5);
-            k += q.k * ((real)0.5);
+            r += q.r * ((T)0.5);
+            i += q.i * ((T)0.5);
+            j += q.j * ((T)0.5);
+            k += q.k * ((T)0.5);
         }
 
-        void rotateByVector(const Vector3& vector)
+        void rotateByVector(const Vector3T<T>& vector)
         {
-            Quaternion q(0, vector.x, vector.y, vector.z);
+            QuaternionT<T> q(0, vector.x, vector.y, vector.z);
             (*this) *= q;
         }
     };
 
-    class Matrix3
+    template<class T>
+    class Matrix3T
     {
     public:
         // Holds the tensor matrix data in array form.
-        real data[9];
+        T data[9];
 
-        Matrix3()
+        Matrix3T()
         {
             data[0] = data[1] = data[2] = 0;
             data[3] = data[4] = data[5] = 0;
             data[6] = data[7] = data[8] = 0;
         }
 
-        Matrix3(real c0, real c1, real c2,
-                real c3, real c4, real c5,
-                real c6, real c7, real c8)
+        Matrix3T(T c0, T c1, T c2,
+                T c3, T c4, T c5,
+                T c6, T c7, T c8)
         {
             data[0] = c0; data[1] = c1; data[2] = c2;
             data[3] = c3; data[4] = c4; data[5] = c5;
             data[6] = c6; data[7] = c7; data[8] = c8;
         }
 
-        Vector3 operator*(const Vector3& vector) const
+        Vector3T<T> operator*(const Vector3T<T>& vector) const
         {
-            return Vector3(
-                vector.x * data[0] + vector.y * data[1] + vector.z + data[2],
-                vector.x * data[3] + vector.y * data[4] + vector.z + data[5],
-                vector.x * data[6] + vector.y * data[7] + vector.z + data[8]
+            return Vector3T<T>(
+                vector.x * data[0] + vector.y * data[1] + vector.z * data[2],
+                vector.x * data[3] + vector.y * data[4] + vector.z * data[5],
+                vector.x * data[6] + vector.y * data[7] + vector.z * data[8]
             );
         }
 
-        Vector3 transform(const Vector3 &vector) const
+        Vector3T<T> transform(const Vector3T<T> &vector) const
         {
             return (*this) * vector;
         }
 
-        Matrix3 operator*(const Matrix3 &o) const
+        // Transforms the given vector by the transpose of this matrix.
+        Vector3T<T> transformTranspose(const Vector3T<T> &vector) const
+        {
+            return Vector3T<T>(
+                vector.x * data[0] + vector.y * data[3] + vector.z * data[6],
+                vector.x * data[1] + vector.y * data[4] + vector.z * data[7],
+                vector.x * data[2] + vector.y * data[5] + vector.z * data[8]
+            );
+        }
+
+        // Sets the matrix to have the given vectors as its columns.
+        void setComponents(const Vector3T<T> &one, const Vector3T<T> &two,
+                           const Vector3T<T> &three)
         {
-            return Matrix3(
+            data[0] = one.x; data[1] = two.x; data[2] = three.x;
+            data[3] = one.y; data[4] = two.y; data[5] = three.y;
+            data[6] = one.z; data[7] = two.z; data[8] = three.z;
+        }
+
+        /* Sets the matrix to be the skew symmetric matrix of the given
+         * vector, so multiplying by it is the same as taking the vector
+         * product with the vector.
+         */
+        void setSkewSymmetric(const Vector3T<T> &vector)
+        {
+            data[0] = data[4] = data[8] = 0;
+            data[1] = -vector.z;
+            data[2] = vector.y;
+            data[3] = vector.z;
+            data[5] = -vector.x;
+            data[6] = -vector.y;
+            data[7] = vector.x;
+        }
+
+        void operator+=(const Matrix3T<T> &o)
+        {
+            for(unsigned i = 0; i < 9; i++) data[i] += o.data[i];
+        }
+
+        void operator*=(const T scalar)
+        {
+            for(unsigned i = 0; i < 9; i++) data[i] *= scalar;
+        }
+
+        Matrix3T<T> operator*(const Matrix3T<T> &o) const
+        {
+            return Matrix3T<T>(
                 data[0]*o.data[0] + data[1]*o.data[3] + data[2]*o.data[6],
                 data[0]*o.data[1] + data[1]*o.data[4] + data[2]*o.data[7],
                 data[0]*o.data[2] + data[1]*o.data[5] + data[2]*o.data[8],
@@ -261,11 +415,11 @@ namespace Phy
             );
         }
 
-        void operator*=(const Matrix3 &o)
+        void operator*=(const Matrix3T<T> &o)
         {
-            real t1;
-            real t2;
-            real t3;
+            T t1;
+            T t2;
+            T t3;
 
             t1 = data[0]*o.data[0] + data[1]*o.data[3] + data[2]*o.data[6];
             t2 = data[0]*o.data[1] + data[1]*o.data[4] + data[2]*o.data[7];
@@ -289,22 +443,22 @@ namespace Phy
             data[8] = t3;
         }
 
-        void setInverse(const Matrix3 &m)
+        void setInverse(const Matrix3T<T> &m)
         {
-            real t4 = m.data[0]*m.data[4];
-            real t6 = m.data[0]*m.data[5];
-            real t8 = m.data[1]*m.data[3];
-            real t10 = m.data[2]*m.data[3];
-            real t12 = m.data[1]*m.data[6];
-            real t14 = m.data[2]*m.data[6];
+            T t4 = m.data[0]*m.data[4];
+            T t6 = m.data[0]*m.data[5];
+            T t8 = m.data[1]*m.data[3];
+            T t10 = m.data[2]*m.data[3];
+            T t12 = m.data[1]*m.data[6];
+            T t14 = m.data[2]*m.data[6];
 
             // Calculate the determinant
-            real t16 = (t4*m.data[8] - t6*m.data[7] - t8*m.data[8]+
+            T t16 = (t4*m.data[8] - t6*m.data[7] - t8*m.data[8]+
                         t10*m.data[7] + t12*m.data[5] - t14*m.data[4]);
 
             // Make sure the determinant is non-zero.
-            if (t16 == (real)0.0f) return;
-            real t17 = 1/t16;
+            if (t16 == (T)0.0f) return;
+            T t17 = 1/t16;
 
             data[0] = (m.data[4]*m.data[8]-m.data[5]*m.data[7])*t17;
             data[1] = -(m.data[1]*m.data[8]-m.data[2]*m.data[7])*t17;
@@ -318,9 +472,9 @@ namespace Phy
         }
 
         /** Returns a new matrix containing the inverse of this matrix. */
-        Matrix3 inverse() const
+        Matrix3T<T> inverse() const
         {
-            Matrix3 result;
+            Matrix3T<T> result;
             result.setInverse(*this);
             return result;
         }
@@ -333,7 +487,7 @@ namespace Phy
             setInverse(*this);
         }
 
-        void setTranspose(const Matrix3 &m)
+        void setTranspose(const Matrix3T<T> &m)
         {
             data[0] = m.data[0];
             data[1] = m.data[3];
@@ -346,14 +500,14 @@ namespace Phy
             data[8] = m.data[8];
         }
 
-        Matrix3 transpose() const
+        Matrix3T<T> transpose() const
         {
-            Matrix3 result;
+            Matrix3T<T> result;
             result.setTranspose(*this);
             return result;
         }
 
-        void setOrientation(const Quaternion &q)
+        void setOrientation(const QuaternionT<T> &q)
         {
             data[0] = 1 - (2*q.j*q.j + 2*q.k*q.k);
             data[1] = 2*q.i*q.j + 2*q.k*q.r;
@@ -375,15 +529,16 @@ namespace Phy
      * The matrix has 12 elements, and it is assumed that the
      * remainding four are (0,0,0,1), producing a homogenous matrix.
     */
-    class Matrix4
+    template<class T>
+    class Matrix4T
     {
     public:
         // Holds the transform matrix data in array form.
-        real data[12];
+        T data[12];
 
-        Vector3 operator*(const Vector3 &vector) const
+        Vector3T<T> operator*(const Vector3T<T> &vector) const
         {
-            return Vector3(
+            return Vector3T<T>(
                 vector.x * data[0] + 
                 vector.y * data[1] +
                 vector.z * data[2] + data[3],
@@ -398,14 +553,14 @@ namespace Phy
             );
         }
 
-        Vector3 transform(const Vector3 &vector) const
+        Vector3T<T> transform(const Vector3T<T> &vector) const
         {
             return (*this) * vector;
         }
 
-        Matrix4 operator*(const Matrix4 &o) const
+        Matrix4T<T> operator*(const Matrix4T<T> &o) const
         {
-            Matrix4 result;
+            Matrix4T<T> result;
             result.data[0] = (o.data[0]*data[0]) + (o.data[4]*data[1]) + (o.data[8]*data[2]);
             result.data[4] = (o.data[0]*data[4]) + (o.data[4]*data[5]) + (o.data[8]*data[6]);
             result.data[8] = (o.data[0]*data[8]) + (o.data[4]*data[9]) + (o.data[8]*data[10]);
@@ -425,16 +580,17 @@ namespace Phy
             return result;
         }
 
-        real getDeterminant() const;
-        void setInverse(const Matrix4 &m);
-        Matrix4 inverse() const
+        // Defined in core.cpp, for float and double.
+        T getDeterminant() const;
+        void setInverse(const Matrix4T<T> &m);
+        Matrix4T<T> inverse() const
         {
-            Matrix4 result;
+            Matrix4T<T> result;
             result.setInverse(*this);
             return result;
         }
 
-        void setOrientationAndPos(const Quaternion &q, const Vector3 &pos)
+        void setOrientationAndPos(const QuaternionT<T> &q, const Vector3T<T> &pos)
         {
             data[0] = 1 - (2*q.j*q.j + 2*q.k*q.k);
             data[1] = 2*q.i*q.j + 2*q.k*q.r;
@@ -452,13 +608,16 @@ namespace Phy
             data[11] = pos.z;
         }
 
-        Vector3 transformInverse(const Vector3 &vector) const
+        Vector3T<T> transformInverse(const Vector3T<T> &vector) const
         {
-            Vector3 tmp = vector;
+            Vector3T<T> tmp = vector;
             tmp.x -= data[3];
             tmp.y -= data[7];
             tmp.z -= data[11];
-            return Vector3(
+#ifdef PHY_SIMD_CORE
+            return transformInverseDirection(tmp);
+#else
+            return Vector3T<T>(
                 tmp.x * data[0] +
                 tmp.y * data[4] +
                 tmp.z * data[8],
@@ -471,11 +630,12 @@ namespace Phy
                 tmp.y * data[6] +
                 tmp.z * data[10]
             );
+#endif
         }
 
-        Vector3 transformDirection(const Vector3 &vector) const
+        Vector3T<T> transformDirection(const Vector3T<T> &vector) const
         {
-            return Vector3(
+            return Vector3T<T>(
                 vector.x * data[0] +
                 vector.y * data[1] +
                 vector.z * data[2],
@@ -490,9 +650,17 @@ namespace Phy
             );
         }
 
-        Vector3 transformInverseDirection(const Vector3 &vector) const
+        Vector3T<T> transformInverseDirection(const Vector3T<T> &vector) const
         {
-            return Vector3(
+#ifdef PHY_SIMD_CORE
+            // The transpose times the vector is a sum of the rows, and
+            // splat3 keeps the translation out of the pad lane.
+            return Vector3T<T>::from(
+                Packed4<T>::load(data) * Packed4<T>::splat3(vector.x) +
+                Packed4<T>::load(data + 4) * Packed4<T>::splat3(vector.y) +
+                Packed4<T>::load(data + 8) * Packed4<T>::splat3(vector.z));
+#else
+            return Vector3T<T>(
                 vector.x * data[0] +
                 vector.y * data[4] +
                 vector.z * data[8],
@@ -505,16 +673,31 @@ namespace Phy
                 vector.y * data[6] +
                 vector.z * data[10]
             );
+#endif
         }
         
         // gets a vector representing one axis (one column) in the matrix
-        Vector3 getAxisVector(int i) const
+        Vector3T<T> getAxisVector(int i) const
         {
-            return Vector3(data[i], data[i+4], data[i+8]);
+            return Vector3T<T>(data[i], data[i+4], data[i+8]);
         }
 
     };
 
+    typedef Vector3T<real> Vector3;
+    typedef QuaternionT<real> Quaternion;
+    typedef Matrix3T<real> Matrix3;
+    typedef Matrix4T<real> Matrix4;
+
+    typedef Vector3T<float> Vector3f;
+    typedef QuaternionT<float> Quaternionf;
+    typedef Matrix3T<float> Matrix3f;
+    typedef Matrix4T<float> Matrix4f;
+
+    typedef Vector3T<double> Vector3d;
+    typedef QuaternionT<double> Quaterniond;
+    typedef Matrix3T<double> Matrix3d;
+    typedef Matrix4T<double> Matrix4d;
 }
 
 
@@ -10,15 +10,43 @@ namespace Phy
         registrations.push_back(registration);
     }
 
+    void ForceRegistry::clear()
+    {
+        registrations.clear();
+    }
+
+    unsigned ForceRegistry::getCount() const
+    {
+        return (unsigned)registrations.size();
+    }
+
+    RigidBody *ForceRegistry::getBody(unsigned registration) const
+    {
+        return registrations[registration].body;
+    }
+
+    ForceGenerator *ForceRegistry::getForceGenerator(unsigned registration) const
+    {
+        return registrations[registration].fg;
+    }
+
     void ForceRegistry::updateForces(real duration)
     {
         Registry::iterator i = registrations.begin();
         for(; i != registrations.end(); i++)
         {
+            // Constant forces are skipped on sleeping bodies, or gravity
+            // would keep everything awake.
+            if(!i->body->getAwake() && i->fg->isConstant()) continue;
             i->fg->updateForce(i->body, duration);
         }
     }
 
+    bool ForceGenerator::isConstant() const
+    {
+        return false;
+    }
+
     Gravity::Gravity(const Vector3 &gravity) : gravity(gravity) {}
 
     void Gravity::updateForce(RigidBody *body, real duration)
@@ -28,6 +56,11 @@ namespace Phy
         body->addForce(gravity * body->getMass());
     }
 
+    bool Gravity::isConstant() const
+    {
+        return true;
+    }
+
 
     Spring::Spring(const Vector3 &localConnectionPt,
                    RigidBody *other,
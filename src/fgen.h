@@ -11,6 +11,14 @@ namespace Phy
     {
     public:
         virtual void updateForce(RigidBody *body, real duration) = 0;
+
+        /* Returns true if the generator applies the same force to a
+         * body whatever happens around it, as gravity does. Those are
+         * skipped for sleeping bodies, since they would otherwise keep
+         * every body awake; any other generator still runs, and wakes
+         * the body when it applies a force.
+         */
+        virtual bool isConstant() const;
     };
 
     class Gravity : public ForceGenerator
@@ -19,6 +27,7 @@ namespace Phy
     public:
         Gravity(const Vector3 &gravity);
         virtual void updateForce(RigidBody *body, real duration);
+        virtual bool isConstant() const;
     };
 
     class Spring : public ForceGenerator
@@ -59,7 +68,13 @@ namespace Phy
         Registry registrations;
     public:
         void add(RigidBody *body, ForceGenerator *fg);
+        void clear();
         void updateForces(real duration);
+
+        // The registrations, in the order they were added.
+        unsigned getCount() const;
+        RigidBody *getBody(unsigned registration) const;
+        ForceGenerator *getForceGenerator(unsigned registration) const;
     };
 }
 
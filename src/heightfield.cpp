@@ -0,0 +1,300 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "heightfield.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    HeightField::HeightField()
+        : size(0), tileSize(65), tilesPerSide(0),
+          worldX(1), worldZ(1), maxHeight(1)
+    {
+        calculateScale();
+    }
+
+    void HeightField::calculateScale()
+    {
+        real cells = size > 1 ? (real)(size - 1) : (real)1;
+        cellX = worldX / cells;
+        cellZ = worldZ / cells;
+        heightScale = maxHeight / (real)65535;
+    }
+
+    void HeightField::calculateTiles()
+    {
+        tilesPerSide = 0;
+        tileMin.clear();
+        tileMax.clear();
+        if(size < 2) return;
+
+        unsigned tileCells = tileSize - 1;
+        tilesPerSide = (size - 1 + tileCells - 1) / tileCells;
+        tileMin.assign(tilesPerSide * tilesPerSide, 0xffff);
+        tileMax.assign(tilesPerSide * tilesPerSide, 0);
+
+        // Samples on a tile's edge belong to the tiles either side.
+        for(unsigned z = 0; z < size; z++)
+        {
+            unsigned tz0 = (z > 0) ? (z - 1) / tileCells : 0;
+            unsigned tz1 = (z < size - 1) ? z / tileCells : tz0;
+            for(unsigned x = 0; x < size; x++)
+            {
+                unsigned tx0 = (x > 0) ? (x - 1) / tileCells : 0;
+                unsigned tx1 = (x < size - 1) ? x / tileCells : tx0;
+                unsigned short h = heights[z * size + x];
+                for(unsigned tz = tz0; tz <= tz1; tz++)
+                {
+                    for(unsigned tx = tx0; tx <= tx1; tx++)
+                    {
+                        unsigned t = tz * tilesPerSide + tx;
+                        if(h < tileMin[t]) tileMin[t] = h;
+                        if(h > tileMax[t]) tileMax[t] = h;
+                    }
+                }
+            }
+        }
+    }
+
+    real HeightField::getSample(unsigned x, unsigned z) const
+    {
+        return origin.y + heights[z * size + x] * heightScale;
+    }
+
+    bool HeightField::loadConfig(const char *filename)
+    {
+        FILE *file = fopen(filename, "r");
+        if(!file) return false;
+
+        unsigned pageSize = 0, rawSize = 0, rawBytes = 1;
+        real pageWorldX = worldX, pageWorldZ = worldZ, pageMaxHeight = maxHeight;
+        char line[512];
+        while(fgets(line, sizeof(line), file))
+        {
+            if(line[0] == '#') continue;
+            char *equals = strchr(line, '=');
+            if(!equals) continue;
+            *equals = 0;
+            const char *key = line;
+            char *value = equals + 1;
+            value[strcspn(value, "\r\n")] = 0;
+
+            if(!strcmp(key, "PageSize")) pageSize = (unsigned)atoi(value);
+            else if(!strcmp(key, "TileSize")) tileSize = (unsigned)atoi(value);
+            else if(!strcmp(key, "PageWorldX")) pageWorldX = (real)atof(value);
+            else if(!strcmp(key, "PageWorldZ")) pageWorldZ = (real)atof(value);
+            else if(!strcmp(key, "MaxHeight")) pageMaxHeight = (real)atof(value);
+            else if(!strcmp(key, "Heightmap.image")) imageName = value;
+            else if(!strcmp(key, "Heightmap.raw.size")) rawSize = (unsigned)atoi(value);
+            else if(!strcmp(key, "Heightmap.raw.bpp")) rawBytes = (unsigned)atoi(value);
+        }
+        fclose(file);
+
+        if(tileSize < 2) tileSize = 65;
+        setScale(pageWorldX, pageWorldZ, pageMaxHeight);
+
+        // Only RAW heightmaps are read here.
+        size_t length = imageName.size();
+        if(length < 4 || imageName.compare(length - 4, 4, ".raw") != 0) return true;
+
+        std::string path(filename);
+        size_t slash = path.find_last_of("/\\");
+        path = (slash == std::string::npos) ? imageName : path.substr(0, slash + 1) + imageName;
+        return loadRaw(path.c_str(), rawSize ? rawSize : pageSize, rawBytes);
+    }
+
+    bool HeightField::loadRaw(const char *filename, unsigned size, unsigned bytesPerSample)
+    {
+        if(size < 2 || bytesPerSample < 1 || bytesPerSample > 2) return false;
+
+        FILE *file = fopen(filename, "rb");
+        if(!file) return false;
+
+        std::vector<unsigned char> data(size * size * bytesPerSample);
+        bool read = fread(&data[0], 1, data.size(), file) == data.size();
+        fclose(file);
+        if(!read) return false;
+
+        if(bytesPerSample == 1)
+        {
+            setHeights(&data[0], size);
+        }
+        else
+        {
+            std::vector<unsigned short> samples(size * size);
+            for(unsigned i = 0; i < samples.size(); i++)
+            {
+                samples[i] = (unsigned short)(data[i*2] | (data[i*2 + 1] << 8));
+            }
+            setHeights(&samples[0], size);
+        }
+        return true;
+    }
+
+    void HeightField::setHeights(const unsigned short *samples, unsigned size)
+    {
+        HeightField::size = size;
+        heights.assign(samples, samples + size * size);
+        calculateScale();
+        calculateTiles();
+    }
+
+    void HeightField::setHeights(const unsigned char *samples, unsigned size)
+    {
+        // Spread the 8 bit samples over the full 16 bit range.
+        HeightField::size = size;
+        heights.resize(size * size);
+        for(unsigned i = 0; i < heights.size(); i++)
+        {
+            heights[i] = (unsigned short)(samples[i] * 257);
+        }
+        calculateScale();
+        calculateTiles();
+    }
+
+    void HeightField::setScale(real worldX, real worldZ, real maxHeight)
+    {
+        HeightField::worldX = worldX;
+        HeightField::worldZ = worldZ;
+        HeightField::maxHeight = maxHeight;
+        calculateScale();
+    }
+
+    void HeightField::setOrigin(const Vector3 &origin)
+    {
+        HeightField::origin = origin;
+    }
+
+    void HeightField::setTileSize(unsigned tileSize)
+    {
+        Assert(tileSize >= 2);
+        HeightField::tileSize = tileSize;
+        calculateTiles();
+    }
+
+    unsigned HeightField::getSize() const
+    {
+        return size;
+    }
+
+    unsigned HeightField::getTileSize() const
+    {
+        return tileSize;
+    }
+
+    const Vector3 &HeightField::getOrigin() const
+    {
+        return origin;
+    }
+
+    const std::string &HeightField::getImageName() const
+    {
+        return imageName;
+    }
+
+    bool HeightField::getHeight(real x, real z, real *height, Vector3 *normal) const
+    {
+        if(size < 2) return false;
+
+        real gridX = (x - origin.x) / cellX;
+        real gridZ = (z - origin.z) / cellZ;
+        real last = (real)(size - 1);
+        if(gridX < 0 || gridZ < 0 || gridX > last || gridZ > last) return false;
+
+        unsigned ix = (unsigned)gridX;
+        unsigned iz = (unsigned)gridZ;
+        if(ix > size - 2) ix = size - 2;
+        if(iz > size - 2) iz = size - 2;
+        real fx = gridX - ix;
+        real fz = gridZ - iz;
+
+        real h00 = getSample(ix, iz);
+        real h11 = getSample(ix + 1, iz + 1);
+
+        // The slopes of the triangle the point is over, along x and z.
+        real slopeX, slopeZ;
+        if(fx >= fz)
+        {
+            real h10 = getSample(ix + 1, iz);
+            slopeX = h10 - h00;
+            slopeZ = h11 - h10;
+        }
+        else
+        {
+            real h01 = getSample(ix, iz + 1);
+            slopeX = h11 - h01;
+            slopeZ = h01 - h00;
+        }
+
+        *height = h00 + slopeX * fx + slopeZ * fz;
+        if(normal)
+        {
+            *normal = Vector3(-slopeX * cellZ, cellX * cellZ, -slopeZ * cellX);
+            normal->normalize();
+        }
+        return true;
+    }
+
+    bool HeightField::getCells(real minX, real minZ, real maxX, real maxZ,
+                               unsigned *cellMinX, unsigned *cellMinZ,
+                               unsigned *cellMaxX, unsigned *cellMaxZ) const
+    {
+        if(size < 2) return false;
+
+        real last = (real)(size - 2);
+        real x0 = real_floor((minX - origin.x) / cellX);
+        real z0 = real_floor((minZ - origin.z) / cellZ);
+        real x1 = real_floor((maxX - origin.x) / cellX);
+        real z1 = real_floor((maxZ - origin.z) / cellZ);
+        if(x1 < 0 || z1 < 0 || x0 > last || z0 > last) return false;
+
+        *cellMinX = x0 < 0 ? 0 : (unsigned)x0;
+        *cellMinZ = z0 < 0 ? 0 : (unsigned)z0;
+        *cellMaxX = x1 > last ? size - 2 : (unsigned)x1;
+        *cellMaxZ = z1 > last ? size - 2 : (unsigned)z1;
+        return true;
+    }
+
+    bool HeightField::reaches(real minX, real minZ, real maxX, real maxZ, real height) const
+    {
+        unsigned x0, z0, x1, z1;
+        if(!getCells(minX, minZ, maxX, maxZ, &x0, &z0, &x1, &z1)) return false;
+
+        // The sample below which nothing in a tile can be.
+        real level = (height - origin.y) / heightScale;
+        if(level <= 0) return true;
+        if(level > (real)0xffff) return false;
+
+        unsigned tileCells = tileSize - 1;
+        for(unsigned tz = z0 / tileCells; tz <= z1 / tileCells; tz++)
+        {
+            for(unsigned tx = x0 / tileCells; tx <= x1 / tileCells; tx++)
+            {
+                if(tileMax[tz * tilesPerSide + tx] >= level) return true;
+            }
+        }
+        return false;
+    }
+
+    void HeightField::getTriangle(unsigned cellX, unsigned cellZ, unsigned triangle,
+                                  Vector3 corners[3]) const
+    {
+        real x0 = origin.x + cellX * HeightField::cellX;
+        real z0 = origin.z + cellZ * HeightField::cellZ;
+        real x1 = x0 + HeightField::cellX;
+        real z1 = z0 + HeightField::cellZ;
+
+        corners[0] = Vector3(x0, getSample(cellX, cellZ), z0);
+        if(triangle == 0)
+        {
+            corners[1] = Vector3(x1, getSample(cellX + 1, cellZ + 1), z1);
+            corners[2] = Vector3(x1, getSample(cellX + 1, cellZ), z0);
+        }
+        else
+        {
+            corners[1] = Vector3(x0, getSample(cellX, cellZ + 1), z1);
+            corners[2] = Vector3(x1, getSample(cellX + 1, cellZ + 1), z1);
+        }
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef PHY_HEIGHTFIELD_H
+#define PHY_HEIGHTFIELD_H
+
+#include <cstddef>
+#include <vector>
+#include <string>
+#include "core.h"
+
+namespace Phy
+{
+
+    /*
+     * A square grid of terrain heights, for colliding with large
+     * outdoor worlds without building a triangle mesh for them.
+     *
+     * The heights are kept as 16 bit samples, scaled to the world by the
+     * maximum height, so a 513 x 513 page takes half a megabyte. Each
+     * cell of the grid is split into two triangles along the diagonal
+     * from its lowest x and z corner, the same split the terrain
+     * renderer uses. The grid is also divided into tiles, as the
+     * terrain is paged, and each tile keeps the lowest and highest
+     * sample in it: a query over an area first checks the tiles it
+     * covers, and only looks at the cells of tiles that reach it.
+     *
+     * The grid lies along the world x and z axes, from the origin to
+     * the origin plus the world size, with heights along y above the
+     * origin.
+     */
+    class HeightField
+    {
+    protected:
+        // The samples along each side, and the samples in a row of heights.
+        unsigned size;
+        std::vector<unsigned short> heights;
+
+        // The samples along each side of a tile, which share their edges.
+        unsigned tileSize;
+        unsigned tilesPerSide;
+        std::vector<unsigned short> tileMin;
+        std::vector<unsigned short> tileMax;
+
+        Vector3 origin;
+        real worldX;
+        real worldZ;
+        real maxHeight;
+
+        // Derived from the above when any of them change.
+        real cellX;
+        real cellZ;
+        real heightScale;
+
+        // The heightmap file named by the last configuration loaded.
+        std::string imageName;
+
+        void calculateScale();
+        void calculateTiles();
+
+        // Returns the world height of the given sample.
+        real getSample(unsigned x, unsigned z) const;
+
+    public:
+        HeightField();
+
+        /* Reads the physics settings from a terrain configuration file
+         * of the form of Media/terrain.cfg: PageSize, TileSize,
+         * PageWorldX, PageWorldZ, MaxHeight and the heightmap. A RAW
+         * heightmap, named by Heightmap.image with its size and bytes
+         * per pixel given by Heightmap.raw.size and Heightmap.raw.bpp,
+         * is loaded from the directory of the configuration file. Any
+         * other image has to be decoded by the caller (Ogre::Image
+         * does it) and passed to setHeights; getImageName gives its
+         * name. Returns false if the file, or its RAW heightmap,
+         * couldn't be read.
+         */
+        bool loadConfig(const char *filename);
+
+        /* Loads a RAW heightmap of the given size, with one or two
+         * bytes a sample. Two byte samples are little endian. */
+        bool loadRaw(const char *filename, unsigned size, unsigned bytesPerSample);
+
+        // Sets the heights from a size x size array of samples, row by row along z.
+        void setHeights(const unsigned short *samples, unsigned size);
+        void setHeights(const unsigned char *samples, unsigned size);
+
+        // Sets the world size of the grid and the height of the highest sample.
+        void setScale(real worldX, real worldZ, real maxHeight);
+        void setOrigin(const Vector3 &origin);
+
+        /* Sets the samples along each side of a tile, which must be
+         * (2^n)+1. Tiles are rebuilt from the current heights. */
+        void setTileSize(unsigned tileSize);
+
+        unsigned getSize() const;
+        unsigned getTileSize() const;
+        const Vector3 &getOrigin() const;
+        const std::string &getImageName() const;
+
+        /* Finds the height of the terrain at the given world x and z,
+         * and its normal there if one is asked for. Returns false if
+         * the point is off the grid. */
+        bool getHeight(real x, real z, real *height, Vector3 *normal = NULL) const;
+
+        /* Returns whether any tile under the given area of the world
+         * reaches up to the given height. The cheap test to make
+         * before looking at the cells. */
+        bool reaches(real minX, real minZ, real maxX, real maxZ, real height) const;
+
+        /* Finds the cells under the given area, clamped to the grid.
+         * Returns false if the area is off the grid. */
+        bool getCells(real minX, real minZ, real maxX, real maxZ,
+                      unsigned *cellMinX, unsigned *cellMinZ,
+                      unsigned *cellMaxX, unsigned *cellMaxZ) const;
+
+        /* Fills in the world corners of one of the two triangles of a
+         * cell, wound so that (b - a) % (c - a) points up. */
+        void getTriangle(unsigned cellX, unsigned cellZ, unsigned triangle,
+                         Vector3 corners[3]) const;
+    };
+
+}
+
+#endif
@@ -0,0 +1,331 @@
+#include "integrator.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    /*
+     * The linear part of one rigid body step:
+     *   lastFrameAcceleration = acceleration + forceAccum * inverseMass
+     *   velocity = (velocity + lastFrameAcceleration * duration) * linearPow
+     *   rotation = (rotation + angularAcceleration * duration) * angularPow
+     *   position += velocity * duration
+     */
+    static inline void bodyStep(Vector3 &position, Vector3 &velocity,
+                                Vector3 &rotation, Vector3 &lastFrameAcceleration,
+                                const Vector3 &acceleration, const Vector3 &forceAccum,
+                                real inverseMass, const Vector3 &angularAcceleration,
+                                real duration, real linearPow, real angularPow)
+    {
+        lastFrameAcceleration = acceleration;
+        lastFrameAcceleration.addScaledVector(forceAccum, inverseMass);
+
+        velocity.addScaledVector(lastFrameAcceleration, duration);
+        rotation.addScaledVector(angularAcceleration, duration);
+
+        velocity *= linearPow;
+        rotation *= angularPow;
+
+        position.addScaledVector(velocity, duration);
+    }
+
+    static inline void particleStep(Vector3 &position, Vector3 &velocity,
+                                    const Vector3 &acceleration, Vector3 &forceAccum,
+                                    real inverseMass, real duration, real dampingPow)
+    {
+        position.addScaledVector(velocity, duration);
+
+        Vector3 resultAcc = acceleration;
+        resultAcc.addScaledVector(forceAccum, inverseMass);
+        velocity.addScaledVector(resultAcc, duration);
+
+        velocity *= dampingPow;
+
+        forceAccum.clear();
+    }
+
+#if defined(PHY_SIMD_X86) && defined(DOUBLE_PRECISION)
+
+    /*
+     * Each Vector3 is four doubles (x, y, z, pad). A group of particles
+     * is transposed into one register per component, stepped, and
+     * transposed back; the pads are written back as they were. Lanes
+     * whose particle has no finite mass keep their old values, as
+     * Particle::integrate leaves them, including the force accumulator.
+     */
+
+    // Takes a where the mask is set and b elsewhere.
+    static inline __m128d select2(__m128d mask, __m128d a, __m128d b)
+    {
+        return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+    }
+
+    // Transposes two vectors into x, y, z and pad registers, and back.
+    static inline void load2(const Vector3 *v, __m128d &x, __m128d &y,
+                             __m128d &z, __m128d &pad)
+    {
+        __m128d xy0 = _mm_loadu_pd(&v[0].x), xy1 = _mm_loadu_pd(&v[1].x);
+        __m128d zp0 = _mm_loadu_pd(&v[0].z), zp1 = _mm_loadu_pd(&v[1].z);
+        x = _mm_unpacklo_pd(xy0, xy1);
+        y = _mm_unpackhi_pd(xy0, xy1);
+        z = _mm_unpacklo_pd(zp0, zp1);
+        pad = _mm_unpackhi_pd(zp0, zp1);
+    }
+
+    static inline void store2(Vector3 *v, __m128d x, __m128d y, __m128d z, __m128d pad)
+    {
+        _mm_storeu_pd(&v[0].x, _mm_unpacklo_pd(x, y));
+        _mm_storeu_pd(&v[1].x, _mm_unpackhi_pd(x, y));
+        _mm_storeu_pd(&v[0].z, _mm_unpacklo_pd(z, pad));
+        _mm_storeu_pd(&v[1].z, _mm_unpackhi_pd(z, pad));
+    }
+
+    static void particlesSSE2(Vector3 *position, Vector3 *velocity,
+                              const Vector3 *acceleration, Vector3 *forceAccum,
+                              const real *inverseMass, const real *dampingPow,
+                              unsigned count, real duration)
+    {
+        __m128d dt = _mm_set1_pd(duration);
+        __m128d zero = _mm_setzero_pd();
+        for(unsigned i = 0; i < count; i += 2)
+        {
+            // Not (inverseMass <= 0), so the lanes match the scalar test.
+            __m128d im = _mm_loadu_pd(inverseMass + i);
+            __m128d moves = _mm_cmpnle_pd(im, zero);
+            if(!_mm_movemask_pd(moves)) continue;
+
+            // The forces become accelerations and are cleared.
+            __m128d ax, ay, az, fx, fy, fz, pad;
+            load2(acceleration + i, ax, ay, az, pad);
+            load2(forceAccum + i, fx, fy, fz, pad);
+            ax = _mm_add_pd(ax, _mm_mul_pd(fx, im));
+            ay = _mm_add_pd(ay, _mm_mul_pd(fy, im));
+            az = _mm_add_pd(az, _mm_mul_pd(fz, im));
+            store2(forceAccum + i, _mm_andnot_pd(moves, fx), _mm_andnot_pd(moves, fy),
+                   _mm_andnot_pd(moves, fz), pad);
+
+            // The positions move with the old velocities.
+            __m128d vx, vy, vz, vpad, px, py, pz;
+            load2(velocity + i, vx, vy, vz, vpad);
+            load2(position + i, px, py, pz, pad);
+            store2(position + i,
+                   select2(moves, _mm_add_pd(px, _mm_mul_pd(vx, dt)), px),
+                   select2(moves, _mm_add_pd(py, _mm_mul_pd(vy, dt)), py),
+                   select2(moves, _mm_add_pd(pz, _mm_mul_pd(vz, dt)), pz), pad);
+
+            __m128d damp = _mm_loadu_pd(dampingPow + i);
+            store2(velocity + i,
+                   select2(moves, _mm_mul_pd(_mm_add_pd(vx, _mm_mul_pd(ax, dt)), damp), vx),
+                   select2(moves, _mm_mul_pd(_mm_add_pd(vy, _mm_mul_pd(ay, dt)), damp), vy),
+                   select2(moves, _mm_mul_pd(_mm_add_pd(vz, _mm_mul_pd(az, dt)), damp), vz),
+                   vpad);
+        }
+    }
+
+    static PHY_TARGET_AVX inline __m256d select4(__m256d mask, __m256d a, __m256d b)
+    {
+        return _mm256_or_pd(_mm256_and_pd(mask, a), _mm256_andnot_pd(mask, b));
+    }
+
+    /* Transposes four vectors into x, y, z and pad registers, and back.
+     * The halves of the vectors are loaded into, and stored from, the
+     * halves of the registers, which leaves one unpack per register.
+     */
+    static PHY_TARGET_AVX inline void load4(const Vector3 *v, __m256d &x, __m256d &y,
+                                            __m256d &z, __m256d &pad)
+    {
+        __m256d xy02 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(&v[0].x)),
+                                            _mm_loadu_pd(&v[2].x), 1);
+        __m256d xy13 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(&v[1].x)),
+                                            _mm_loadu_pd(&v[3].x), 1);
+        __m256d zp02 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(&v[0].z)),
+                                            _mm_loadu_pd(&v[2].z), 1);
+        __m256d zp13 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(&v[1].z)),
+                                            _mm_loadu_pd(&v[3].z), 1);
+        x = _mm256_unpacklo_pd(xy02, xy13);
+        y = _mm256_unpackhi_pd(xy02, xy13);
+        z = _mm256_unpacklo_pd(zp02, zp13);
+        pad = _mm256_unpackhi_pd(zp02, zp13);
+    }
+
+    static PHY_TARGET_AVX inline void store4(Vector3 *v, __m256d x, __m256d y,
+                                             __m256d z, __m256d pad)
+    {
+        __m256d xy02 = _mm256_unpacklo_pd(x, y), xy13 = _mm256_unpackhi_pd(x, y);
+        __m256d zp02 = _mm256_unpacklo_pd(z, pad), zp13 = _mm256_unpackhi_pd(z, pad);
+        _mm_storeu_pd(&v[0].x, _mm256_castpd256_pd128(xy02));
+        _mm_storeu_pd(&v[1].x, _mm256_castpd256_pd128(xy13));
+        _mm_storeu_pd(&v[2].x, _mm256_extractf128_pd(xy02, 1));
+        _mm_storeu_pd(&v[3].x, _mm256_extractf128_pd(xy13, 1));
+        _mm_storeu_pd(&v[0].z, _mm256_castpd256_pd128(zp02));
+        _mm_storeu_pd(&v[1].z, _mm256_castpd256_pd128(zp13));
+        _mm_storeu_pd(&v[2].z, _mm256_extractf128_pd(zp02, 1));
+        _mm_storeu_pd(&v[3].z, _mm256_extractf128_pd(zp13, 1));
+    }
+
+    static PHY_TARGET_AVX void particlesAVX(Vector3 *position, Vector3 *velocity,
+                                            const Vector3 *acceleration, Vector3 *forceAccum,
+                                            const real *inverseMass, const real *dampingPow,
+                                            unsigned count, real duration)
+    {
+        __m256d dt = _mm256_set1_pd(duration);
+        __m256d zero = _mm256_setzero_pd();
+        for(unsigned i = 0; i < count; i += 4)
+        {
+            // Not (inverseMass <= 0), so the lanes match the scalar test.
+            __m256d im = _mm256_loadu_pd(inverseMass + i);
+            __m256d moves = _mm256_cmp_pd(im, zero, _CMP_NLE_UQ);
+            if(!_mm256_movemask_pd(moves)) continue;
+
+            // The forces become accelerations and are cleared.
+            __m256d ax, ay, az, fx, fy, fz, pad;
+            load4(acceleration + i, ax, ay, az, pad);
+            load4(forceAccum + i, fx, fy, fz, pad);
+            ax = _mm256_add_pd(ax, _mm256_mul_pd(fx, im));
+            ay = _mm256_add_pd(ay, _mm256_mul_pd(fy, im));
+            az = _mm256_add_pd(az, _mm256_mul_pd(fz, im));
+            store4(forceAccum + i, _mm256_andnot_pd(moves, fx), _mm256_andnot_pd(moves, fy),
+                   _mm256_andnot_pd(moves, fz), pad);
+
+            // The positions move with the old velocities.
+            __m256d vx, vy, vz, vpad, px, py, pz;
+            load4(velocity + i, vx, vy, vz, vpad);
+            load4(position + i, px, py, pz, pad);
+            store4(position + i,
+                   select4(moves, _mm256_add_pd(px, _mm256_mul_pd(vx, dt)), px),
+                   select4(moves, _mm256_add_pd(py, _mm256_mul_pd(vy, dt)), py),
+                   select4(moves, _mm256_add_pd(pz, _mm256_mul_pd(vz, dt)), pz), pad);
+
+            __m256d damp = _mm256_loadu_pd(dampingPow + i);
+            store4(velocity + i,
+                   select4(moves, _mm256_mul_pd(_mm256_add_pd(vx, _mm256_mul_pd(ax, dt)), damp), vx),
+                   select4(moves, _mm256_mul_pd(_mm256_add_pd(vy, _mm256_mul_pd(ay, dt)), damp), vy),
+                   select4(moves, _mm256_mul_pd(_mm256_add_pd(vz, _mm256_mul_pd(az, dt)), damp), vz),
+                   vpad);
+        }
+    }
+
+#endif
+
+    BatchIntegrator::BatchIntegrator()
+        : level(detectSimdLevel())
+    {
+    }
+
+    void BatchIntegrator::setSimdLevel(SimdLevel level)
+    {
+        SimdLevel supported = detectSimdLevel();
+        BatchIntegrator::level = (level > supported) ? supported : level;
+    }
+
+    SimdLevel BatchIntegrator::getSimdLevel() const
+    {
+        return level;
+    }
+
+    void BatchIntegrator::calculateDampingPowers(const real *damping, real *result,
+                                                 unsigned count, real duration)
+    {
+        // Objects created together usually share their damping, so we
+        // only call real_pow when the value changes.
+        real lastDamping = 0;
+        real lastPow = 0;
+        bool cached = false;
+        for(unsigned i = 0; i < count; i++)
+        {
+            if(!cached || damping[i] != lastDamping)
+            {
+                lastDamping = damping[i];
+                lastPow = real_pow(lastDamping, duration);
+                cached = true;
+            }
+            result[i] = lastPow;
+        }
+    }
+
+    void BatchIntegrator::integrateParticles(Vector3 *position,
+                                             Vector3 *velocity,
+                                             const Vector3 *acceleration,
+                                             Vector3 *forceAccum,
+                                             const real *damping,
+                                             const real *inverseMass,
+                                             unsigned count, real duration)
+    {
+        Assert(duration > 0.0);
+        if(count == 0) return;
+
+        if(dampingPowers.size() < count) dampingPowers.resize(count);
+        real *dampingPow = &dampingPowers[0];
+        calculateDampingPowers(damping, dampingPow, count, duration);
+
+        // Whole groups go through the widest kernel, the rest one by one.
+        unsigned done = 0;
+#if defined(PHY_SIMD_X86) && defined(DOUBLE_PRECISION)
+        if(level == SIMD_AVX)
+        {
+            done = count & ~3u;
+            particlesAVX(position, velocity, acceleration, forceAccum,
+                         inverseMass, dampingPow, done, duration);
+        }
+        else if(level == SIMD_SSE2)
+        {
+            done = count & ~1u;
+            particlesSSE2(position, velocity, acceleration, forceAccum,
+                          inverseMass, dampingPow, done, duration);
+        }
+#endif
+
+        for(unsigned i = done; i < count; i++)
+        {
+            if(inverseMass[i] <= 0.0f) continue;
+            particleStep(position[i], velocity[i], acceleration[i], forceAccum[i],
+                         inverseMass[i], duration, dampingPow[i]);
+        }
+    }
+
+    void BatchIntegrator::integrateRigidBodies(RigidBody *bodies, unsigned count,
+                                               real duration)
+    {
+        real linearDamping = 0, linearPow = 0;
+        real angularDamping = 0, angularPow = 0;
+        bool cached = false;
+        real motionBias = real_pow((real)0.5, duration);
+
+        for(unsigned n = 0; n < count; n++)
+        {
+            RigidBody &body = bodies[n];
+            if(!body.isAwake) continue;
+
+            // Reuse the damping powers of the previous body when they match.
+            if(!cached || body.linearDamping != linearDamping)
+            {
+                linearDamping = body.linearDamping;
+                linearPow = real_pow(linearDamping, duration);
+            }
+            if(!cached || body.angularDamping != angularDamping)
+            {
+                angularDamping = body.angularDamping;
+                angularPow = real_pow(angularDamping, duration);
+            }
+            cached = true;
+
+            Vector3 angularAcceleration =
+                body.inverseInertiaTensorWorld.transform(body.torqueAccum);
+
+            bodyStep(body.position, body.velocity, body.rotation,
+                     body.lastFrameAcceleration, body.acceleration,
+                     body.forceAccum, body.inverseMass, angularAcceleration,
+                     duration, linearPow, angularPow);
+
+            body.orientation.addScaledVector(body.rotation, duration);
+            body.derivedDataDirty = true;
+
+            body.clearAccumulators();
+
+            body.updateMotion(motionBias);
+        }
+
+        // The moved bodies' derived data, in one tight pass.
+        RigidBody::calculateDerivedData(bodies, count);
+    }
+}
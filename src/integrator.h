@@ -0,0 +1,64 @@
+#ifndef PHY_INTEGRATOR_H
+#define PHY_INTEGRATOR_H
+
+#include <vector>
+#include "body.h"
+#include "simd.h"
+
+namespace Phy
+{
+    /*
+     * Integrates whole arrays of particles or rigid bodies in one call.
+     *
+     * The damping power real_pow(damping, duration) is computed once per
+     * run of objects sharing the same damping, rather than once per object.
+     *
+     * Particles come as parallel arrays, so at double precision they are
+     * stepped several at a time: two per instruction with SSE2, four
+     * with AVX, the widest the CPU supports being picked at runtime. The
+     * vectors of a group are transposed so each register holds one
+     * component of every particle, and the inverse masses and damping
+     * powers are loaded straight from their arrays. Rigid bodies are
+     * stepped one at a time with the core maths types, which already use
+     * SIMD lanes for each vector. Every path performs the same operations
+     * in the same order as Particle::integrate and RigidBody::integrate.
+     */
+    class BatchIntegrator
+    {
+    protected:
+        SimdLevel level;
+
+        // Scratch space for the damping powers of the current batch.
+        std::vector<real> dampingPowers;
+
+        void calculateDampingPowers(const real *damping, real *result,
+                                    unsigned count, real duration);
+
+    public:
+        BatchIntegrator();
+
+        // Forces a given instruction set for the particle kernels.
+        // Levels the CPU doesn't support are clamped to the detected one.
+        void setSimdLevel(SimdLevel level);
+        SimdLevel getSimdLevel() const;
+
+        /* Integrates count particles stored as parallel arrays, in the
+         * layout used by ParticleWorldSoA. Particles with a non positive
+         * inverse mass are left untouched. */
+        void integrateParticles(Vector3 *position,
+                                Vector3 *velocity,
+                                const Vector3 *acceleration,
+                                Vector3 *forceAccum,
+                                const real *damping,
+                                const real *inverseMass,
+                                unsigned count, real duration);
+
+        /* Integrates a contiguous array of rigid bodies. Equivalent to
+         * calling RigidBody::integrate on each one, except that the
+         * derived data is calculated in a second pass over the array. */
+        void integrateRigidBodies(RigidBody *bodies, unsigned count,
+                                  real duration);
+    };
+}
+
+#endif
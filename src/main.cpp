@@ -8,8 +8,9 @@
 #include "OgreApplicationContext.h"
 
 #include "pworld.h"
+#include "timestep.h"
 
-Ogre::Vector3 PhyToOgre(Phy::Vector3& v)
+Ogre::Vector3 PhyToOgre(const Phy::Vector3& v)
 {
     return Ogre::Vector3(v.x, v.y, v.z);
 }
@@ -26,12 +27,16 @@ Phy::Vector3 OgreToPhy(Ogre::Vector3& v)
 #define BASE_MASS 1
 #define EXTRA_MASS 10
 
+#define PHYSICS_RATE 120
+#define MAX_SUBSTEPS 8
+
 class OgreApp : public Ogre::FrameListener, public OgreBites::InputListener
 {
 public:
 
     OgreApp(unsigned int _particleCount, Ogre::SceneNode** _nodes) 
-        : particleCount(_particleCount), nodes(_nodes), world(_particleCount*10), cables(0), rods(0), massPos(0, 0, 0.5f)
+        : particleCount(_particleCount), nodes(_nodes), world(_particleCount*10),
+          stepper(Phy::real(1.0)/PHYSICS_RATE, MAX_SUBSTEPS), cables(0), rods(0), massPos(0, 0, 0.5f)
     {
         particleArray = new Phy::Particle[particleCount];
         for(unsigned i = 0; i < particleCount; i++)
@@ -96,6 +101,8 @@ public:
         }
 
         updateAdditionalMass();
+
+        stepper.setParticleWorld(&world);
     }
 
     ~OgreApp() 
@@ -132,18 +139,19 @@ public:
     { 
         handleInput();
 
-        world.startFrame();
-
         Ogre::Real duration = evt.timeSinceLastFrame;
         if(duration <= 0.0f) return true;
 
-        world.runPhysics(duration);
+        // Runs whole fixed steps; a long frame is capped at MAX_SUBSTEPS.
+        stepper.advance(duration);
 
         updateAdditionalMass();
 
+        // Draw between the last two steps, so motion stays smooth when
+        // the frame rate and the physics rate differ.
         for(unsigned i = 0; i < 12; i++)
         {
-            nodes[i]->setPosition(PhyToOgre(particleArray[i].position));
+            nodes[i]->setPosition(PhyToOgre(stepper.getParticlePosition(i)));
         }
         nodes[12]->setPosition(massDisplayPos.x, massDisplayPos.y+0.25f, massDisplayPos.z);
 
@@ -241,6 +249,7 @@ private:
     Phy::ParticleWorld world;
     Phy::Particle* particleArray;
     Phy::GroundContacts groundContactGenerator;
+    Phy::FixedTimestep stepper;
 
     // TODO: render nodes
     Ogre::SceneNode** nodes;
@@ -66,7 +66,7 @@ namespace Phy
 
     bool Particle::hasFiniteMass() const
     {
-        return inverseMass >= 0.0f;
+        return inverseMass > 0.0f;
 
     }
 }
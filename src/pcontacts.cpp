@@ -1,4 +1,8 @@
+#include <cstddef>
+#include <algorithm>
 #include "pcontacts.h"
+#include "workers.h"
+#include "profile.h"
 
 namespace Phy
 {
@@ -101,22 +105,51 @@ namespace Phy
 
 
 
-    ParticleContactResolver::ParticleContactResolver(unsigned iterations)
-        : iterations(iterations), iterationsUsed(0)
+    /*
+     * Adjusts a contact's penetration for the particle movement made
+     * while resolving another contact.
+     */
+    static inline void updatePenetration(ParticleContact &contact,
+                                         const ParticleContact &resolved)
     {
-
-    }
-
-    void ParticleContactResolver::setIterations(unsigned iterations)
-    {
-        ParticleContactResolver::iterations = iterations;
+        const Vector3 *move = resolved.particleMovement;
+        if (contact.particle[0] == resolved.particle[0])
+        {
+            contact.penetration -= move[0] * contact.contactNormal;
+        }
+        else if (contact.particle[0] == resolved.particle[1])
+        {
+            contact.penetration -= move[1] * contact.contactNormal;
+        }
+        if (contact.particle[1])
+        {
+            if (contact.particle[1] == resolved.particle[0])
+            {
+                contact.penetration += move[0] * contact.contactNormal;
+            }
+            else if (contact.particle[1] == resolved.particle[1])
+            {
+                contact.penetration += move[1] * contact.contactNormal;
+            }
+        }
     }
 
-    void ParticleContactResolver::resolveContacts(ParticleContact* contactArray,
-                         unsigned numContacts, real duration)
+    /*
+     * The serial resolution loop: repeatedly picks the contact with the
+     * largest closing velocity, resolves it and adjusts the penetration
+     * of the contacts that share its particles. Returns the number of
+     * iterations used.
+     */
+    static unsigned resolveSerial(ParticleContact* contactArray,
+                                  unsigned numContacts, real duration,
+                                  unsigned iterations, ParticleContactIndex &index)
     {
+        PHY_PROFILE_SCOPE("resolveSerial");
         unsigned i;
-        iterationsUsed = 0;
+        unsigned iterationsUsed = 0;
+
+        index.build(contactArray, numContacts);
+
         while(iterationsUsed < iterations)
         {
             // Find the contact with the largest closing velocity
@@ -139,34 +172,477 @@ namespace Phy
             // resolve this contact
             contactArray[maxIndex].resolve(duration);
 
-            // Update the interpenetrations for all particles
-            Vector3 *move = contactArray[maxIndex].particleMovement;
-            for (i = 0; i < numContacts; i++)
+            // Update the interpenetrations of the contacts that share
+            // a particle with the one we resolved
+            index.updatePenetrations(contactArray, maxIndex);
+
+            iterationsUsed++;
+        }
+
+        return iterationsUsed;
+    }
+
+    ParticleContactIslands::ParticleContactIslands()
+        : islandCount(0)
+    {
+    }
+
+    unsigned ParticleContactIslands::findRoot(unsigned contact)
+    {
+        while(parent[contact] != contact)
+        {
+            // Path halving keeps the trees shallow.
+            parent[contact] = parent[parent[contact]];
+            contact = parent[contact];
+        }
+        return contact;
+    }
+
+    unsigned ParticleContactIslands::build(const ParticleContactIndex &index,
+                                           unsigned numContacts)
+    {
+        unsigned i;
+
+        // Join each contact to the others touching the same particles.
+        parent.resize(numContacts);
+        for(i = 0; i < numContacts; i++)
+        {
+            parent[i] = i;
+        }
+        for(i = 0; i < numContacts; i++)
+        {
+            for(unsigned end = 0; end < 2; end++)
             {
-                if (contactArray[i].particle[0] == contactArray[maxIndex].particle[0])
-                {
-                    contactArray[i].penetration -= move[0] * contactArray[i].contactNormal;
-                }
-                else if (contactArray[i].particle[0] == contactArray[maxIndex].particle[1])
+                unsigned group = index.getGroup(i, end);
+                if(group == ParticleContactIndex::NO_GROUP) continue;
+
+                // The group's contacts are sorted, so joining to the
+                // first one is enough.
+                unsigned a = findRoot(i);
+                unsigned b = findRoot(index.getGroupContacts(group)[0]);
+                if(a != b) parent[a] = b;
+            }
+        }
+
+        // Number the islands and count their contacts.
+        islandCount = 0;
+        islandOf.assign(numContacts, numContacts);
+        islandStart.clear();
+        for(i = 0; i < numContacts; i++)
+        {
+            unsigned root = findRoot(i);
+            if(islandOf[root] == numContacts)
+            {
+                islandOf[root] = islandCount++;
+                islandStart.push_back(0);
+            }
+            islandOf[i] = islandOf[root];
+            islandStart[islandOf[i]]++;
+        }
+
+        // Turn the counts into offsets and bucket the contacts.
+        unsigned offset = 0;
+        for(i = 0; i < islandCount; i++)
+        {
+            unsigned count = islandStart[i];
+            islandStart[i] = offset;
+            offset += count;
+        }
+        islandStart.push_back(offset);
+
+        contactOrder.resize(numContacts);
+        for(i = 0; i < numContacts; i++)
+        {
+            contactOrder[islandStart[islandOf[i]]++] = i;
+        }
+        for(i = islandCount; i > 0; i--)
+        {
+            islandStart[i] = islandStart[i-1];
+        }
+        islandStart[0] = 0;
+
+        return islandCount;
+    }
+
+    unsigned ParticleContactIslands::getIslandCount() const
+    {
+        return islandCount;
+    }
+
+    unsigned ParticleContactIslands::getIslandSize(unsigned island) const
+    {
+        return islandStart[island+1] - islandStart[island];
+    }
+
+    const unsigned* ParticleContactIslands::getIslandContacts(unsigned island) const
+    {
+        return &contactOrder[islandStart[island]];
+    }
+
+    const unsigned ParticleContactIndex::NO_GROUP;
+
+    void ParticleContactIndex::build(const ParticleContact* contactArray,
+                                     unsigned numContacts)
+    {
+        unsigned i;
+
+        // Sort every (particle, contact) pair, so each particle's
+        // contacts form one run.
+        entries.clear();
+        contactGroups.assign(numContacts * 2, NO_GROUP);
+        for(i = 0; i < numContacts; i++)
+        {
+            for(unsigned k = 0; k < 2; k++)
+            {
+                if(!contactArray[i].particle[k]) continue;
+                ParticleEntry entry;
+                entry.particle = contactArray[i].particle[k];
+                entry.contact = i;
+                entries.push_back(entry);
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+
+        // Each run becomes a group.
+        groupStart.clear();
+        groupContacts.resize(entries.size());
+        for(i = 0; i < entries.size(); i++)
+        {
+            if(i == 0 || entries[i].particle != entries[i-1].particle)
+            {
+                groupStart.push_back(i);
+            }
+            unsigned group = (unsigned)groupStart.size() - 1;
+            unsigned contact = entries[i].contact;
+            groupContacts[i] = contact;
+
+            unsigned end = (contactArray[contact].particle[0] == entries[i].particle) ? 0 : 1;
+            contactGroups[contact*2 + end] = group;
+        }
+        groupStart.push_back((unsigned)entries.size());
+    }
+
+    unsigned ParticleContactIndex::getGroup(unsigned contact, unsigned end) const
+    {
+        return contactGroups[contact*2 + end];
+    }
+
+    unsigned ParticleContactIndex::getGroupSize(unsigned group) const
+    {
+        return groupStart[group+1] - groupStart[group];
+    }
+
+    const unsigned* ParticleContactIndex::getGroupContacts(unsigned group) const
+    {
+        return &groupContacts[groupStart[group]];
+    }
+
+    void ParticleContactIndex::updatePenetrations(ParticleContact* contactArray,
+                                                  unsigned resolved) const
+    {
+        const ParticleContact &contact = contactArray[resolved];
+        for(unsigned end = 0; end < 2; end++)
+        {
+            unsigned group = getGroup(resolved, end);
+            if(group == NO_GROUP) continue;
+
+            const unsigned *contacts = getGroupContacts(group);
+            unsigned count = getGroupSize(group);
+            for(unsigned i = 0; i < count; i++)
+            {
+                // A contact sharing both particles is in both groups,
+                // so the second group skips it.
+                ParticleContact &other = contactArray[contacts[i]];
+                if(end == 1 &&
+                   (other.particle[0] == contact.particle[0] ||
+                    other.particle[1] == contact.particle[0]))
                 {
-                    contactArray[i].penetration -= move[1] * contactArray[i].contactNormal;
+                    continue;
                 }
-                if (contactArray[i].particle[1])
+                updatePenetration(other, contact);
+            }
+        }
+    }
+
+    bool ParticleContactQueue::comesBefore(unsigned a, unsigned b) const
+    {
+        // Ties go to the lower index, as they do in the linear scan.
+        if(keys[a] != keys[b]) return keys[a] < keys[b];
+        return a < b;
+    }
+
+    void ParticleContactQueue::swapEntries(unsigned i, unsigned j)
+    {
+        unsigned a = heap[i];
+        unsigned b = heap[j];
+        heap[i] = b;
+        heap[j] = a;
+        heapPosition[b] = i;
+        heapPosition[a] = j;
+    }
+
+    void ParticleContactQueue::siftUp(unsigned i)
+    {
+        while(i > 0)
+        {
+            unsigned up = (i - 1) / 2;
+            if(!comesBefore(heap[i], heap[up])) break;
+            swapEntries(i, up);
+            i = up;
+        }
+    }
+
+    void ParticleContactQueue::siftDown(unsigned i)
+    {
+        unsigned size = (unsigned)heap.size();
+        for(;;)
+        {
+            unsigned best = i;
+            unsigned left = i*2 + 1;
+            unsigned right = left + 1;
+            if(left < size && comesBefore(heap[left], heap[best])) best = left;
+            if(right < size && comesBefore(heap[right], heap[best])) best = right;
+            if(best == i) break;
+            swapEntries(i, best);
+            i = best;
+        }
+    }
+
+    void ParticleContactQueue::updateKey(const ParticleContact* contactArray,
+                                         unsigned contact)
+    {
+        // Contacts that the linear scan would skip sort last.
+        real sepVel = contactArray[contact].calculateSeparatingVelocity();
+        if(sepVel < 0 || contactArray[contact].penetration > 0)
+        {
+            keys[contact] = sepVel;
+        }
+        else
+        {
+            keys[contact] = REAL_MAX;
+        }
+    }
+
+    unsigned ParticleContactQueue::resolve(ParticleContact* contactArray,
+                                           unsigned numContacts, real duration,
+                                           unsigned iterations)
+    {
+        PHY_PROFILE_SCOPE("ParticleContactQueue::resolve");
+        unsigned i;
+        if(numContacts == 0) return 0;
+
+        index.build(contactArray, numContacts);
+
+        keys.resize(numContacts);
+        heap.resize(numContacts);
+        heapPosition.resize(numContacts);
+        for(i = 0; i < numContacts; i++)
+        {
+            updateKey(contactArray, i);
+            heap[i] = i;
+            heapPosition[i] = i;
+        }
+        for(i = numContacts / 2; i > 0; i--)
+        {
+            siftDown(i - 1);
+        }
+
+        unsigned iterationsUsed = 0;
+        while(iterationsUsed < iterations)
+        {
+            // Do we have anything worth resolving?
+            unsigned top = heap[0];
+            if(!(keys[top] < REAL_MAX)) break;
+
+            contactArray[top].resolve(duration);
+            index.updatePenetrations(contactArray, top);
+
+            // Only the contacts sharing a particle with the resolved one
+            // have changed, so only they need new keys.
+            for(unsigned end = 0; end < 2; end++)
+            {
+                unsigned group = index.getGroup(top, end);
+                if(group == ParticleContactIndex::NO_GROUP) continue;
+
+                const unsigned *contacts = index.getGroupContacts(group);
+                unsigned count = index.getGroupSize(group);
+                for(i = 0; i < count; i++)
                 {
-                    if (contactArray[i].particle[1] == contactArray[maxIndex].particle[0])
-                    {
-                        contactArray[i].penetration += move[0] * contactArray[i].contactNormal;
-                    }
-                    else if (contactArray[i].particle[1] == contactArray[maxIndex].particle[1])
-                    {
-                        contactArray[i].penetration += move[1] * contactArray[i].contactNormal;
-                    }
+                    unsigned c = contacts[i];
+                    updateKey(contactArray, c);
+                    siftUp(heapPosition[c]);
+                    siftDown(heapPosition[c]);
                 }
             }
 
             iterationsUsed++;
         }
+
+        return iterationsUsed;
     }
 
+    /*
+     * Resolves one island per index. The island's contacts have already
+     * been gathered into a contiguous run of the scratch array.
+     */
+    class IslandResolveTask : public ParallelTask
+    {
+    public:
+        const ParticleContactIslands* islands;
+        ParticleContact* islandContacts;
+        unsigned* islandIterations;
+        ParticleContactIndex* indices;
+        ParticleContactQueue* queues;
+        real duration;
+        unsigned iterations;
+        unsigned numContacts;
+
+        virtual void run(unsigned island, unsigned thread)
+        {
+            PHY_PROFILE_SCOPE("IslandResolveTask::run");
+            unsigned offset = unsigned(islands->getIslandContacts(island) -
+                                       islands->getIslandContacts(0));
+            unsigned size = islands->getIslandSize(island);
+
+            // The island's share of the budget, rounded up.
+            unsigned budget = unsigned(((unsigned long long)iterations * size +
+                                        numContacts - 1) / numContacts);
 
+            if(queues)
+            {
+                islandIterations[island] = queues[thread].resolve(islandContacts + offset,
+                                                                  size, duration, budget);
+            }
+            else
+            {
+                islandIterations[island] = resolveSerial(islandContacts + offset,
+                                                         size, duration, budget,
+                                                         indices[thread]);
+            }
+        }
+    };
+
+    ParticleContactResolver::ParticleContactResolver(unsigned iterations)
+        : iterations(iterations), iterationsUsed(0),
+          selection(SELECT_LINEAR_SCAN), workers(NULL)
+    {
+
+    }
+
+    void ParticleContactResolver::setIterations(unsigned iterations)
+    {
+        ParticleContactResolver::iterations = iterations;
+    }
+
+    unsigned ParticleContactResolver::getIterationsUsed() const
+    {
+        return iterationsUsed;
+    }
+
+    void ParticleContactResolver::setSelection(ParticleContactSelection selection)
+    {
+        ParticleContactResolver::selection = selection;
+    }
+
+    ParticleContactSelection ParticleContactResolver::getSelection() const
+    {
+        return selection;
+    }
+
+    void ParticleContactResolver::setWorkerPool(WorkerPool* workers)
+    {
+        ParticleContactResolver::workers = workers;
+    }
+
+    void ParticleContactResolver::resolveIslands(ParticleContact* contactArray,
+                                                 unsigned numContacts, real duration)
+    {
+        PHY_PROFILE_SCOPE("ParticleContactResolver::resolveIslands");
+        unsigned threadCount = workers->getThreadCount();
+        if(indices.size() < threadCount) indices.resize(threadCount);
+
+        indices[0].build(contactArray, numContacts);
+        unsigned islandCount = islands.build(indices[0], numContacts);
+
+        // Gather the contacts island by island, so each island is a
+        // contiguous array the serial algorithm can work on.
+        const unsigned* order = islands.getIslandContacts(0);
+        islandContacts.resize(numContacts);
+        unsigned i;
+        for(i = 0; i < numContacts; i++)
+        {
+            islandContacts[i] = contactArray[order[i]];
+        }
+        islandIterations.resize(islandCount);
+
+        IslandResolveTask task;
+        task.islands = &islands;
+        task.islandContacts = &islandContacts[0];
+        task.islandIterations = &islandIterations[0];
+        task.duration = duration;
+        task.iterations = iterations;
+        task.numContacts = numContacts;
+        task.indices = &indices[0];
+        task.queues = NULL;
+        if(selection == SELECT_PRIORITY_QUEUE)
+        {
+            if(queues.size() < threadCount) queues.resize(threadCount);
+            task.queues = &queues[0];
+        }
+        workers->run(&task, islandCount);
+
+        // Write the results back in the caller's order.
+        for(i = 0; i < numContacts; i++)
+        {
+            contactArray[order[i]] = islandContacts[i];
+        }
+
+        iterationsUsed = 0;
+        for(i = 0; i < islandCount; i++)
+        {
+            iterationsUsed += islandIterations[i];
+        }
+    }
+
+    void ParticleContactResolver::resolveContacts(ParticleContact* contactArray,
+                         unsigned numContacts, real duration)
+    {
+        PHY_PROFILE_SCOPE("ParticleContactResolver::resolveContacts");
+
+        if(workers && numContacts > 0)
+        {
+            resolveIslands(contactArray, numContacts, duration);
+        }
+        else if(selection == SELECT_PRIORITY_QUEUE)
+        {
+            if(queues.empty()) queues.resize(1);
+            iterationsUsed = queues[0].resolve(contactArray, numContacts, duration, iterations);
+        }
+        else
+        {
+            if(indices.empty()) indices.resize(1);
+            iterationsUsed = resolveSerial(contactArray, numContacts, duration, iterations,
+                                           indices[0]);
+        }
+
+        PHY_PROFILE_COUNTER("iterations", iterationsUsed);
+    }
+
+    bool ParticleContactGenerator::saveState(Snapshot *,
+                                             const PointerIndex<Particle> &) const
+    {
+        return true;
+    }
+
+    bool ParticleContactGenerator::restoreState(SnapshotReader *,
+                                                Particle *const *, unsigned)
+    {
+        return true;
+    }
+
+    bool ParticleContactGenerator::addConstraint(ParticleXPBDSolver *,
+                                                 const PointerIndex<Particle> &) const
+    {
+        return false;
+    }
 }
@@ -1,10 +1,15 @@
 #ifndef PHY_PCONTACTS_H
 #define PHY_PCONTACTS_H
 
+#include <vector>
+#include <functional>
 #include "particle.h"
+#include "snapshot.h"
 
 namespace Phy
 {
+    class ParticleXPBDSolver;
+    class WorkerPool;
 
     class ParticleContact
     {
@@ -21,14 +26,158 @@ namespace Phy
         void resolveInterpenetration(real duration);
     };
 
+    /*
+     * Maps each particle to the contacts that touch it, so the contacts
+     * affected by resolving one contact can be found without scanning
+     * the whole array. The index is rebuilt every frame into flat arrays
+     * that keep their storage, so once they have grown to the largest
+     * contact count seen no more memory is allocated.
+     */
+    class ParticleContactIndex
+    {
+    protected:
+        struct ParticleEntry
+        {
+            Particle* particle;
+            unsigned contact;
+
+            bool operator<(const ParticleEntry &other) const
+            {
+                if(particle != other.particle)
+                {
+                    return std::less<Particle*>()(particle, other.particle);
+                }
+                return contact < other.contact;
+            }
+        };
+
+        std::vector<ParticleEntry> entries;
+        // The contacts of particle group g are
+        // groupContacts[groupStart[g]] .. groupContacts[groupStart[g+1]-1].
+        std::vector<unsigned> groupStart;
+        std::vector<unsigned> groupContacts;
+        // The group of each end of each contact, two per contact.
+        std::vector<unsigned> contactGroups;
+    public:
+        // Marks a contact end without a particle.
+        static const unsigned NO_GROUP = 0xffffffff;
+
+        void build(const ParticleContact* contactArray, unsigned numContacts);
+
+        // Returns the group of the given end of a contact, or NO_GROUP.
+        unsigned getGroup(unsigned contact, unsigned end) const;
+        unsigned getGroupSize(unsigned group) const;
+        // The contacts touching a group's particle, in ascending order.
+        const unsigned* getGroupContacts(unsigned group) const;
+
+        /* Adjusts the penetration of every contact that shares a
+         * particle with the given contact, after it has been resolved. */
+        void updatePenetrations(ParticleContact* contactArray,
+                                unsigned resolved) const;
+    };
+
+    /*
+     * Splits a set of contacts into islands: groups of contacts that are
+     * connected through shared particles. Contacts in different islands
+     * never touch the same particle, so they can be resolved independently.
+     */
+    class ParticleContactIslands
+    {
+    protected:
+        // Scratch arrays, kept between frames to avoid reallocating.
+        std::vector<unsigned> parent;
+        std::vector<unsigned> islandOf;
+        std::vector<unsigned> islandStart;
+        std::vector<unsigned> contactOrder;
+        unsigned islandCount;
+
+        unsigned findRoot(unsigned contact);
+    public:
+        ParticleContactIslands();
+
+        /* Groups the contacts and returns the number of islands found.
+         * The index must have been built from the same contacts. */
+        unsigned build(const ParticleContactIndex &index, unsigned numContacts);
+
+        unsigned getIslandCount() const;
+        unsigned getIslandSize(unsigned island) const;
+        // Returns the indices of the contacts in the given island, in
+        // the same relative order as the original array.
+        const unsigned* getIslandContacts(unsigned island) const;
+    };
+
+    /*
+     * Resolves contacts in the same order as the serial linear scan,
+     * but keeps them in an indexed binary heap keyed on separating
+     * velocity. After each resolution only the contacts that share a
+     * particle with the resolved one are re-keyed, so a frame costs
+     * O(n log n) for sparse contact graphs instead of O(n^2).
+     */
+    class ParticleContactQueue
+    {
+    protected:
+        ParticleContactIndex index;
+        std::vector<unsigned> heap;
+        std::vector<unsigned> heapPosition;
+        std::vector<real> keys;
+
+        bool comesBefore(unsigned a, unsigned b) const;
+        void swapEntries(unsigned i, unsigned j);
+        void siftUp(unsigned i);
+        void siftDown(unsigned i);
+        void updateKey(const ParticleContact* contactArray, unsigned contact);
+    public:
+        // Returns the number of iterations used.
+        unsigned resolve(ParticleContact* contactArray, unsigned numContacts,
+                         real duration, unsigned iterations);
+    };
+
+    // How the resolver picks the next contact to resolve.
+    enum ParticleContactSelection
+    {
+        // Scan every contact on every iteration.
+        SELECT_LINEAR_SCAN = 0,
+        // Keep the contacts in a ParticleContactQueue.
+        SELECT_PRIORITY_QUEUE
+    };
+
     class ParticleContactResolver
     {
     protected:
         unsigned iterations;
         unsigned iterationsUsed;
+        ParticleContactSelection selection;
+
+        WorkerPool* workers;
+        ParticleContactIslands islands;
+        std::vector<ParticleContact> islandContacts;
+        std::vector<unsigned> islandIterations;
+
+        // Scratch space for each worker thread.
+        std::vector<ParticleContactIndex> indices;
+        std::vector<ParticleContactQueue> queues;
+
+        void resolveIslands(ParticleContact* contactArray,
+                            unsigned numContacts, real duration);
     public:
         ParticleContactResolver(unsigned iterations);
         void setIterations(unsigned iterations);
+        unsigned getIterationsUsed() const;
+
+        // Both strategies resolve the contacts in the same order.
+        void setSelection(ParticleContactSelection selection);
+        ParticleContactSelection getSelection() const;
+
+        /*
+         * Sets a pool of worker threads. While one is set the resolver
+         * splits the contacts into islands and resolves each island on
+         * its own, in parallel. Each island runs the serial algorithm
+         * with a share of the iteration budget proportional to its
+         * number of contacts, so it ends up exactly where the serial
+         * resolver leaves it when given that island alone. Pass NULL
+         * to go back to serial mode.
+         */
+        void setWorkerPool(WorkerPool* workers);
 
         // resolves a set of particles contacts for both penetatrion and velocity
         void resolveContacts(ParticleContact* contactArray,
@@ -40,6 +189,25 @@ namespace Phy
     public:
         virtual unsigned addContact(ParticleContact* contact,
                                     unsigned limit) const = 0;
+
+        /* Writes whatever the generator keeps between frames to a
+         * snapshot of the world, with its particles as their positions
+         * in the world's particle list, and reads it back. Generators
+         * that search the world afresh each frame keep nothing, which
+         * is what these do unless overridden. Return false if a
+         * particle is not in the world, or the snapshot doesn't hold
+         * what was expected. */
+        virtual bool saveState(Snapshot *snapshot,
+                               const PointerIndex<Particle> &particles) const;
+        virtual bool restoreState(SnapshotReader *reader,
+                                  Particle *const *particles, unsigned count);
+
+        /* Adds the generator to the solver as position constraints,
+         * with its particles as their positions in the world's
+         * particle list, and returns true if it did. Only links can;
+         * every other generator keeps generating contacts. */
+        virtual bool addConstraint(ParticleXPBDSolver *solver,
+                                   const PointerIndex<Particle> &particles) const;
     };
 
 }
@@ -81,4 +81,19 @@ namespace Phy
         }
     }
 
+    unsigned ParticleForceRegistry::getCount() const
+    {
+        return (unsigned)registrations.size();
+    }
+
+    Particle* ParticleForceRegistry::getParticle(unsigned registration) const
+    {
+        return registrations[registration].particle;
+    }
+
+    ParticleForceGenerator* ParticleForceRegistry::getForceGenerator(unsigned registration) const
+    {
+        return registrations[registration].fg;
+    }
+
 }
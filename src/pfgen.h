@@ -58,6 +58,11 @@ namespace Phy
         void clear();
         void updateForces(real duration);
 
+        // The registrations, in the order they were added.
+        unsigned getCount() const;
+        Particle* getParticle(unsigned registration) const;
+        ParticleForceGenerator* getForceGenerator(unsigned registration) const;
+
     };
 }
 
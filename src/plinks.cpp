@@ -1,4 +1,5 @@
 #include "plinks.h"
+#include "pxpbd.h"
 
 namespace Phy
 {
@@ -125,5 +126,164 @@ namespace Phy
         return 1;
     }
 
+    bool ParticleLink::saveState(Snapshot *snapshot,
+                                 const PointerIndex<Particle> &particles) const
+    {
+        unsigned ends[2] = { particles.find(particle[0]), particles.find(particle[1]) };
+        if(ends[0] == PointerIndex<Particle>::NOT_FOUND ||
+           ends[1] == PointerIndex<Particle>::NOT_FOUND) return false;
+        snapshot->write(ends, sizeof(ends));
+        return true;
+    }
+
+    bool ParticleLink::restoreState(SnapshotReader *reader,
+                                    Particle *const *particles, unsigned count)
+    {
+        unsigned ends[2];
+        if(!reader->read(ends, sizeof(ends))) return false;
+        if(ends[0] >= count || ends[1] >= count) return false;
+        particle[0] = particles[ends[0]];
+        particle[1] = particles[ends[1]];
+        return true;
+    }
+
+    bool ParticleCable::saveState(Snapshot *snapshot,
+                                  const PointerIndex<Particle> &particles) const
+    {
+        if(!ParticleLink::saveState(snapshot, particles)) return false;
+        real values[2] = { maxLength, restitution };
+        snapshot->write(values, sizeof(values));
+        return true;
+    }
+
+    bool ParticleCable::restoreState(SnapshotReader *reader,
+                                     Particle *const *particles, unsigned count)
+    {
+        real values[2];
+        if(!ParticleLink::restoreState(reader, particles, count) ||
+           !reader->read(values, sizeof(values))) return false;
+        maxLength = values[0];
+        restitution = values[1];
+        return true;
+    }
+
+    bool ParticleRod::saveState(Snapshot *snapshot,
+                                const PointerIndex<Particle> &particles) const
+    {
+        if(!ParticleLink::saveState(snapshot, particles)) return false;
+        snapshot->write(&length, sizeof(real));
+        return true;
+    }
+
+    bool ParticleRod::restoreState(SnapshotReader *reader,
+                                   Particle *const *particles, unsigned count)
+    {
+        return ParticleLink::restoreState(reader, particles, count) &&
+               reader->read(&length, sizeof(real));
+    }
+
+    bool ParticleConstraint::saveState(Snapshot *snapshot,
+                                       const PointerIndex<Particle> &particles) const
+    {
+        unsigned index = particles.find(particle);
+        if(index == PointerIndex<Particle>::NOT_FOUND) return false;
+        snapshot->writeUnsigned(index);
+        real point[3] = { anchor.x, anchor.y, anchor.z };
+        snapshot->write(point, sizeof(point));
+        return true;
+    }
+
+    bool ParticleConstraint::restoreState(SnapshotReader *reader,
+                                          Particle *const *particles, unsigned count)
+    {
+        unsigned index = reader->readUnsigned();
+        real point[3];
+        if(!reader->read(point, sizeof(point)) || index >= count) return false;
+        particle = particles[index];
+        anchor = Vector3(point[0], point[1], point[2]);
+        return true;
+    }
+
+    bool ParticleCableConstraint::saveState(Snapshot *snapshot,
+                                            const PointerIndex<Particle> &particles) const
+    {
+        if(!ParticleConstraint::saveState(snapshot, particles)) return false;
+        real values[2] = { maxLength, restitution };
+        snapshot->write(values, sizeof(values));
+        return true;
+    }
 
+    bool ParticleCableConstraint::restoreState(SnapshotReader *reader,
+                                               Particle *const *particles, unsigned count)
+    {
+        real values[2];
+        if(!ParticleConstraint::restoreState(reader, particles, count) ||
+           !reader->read(values, sizeof(values))) return false;
+        maxLength = values[0];
+        restitution = values[1];
+        return true;
+    }
+
+    bool ParticleRodConstraint::saveState(Snapshot *snapshot,
+                                          const PointerIndex<Particle> &particles) const
+    {
+        if(!ParticleConstraint::saveState(snapshot, particles)) return false;
+        snapshot->write(&length, sizeof(real));
+        return true;
+    }
+
+    bool ParticleRodConstraint::restoreState(SnapshotReader *reader,
+                                             Particle *const *particles, unsigned count)
+    {
+        return ParticleConstraint::restoreState(reader, particles, count) &&
+               reader->read(&length, sizeof(real));
+    }
+
+    // Finds the particles of a link in the world, or returns false.
+    static bool findEnds(const PointerIndex<Particle> &particles,
+                         Particle *const *ends, unsigned count, unsigned *indices)
+    {
+        for(unsigned i = 0; i < count; i++)
+        {
+            indices[i] = particles.find(ends[i]);
+            if(indices[i] == PointerIndex<Particle>::NOT_FOUND) return false;
+        }
+        return true;
+    }
+
+    bool ParticleCable::addConstraint(ParticleXPBDSolver *solver,
+                                      const PointerIndex<Particle> &particles) const
+    {
+        unsigned ends[2];
+        if(!findEnds(particles, particle, 2, ends)) return false;
+        solver->addLink(ends[0], ends[1], maxLength, true);
+        return true;
+    }
+
+    bool ParticleRod::addConstraint(ParticleXPBDSolver *solver,
+                                    const PointerIndex<Particle> &particles) const
+    {
+        unsigned ends[2];
+        if(!findEnds(particles, particle, 2, ends)) return false;
+        solver->addLink(ends[0], ends[1], length, false);
+        return true;
+    }
+
+    bool ParticleCableConstraint::addConstraint(ParticleXPBDSolver *solver,
+                                                const PointerIndex<Particle> &particles) const
+    {
+        unsigned end;
+        if(!findEnds(particles, &particle, 1, &end)) return false;
+        solver->addAnchoredLink(end, anchor, maxLength, true);
+        return true;
+    }
+
+    bool ParticleRodConstraint::addConstraint(ParticleXPBDSolver *solver,
+                                              const PointerIndex<Particle> &particles) const
+    {
+        unsigned end;
+        if(!findEnds(particles, &particle, 1, &end)) return false;
+        solver->addAnchoredLink(end, anchor, length, false);
+        return true;
+    }
 }
@@ -12,6 +12,12 @@ namespace Phy
     protected:
         real currentLength() const;
     public:
+        // Snapshots hold the particles of the link.
+        virtual bool saveState(Snapshot *snapshot,
+                               const PointerIndex<Particle> &particles) const;
+        virtual bool restoreState(SnapshotReader *reader,
+                                  Particle *const *particles, unsigned count);
+
         /**
          * Geneates the contacts to keep this link from being
          * violated. This class can only ever generate a single
@@ -36,6 +42,12 @@ namespace Phy
     public:
         virtual unsigned addContact(ParticleContact *contact,
                                     unsigned limit) const;
+        virtual bool saveState(Snapshot *snapshot,
+                               const PointerIndex<Particle> &particles) const;
+        virtual bool restoreState(SnapshotReader *reader,
+                                  Particle *const *particles, unsigned count);
+        virtual bool addConstraint(ParticleXPBDSolver *solver,
+                                   const PointerIndex<Particle> &particles) const;
     };
 
     class ParticleRod : public ParticleLink
@@ -45,6 +57,12 @@ namespace Phy
     public:
         virtual unsigned addContact(ParticleContact *contact,
                                     unsigned limit) const;
+        virtual bool saveState(Snapshot *snapshot,
+                               const PointerIndex<Particle> &particles) const;
+        virtual bool restoreState(SnapshotReader *reader,
+                                  Particle *const *particles, unsigned count);
+        virtual bool addConstraint(ParticleXPBDSolver *solver,
+                                   const PointerIndex<Particle> &particles) const;
     };
 
 
@@ -58,6 +76,12 @@ namespace Phy
     public:
         virtual unsigned addContact(ParticleContact *contact,
                                     unsigned limit) const = 0;
+
+        // Snapshots hold the particle and the anchor.
+        virtual bool saveState(Snapshot *snapshot,
+                               const PointerIndex<Particle> &particles) const;
+        virtual bool restoreState(SnapshotReader *reader,
+                                  Particle *const *particles, unsigned count);
     };
 
     class ParticleCableConstraint : public ParticleConstraint
@@ -68,6 +92,12 @@ namespace Phy
     public:
         virtual unsigned addContact(ParticleContact *contact,
                                     unsigned limit) const;
+        virtual bool saveState(Snapshot *snapshot,
+                               const PointerIndex<Particle> &particles) const;
+        virtual bool restoreState(SnapshotReader *reader,
+                                  Particle *const *particles, unsigned count);
+        virtual bool addConstraint(ParticleXPBDSolver *solver,
+                                   const PointerIndex<Particle> &particles) const;
     };
 
     class ParticleRodConstraint : public ParticleConstraint
@@ -77,6 +107,12 @@ namespace Phy
     public:
         virtual unsigned addContact(ParticleContact *contact,
                                     unsigned limit) const;
+        virtual bool saveState(Snapshot *snapshot,
+                               const PointerIndex<Particle> &particles) const;
+        virtual bool restoreState(SnapshotReader *reader,
+                                  Particle *const *particles, unsigned count);
+        virtual bool addConstraint(ParticleXPBDSolver *solver,
+                                   const PointerIndex<Particle> &particles) const;
     };
 
 };
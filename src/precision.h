@@ -26,6 +26,7 @@
 #define PHY_PRECISION_H
 
 #include <float.h>
+#include <math.h>
 
 namespace Phy {
 
@@ -63,6 +64,9 @@ namespace Phy {
 
     /** Defines the precision of the floating point modulo operator. */
     #define real_fmod fmodf
+
+    /** Defines the precision of the floor operator. */
+    #define real_floor floorf
     
     /** Defines the number e on which 1+e == 1 **/
     #define real_epsilon FLT_EPSILON
@@ -79,9 +83,46 @@ namespace Phy {
     #define real_exp exp
     #define real_pow pow
     #define real_fmod fmod
+    #define real_floor floor
     #define real_epsilon DBL_EPSILON
     #define R_PI 3.14159265358979
 #endif
+
+    /**
+     * The mathematical functions for a given scalar type, so code that
+     * is templated on its precision (such as Vector3T) can call the
+     * right ones. Code at the library's own precision keeps using real
+     * and the defines above.
+     */
+    template<class T> struct ScalarTraits;
+
+    template<> struct ScalarTraits<float>
+    {
+        static float max() { return FLT_MAX; }
+        static float epsilon() { return FLT_EPSILON; }
+        static float sqrt(float value) { return sqrtf(value); }
+        static float abs(float value) { return fabsf(value); }
+        static float sin(float value) { return sinf(value); }
+        static float cos(float value) { return cosf(value); }
+        static float exp(float value) { return expf(value); }
+        static float pow(float base, float exponent) { return powf(base, exponent); }
+        static float fmod(float value, float divisor) { return fmodf(value, divisor); }
+        static float floor(float value) { return floorf(value); }
+    };
+
+    template<> struct ScalarTraits<double>
+    {
+        static double max() { return DBL_MAX; }
+        static double epsilon() { return DBL_EPSILON; }
+        static double sqrt(double value) { return ::sqrt(value); }
+        static double abs(double value) { return ::fabs(value); }
+        static double sin(double value) { return ::sin(value); }
+        static double cos(double value) { return ::cos(value); }
+        static double exp(double value) { return ::exp(value); }
+        static double pow(double base, double exponent) { return ::pow(base, exponent); }
+        static double fmod(double value, double divisor) { return ::fmod(value, divisor); }
+        static double floor(double value) { return ::floor(value); }
+    };
 }
 
 #endif // CYCLONE_PRECISION_H
@@ -0,0 +1,130 @@
+#include "profile.h"
+
+#ifdef PHY_PROFILE
+
+#include <cstdio>
+#include <chrono>
+#include <mutex>
+
+namespace Phy
+{
+    bool Profiler::recording = false;
+
+    typedef std::chrono::steady_clock ProfileClock;
+
+    static std::mutex threadsMutex;
+    // The buffers of every thread that has recorded, never freed so a
+    // trace can still be written after a worker thread has gone.
+    static std::vector<Profiler::ThreadEvents*> threads;
+    static thread_local Profiler::ThreadEvents *localEvents = NULL;
+
+    static ProfileClock::time_point getOrigin()
+    {
+        static ProfileClock::time_point origin = ProfileClock::now();
+        return origin;
+    }
+
+    Profiler::ThreadEvents &Profiler::getThreadEvents()
+    {
+        if(!localEvents)
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            localEvents = new ThreadEvents;
+            localEvents->thread = (unsigned)threads.size();
+            threads.push_back(localEvents);
+        }
+        return *localEvents;
+    }
+
+    void Profiler::start()
+    {
+        clear();
+        getOrigin();
+        recording = true;
+    }
+
+    void Profiler::stop()
+    {
+        recording = false;
+    }
+
+    void Profiler::clear()
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for(unsigned i = 0; i < threads.size(); i++)
+        {
+            threads[i]->events.clear();
+        }
+    }
+
+    long long Profiler::now()
+    {
+        return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            ProfileClock::now() - getOrigin()).count();
+    }
+
+    void Profiler::addScope(const char *name, long long start, long long end)
+    {
+        Event event = { name, start, end - start, false };
+        getThreadEvents().events.push_back(event);
+    }
+
+    void Profiler::addCounter(const char *name, long long value)
+    {
+        Event event = { name, now(), value, true };
+        getThreadEvents().events.push_back(event);
+    }
+
+    unsigned Profiler::getEventCount()
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        unsigned count = 0;
+        for(unsigned i = 0; i < threads.size(); i++)
+        {
+            count += (unsigned)threads[i]->events.size();
+        }
+        return count;
+    }
+
+    bool Profiler::writeChromeTrace(const char *filename)
+    {
+        FILE *file = fopen(filename, "w");
+        if(!file) return false;
+
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        for(unsigned t = 0; t < threads.size(); t++)
+        {
+            const ThreadEvents &buffer = *threads[t];
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                    "\"args\":{\"name\":\"%s %u\"}}",
+                    first ? "" : ",\n", buffer.thread,
+                    buffer.thread ? "worker" : "main", buffer.thread);
+            first = false;
+
+            // Timestamps are in microseconds.
+            for(unsigned i = 0; i < buffer.events.size(); i++)
+            {
+                const Event &event = buffer.events[i];
+                if(event.counter)
+                {
+                    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,"
+                            "\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+                            event.name, buffer.thread, event.start * 1e-3, event.value);
+                }
+                else
+                {
+                    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                            "\"ts\":%.3f,\"dur\":%.3f}",
+                            event.name, buffer.thread, event.start * 1e-3, event.value * 1e-3);
+                }
+            }
+        }
+        fprintf(file, "\n]}\n");
+
+        return fclose(file) == 0;
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef PHY_PROFILE_H
+#define PHY_PROFILE_H
+
+/*
+ * Optional instrumentation of the simulation phases. Build with
+ * PHY_PROFILE defined, and every PHY_PROFILE_SCOPE records a timed
+ * event from its line to the end of its block, and every
+ * PHY_PROFILE_COUNTER records a sample of a counter, while the
+ * profiler is recording. Without PHY_PROFILE the macros compile to
+ * nothing and their arguments are not evaluated.
+ *
+ * The recorded events can be written as a Chrome trace, which loads
+ * in chrome://tracing and in Perfetto.
+ */
+
+#ifdef PHY_PROFILE
+
+#include <vector>
+
+namespace Phy
+{
+    class Profiler
+    {
+    public:
+        struct Event
+        {
+            // Names must be string literals, or otherwise outlive the recording.
+            const char *name;
+            long long start;
+            // The duration of a scope, or the value of a counter.
+            long long value;
+            bool counter;
+        };
+
+        // Every thread records into its own buffer, without locking.
+        struct ThreadEvents
+        {
+            unsigned thread;
+            std::vector<Event> events;
+        };
+
+    protected:
+        static bool recording;
+        static ThreadEvents &getThreadEvents();
+
+    public:
+        /* Clears the recorded events and starts recording. Recording is
+         * off until this is called. Start, stop and clear must not be
+         * called while a step is running on other threads.
+         */
+        static void start();
+        static void stop();
+        static void clear();
+
+        static bool isRecording()
+        {
+            return recording;
+        }
+
+        // Nanoseconds since the profiler was first used.
+        static long long now();
+
+        static void addScope(const char *name, long long start, long long end);
+        static void addCounter(const char *name, long long value);
+
+        // The number of events recorded over all threads.
+        static unsigned getEventCount();
+
+        /* Writes the recorded events in the Chrome trace event format.
+         * Returns false if the file could not be written.
+         */
+        static bool writeChromeTrace(const char *filename);
+    };
+
+    class ProfileScope
+    {
+        const char *name;
+        long long start;
+    public:
+        ProfileScope(const char *name)
+            : name(name), start(Profiler::isRecording() ? Profiler::now() : -1)
+        {
+        }
+
+        ~ProfileScope()
+        {
+            if(start >= 0) Profiler::addScope(name, start, Profiler::now());
+        }
+    };
+}
+
+#define PHY_PROFILE_JOIN2(a, b) a##b
+#define PHY_PROFILE_JOIN(a, b) PHY_PROFILE_JOIN2(a, b)
+
+#define PHY_PROFILE_SCOPE(name) \
+    Phy::ProfileScope PHY_PROFILE_JOIN(profileScope, __LINE__)(name)
+#define PHY_PROFILE_COUNTER(name, value) \
+    do { if(Phy::Profiler::isRecording()) \
+        Phy::Profiler::addCounter(name, (long long)(value)); } while(0)
+// Code that only exists to feed a counter.
+#define PHY_PROFILE_ONLY(code) code
+
+#else
+
+#define PHY_PROFILE_SCOPE(name)
+#define PHY_PROFILE_COUNTER(name, value)
+#define PHY_PROFILE_ONLY(code)
+
+#endif
+
+#endif
@@ -1,23 +1,25 @@
 #include <cstddef>
+#include <cstring>
 #include "pworld.h"
+#include "profile.h"
 
 namespace Phy
 {
 
-    ParticleWorld::ParticleWorld(unsigned maxContacts, unsigned iterations)
-        : resolver(iterations), maxContacts(maxContacts)
+    ParticleWorld::ParticleWorld(unsigned initialContacts, unsigned iterations)
+        : resolver(iterations), contacts(initialContacts), constraintsDirty(true)
     {
-        contacts = new ParticleContact[maxContacts];
         calculateIterations = (iterations == 0);
+        xpbd.setVariant(LINKS_AS_CONTACTS);
     }
 
     ParticleWorld::~ParticleWorld()
     {
-        delete[] contacts;
     }
 
     void ParticleWorld::startFrame()
     {
+        PHY_PROFILE_SCOPE("ParticleWorld::startFrame");
         for(Particles::iterator p = particles.begin();
             p != particles.end();
             p++)
@@ -28,24 +30,43 @@ namespace Phy
 
     unsigned ParticleWorld::generateContacts()
     {
-        unsigned limit = maxContacts;
-        ParticleContact* nextContact = contacts;
-        for(ContactGenerators::iterator g = contactGenerators.begin();
-            g != contactGenerators.end();
+        PHY_PROFILE_SCOPE("ParticleWorld::generateContacts");
+        contacts.reset();
+
+        // The links kept by the XPBD solver make no contacts.
+        ContactGenerators* generators = &contactGenerators;
+        if(xpbd.getVariant() != LINKS_AS_CONTACTS)
+        {
+            updateConstraints();
+            generators = &contactOnlyGenerators;
+        }
+
+        for(ContactGenerators::iterator g = generators->begin();
+            g != generators->end();
             g++)
         {
+            PHY_PROFILE_SCOPE("ParticleContactGenerator::addContact");
+            unsigned limit;
+            ParticleContact* nextContact = contacts.reserve(1, &limit);
             unsigned used = (*g)->addContact(nextContact, limit);
-            limit -= used;
-            nextContact += used;
 
-            if(limit <= 0) break;
+            // A generator that filled its room may have had more to
+            // add, so it is run again with twice the room.
+            while(used == limit)
+            {
+                nextContact = contacts.reserve(limit * 2, &limit);
+                used = (*g)->addContact(nextContact, limit);
+            }
+            contacts.commit(used);
         }
 
-        return maxContacts - limit;
+        PHY_PROFILE_COUNTER("contacts", contacts.getCount());
+        return contacts.getCount();
     }
 
     void ParticleWorld::integrate(real duration)
     {
+        PHY_PROFILE_SCOPE("ParticleWorld::integrate");
         for(Particles::iterator p = particles.begin();
             p != particles.end();
             p++)
@@ -56,19 +77,88 @@ namespace Phy
 
     void ParticleWorld::runPhysics(real duration)
     {
-        registry.updateForces(duration);
+        PHY_PROFILE_SCOPE("ParticleWorld::runPhysics");
 
-        integrate(duration);
+        {
+            PHY_PROFILE_SCOPE("ParticleForceRegistry::updateForces");
+            registry.updateForces(duration);
+        }
+
+        if(xpbd.getVariant() != LINKS_AS_CONTACTS)
+        {
+            updateConstraints();
+            unsigned substeps = xpbd.getSubsteps();
+            real substep = duration / real(substeps);
+            for(unsigned s = 0; s < substeps; s++)
+            {
+                predict(substep, s + 1 == substeps);
+                xpbd.solve(particles.empty() ? NULL : &particles[0], substep);
+            }
+        }
+        else
+        {
+            integrate(duration);
+        }
 
         unsigned usedContacts = generateContacts();
 
         if(usedContacts)
         {
             if(calculateIterations) resolver.setIterations(usedContacts * 2);
-            resolver.resolveContacts(contacts, usedContacts, duration);
+            resolver.resolveContacts(contacts.gather(), usedContacts, duration);
         }
     }
 
+    void ParticleWorld::predict(real duration, bool lastSubstep)
+    {
+        PHY_PROFILE_SCOPE("ParticleWorld::predict");
+        for(Particles::iterator p = particles.begin();
+            p != particles.end();
+            p++)
+        {
+            // The step moves the particle by its new velocity, rather
+            // than its old one, so the solver's corrections of the
+            // position and velocity agree.
+            Particle* particle = *p;
+
+            // Particles of infinite mass aren't moved, as in integrate.
+            if(particle->getInverseMass() <= 0.0f) continue;
+
+            Vector3 start = particle->position;
+            Vector3 force = particle->forceAccum;
+            particle->integrate(duration);
+            particle->position = start;
+            if(!lastSubstep) particle->forceAccum = force;
+            particle->position.addScaledVector(particle->velocity, duration);
+        }
+    }
+
+    void ParticleWorld::updateConstraints()
+    {
+        if(!constraintsDirty && constraintGenerators == contactGenerators &&
+           constraintParticles == particles)
+        {
+            return;
+        }
+
+        PHY_PROFILE_SCOPE("ParticleWorld::updateConstraints");
+        unsigned particleCount = (unsigned)particles.size();
+        particleIndex.build(particleCount ? &particles[0] : NULL, particleCount);
+        xpbd.clear(particleCount);
+        contactOnlyGenerators.clear();
+        for(unsigned g = 0; g < contactGenerators.size(); g++)
+        {
+            if(!contactGenerators[g]->addConstraint(&xpbd, particleIndex))
+            {
+                contactOnlyGenerators.push_back(contactGenerators[g]);
+            }
+        }
+
+        constraintGenerators = contactGenerators;
+        constraintParticles = particles;
+        constraintsDirty = false;
+    }
+
     ParticleWorld::Particles& ParticleWorld::getParticles()
     {
         return particles;
@@ -84,6 +174,188 @@ namespace Phy
         return registry;
     }
 
+    ParticleContactResolver& ParticleWorld::getResolver()
+    {
+        return resolver;
+    }
+
+    unsigned ParticleWorld::getContactHighWaterMark() const
+    {
+        return contacts.getHighWaterMark();
+    }
+
+    void ParticleWorld::setLinkSolver(ParticleLinkSolver solver)
+    {
+        xpbd.setVariant(solver);
+    }
+
+    ParticleLinkSolver ParticleWorld::getLinkSolver() const
+    {
+        return xpbd.getVariant();
+    }
+
+    ParticleXPBDSolver& ParticleWorld::getXPBDSolver()
+    {
+        return xpbd;
+    }
+
+    void ParticleWorld::rebuildConstraints()
+    {
+        constraintsDirty = true;
+    }
+
+    // Identifies a particle world snapshot, and its version.
+    static const char PARTICLE_WORLD_MAGIC[4] = { 'P', 'H', 'Y', 'P' };
+    static const unsigned PARTICLE_WORLD_VERSION = 1;
+
+    // Written in place of the registration count when there are none.
+    static const unsigned NO_REGISTRATIONS = 0xffffffff;
+
+    // Position, velocity, acceleration and force, damping and inverse mass.
+    static const unsigned PARTICLE_STATE_REALS = 14;
+
+    bool ParticleWorld::saveState(Snapshot *snapshot,
+                                  const ForceGenerators *forceGenerators) const
+    {
+        PHY_PROFILE_SCOPE("ParticleWorld::saveState");
+        snapshot->clear();
+        unsigned particleCount = (unsigned)particles.size();
+        particleIndex.build(particleCount ? &particles[0] : NULL, particleCount);
+
+        snapshot->write(PARTICLE_WORLD_MAGIC, 4);
+        unsigned header[5] = { PARTICLE_WORLD_VERSION, (unsigned)sizeof(real), particleCount,
+                               (unsigned)contactGenerators.size(),
+                               forceGenerators ? registry.getCount() : NO_REGISTRATIONS };
+        snapshot->write(header, sizeof(header));
+
+        if(particleCount)
+        {
+            real *state = (real *)snapshot->extend(particleCount * PARTICLE_STATE_REALS * sizeof(real));
+            for(unsigned i = 0; i < particleCount; i++)
+            {
+                const Particle *particle = particles[i];
+                memcpy(state, &particle->position.x, 3 * sizeof(real));
+                memcpy(state + 3, &particle->velocity.x, 3 * sizeof(real));
+                memcpy(state + 6, &particle->acceleration.x, 3 * sizeof(real));
+                memcpy(state + 9, &particle->forceAccum.x, 3 * sizeof(real));
+                state[12] = particle->damping;
+                state[13] = particle->getInverseMass();
+                state += PARTICLE_STATE_REALS;
+            }
+        }
+
+        if(forceGenerators && registry.getCount())
+        {
+            unsigned generatorCount = (unsigned)forceGenerators->size();
+            forceGeneratorIndex.build(generatorCount ? &(*forceGenerators)[0] : NULL, generatorCount);
+
+            unsigned count = registry.getCount();
+            unsigned *pairs = (unsigned *)snapshot->extend(count * 2 * sizeof(unsigned));
+            for(unsigned r = 0; r < count; r++)
+            {
+                pairs[r*2] = particleIndex.find(registry.getParticle(r));
+                pairs[r*2 + 1] = forceGeneratorIndex.find(registry.getForceGenerator(r));
+                if(pairs[r*2] == PointerIndex<Particle>::NOT_FOUND ||
+                   pairs[r*2 + 1] == PointerIndex<ParticleForceGenerator>::NOT_FOUND)
+                {
+                    return false;
+                }
+            }
+        }
+
+        // Each generator's state is preceded by its size, which the
+        // restore checks it reads back exactly.
+        for(unsigned g = 0; g < contactGenerators.size(); g++)
+        {
+            unsigned sizeOffset = snapshot->getSize();
+            snapshot->writeUnsigned(0);
+            if(!contactGenerators[g]->saveState(snapshot, particleIndex)) return false;
+            snapshot->patchUnsigned(sizeOffset, snapshot->getSize() - sizeOffset - sizeof(unsigned));
+        }
+        return true;
+    }
+
+    bool ParticleWorld::restoreState(const Snapshot &snapshot,
+                                     const ForceGenerators *forceGenerators)
+    {
+        PHY_PROFILE_SCOPE("ParticleWorld::restoreState");
+        SnapshotReader reader(snapshot);
+        const unsigned char *magic = reader.take(4);
+        unsigned header[5];
+        if(!magic || memcmp(magic, PARTICLE_WORLD_MAGIC, 4) || !reader.read(header, sizeof(header)))
+        {
+            return false;
+        }
+
+        unsigned particleCount = (unsigned)particles.size();
+        if(header[0] != PARTICLE_WORLD_VERSION || header[1] != sizeof(real) ||
+           header[2] != particleCount || header[3] != contactGenerators.size())
+        {
+            return false;
+        }
+
+        // Find and check everything before changing anything.
+        const real *state = NULL;
+        if(particleCount)
+        {
+            state = (const real *)reader.take(particleCount * PARTICLE_STATE_REALS * sizeof(real));
+            if(!state) return false;
+        }
+
+        unsigned registrationCount = header[4];
+        const unsigned *pairs = NULL;
+        if(registrationCount != NO_REGISTRATIONS && registrationCount)
+        {
+            pairs = (const unsigned *)reader.take(registrationCount * 2 * sizeof(unsigned));
+            if(!pairs) return false;
+            if(forceGenerators)
+            {
+                for(unsigned r = 0; r < registrationCount; r++)
+                {
+                    if(pairs[r*2] >= particleCount ||
+                       pairs[r*2 + 1] >= forceGenerators->size()) return false;
+                }
+            }
+        }
+
+        for(unsigned i = 0; i < particleCount; i++)
+        {
+            Particle *particle = particles[i];
+            memcpy(&particle->position.x, state, 3 * sizeof(real));
+            memcpy(&particle->velocity.x, state + 3, 3 * sizeof(real));
+            memcpy(&particle->acceleration.x, state + 6, 3 * sizeof(real));
+            memcpy(&particle->forceAccum.x, state + 9, 3 * sizeof(real));
+            particle->damping = state[12];
+            particle->setInverseMass(state[13]);
+            state += PARTICLE_STATE_REALS;
+        }
+
+        if(registrationCount != NO_REGISTRATIONS && forceGenerators)
+        {
+            registry.clear();
+            for(unsigned r = 0; r < registrationCount; r++)
+            {
+                registry.add(particles[pairs[r*2]], (*forceGenerators)[pairs[r*2 + 1]]);
+            }
+        }
+
+        // The links may have been given other particles and lengths.
+        constraintsDirty = true;
+        for(unsigned g = 0; g < contactGenerators.size(); g++)
+        {
+            unsigned size = reader.readUnsigned();
+            unsigned start = reader.getOffset();
+            if(reader.getFailed() ||
+               !contactGenerators[g]->restoreState(&reader, particleCount ? &particles[0] : NULL,
+                                                   particleCount) ||
+               reader.getOffset() - start != size)
+            {
+                return false;
+            }
+        }
+        return reader.atEnd();
+    }
+
     void GroundContacts::init(ParticleWorld::Particles* particles)
     {
         GroundContacts::particles = particles;
@@ -113,4 +385,232 @@ namespace Phy
         return count;
     }
 
+    ParticleGridContacts::ParticleGridContacts()
+        : particles(NULL), radius(1), restitution(0)
+    {
+    }
+
+    void ParticleGridContacts::init(ParticleWorld::Particles* particles,
+                                    real radius, real restitution)
+    {
+        ParticleGridContacts::particles = particles;
+        ParticleGridContacts::radius = radius;
+        ParticleGridContacts::restitution = restitution;
+    }
+
+    void ParticleGridContacts::getCell(const Vector3 &position, int cell[3]) const
+    {
+        // Cells are one particle wide, so overlapping particles are
+        // always in the same or neighbouring cells.
+        real inverseSize = ((real)0.5) / radius;
+        cell[0] = (int)real_floor(position.x * inverseSize);
+        cell[1] = (int)real_floor(position.y * inverseSize);
+        cell[2] = (int)real_floor(position.z * inverseSize);
+    }
+
+    unsigned ParticleGridContacts::hashCell(int x, int y, int z) const
+    {
+        // The bucket count is a power of two.
+        unsigned mask = (unsigned)cellStart.size() - 2;
+        return (((unsigned)x * 73856093u) ^
+                ((unsigned)y * 19349663u) ^
+                ((unsigned)z * 83492791u)) & mask;
+    }
+
+    void ParticleGridContacts::buildGrid() const
+    {
+        unsigned count = (unsigned)particles->size();
+
+        // Use at least twice as many buckets as particles, to keep
+        // unrelated cells from sharing buckets.
+        unsigned buckets = 1;
+        while(buckets < count * 2) buckets <<= 1;
+        cellStart.assign(buckets + 1, 0);
+        particleCells.resize(count);
+        cellParticles.resize(count);
+
+        // Counting sort: count the particles per bucket, turn the counts
+        // into start offsets, then drop each particle into place.
+        int cell[3];
+        for(unsigned i = 0; i < count; i++)
+        {
+            getCell((*particles)[i]->position, cell);
+            unsigned bucket = hashCell(cell[0], cell[1], cell[2]);
+            particleCells[i] = bucket;
+            cellStart[bucket + 1]++;
+        }
+        for(unsigned b = 0; b < buckets; b++)
+        {
+            cellStart[b + 1] += cellStart[b];
+        }
+        for(unsigned i = 0; i < count; i++)
+        {
+            cellParticles[cellStart[particleCells[i]]++] = i;
+        }
+
+        // Placing moved every start up to the next bucket's, shift back.
+        for(unsigned b = buckets; b > 0; b--)
+        {
+            cellStart[b] = cellStart[b - 1];
+        }
+        cellStart[0] = 0;
+    }
+
+    unsigned ParticleGridContacts::addContact(ParticleContact* contact, unsigned limit) const
+    {
+        PHY_PROFILE_SCOPE("ParticleGridContacts::addContact");
+        if(particles->empty() || limit == 0) return 0;
+        buildGrid();
+
+        real diameter = radius * 2;
+        unsigned count = 0;
+        unsigned particleCount = (unsigned)particles->size();
+        for(unsigned i = 0; i < particleCount; i++)
+        {
+            Particle *a = (*particles)[i];
+            int cell[3];
+            getCell(a->position, cell);
+
+            // Different neighbouring cells can share a bucket, so each
+            // bucket is only searched once.
+            unsigned searched[27];
+            unsigned searchedCount = 0;
+            for(int dx = -1; dx <= 1; dx++)
+            for(int dy = -1; dy <= 1; dy++)
+            for(int dz = -1; dz <= 1; dz++)
+            {
+                unsigned bucket = hashCell(cell[0] + dx, cell[1] + dy, cell[2] + dz);
+                bool seen = false;
+                for(unsigned s = 0; s < searchedCount; s++)
+                {
+                    if(searched[s] == bucket) seen = true;
+                }
+                if(seen) continue;
+                searched[searchedCount++] = bucket;
+
+                for(unsigned k = cellStart[bucket]; k < cellStart[bucket + 1]; k++)
+                {
+                    // Each pair is found from its lower index only.
+                    unsigned j = cellParticles[k];
+                    if(j <= i) continue;
+
+                    Particle *b = (*particles)[j];
+                    // Two immovable particles have nothing to resolve.
+                    if(!a->hasFiniteMass() && !b->hasFiniteMass()) continue;
+
+                    Vector3 offset = a->position - b->position;
+                    real distanceSquared = offset.squareMagnitude();
+                    if(distanceSquared >= diameter * diameter) continue;
+
+                    real distance = real_sqrt(distanceSquared);
+                    if(distance > 0)
+                    {
+                        contact->contactNormal = offset * (((real)1) / distance);
+                    }
+                    else
+                    {
+                        contact->contactNormal = Vector3(0, 1, 0);
+                    }
+                    contact->particle[0] = a;
+                    contact->particle[1] = b;
+                    contact->penetration = diameter - distance;
+                    contact->restitution = restitution;
+                    contact++;
+                    count++;
+
+                    if(count >= limit) return count;
+                }
+            }
+        }
+        return count;
+    }
+
+
+    HeightFieldContacts::HeightFieldContacts()
+        : particles(NULL), field(NULL), restitution(0)
+    {
+    }
+
+    void HeightFieldContacts::init(ParticleWorld::Particles* particles,
+                                   const HeightField* field, real restitution)
+    {
+        HeightFieldContacts::particles = particles;
+        HeightFieldContacts::field = field;
+        HeightFieldContacts::restitution = restitution;
+    }
+
+    unsigned HeightFieldContacts::addContact(ParticleContact* contact, unsigned limit) const
+    {
+        unsigned count = 0;
+        if(limit == 0) return 0;
+        for(ParticleWorld::Particles::iterator p = particles->begin();
+            p != particles->end();
+            p++)
+        {
+            const Vector3 &position = (*p)->position;
+            real height;
+            Vector3 normal;
+            if(!field->getHeight(position.x, position.z, &height, &normal)) continue;
+            if(position.y >= height) continue;
+
+            // The depth below the plane of the triangle, not straight down.
+            contact->contactNormal = normal;
+            contact->particle[0] = *p;
+            contact->particle[1] = NULL;
+            contact->penetration = (height - position.y) * normal.y;
+            contact->restitution = restitution;
+            contact++;
+            count++;
+
+            if(count >= limit) return count;
+        }
+        return count;
+    }
+
+    TriangleMeshContacts::TriangleMeshContacts()
+        : particles(NULL), mesh(NULL), radius(0), restitution(0)
+    {
+    }
+
+    void TriangleMeshContacts::init(ParticleWorld::Particles* particles,
+                                    const TriangleMesh* mesh,
+                                    real radius, real restitution)
+    {
+        TriangleMeshContacts::particles = particles;
+        TriangleMeshContacts::mesh = mesh;
+        TriangleMeshContacts::radius = radius;
+        TriangleMeshContacts::restitution = restitution;
+    }
+
+    unsigned TriangleMeshContacts::addContact(ParticleContact* contact, unsigned limit) const
+    {
+        unsigned count = 0;
+        if(limit == 0) return 0;
+        for(ParticleWorld::Particles::iterator p = particles->begin();
+            p != particles->end();
+            p++)
+        {
+            const Vector3 &position = (*p)->position;
+            Vector3 closest;
+            unsigned triangle;
+            if(!mesh->getClosestPoint(position, radius, &closest, &triangle)) continue;
+
+            // A particle centred on the surface is pushed out of its front.
+            Vector3 normal = position - closest;
+            real distance = normal.magnitude();
+            if(distance > 0) normal *= (real)1.0 / distance;
+            else normal = mesh->getNormal(triangle);
+
+            contact->contactNormal = normal;
+            contact->particle[0] = *p;
+            contact->particle[1] = NULL;
+            contact->penetration = radius - distance;
+            contact->restitution = restitution;
+            contact++;
+            count++;
+
+            if(count >= limit) return count;
+        }
+        return count;
+    }
 }
@@ -4,6 +4,10 @@
 #include <vector>
 #include "pfgen.h"
 #include "plinks.h"
+#include "pxpbd.h"
+#include "contact_buffer.h"
+#include "heightfield.h"
+#include "trimesh.h"
 
 namespace Phy
 {
@@ -12,6 +16,7 @@ namespace Phy
     public:
         typedef std::vector<Particle*> Particles;
         typedef std::vector<ParticleContactGenerator*> ContactGenerators;
+        typedef std::vector<ParticleForceGenerator*> ForceGenerators;
     protected:
         Particles particles;
 
@@ -20,13 +25,36 @@ namespace Phy
         ParticleForceRegistry registry;
         ParticleContactResolver resolver;
         ContactGenerators contactGenerators;
-        ParticleContact* contacts;
-        unsigned maxContacts;
+        ContactBuffer<ParticleContact> contacts;
+
+        // Turn pointers into indices for snapshots, kept between them.
+        mutable PointerIndex<Particle> particleIndex;
+        mutable PointerIndex<ParticleForceGenerator> forceGeneratorIndex;
+
+        /* The links as position constraints, when an XPBD link solver
+         * is set, and the generators that still make contacts. The
+         * constraints are gathered again when the particle or
+         * generator lists differ from the ones they were built from. */
+        ParticleXPBDSolver xpbd;
+        ContactGenerators contactOnlyGenerators;
+        ContactGenerators constraintGenerators;
+        Particles constraintParticles;
+        bool constraintsDirty;
+
+        void updateConstraints();
+        /* Integrates the particles to where XPBD predicts they will be,
+         * keeping the forces for the next substep unless it's the last. */
+        void predict(real duration, bool lastSubstep);
 
     public:
-        ParticleWorld(unsigned maxContacts, unsigned iterations=0);
+        /* Creates a world with room for the given number of contacts a
+         * frame to start with; the buffer grows if a frame needs more. */
+        ParticleWorld(unsigned initialContacts, unsigned iterations=0);
         ~ParticleWorld();
 
+        /* Runs every contact generator into the contact buffer. A
+         * generator that fills the room it is given is run again with
+         * more, so no contacts are dropped. */
         unsigned generateContacts();
         void integrate(real duration);
         void runPhysics(real duration);
@@ -36,6 +64,45 @@ namespace Phy
         Particles& getParticles();
         ContactGenerators& getContactGenerators();
         ParticleForceRegistry& getForceRegistry();
+        ParticleContactResolver& getResolver();
+
+        // Returns the most contacts generated in a single frame so far.
+        unsigned getContactHighWaterMark() const;
+
+        /* Sets how the links among the contact generators are kept.
+         * With either XPBD solver the particles are integrated, moved
+         * back to their lengths by the ParticleXPBDSolver, and only
+         * then do the other generators make contacts for the
+         * resolver. Links whose particles are not in the world stay
+         * contact generators. Defaults to LINKS_AS_CONTACTS. */
+        void setLinkSolver(ParticleLinkSolver solver);
+        ParticleLinkSolver getLinkSolver() const;
+        ParticleXPBDSolver& getXPBDSolver();
+
+        /* Gathers the links into the XPBD solver again on the next
+         * step. Call after changing a link's particles or length. */
+        void rebuildConstraints();
+
+        /* Writes the state of the world to the snapshot, replacing what
+         * it held: every particle, in the order of the particle list,
+         * and the state of each contact generator, such as the
+         * particles and lengths of the links. Force generators are
+         * the caller's objects, so the force registrations are only
+         * written if a list of the generators is given to write them
+         * as positions in. Returns false if a registration or a link
+         * refers to something not in the lists.
+         */
+        bool saveState(Snapshot *snapshot, const ForceGenerators *forceGenerators = NULL) const;
+
+        /* Puts the world back to the state in the snapshot. The world
+         * must have the same number of particles and contact
+         * generators as when it was saved, and the same force
+         * generator list if registrations were saved, which replace
+         * the current ones. Returns false, without changing the world,
+         * if the snapshot doesn't match it; a malformed snapshot may
+         * leave it partly restored.
+         */
+        bool restoreState(const Snapshot &snapshot, const ForceGenerators *forceGenerators = NULL);
 
     };
 
@@ -46,6 +113,75 @@ namespace Phy
         void init(ParticleWorld::Particles* particles);
         virtual unsigned addContact(ParticleContact* contact, unsigned limit) const;
     };
+
+    /*
+     * Generates contacts between overlapping particles, treating every
+     * particle as a sphere of the same radius. The particles are binned
+     * into a hashed grid of cells one particle wide, rebuilt on every
+     * call with a counting sort, so each particle is only tested
+     * against the particles in the 27 cells around it and the cost
+     * grows linearly with the particle count.
+     */
+    class ParticleGridContacts : public ParticleContactGenerator
+    {
+        ParticleWorld::Particles* particles;
+        real radius;
+        real restitution;
+
+        // The grid, rebuilt by every call to addContact.
+        mutable std::vector<unsigned> particleCells;
+        // The particles of cell bucket b are
+        // cellParticles[cellStart[b]] .. cellParticles[cellStart[b+1]-1].
+        mutable std::vector<unsigned> cellStart;
+        mutable std::vector<unsigned> cellParticles;
+
+        void buildGrid() const;
+        void getCell(const Vector3 &position, int cell[3]) const;
+        unsigned hashCell(int x, int y, int z) const;
+    public:
+        ParticleGridContacts();
+
+        void init(ParticleWorld::Particles* particles, real radius, real restitution);
+        virtual unsigned addContact(ParticleContact* contact, unsigned limit) const;
+    };
+
+    /*
+     * Generates contacts between particles and the terrain. Each
+     * particle only looks up the triangle under it, and is pushed out
+     * along its normal.
+     */
+    class HeightFieldContacts : public ParticleContactGenerator
+    {
+        ParticleWorld::Particles* particles;
+        const HeightField* field;
+        real restitution;
+    public:
+        HeightFieldContacts();
+
+        void init(ParticleWorld::Particles* particles, const HeightField* field,
+                  real restitution);
+        virtual unsigned addContact(ParticleContact* contact, unsigned limit) const;
+    };
+
+    /*
+     * Generates contacts between particles and a static triangle
+     * mesh, treating every particle as a sphere of the same radius.
+     * Each particle gets one contact, with the nearest point of the
+     * mesh the mesh's tree finds within its radius.
+     */
+    class TriangleMeshContacts : public ParticleContactGenerator
+    {
+        ParticleWorld::Particles* particles;
+        const TriangleMesh* mesh;
+        real radius;
+        real restitution;
+    public:
+        TriangleMeshContacts();
+
+        void init(ParticleWorld::Particles* particles, const TriangleMesh* mesh,
+                  real radius, real restitution);
+        virtual unsigned addContact(ParticleContact* contact, unsigned limit) const;
+    };
 }
 
 #endif
@@ -0,0 +1,397 @@
+#include <cstring>
+#include "pworld_soa.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    template<class T>
+    void ParticleWorldSoAT<T>::reserve(unsigned count)
+    {
+        positions.reserve(count);
+        velocities.reserve(count);
+        accelerations.reserve(count);
+        forceAccums.reserve(count);
+        dampings.reserve(count);
+        inverseMasses.reserve(count);
+        handleToIndex.reserve(count);
+        indexToHandle.reserve(count);
+    }
+
+    template<class T>
+    ParticleHandle ParticleWorldSoAT<T>::addParticle(const Vector3T<T> &position,
+                                                 const Vector3T<T> &velocity,
+                                                 const Vector3T<T> &acceleration,
+                                                 T damping,
+                                                 T inverseMass)
+    {
+        unsigned index = (unsigned)positions.size();
+        positions.push_back(position);
+        velocities.push_back(velocity);
+        accelerations.push_back(acceleration);
+        forceAccums.push_back(Vector3T<T>());
+        dampings.push_back(damping);
+        inverseMasses.push_back(inverseMass);
+
+        // Reuse a released handle if we have one.
+        ParticleHandle handle;
+        if(!freeHandles.empty())
+        {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            handleToIndex[handle] = index;
+        }
+        else
+        {
+            handle = (ParticleHandle)handleToIndex.size();
+            handleToIndex.push_back(index);
+        }
+        indexToHandle.push_back(handle);
+
+        return handle;
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::removeParticle(ParticleHandle handle)
+    {
+        unsigned index = handleToIndex[handle];
+        unsigned last = (unsigned)positions.size() - 1;
+
+        // Move the last particle into the hole to keep the arrays dense.
+        if(index != last)
+        {
+            positions[index] = positions[last];
+            velocities[index] = velocities[last];
+            accelerations[index] = accelerations[last];
+            forceAccums[index] = forceAccums[last];
+            dampings[index] = dampings[last];
+            inverseMasses[index] = inverseMasses[last];
+
+            ParticleHandle moved = indexToHandle[last];
+            indexToHandle[index] = moved;
+            handleToIndex[moved] = index;
+        }
+
+        positions.pop_back();
+        velocities.pop_back();
+        accelerations.pop_back();
+        forceAccums.pop_back();
+        dampings.pop_back();
+        inverseMasses.pop_back();
+        indexToHandle.pop_back();
+
+        freeHandles.push_back(handle);
+    }
+
+    template<class T>
+    unsigned ParticleWorldSoAT<T>::getParticleCount() const
+    {
+        return (unsigned)positions.size();
+    }
+
+    template<class T>
+    unsigned ParticleWorldSoAT<T>::getIndex(ParticleHandle handle) const
+    {
+        return handleToIndex[handle];
+    }
+
+    template<class T>
+    ParticleHandle ParticleWorldSoAT<T>::getHandle(unsigned index) const
+    {
+        return indexToHandle[index];
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::setPosition(ParticleHandle handle, const Vector3T<T> &position)
+    {
+        positions[handleToIndex[handle]] = position;
+    }
+
+    template<class T>
+    Vector3T<T> ParticleWorldSoAT<T>::getPosition(ParticleHandle handle) const
+    {
+        return positions[handleToIndex[handle]];
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::setVelocity(ParticleHandle handle, const Vector3T<T> &velocity)
+    {
+        velocities[handleToIndex[handle]] = velocity;
+    }
+
+    template<class T>
+    Vector3T<T> ParticleWorldSoAT<T>::getVelocity(ParticleHandle handle) const
+    {
+        return velocities[handleToIndex[handle]];
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::setAcceleration(ParticleHandle handle, const Vector3T<T> &acceleration)
+    {
+        accelerations[handleToIndex[handle]] = acceleration;
+    }
+
+    template<class T>
+    Vector3T<T> ParticleWorldSoAT<T>::getAcceleration(ParticleHandle handle) const
+    {
+        return accelerations[handleToIndex[handle]];
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::setDamping(ParticleHandle handle, const T damping)
+    {
+        dampings[handleToIndex[handle]] = damping;
+    }
+
+    template<class T>
+    T ParticleWorldSoAT<T>::getDamping(ParticleHandle handle) const
+    {
+        return dampings[handleToIndex[handle]];
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::setMass(ParticleHandle handle, const T mass)
+    {
+        Assert(mass != 0);
+        inverseMasses[handleToIndex[handle]] = ((T)1.0)/mass;
+    }
+
+    template<class T>
+    T ParticleWorldSoAT<T>::getMass(ParticleHandle handle) const
+    {
+        T inverseMass = inverseMasses[handleToIndex[handle]];
+        if(inverseMass == 0)
+        {
+            return ScalarTraits<T>::max();
+        }
+        else
+        {
+            return ((T)1.0)/inverseMass;
+        }
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::setInverseMass(ParticleHandle handle, const T inverseMass)
+    {
+        inverseMasses[handleToIndex[handle]] = inverseMass;
+    }
+
+    template<class T>
+    T ParticleWorldSoAT<T>::getInverseMass(ParticleHandle handle) const
+    {
+        return inverseMasses[handleToIndex[handle]];
+    }
+
+    template<class T>
+    bool ParticleWorldSoAT<T>::hasFiniteMass(ParticleHandle handle) const
+    {
+        return inverseMasses[handleToIndex[handle]] > 0.0f;
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::addForce(ParticleHandle handle, const Vector3T<T> &force)
+    {
+        forceAccums[handleToIndex[handle]] += force;
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::startFrame()
+    {
+        for(typename Vectors::iterator f = forceAccums.begin();
+            f != forceAccums.end();
+            f++)
+        {
+            f->clear();
+        }
+    }
+
+    // At the library's precision the batch integrator does the work.
+    static void integrateArrays(BatchIntegrator &integrator,
+                                Vector3 *position, Vector3 *velocity,
+                                const Vector3 *acceleration, Vector3 *forceAccum,
+                                const real *damping, const real *inverseMass,
+                                unsigned count, real duration)
+    {
+        integrator.integrateParticles(position, velocity, acceleration, forceAccum,
+                                      damping, inverseMass, count, duration);
+    }
+
+    /* Any other precision runs the same steps as Particle::integrate,
+     * working out the damping power once per run of equal dampings as
+     * the batch integrator does. It takes the integrator only to
+     * match the overload above.
+     */
+    template<class T>
+    static void integrateArrays(BatchIntegrator &,
+                                Vector3T<T> *position, Vector3T<T> *velocity,
+                                const Vector3T<T> *acceleration, Vector3T<T> *forceAccum,
+                                const T *damping, const T *inverseMass,
+                                unsigned count, T duration)
+    {
+        T lastDamping = 0;
+        T dampingPow = ScalarTraits<T>::pow(lastDamping, duration);
+        for(unsigned i = 0; i < count; i++)
+        {
+            if(inverseMass[i] <= 0.0f) continue;
+
+            if(damping[i] != lastDamping)
+            {
+                lastDamping = damping[i];
+                dampingPow = ScalarTraits<T>::pow(lastDamping, duration);
+            }
+
+            position[i].addScaledVector(velocity[i], duration);
+
+            Vector3T<T> resultAcc = acceleration[i];
+            resultAcc.addScaledVector(forceAccum[i], inverseMass[i]);
+            velocity[i].addScaledVector(resultAcc, duration);
+
+            velocity[i] *= dampingPow;
+
+            forceAccum[i].clear();
+        }
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::integrate(T duration)
+    {
+        integrateArrays(integrator, getPositions(), getVelocities(),
+                        getAccelerations(), getForceAccums(),
+                        getDampings(), getInverseMasses(),
+                        getParticleCount(), duration);
+    }
+
+    template<class T>
+    Vector3T<T> *ParticleWorldSoAT<T>::getPositions()
+    {
+        return positions.empty() ? 0 : &positions[0];
+    }
+
+    template<class T>
+    Vector3T<T> *ParticleWorldSoAT<T>::getVelocities()
+    {
+        return velocities.empty() ? 0 : &velocities[0];
+    }
+
+    template<class T>
+    Vector3T<T> *ParticleWorldSoAT<T>::getAccelerations()
+    {
+        return accelerations.empty() ? 0 : &accelerations[0];
+    }
+
+    template<class T>
+    Vector3T<T> *ParticleWorldSoAT<T>::getForceAccums()
+    {
+        return forceAccums.empty() ? 0 : &forceAccums[0];
+    }
+
+    template<class T>
+    T *ParticleWorldSoAT<T>::getDampings()
+    {
+        return dampings.empty() ? 0 : &dampings[0];
+    }
+
+    template<class T>
+    T *ParticleWorldSoAT<T>::getInverseMasses()
+    {
+        return inverseMasses.empty() ? 0 : &inverseMasses[0];
+    }
+
+    template<class T>
+    BatchIntegrator& ParticleWorldSoAT<T>::getIntegrator()
+    {
+        return integrator;
+    }
+
+    // Identifies a structure of arrays world snapshot, and its version.
+    static const char SOA_WORLD_MAGIC[4] = { 'P', 'H', 'Y', 'A' };
+    static const unsigned SOA_WORLD_VERSION = 1;
+
+    // Appends a whole array to the snapshot.
+    template<class Element>
+    static void writeArray(Snapshot *snapshot, const std::vector<Element> &array)
+    {
+        if(!array.empty()) snapshot->write(&array[0], (unsigned)(array.size() * sizeof(Element)));
+    }
+
+    // Finds an array of the given length in the snapshot, or returns false.
+    template<class Element>
+    static bool takeArray(SnapshotReader *reader, unsigned count, const Element **array)
+    {
+        *array = NULL;
+        if(count == 0) return true;
+        *array = (const Element *)reader->take(count * sizeof(Element));
+        return *array != NULL;
+    }
+
+    template<class Element>
+    static void assignArray(std::vector<Element> &array, const Element *source, unsigned count)
+    {
+        array.resize(count);
+        if(count) memcpy(&array[0], source, count * sizeof(Element));
+    }
+
+    template<class T>
+    void ParticleWorldSoAT<T>::saveState(Snapshot *snapshot) const
+    {
+        snapshot->clear();
+        snapshot->write(SOA_WORLD_MAGIC, 4);
+        unsigned header[5] = { SOA_WORLD_VERSION, (unsigned)sizeof(T),
+                               (unsigned)positions.size(), (unsigned)handleToIndex.size(),
+                               (unsigned)freeHandles.size() };
+        snapshot->write(header, sizeof(header));
+
+        writeArray(snapshot, positions);
+        writeArray(snapshot, velocities);
+        writeArray(snapshot, accelerations);
+        writeArray(snapshot, forceAccums);
+        writeArray(snapshot, dampings);
+        writeArray(snapshot, inverseMasses);
+        writeArray(snapshot, handleToIndex);
+        writeArray(snapshot, indexToHandle);
+        writeArray(snapshot, freeHandles);
+    }
+
+    template<class T>
+    bool ParticleWorldSoAT<T>::restoreState(const Snapshot &snapshot)
+    {
+        SnapshotReader reader(snapshot);
+        const unsigned char *magic = reader.take(4);
+        unsigned header[5];
+        if(!magic || memcmp(magic, SOA_WORLD_MAGIC, 4) || !reader.read(header, sizeof(header)) ||
+           header[0] != SOA_WORLD_VERSION || header[1] != sizeof(T))
+        {
+            return false;
+        }
+
+        // Find every array before changing anything.
+        unsigned count = header[2], handles = header[3], free = header[4];
+        const Vector3T<T> *vectors[4];
+        const T *reals[2];
+        const unsigned *tables[3];
+        for(unsigned i = 0; i < 4; i++)
+        {
+            if(!takeArray(&reader, count, &vectors[i])) return false;
+        }
+        if(!takeArray(&reader, count, &reals[0]) || !takeArray(&reader, count, &reals[1]) ||
+           !takeArray(&reader, handles, &tables[0]) || !takeArray(&reader, count, &tables[1]) ||
+           !takeArray(&reader, free, &tables[2]) || !reader.atEnd())
+        {
+            return false;
+        }
+
+        assignArray(positions, vectors[0], count);
+        assignArray(velocities, vectors[1], count);
+        assignArray(accelerations, vectors[2], count);
+        assignArray(forceAccums, vectors[3], count);
+        assignArray(dampings, reals[0], count);
+        assignArray(inverseMasses, reals[1], count);
+        assignArray(handleToIndex, tables[0], handles);
+        assignArray(indexToHandle, tables[1], count);
+        assignArray(freeHandles, tables[2], free);
+        return true;
+    }
+
+    template class ParticleWorldSoAT<float>;
+    template class ParticleWorldSoAT<double>;
+}
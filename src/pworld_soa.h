@@ -0,0 +1,119 @@
+#ifndef PHY_PWORLD_SOA_H
+#define PHY_PWORLD_SOA_H
+
+#include <vector>
+#include "integrator.h"
+#include "snapshot.h"
+
+namespace Phy
+{
+    /*
+     * Identifies a particle stored in a ParticleWorldSoA. Handles stay
+     * valid while other particles are added and removed, but become
+     * invalid once their own particle is removed.
+     */
+    typedef unsigned ParticleHandle;
+
+    /*
+     * An alternative particle world that stores each particle attribute
+     * in its own contiguous array (structure of arrays) instead of
+     * holding pointers to Particle objects. Integration then streams
+     * linearly through memory, touching only the data it needs.
+     *
+     * Particles are addressed through handles. Removing a particle moves
+     * the last particle into its slot, so the arrays are always dense.
+     *
+     * The world is templated on its scalar type: a float world halves
+     * the memory each particle streams through, for bulk effects that
+     * need no more. Worlds at the library's own precision integrate
+     * through the BatchIntegrator; other precisions use a scalar loop
+     * doing the same operations.
+     */
+    template<class T>
+    class ParticleWorldSoAT
+    {
+    public:
+        typedef std::vector<Vector3T<T> > Vectors;
+        typedef std::vector<T> Reals;
+        typedef std::vector<unsigned> Indices;
+    protected:
+        Vectors positions;
+        Vectors velocities;
+        Vectors accelerations;
+        Vectors forceAccums;
+        Reals dampings;
+        Reals inverseMasses;
+
+        // Maps handles to slots in the dense arrays and back again.
+        Indices handleToIndex;
+        Indices indexToHandle;
+        Indices freeHandles;
+
+        BatchIntegrator integrator;
+
+    public:
+        void reserve(unsigned count);
+
+        ParticleHandle addParticle(const Vector3T<T> &position,
+                                   const Vector3T<T> &velocity,
+                                   const Vector3T<T> &acceleration,
+                                   T damping,
+                                   T inverseMass);
+        void removeParticle(ParticleHandle handle);
+
+        unsigned getParticleCount() const;
+        unsigned getIndex(ParticleHandle handle) const;
+        ParticleHandle getHandle(unsigned index) const;
+
+        void setPosition(ParticleHandle handle, const Vector3T<T> &position);
+        Vector3T<T> getPosition(ParticleHandle handle) const;
+
+        void setVelocity(ParticleHandle handle, const Vector3T<T> &velocity);
+        Vector3T<T> getVelocity(ParticleHandle handle) const;
+
+        void setAcceleration(ParticleHandle handle, const Vector3T<T> &acceleration);
+        Vector3T<T> getAcceleration(ParticleHandle handle) const;
+
+        void setDamping(ParticleHandle handle, const T damping);
+        T getDamping(ParticleHandle handle) const;
+
+        void setMass(ParticleHandle handle, const T mass);
+        T getMass(ParticleHandle handle) const;
+        void setInverseMass(ParticleHandle handle, const T inverseMass);
+        T getInverseMass(ParticleHandle handle) const;
+        bool hasFiniteMass(ParticleHandle handle) const;
+
+        void addForce(ParticleHandle handle, const Vector3T<T> &force);
+
+        void startFrame();
+        void integrate(T duration);
+
+        /* Raw access to the dense arrays, indexed by getIndex(). The
+         * pointers are invalidated by addParticle and removeParticle. */
+        Vector3T<T> *getPositions();
+        Vector3T<T> *getVelocities();
+        Vector3T<T> *getAccelerations();
+        Vector3T<T> *getForceAccums();
+        T *getDampings();
+        T *getInverseMasses();
+
+        BatchIntegrator& getIntegrator();
+
+        /* Writes every particle and the handle tables to the snapshot,
+         * replacing what it held. Each array is copied whole. */
+        void saveState(Snapshot *snapshot) const;
+
+        /* Puts the world back to the state in the snapshot, with the
+         * particles and handles it had then, which may be more or
+         * fewer than now. Returns false, without changing the world,
+         * if the snapshot isn't of a world of this precision.
+         */
+        bool restoreState(const Snapshot &snapshot);
+    };
+
+    typedef ParticleWorldSoAT<real> ParticleWorldSoA;
+    typedef ParticleWorldSoAT<float> ParticleWorldSoAf;
+    typedef ParticleWorldSoAT<double> ParticleWorldSoAd;
+}
+
+#endif
@@ -0,0 +1,478 @@
+#include "pxpbd.h"
+#include "workers.h"
+#include "profile.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    // The number of constraints, or nodes, in each block run in parallel.
+    static const unsigned BLOCK_SIZE = 512;
+
+    typedef ParticleXPBDSolver::Constraint Constraint;
+
+    /*
+     * Works out the correction of one constraint from the positions of
+     * its ends, scaled by the given amount, and adds it to the
+     * constraint's lambda. Returns false if there is nothing to correct.
+     */
+    static inline bool relaxConstraint(Constraint &constraint, const Vector3 *positions,
+                                       const real *inverseMasses, real alpha, real scale,
+                                       Vector3 *move0, Vector3 *move1)
+    {
+        real w0 = inverseMasses[constraint.node[0]];
+        real w1 = inverseMasses[constraint.node[1]];
+        if(w0 + w1 <= 0) return false;
+
+        Vector3 difference = positions[constraint.node[0]] - positions[constraint.node[1]];
+        real distance = difference.magnitude();
+        if(distance <= 0) return false;
+
+        real error = distance - constraint.length;
+        real change = scale * (-error - alpha * constraint.lambda) / (w0 + w1 + alpha);
+
+        // A cable can only pull, so its lambda never goes above zero.
+        if(constraint.slack && constraint.lambda + change > 0)
+        {
+            change = -constraint.lambda;
+        }
+        if(change == 0) return false;
+        constraint.lambda += change;
+
+        Vector3 normal = difference * (1 / distance);
+        *move0 = normal * (change * w0);
+        *move1 = normal * (-change * w1);
+        return true;
+    }
+
+    /*
+     * Relaxes one block of a run of constraints that share no nodes,
+     * moving their ends in place.
+     */
+    class XPBDColourTask : public ParallelTask
+    {
+    public:
+        Constraint* constraints;
+        unsigned count;
+        Vector3* positions;
+        const real* inverseMasses;
+        real rodAlpha;
+        real cableAlpha;
+
+        virtual void run(unsigned block, unsigned)
+        {
+            unsigned end = (block + 1) * BLOCK_SIZE;
+            if(end > count) end = count;
+            for(unsigned c = block * BLOCK_SIZE; c < end; c++)
+            {
+                Constraint &constraint = constraints[c];
+                Vector3 move0, move1;
+                if(relaxConstraint(constraint, positions, inverseMasses,
+                                   constraint.slack ? cableAlpha : rodAlpha, 1,
+                                   &move0, &move1))
+                {
+                    positions[constraint.node[0]] += move0;
+                    positions[constraint.node[1]] += move1;
+                }
+            }
+        }
+    };
+
+    /*
+     * Works out the corrections of one block of constraints, from the
+     * positions at the start of the pass, without moving anything.
+     * Each is scaled by the constraint's share of the relaxation, so
+     * its lambda holds what its ends are actually moved by.
+     */
+    class XPBDJacobiTask : public ParallelTask
+    {
+    public:
+        Constraint* constraints;
+        unsigned count;
+        const Vector3* positions;
+        const real* inverseMasses;
+        const real* shares;
+        Vector3* corrections;
+        real rodAlpha;
+        real cableAlpha;
+        real relaxation;
+
+        virtual void run(unsigned block, unsigned)
+        {
+            unsigned end = (block + 1) * BLOCK_SIZE;
+            if(end > count) end = count;
+            for(unsigned c = block * BLOCK_SIZE; c < end; c++)
+            {
+                Constraint &constraint = constraints[c];
+                if(!relaxConstraint(constraint, positions, inverseMasses,
+                                    constraint.slack ? cableAlpha : rodAlpha,
+                                    relaxation * shares[c],
+                                    &corrections[c*2], &corrections[c*2 + 1]))
+                {
+                    corrections[c*2].clear();
+                    corrections[c*2 + 1].clear();
+                }
+            }
+        }
+    };
+
+    /*
+     * Moves one block of nodes by the total of their corrections,
+     * always added up in the same order.
+     */
+    class XPBDGatherTask : public ParallelTask
+    {
+    public:
+        unsigned count;
+        Vector3* positions;
+        const Vector3* corrections;
+        const unsigned* nodeStart;
+        const unsigned* nodeCorrections;
+
+        virtual void run(unsigned block, unsigned)
+        {
+            unsigned end = (block + 1) * BLOCK_SIZE;
+            if(end > count) end = count;
+            for(unsigned n = block * BLOCK_SIZE; n < end; n++)
+            {
+                unsigned first = nodeStart[n];
+                unsigned last = nodeStart[n + 1];
+                if(first == last) continue;
+
+                Vector3 total;
+                for(unsigned i = first; i < last; i++)
+                {
+                    total += corrections[nodeCorrections[i]];
+                }
+                positions[n] += total;
+            }
+        }
+    };
+
+    static unsigned blockCount(unsigned count)
+    {
+        return (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+    ParticleXPBDSolver::ParticleXPBDSolver()
+        : coloured(false), particleCount(0), indexed(false),
+          variant(LINKS_XPBD_GAUSS_SEIDEL), iterations(8), substeps(1),
+          rodCompliance(0), cableCompliance(0), relaxation(1.5), workers(NULL)
+    {
+    }
+
+    void ParticleXPBDSolver::clear(unsigned particleCount)
+    {
+        ParticleXPBDSolver::particleCount = particleCount;
+        constraints.clear();
+        positions.resize(particleCount);
+        predicted.resize(particleCount);
+        inverseMasses.resize(particleCount);
+        coloured = false;
+        indexed = false;
+    }
+
+    void ParticleXPBDSolver::addLink(unsigned particle0, unsigned particle1,
+                                     real length, bool cable)
+    {
+        Assert(particle0 < particleCount && particle1 < particleCount);
+        Constraint constraint;
+        constraint.node[0] = particle0;
+        constraint.node[1] = particle1;
+        constraint.length = length;
+        constraint.lambda = 0;
+        constraint.slack = cable;
+        constraints.push_back(constraint);
+        coloured = false;
+        indexed = false;
+    }
+
+    void ParticleXPBDSolver::addAnchoredLink(unsigned particle, const Vector3 &anchor,
+                                             real length, bool cable)
+    {
+        Assert(particle < particleCount);
+
+        // The anchor is a node of its own that nothing can move.
+        unsigned node = (unsigned)positions.size();
+        positions.push_back(anchor);
+        predicted.push_back(anchor);
+        inverseMasses.push_back(0);
+
+        Constraint constraint;
+        constraint.node[0] = particle;
+        constraint.node[1] = node;
+        constraint.length = length;
+        constraint.lambda = 0;
+        constraint.slack = cable;
+        constraints.push_back(constraint);
+        coloured = false;
+        indexed = false;
+    }
+
+    unsigned ParticleXPBDSolver::getConstraintCount() const
+    {
+        return (unsigned)constraints.size();
+    }
+
+    unsigned ParticleXPBDSolver::getColourCount() const
+    {
+        return coloured ? (unsigned)colourStart.size() - 2 : 0;
+    }
+
+    void ParticleXPBDSolver::setVariant(ParticleLinkSolver variant)
+    {
+        ParticleXPBDSolver::variant = variant;
+    }
+
+    ParticleLinkSolver ParticleXPBDSolver::getVariant() const
+    {
+        return variant;
+    }
+
+    void ParticleXPBDSolver::setIterations(unsigned iterations)
+    {
+        ParticleXPBDSolver::iterations = iterations;
+    }
+
+    unsigned ParticleXPBDSolver::getIterations() const
+    {
+        return iterations;
+    }
+
+    void ParticleXPBDSolver::setSubsteps(unsigned substeps)
+    {
+        ParticleXPBDSolver::substeps = substeps ? substeps : 1;
+    }
+
+    unsigned ParticleXPBDSolver::getSubsteps() const
+    {
+        return substeps;
+    }
+
+    void ParticleXPBDSolver::setCompliance(real rodCompliance, real cableCompliance)
+    {
+        ParticleXPBDSolver::rodCompliance = rodCompliance;
+        ParticleXPBDSolver::cableCompliance = cableCompliance;
+    }
+
+    void ParticleXPBDSolver::setRelaxation(real relaxation)
+    {
+        ParticleXPBDSolver::relaxation = relaxation;
+    }
+
+    void ParticleXPBDSolver::setWorkerPool(WorkerPool* workers)
+    {
+        ParticleXPBDSolver::workers = workers;
+    }
+
+    void ParticleXPBDSolver::colourConstraints()
+    {
+        PHY_PROFILE_SCOPE("ParticleXPBDSolver::colourConstraints");
+        unsigned count = (unsigned)constraints.size();
+
+        // Greedily give each constraint the lowest colour neither of its
+        // nodes has yet, with a bit per colour for each node.
+        std::vector<unsigned> nodeColours(positions.size(), 0);
+        std::vector<unsigned> colourOf(count);
+        unsigned colourCount = 0;
+        unsigned c;
+        for(c = 0; c < count; c++)
+        {
+            unsigned *used0 = &nodeColours[constraints[c].node[0]];
+            unsigned *used1 = &nodeColours[constraints[c].node[1]];
+            unsigned free = ~(*used0 | *used1);
+            unsigned colour = 0;
+            while(colour < MAX_COLOURS && !(free & (1u << colour))) colour++;
+
+            colourOf[c] = colour;
+            if(colour == MAX_COLOURS) continue;
+            *used0 |= 1u << colour;
+            *used1 |= 1u << colour;
+            if(colour + 1 > colourCount) colourCount = colour + 1;
+        }
+
+        // Counting sort by colour, with the uncoloured ones last.
+        colourStart.assign(colourCount + 2, 0);
+        for(c = 0; c < count; c++)
+        {
+            unsigned colour = colourOf[c] < colourCount ? colourOf[c] : colourCount;
+            colourOf[c] = colour;
+            colourStart[colour + 1]++;
+        }
+        for(unsigned i = 1; i < colourStart.size(); i++)
+        {
+            colourStart[i] += colourStart[i - 1];
+        }
+
+        std::vector<unsigned> next(colourStart.begin(), colourStart.end() - 1);
+        std::vector<Constraint> sorted(count);
+        for(c = 0; c < count; c++)
+        {
+            sorted[next[colourOf[c]]++] = constraints[c];
+        }
+        constraints.swap(sorted);
+
+        coloured = true;
+        indexed = false;
+    }
+
+    void ParticleXPBDSolver::indexCorrections()
+    {
+        PHY_PROFILE_SCOPE("ParticleXPBDSolver::indexCorrections");
+        unsigned count = (unsigned)constraints.size();
+        corrections.resize(count * 2);
+
+        // Only the particles move, so the anchors need no entries.
+        nodeStart.assign(particleCount + 1, 0);
+        unsigned c, end;
+        for(c = 0; c < count; c++)
+        {
+            for(end = 0; end < 2; end++)
+            {
+                unsigned node = constraints[c].node[end];
+                if(node < particleCount) nodeStart[node + 1]++;
+            }
+        }
+        for(unsigned n = 0; n < particleCount; n++)
+        {
+            nodeStart[n + 1] += nodeStart[n];
+        }
+
+        nodeCorrections.resize(nodeStart[particleCount]);
+        std::vector<unsigned> next(nodeStart.begin(), nodeStart.end() - 1);
+        for(c = 0; c < count; c++)
+        {
+            for(end = 0; end < 2; end++)
+            {
+                unsigned node = constraints[c].node[end];
+                if(node < particleCount) nodeCorrections[next[node]++] = c*2 + end;
+            }
+        }
+
+        // A constraint gets the share of the busier of its two ends, so
+        // no node is moved by more than the relaxation of a full step.
+        shares.resize(count);
+        for(c = 0; c < count; c++)
+        {
+            unsigned most = 1;
+            for(end = 0; end < 2; end++)
+            {
+                unsigned node = constraints[c].node[end];
+                if(node >= particleCount) continue;
+                unsigned size = nodeStart[node + 1] - nodeStart[node];
+                if(size > most) most = size;
+            }
+            shares[c] = 1 / real(most);
+        }
+        indexed = true;
+    }
+
+    void ParticleXPBDSolver::solveJacobi(real duration)
+    {
+        PHY_PROFILE_SCOPE("ParticleXPBDSolver::solveJacobi");
+        if(!indexed) indexCorrections();
+        unsigned count = (unsigned)constraints.size();
+
+        XPBDJacobiTask relax;
+        relax.constraints = &constraints[0];
+        relax.count = count;
+        relax.positions = &positions[0];
+        relax.inverseMasses = &inverseMasses[0];
+        relax.shares = &shares[0];
+        relax.corrections = &corrections[0];
+        relax.rodAlpha = rodCompliance / (duration * duration);
+        relax.cableAlpha = cableCompliance / (duration * duration);
+        relax.relaxation = relaxation;
+
+        XPBDGatherTask gather;
+        gather.count = particleCount;
+        gather.positions = &positions[0];
+        gather.corrections = &corrections[0];
+        gather.nodeStart = &nodeStart[0];
+        gather.nodeCorrections = nodeCorrections.empty() ? NULL : &nodeCorrections[0];
+
+        for(unsigned i = 0; i < iterations; i++)
+        {
+            if(workers)
+            {
+                workers->run(&relax, blockCount(count));
+                workers->run(&gather, blockCount(particleCount));
+            }
+            else
+            {
+                unsigned block;
+                for(block = 0; block < blockCount(count); block++) relax.run(block, 0);
+                for(block = 0; block < blockCount(particleCount); block++) gather.run(block, 0);
+            }
+        }
+    }
+
+    void ParticleXPBDSolver::solveGaussSeidel(real duration)
+    {
+        PHY_PROFILE_SCOPE("ParticleXPBDSolver::solveGaussSeidel");
+        if(!coloured) colourConstraints();
+        unsigned colourCount = getColourCount();
+
+        XPBDColourTask task;
+        task.positions = &positions[0];
+        task.inverseMasses = &inverseMasses[0];
+        task.rodAlpha = rodCompliance / (duration * duration);
+        task.cableAlpha = cableCompliance / (duration * duration);
+
+        for(unsigned i = 0; i < iterations; i++)
+        {
+            for(unsigned colour = 0; colour <= colourCount; colour++)
+            {
+                task.constraints = &constraints[0] + colourStart[colour];
+                task.count = colourStart[colour + 1] - colourStart[colour];
+                unsigned blocks = blockCount(task.count);
+
+                // The uncoloured constraints may share nodes, so they
+                // are relaxed one after the other.
+                if(workers && colour < colourCount && blocks > 1)
+                {
+                    workers->run(&task, blocks);
+                }
+                else
+                {
+                    for(unsigned block = 0; block < blocks; block++) task.run(block, 0);
+                }
+            }
+        }
+    }
+
+    void ParticleXPBDSolver::solve(Particle *const *particles, real duration)
+    {
+        PHY_PROFILE_SCOPE("ParticleXPBDSolver::solve");
+        if(constraints.empty() || variant == LINKS_AS_CONTACTS) return;
+        Assert(duration > 0.0);
+
+        unsigned i;
+        for(i = 0; i < particleCount; i++)
+        {
+            positions[i] = particles[i]->position;
+            predicted[i] = positions[i];
+            inverseMasses[i] = particles[i]->getInverseMass();
+        }
+
+        // Each step starts the links from no force.
+        unsigned count = (unsigned)constraints.size();
+        for(i = 0; i < count; i++)
+        {
+            constraints[i].lambda = 0;
+        }
+
+        if(variant == LINKS_XPBD_JACOBI) solveJacobi(duration);
+        else solveGaussSeidel(duration);
+
+        real inverseDuration = 1 / duration;
+        for(i = 0; i < particleCount; i++)
+        {
+            Particle *particle = particles[i];
+            particle->velocity.addScaledVector(positions[i] - predicted[i], inverseDuration);
+            particle->position = positions[i];
+        }
+
+        PHY_PROFILE_COUNTER("constraints", count);
+    }
+}
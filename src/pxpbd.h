@@ -0,0 +1,160 @@
+#ifndef PHY_PXPBD_H
+#define PHY_PXPBD_H
+
+#include <vector>
+#include "particle.h"
+
+namespace Phy
+{
+    class WorkerPool;
+
+    // How a ParticleWorld keeps its rods, cables and their constraints.
+    enum ParticleLinkSolver
+    {
+        // As contacts, resolved by the ParticleContactResolver.
+        LINKS_AS_CONTACTS = 0,
+        // As distance constraints, relaxed all at once and shared out.
+        LINKS_XPBD_JACOBI,
+        // As distance constraints, relaxed one colour at a time.
+        LINKS_XPBD_GAUSS_SEIDEL
+    };
+
+    /*
+     * Keeps particle links as compliant distance constraints and solves
+     * them on the particle positions with extended position based
+     * dynamics (XPBD). The constraints are gathered once, from the
+     * links' addConstraint, into a flat array holding each one's two
+     * ends as node indices; the nodes are the world's particles, in
+     * the order of its particle list, followed by the anchors of the
+     * anchored links, which never move. Each step copies the predicted
+     * particle positions into a flat array of nodes, relaxes every
+     * constraint a fixed number of times and copies them back.
+     *
+     * A rod holds its ends at its length, a cable only stops them
+     * going further apart than its length; cables don't bounce. A
+     * compliance of zero makes a link rigid, larger ones let it
+     * stretch like a spring of stiffness 1/compliance, whatever the
+     * time step and iteration count.
+     *
+     * The Jacobi variant works out every constraint's correction from
+     * the same positions and moves each node by the total of the
+     * corrections it is given. Each correction, and so the lambda the
+     * compliance works from, is scaled by the relaxation over the
+     * number of constraints on the busier end. The Gauss-Seidel
+     * variant colours the constraints so no two of a colour share a
+     * node, and relaxes a colour at a time, each from the positions the
+     * colours before it left; a chain needs two colours, a grid four.
+     * Gauss-Seidel converges in fewer iterations, Jacobi has no step
+     * between colours. With a worker pool set both split the
+     * constraints of a pass into blocks run in parallel, and give the
+     * same result as without one.
+     */
+    class ParticleXPBDSolver
+    {
+    public:
+        // The most colours the Gauss-Seidel variant uses.
+        static const unsigned MAX_COLOURS = 32;
+
+        // One link, as the solver keeps it.
+        struct Constraint
+        {
+            unsigned node[2];
+            real length;
+            // The total of the corrections made this step.
+            real lambda;
+            // Set for cables, which may be shorter than their length.
+            bool slack;
+        };
+
+    protected:
+        /* The constraints, sorted by colour once the Gauss-Seidel
+         * variant has run. The constraints of colour c are
+         * constraints[colourStart[c]] .. [colourStart[c+1]-1]; any that
+         * would have needed more than MAX_COLOURS follow the last
+         * colour and are relaxed on the calling thread. */
+        std::vector<Constraint> constraints;
+        std::vector<unsigned> colourStart;
+        bool coloured;
+
+        // The nodes: the particles, then the anchors.
+        unsigned particleCount;
+        std::vector<Vector3> positions;
+        std::vector<Vector3> predicted;
+        std::vector<real> inverseMasses;
+
+        /* For the Jacobi variant, each constraint's correction of its
+         * two ends and its share of the relaxation, and the
+         * corrections of node n at
+         * nodeCorrections[nodeStart[n]] .. [nodeStart[n+1]-1]. */
+        std::vector<Vector3> corrections;
+        std::vector<real> shares;
+        std::vector<unsigned> nodeStart;
+        std::vector<unsigned> nodeCorrections;
+        bool indexed;
+
+        ParticleLinkSolver variant;
+        unsigned iterations;
+        unsigned substeps;
+        real rodCompliance;
+        real cableCompliance;
+        real relaxation;
+        WorkerPool* workers;
+
+        void colourConstraints();
+        void indexCorrections();
+        void solveJacobi(real duration);
+        void solveGaussSeidel(real duration);
+
+    public:
+        ParticleXPBDSolver();
+
+        /* Empties the solver, ready for the links of a world with the
+         * given number of particles to be added. */
+        void clear(unsigned particleCount);
+
+        /* Adds a link between two particles, given as their positions
+         * in the world's particle list, or between a particle and a
+         * fixed anchor. */
+        void addLink(unsigned particle0, unsigned particle1, real length, bool cable);
+        void addAnchoredLink(unsigned particle, const Vector3 &anchor, real length, bool cable);
+
+        unsigned getConstraintCount() const;
+        // The number of colours the Gauss-Seidel variant last used.
+        unsigned getColourCount() const;
+
+        void setVariant(ParticleLinkSolver variant);
+        ParticleLinkSolver getVariant() const;
+
+        // The number of times every constraint is relaxed each step.
+        void setIterations(unsigned iterations);
+        unsigned getIterations() const;
+
+        /* Sets the number of steps the ParticleWorld splits each of
+         * its steps into, integrating and solving each in turn. The
+         * error a long chain is left with falls with the square of
+         * the step, so a few substeps of one iteration hold it far
+         * better than as many iterations of one step. Defaults to 1. */
+        void setSubsteps(unsigned substeps);
+        unsigned getSubsteps() const;
+
+        /* Sets how far the links give, in metres per newton, with zero
+         * for rigid links, the default. */
+        void setCompliance(real rodCompliance, real cableCompliance);
+
+        /* Scales the shared out Jacobi corrections. Values above one
+         * make up for the sharing and converge faster; two or more
+         * overshoots. Defaults to 1.5. */
+        void setRelaxation(real relaxation);
+
+        // Sets a pool to solve in parallel with, or NULL to solve serially.
+        void setWorkerPool(WorkerPool* workers);
+
+        /* Moves the particles from where they would have got to
+         * without their links to where the links hold them, and
+         * changes their velocities by the distance moved over the
+         * duration. The particles are the world's particle list. */
+        void solve(Particle *const *particles, real duration);
+    };
+}
+
+#endif
@@ -0,0 +1,47 @@
+#include "simd.h"
+
+#if defined(PHY_SIMD_X86) && defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+namespace Phy
+{
+    static SimdLevel queryCpu()
+    {
+#if defined(PHY_SIMD_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+
+        bool sse2 = (info[3] & (1 << 26)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+
+        // The OS must also save the upper halves of the ymm registers.
+        if(avx && osxsave)
+        {
+            avx = (_xgetbv(0) & 6) == 6;
+        }
+        else
+        {
+            avx = false;
+        }
+
+        if(avx) return SIMD_AVX;
+        if(sse2) return SIMD_SSE2;
+        return SIMD_NONE;
+#elif defined(PHY_SIMD_X86)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx")) return SIMD_AVX;
+        if(__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+        return SIMD_NONE;
+#else
+        return SIMD_NONE;
+#endif
+    }
+
+    SimdLevel detectSimdLevel()
+    {
+        static SimdLevel level = queryCpu();
+        return level;
+    }
+}
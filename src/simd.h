@@ -0,0 +1,221 @@
+#ifndef PHY_SIMD_H
+#define PHY_SIMD_H
+
+/*
+ * Helpers for the optional SIMD code paths. Kernels that use wider
+ * instruction sets are compiled for them with PHY_TARGET_AVX and only
+ * called when detectSimdLevel() says the CPU supports them, so the
+ * rest of the library still builds for a baseline target.
+ */
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define PHY_SIMD_X86
+    #include <emmintrin.h>
+    #include <immintrin.h>
+#endif
+
+// SSE2 is part of the x86-64 baseline, so small inline kernels can use
+// it without checking the CPU first.
+#if defined(PHY_SIMD_X86) && (defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define PHY_SIMD_SSE2
+#endif
+
+// NEON, with double precision lanes, is part of the 64-bit ARM baseline.
+#if defined(__aarch64__) || defined(_M_ARM64)
+    #define PHY_SIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+// The core maths types use four lane vectors where the baseline has
+// them, unless PHY_SCALAR_MATH asks for the plain scalar code.
+#if (defined(PHY_SIMD_SSE2) || defined(PHY_SIMD_NEON)) && !defined(PHY_SCALAR_MATH)
+    #define PHY_SIMD_CORE
+#endif
+
+#if defined(_MSC_VER)
+    #define PHY_TARGET_AVX
+#else
+    #define PHY_TARGET_AVX __attribute__((target("avx")))
+#endif
+
+namespace Phy
+{
+    enum SimdLevel
+    {
+        SIMD_NONE = 0,
+        SIMD_SSE2,
+        SIMD_AVX
+    };
+
+    // Returns the widest instruction set supported by both the CPU
+    // and the OS. The result is detected once and cached.
+    SimdLevel detectSimdLevel();
+
+#ifdef PHY_SIMD_CORE
+    /*
+     * Four scalars held in SIMD registers, loaded from and stored to
+     * four consecutive values in memory: a padded Vector3 or one row of
+     * a Matrix4. Doubles take two registers of two lanes, floats one of
+     * four. Every operation is done lane by lane in the same order as
+     * the scalar code, so results match it exactly.
+     */
+    template<class T> struct Packed4;
+
+    template<> struct Packed4<double>
+    {
+#if defined(PHY_SIMD_SSE2)
+        __m128d lo, hi;
+
+        static Packed4 load(const double *p)
+        {
+            Packed4 r; r.lo = _mm_loadu_pd(p); r.hi = _mm_loadu_pd(p + 2); return r;
+        }
+        void store(double *p) const
+        {
+            _mm_storeu_pd(p, lo); _mm_storeu_pd(p + 2, hi);
+        }
+        static Packed4 splat(double s)
+        {
+            Packed4 r; r.lo = r.hi = _mm_set1_pd(s); return r;
+        }
+        // (s, s, s, 0), for scaling a vector without touching its pad.
+        static Packed4 splat3(double s)
+        {
+            Packed4 r; r.lo = _mm_set1_pd(s); r.hi = _mm_set_sd(s); return r;
+        }
+        Packed4 operator+(const Packed4 &o) const
+        {
+            Packed4 r; r.lo = _mm_add_pd(lo, o.lo); r.hi = _mm_add_pd(hi, o.hi); return r;
+        }
+        Packed4 operator-(const Packed4 &o) const
+        {
+            Packed4 r; r.lo = _mm_sub_pd(lo, o.lo); r.hi = _mm_sub_pd(hi, o.hi); return r;
+        }
+        Packed4 operator*(const Packed4 &o) const
+        {
+            Packed4 r; r.lo = _mm_mul_pd(lo, o.lo); r.hi = _mm_mul_pd(hi, o.hi); return r;
+        }
+        // (lane0 + lane1) + lane2.
+        double sum3() const
+        {
+            __m128d s = _mm_add_sd(lo, _mm_unpackhi_pd(lo, lo));
+            return _mm_cvtsd_f64(_mm_add_sd(s, hi));
+        }
+#else
+        float64x2_t lo, hi;
+
+        static Packed4 load(const double *p)
+        {
+            Packed4 r; r.lo = vld1q_f64(p); r.hi = vld1q_f64(p + 2); return r;
+        }
+        void store(double *p) const
+        {
+            vst1q_f64(p, lo); vst1q_f64(p + 2, hi);
+        }
+        static Packed4 splat(double s)
+        {
+            Packed4 r; r.lo = r.hi = vdupq_n_f64(s); return r;
+        }
+        static Packed4 splat3(double s)
+        {
+            Packed4 r; r.lo = vdupq_n_f64(s); r.hi = vsetq_lane_f64(s, vdupq_n_f64(0), 0); return r;
+        }
+        Packed4 operator+(const Packed4 &o) const
+        {
+            Packed4 r; r.lo = vaddq_f64(lo, o.lo); r.hi = vaddq_f64(hi, o.hi); return r;
+        }
+        Packed4 operator-(const Packed4 &o) const
+        {
+            Packed4 r; r.lo = vsubq_f64(lo, o.lo); r.hi = vsubq_f64(hi, o.hi); return r;
+        }
+        Packed4 operator*(const Packed4 &o) const
+        {
+            Packed4 r; r.lo = vmulq_f64(lo, o.lo); r.hi = vmulq_f64(hi, o.hi); return r;
+        }
+        double sum3() const
+        {
+            return (vgetq_lane_f64(lo, 0) + vgetq_lane_f64(lo, 1)) + vgetq_lane_f64(hi, 0);
+        }
+#endif
+    };
+
+    template<> struct Packed4<float>
+    {
+#if defined(PHY_SIMD_SSE2)
+        __m128 v;
+
+        static Packed4 load(const float *p)
+        {
+            Packed4 r; r.v = _mm_loadu_ps(p); return r;
+        }
+        void store(float *p) const
+        {
+            _mm_storeu_ps(p, v);
+        }
+        static Packed4 splat(float s)
+        {
+            Packed4 r; r.v = _mm_set1_ps(s); return r;
+        }
+        static Packed4 splat3(float s)
+        {
+            Packed4 r; r.v = _mm_set_ps(0, s, s, s); return r;
+        }
+        Packed4 operator+(const Packed4 &o) const
+        {
+            Packed4 r; r.v = _mm_add_ps(v, o.v); return r;
+        }
+        Packed4 operator-(const Packed4 &o) const
+        {
+            Packed4 r; r.v = _mm_sub_ps(v, o.v); return r;
+        }
+        Packed4 operator*(const Packed4 &o) const
+        {
+            Packed4 r; r.v = _mm_mul_ps(v, o.v); return r;
+        }
+        float sum3() const
+        {
+            __m128 s = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+            return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(v, v)));
+        }
+#else
+        float32x4_t v;
+
+        static Packed4 load(const float *p)
+        {
+            Packed4 r; r.v = vld1q_f32(p); return r;
+        }
+        void store(float *p) const
+        {
+            vst1q_f32(p, v);
+        }
+        static Packed4 splat(float s)
+        {
+            Packed4 r; r.v = vdupq_n_f32(s); return r;
+        }
+        static Packed4 splat3(float s)
+        {
+            Packed4 r; r.v = vsetq_lane_f32(0, vdupq_n_f32(s), 3); return r;
+        }
+        Packed4 operator+(const Packed4 &o) const
+        {
+            Packed4 r; r.v = vaddq_f32(v, o.v); return r;
+        }
+        Packed4 operator-(const Packed4 &o) const
+        {
+            Packed4 r; r.v = vsubq_f32(v, o.v); return r;
+        }
+        Packed4 operator*(const Packed4 &o) const
+        {
+            Packed4 r; r.v = vmulq_f32(v, o.v); return r;
+        }
+        float sum3() const
+        {
+            return (vgetq_lane_f32(v, 0) + vgetq_lane_f32(v, 1)) + vgetq_lane_f32(v, 2);
+        }
+#endif
+    };
+#endif
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include "sleep.h"
+
+namespace Phy
+{
+    SleepIslands::SleepIslands()
+        : sleepingCount(0)
+    {
+    }
+
+    unsigned SleepIslands::find(unsigned body)
+    {
+        while(parents[body] != body)
+        {
+            // Halve the path as we go.
+            parents[body] = parents[parents[body]];
+            body = parents[body];
+        }
+        return body;
+    }
+
+    void SleepIslands::join(unsigned a, unsigned b)
+    {
+        a = find(a);
+        b = find(b);
+        if(a == b) return;
+
+        // Keep the lower index as the root, so the result does not
+        // depend on the order of the pairs.
+        if(a < b) parents[b] = a;
+        else parents[a] = b;
+    }
+
+    void SleepIslands::update(RigidBody *bodies, unsigned count,
+                              const PotentialContact *pairs, unsigned numPairs)
+    {
+        parents.resize(count);
+        restless.assign(count, 0);
+        for(unsigned i = 0; i < count; i++) parents[i] = i;
+
+        for(unsigned p = 0; p < numPairs; p++)
+        {
+            RigidBody *one = pairs[p].body[0];
+            RigidBody *two = pairs[p].body[1];
+            if(one < bodies || one >= bodies + count) continue;
+            if(two < bodies || two >= bodies + count) continue;
+            // Static bodies hold nothing together.
+            if(!one->hasFiniteMass() || !two->hasFiniteMass()) continue;
+
+            join((unsigned)(one - bodies), (unsigned)(two - bodies));
+        }
+
+        // An island must stay awake if any of its bodies is awake and
+        // either still moving or not allowed to sleep.
+        for(unsigned i = 0; i < count; i++)
+        {
+            const RigidBody &body = bodies[i];
+            if(body.getInverseMass() <= 0 || !body.getAwake()) continue;
+            if(!body.getCanSleep() || body.getMotion() >= sleepEpsilon)
+            {
+                restless[find(i)] = 1;
+            }
+        }
+
+        sleepingCount = 0;
+        for(unsigned i = 0; i < count; i++)
+        {
+            RigidBody &body = bodies[i];
+            if(body.getInverseMass() <= 0) continue;
+
+            if(restless[find(i)])
+            {
+                if(!body.getAwake()) body.setAwake();
+            }
+            else
+            {
+                if(body.getAwake()) body.setAwake(false);
+                sleepingCount++;
+            }
+        }
+    }
+
+    unsigned SleepIslands::getSleepingCount() const
+    {
+        return sleepingCount;
+    }
+}
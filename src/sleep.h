@@ -0,0 +1,45 @@
+#ifndef PHY_SLEEP_H
+#define PHY_SLEEP_H
+
+#include <vector>
+#include "collide_coarse.h"
+
+namespace Phy
+{
+    /*
+     * Puts resting groups of bodies to sleep and wakes them again. The
+     * bodies are split into islands: groups connected through touching
+     * pairs, where bodies of infinite mass (the ground, walls) do not
+     * connect anything. An island sleeps once every body in it has a
+     * motion average under sleepEpsilon. If any body in a sleeping
+     * island is woken, by a force or by an awake body touching it, the
+     * whole island wakes on the next update.
+     */
+    class SleepIslands
+    {
+    protected:
+        // Union-find parents over body indices.
+        std::vector<unsigned> parents;
+        // Whether each island has a body that must stay awake.
+        std::vector<unsigned char> restless;
+        unsigned sleepingCount;
+
+        unsigned find(unsigned body);
+        void join(unsigned a, unsigned b);
+
+    public:
+        SleepIslands();
+
+        /* Updates the awake state of the given bodies, using the given
+         * pairs of touching bodies to build the islands. Pairs holding
+         * bodies outside the array are ignored.
+         */
+        void update(RigidBody *bodies, unsigned count,
+                    const PotentialContact *pairs, unsigned numPairs);
+
+        // The number of bodies asleep after the last update.
+        unsigned getSleepingCount() const;
+    };
+}
+
+#endif
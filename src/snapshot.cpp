@@ -0,0 +1,243 @@
+#include <cstdio>
+#include <cstring>
+#include "snapshot.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    // Identifies snapshot files, and deltas.
+    static const char FILE_MAGIC[4] = { 'P', 'H', 'Y', 'S' };
+    static const char DELTA_MAGIC[4] = { 'P', 'H', 'Y', 'D' };
+
+    Snapshot::Snapshot()
+        : size(0), frame(0)
+    {
+    }
+
+    void Snapshot::clear()
+    {
+        size = 0;
+    }
+
+    unsigned char *Snapshot::extend(unsigned bytes)
+    {
+        if(size + bytes > data.size())
+        {
+            // Grow geometrically, so building a snapshot up is linear.
+            unsigned capacity = (unsigned)data.size() * 2;
+            if(capacity < size + bytes) capacity = size + bytes;
+            data.resize(capacity);
+        }
+        unsigned char *start = data.empty() ? NULL : &data[size];
+        size += bytes;
+        return start;
+    }
+
+    void Snapshot::write(const void *source, unsigned bytes)
+    {
+        if(bytes == 0) return;
+        memcpy(extend(bytes), source, bytes);
+    }
+
+    void Snapshot::writeUnsigned(unsigned value)
+    {
+        write(&value, sizeof(unsigned));
+    }
+
+    void Snapshot::patchUnsigned(unsigned offset, unsigned value)
+    {
+        Assert(offset + sizeof(unsigned) <= size);
+        memcpy(&data[offset], &value, sizeof(unsigned));
+    }
+
+    const unsigned char *Snapshot::getData() const
+    {
+        return size ? &data[0] : NULL;
+    }
+
+    unsigned Snapshot::getSize() const
+    {
+        return size;
+    }
+
+    void Snapshot::setFrame(unsigned frame)
+    {
+        Snapshot::frame = frame;
+    }
+
+    unsigned Snapshot::getFrame() const
+    {
+        return frame;
+    }
+
+    bool Snapshot::save(const char *filename) const
+    {
+        FILE *file = fopen(filename, "wb");
+        if(!file) return false;
+
+        unsigned header[2] = { frame, size };
+        bool written = fwrite(FILE_MAGIC, 1, 4, file) == 4 &&
+                       fwrite(header, sizeof(unsigned), 2, file) == 2 &&
+                       (size == 0 || fwrite(&data[0], 1, size, file) == size);
+        return (fclose(file) == 0) && written;
+    }
+
+    bool Snapshot::load(const char *filename)
+    {
+        FILE *file = fopen(filename, "rb");
+        if(!file) return false;
+
+        char magic[4];
+        unsigned header[2];
+        bool valid = fread(magic, 1, 4, file) == 4 && !memcmp(magic, FILE_MAGIC, 4) &&
+                     fread(header, sizeof(unsigned), 2, file) == 2;
+        if(valid)
+        {
+            clear();
+            unsigned char *target = extend(header[1]);
+            valid = header[1] == 0 || fread(target, 1, header[1], file) == header[1];
+            frame = header[0];
+        }
+        fclose(file);
+        if(!valid) clear();
+        return valid;
+    }
+
+    void Snapshot::makeDelta(const Snapshot &base, const Snapshot &target)
+    {
+        Assert(this != &base && this != &target);
+        clear();
+        frame = target.frame;
+
+        write(DELTA_MAGIC, 4);
+        writeUnsigned(base.frame);
+        writeUnsigned(base.size);
+        writeUnsigned(target.size);
+        unsigned countOffset = size;
+        writeUnsigned(0);
+
+        // Runs of changed blocks where both snapshots have them, then
+        // whatever the target has beyond the end of the base.
+        unsigned common = base.size < target.size ? base.size : target.size;
+        const unsigned char *from = base.getData();
+        const unsigned char *to = target.getData();
+        unsigned runs = 0;
+        unsigned offset = 0;
+        while(offset < common)
+        {
+            unsigned length = common - offset < DELTA_BLOCK ? common - offset : DELTA_BLOCK;
+            if(!memcmp(from + offset, to + offset, length))
+            {
+                offset += length;
+                continue;
+            }
+
+            unsigned start = offset;
+            offset += length;
+            while(offset < common)
+            {
+                length = common - offset < DELTA_BLOCK ? common - offset : DELTA_BLOCK;
+                if(!memcmp(from + offset, to + offset, length)) break;
+                offset += length;
+            }
+
+            writeUnsigned(start);
+            writeUnsigned(offset - start);
+            write(to + start, offset - start);
+            runs++;
+        }
+        if(target.size > common)
+        {
+            writeUnsigned(common);
+            writeUnsigned(target.size - common);
+            write(to + common, target.size - common);
+            runs++;
+        }
+        patchUnsigned(countOffset, runs);
+    }
+
+    bool Snapshot::applyDelta(const Snapshot &base, const Snapshot &delta)
+    {
+        Assert(this != &base && this != &delta);
+
+        SnapshotReader reader(delta);
+        const unsigned char *magic = reader.take(4);
+        if(!magic || memcmp(magic, DELTA_MAGIC, 4)) return false;
+        unsigned baseFrame = reader.readUnsigned();
+        unsigned baseSize = reader.readUnsigned();
+        unsigned targetSize = reader.readUnsigned();
+        unsigned runs = reader.readUnsigned();
+        if(reader.getFailed() || baseFrame != base.frame || baseSize != base.size) return false;
+
+        clear();
+        unsigned char *target = extend(targetSize);
+        unsigned common = baseSize < targetSize ? baseSize : targetSize;
+        if(common) memcpy(target, base.getData(), common);
+        for(unsigned r = 0; r < runs; r++)
+        {
+            unsigned offset = reader.readUnsigned();
+            unsigned length = reader.readUnsigned();
+            if(reader.getFailed() || offset > targetSize || length > targetSize - offset)
+            {
+                clear();
+                return false;
+            }
+            if(!reader.read(target + offset, length))
+            {
+                clear();
+                return false;
+            }
+        }
+        frame = delta.frame;
+        return true;
+    }
+
+    SnapshotReader::SnapshotReader(const Snapshot &snapshot)
+        : snapshot(&snapshot), offset(0), failed(false)
+    {
+    }
+
+    const unsigned char *SnapshotReader::take(unsigned bytes)
+    {
+        if(failed || bytes > snapshot->getSize() - offset)
+        {
+            failed = true;
+            return NULL;
+        }
+        const unsigned char *start = snapshot->getData() + offset;
+        offset += bytes;
+        return start;
+    }
+
+    bool SnapshotReader::read(void *target, unsigned bytes)
+    {
+        if(bytes == 0) return !failed;
+        const unsigned char *source = take(bytes);
+        if(!source) return false;
+        memcpy(target, source, bytes);
+        return true;
+    }
+
+    unsigned SnapshotReader::readUnsigned()
+    {
+        unsigned value = 0;
+        read(&value, sizeof(unsigned));
+        return value;
+    }
+
+    unsigned SnapshotReader::getOffset() const
+    {
+        return offset;
+    }
+
+    bool SnapshotReader::getFailed() const
+    {
+        return failed;
+    }
+
+    bool SnapshotReader::atEnd() const
+    {
+        return offset == snapshot->getSize();
+    }
+}
@@ -0,0 +1,224 @@
+#ifndef PHY_SNAPSHOT_H
+#define PHY_SNAPSHOT_H
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "precision.h"
+
+namespace Phy
+{
+
+    /*
+     * A binary copy of the state of a world, for rolling the world
+     * back to an earlier frame or replaying it from one. The worlds
+     * write and read their own sections (see ParticleWorld::saveState,
+     * World::saveState and ParticleWorldSoAT::saveState); the snapshot
+     * only holds the bytes, in the byte order and precision of the
+     * build that wrote them, which each world checks on restore.
+     *
+     * Pointers between the simulation's objects are written as
+     * indices: particles by their place in the world's particle list,
+     * bodies by their place in the world's body array. Clearing a
+     * snapshot keeps its storage, so a ring of snapshots reused frame
+     * after frame stops allocating once each has held the largest
+     * world seen.
+     *
+     * A delta holds only the parts of a snapshot that differ from a
+     * base snapshot, in blocks of DELTA_BLOCK bytes, along with the
+     * frame of the base. Most of a world at rest is unchanged from one
+     * frame to the next, so deltas against a recent keyframe are much
+     * smaller than full snapshots for sending or keeping.
+     */
+    class Snapshot
+    {
+    public:
+        // The size of the blocks a delta compares and copies.
+        static const unsigned DELTA_BLOCK = 64;
+
+    protected:
+        std::vector<unsigned char> data;
+        unsigned size;
+
+        // The frame the snapshot was taken on, set by the caller.
+        unsigned frame;
+
+    public:
+        Snapshot();
+
+        // Empties the snapshot, keeping its storage.
+        void clear();
+
+        /* Adds the given number of bytes to the end of the snapshot
+         * and returns them, to be written in place. The pointer is
+         * invalidated by the next write. */
+        unsigned char *extend(unsigned bytes);
+
+        void write(const void *source, unsigned bytes);
+        void writeUnsigned(unsigned value);
+
+        // Overwrites a value written earlier, such as a size.
+        void patchUnsigned(unsigned offset, unsigned value);
+
+        const unsigned char *getData() const;
+        unsigned getSize() const;
+
+        void setFrame(unsigned frame);
+        unsigned getFrame() const;
+
+        // Writes the snapshot and its frame to a file, and reads them back.
+        bool save(const char *filename) const;
+        bool load(const char *filename);
+
+        /* Makes this snapshot a delta holding the blocks of the target
+         * that differ from the base. The delta takes the frame of the
+         * target. */
+        void makeDelta(const Snapshot &base, const Snapshot &target);
+
+        /* Makes this snapshot the target a delta was made from, given
+         * the base it was made against. Returns false if the base is
+         * not from the frame the delta was made against, or the delta
+         * is malformed. */
+        bool applyDelta(const Snapshot &base, const Snapshot &delta);
+    };
+
+    /*
+     * Reads a snapshot back in the order it was written. A read past
+     * the end fails, and every read after it fails too, so a restore
+     * can read a whole section and check once at the end.
+     */
+    class SnapshotReader
+    {
+    protected:
+        const Snapshot *snapshot;
+        unsigned offset;
+        bool failed;
+
+    public:
+        SnapshotReader(const Snapshot &snapshot);
+
+        /* Returns the next given number of bytes, to be read in
+         * place, or NULL if there aren't that many. */
+        const unsigned char *take(unsigned bytes);
+
+        bool read(void *target, unsigned bytes);
+        unsigned readUnsigned();
+
+        unsigned getOffset() const;
+        bool getFailed() const;
+        bool atEnd() const;
+    };
+
+    /*
+     * Turns pointers into their positions in a list of pointers, such
+     * as ParticleWorld::Particles, so they can be written as indices.
+     *
+     * Lists of objects that are laid out in order in one array, which
+     * is how particles are usually allocated, are found by subtracting
+     * the first pointer. Other lists are sorted once and searched. The
+     * index is only rebuilt when the list it is given has changed
+     * since the last build.
+     */
+    template<class T>
+    class PointerIndex
+    {
+    public:
+        // Returned for a pointer that is not in the list.
+        static const unsigned NOT_FOUND = 0xffffffff;
+
+    protected:
+        struct Entry
+        {
+            const T *item;
+            unsigned index;
+
+            bool operator<(const Entry &other) const
+            {
+                return std::less<const T*>()(item, other.item);
+            }
+        };
+
+        // The list the index was built from.
+        std::vector<T*> items;
+
+        // Set if every item follows the one before it in memory.
+        bool contiguous;
+        std::vector<Entry> sorted;
+
+    public:
+        PointerIndex();
+
+        void build(T *const *list, unsigned count);
+        unsigned find(const T *item) const;
+        unsigned getCount() const;
+    };
+
+    template <class T>
+    const unsigned PointerIndex<T>::NOT_FOUND;
+
+    template <class T>
+    PointerIndex<T>::PointerIndex()
+        : contiguous(true)
+    {
+    }
+
+    template <class T>
+    void PointerIndex<T>::build(T *const *list, unsigned count)
+    {
+        if(count == items.size() && (count == 0 || std::equal(list, list + count, items.begin())))
+        {
+            return;
+        }
+
+        items.assign(list, list + count);
+        contiguous = true;
+        for(unsigned i = 1; i < count && contiguous; i++)
+        {
+            contiguous = (items[i] == items[0] + i);
+        }
+
+        sorted.clear();
+        if(contiguous) return;
+
+        sorted.resize(count);
+        for(unsigned i = 0; i < count; i++)
+        {
+            sorted[i].item = items[i];
+            sorted[i].index = i;
+        }
+        std::sort(sorted.begin(), sorted.end());
+    }
+
+    template <class T>
+    unsigned PointerIndex<T>::find(const T *item) const
+    {
+        if(items.empty()) return NOT_FOUND;
+
+        if(contiguous)
+        {
+            // Compared as addresses, as the item may not be in the array.
+            size_t first = (size_t)items[0];
+            size_t address = (size_t)item;
+            if(address < first || (address - first) % sizeof(T)) return NOT_FOUND;
+            size_t index = (address - first) / sizeof(T);
+            return index < items.size() ? (unsigned)index : NOT_FOUND;
+        }
+
+        Entry key;
+        key.item = item;
+        typename std::vector<Entry>::const_iterator found =
+            std::lower_bound(sorted.begin(), sorted.end(), key);
+        if(found == sorted.end() || found->item != item) return NOT_FOUND;
+        return found->index;
+    }
+
+    template <class T>
+    unsigned PointerIndex<T>::getCount() const
+    {
+        return (unsigned)items.size();
+    }
+
+}
+
+#endif
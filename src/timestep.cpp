@@ -0,0 +1,173 @@
+#include "timestep.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    FixedTimestep::FixedTimestep(real stepSize, unsigned maxSteps)
+        : stepSize(stepSize), maxSteps(maxSteps), accumulator(0),
+          particleWorld(NULL), world(NULL), stepsTaken(0), droppedTime(0)
+    {
+        Assert(stepSize > 0);
+    }
+
+    void FixedTimestep::setParticleWorld(ParticleWorld *particleWorld)
+    {
+        FixedTimestep::particleWorld = particleWorld;
+        reset();
+    }
+
+    void FixedTimestep::setWorld(World *world)
+    {
+        FixedTimestep::world = world;
+        reset();
+    }
+
+    void FixedTimestep::saveState()
+    {
+        if(particleWorld)
+        {
+            ParticleWorld::Particles &particles = particleWorld->getParticles();
+            previousParticlePositions.resize(particles.size());
+            for(unsigned i = 0; i < particles.size(); i++)
+            {
+                previousParticlePositions[i] = particles[i]->position;
+            }
+        }
+
+        if(world)
+        {
+            World::RigidBodies &bodies = world->getRigidBodies();
+            previousBodyPositions.resize(bodies.size());
+            previousBodyOrientations.resize(bodies.size());
+            for(unsigned i = 0; i < bodies.size(); i++)
+            {
+                previousBodyPositions[i] = bodies[i].getPosition();
+                previousBodyOrientations[i] = bodies[i].getOrientation();
+            }
+        }
+    }
+
+    void FixedTimestep::step()
+    {
+        saveState();
+
+        if(particleWorld)
+        {
+            particleWorld->startFrame();
+            particleWorld->runPhysics(stepSize);
+        }
+        if(world)
+        {
+            world->startFrame();
+            world->runPhysics(stepSize);
+        }
+    }
+
+    unsigned FixedTimestep::advance(real frameTime)
+    {
+        if(frameTime > 0) accumulator += frameTime;
+
+        stepsTaken = 0;
+        while(accumulator >= stepSize && stepsTaken < maxSteps)
+        {
+            step();
+            accumulator -= stepSize;
+            stepsTaken++;
+        }
+
+        // Drop the whole steps we had no budget for, keeping the
+        // fraction of a step for interpolation.
+        if(accumulator >= stepSize)
+        {
+            real kept = real_fmod(accumulator, stepSize);
+            droppedTime += accumulator - kept;
+            accumulator = kept;
+        }
+
+        return stepsTaken;
+    }
+
+    void FixedTimestep::reset()
+    {
+        accumulator = 0;
+        saveState();
+    }
+
+    real FixedTimestep::getAlpha() const
+    {
+        return accumulator / stepSize;
+    }
+
+    Vector3 FixedTimestep::getParticlePosition(unsigned index) const
+    {
+        const Vector3 &current = particleWorld->getParticles()[index]->position;
+        if(index >= previousParticlePositions.size()) return current;
+
+        Vector3 result = previousParticlePositions[index];
+        result.addScaledVector(current - result, getAlpha());
+        return result;
+    }
+
+    Vector3 FixedTimestep::getBodyPosition(unsigned index) const
+    {
+        Vector3 current = world->getRigidBodies()[index].getPosition();
+        if(index >= previousBodyPositions.size()) return current;
+
+        Vector3 result = previousBodyPositions[index];
+        result.addScaledVector(current - result, getAlpha());
+        return result;
+    }
+
+    Quaternion FixedTimestep::getBodyOrientation(unsigned index) const
+    {
+        Quaternion current = world->getRigidBodies()[index].getOrientation();
+        if(index >= previousBodyOrientations.size()) return current;
+
+        // Normalised linear interpolation, through the shorter arc.
+        const Quaternion &previous = previousBodyOrientations[index];
+        real alpha = getAlpha();
+        real dot = previous.r*current.r + previous.i*current.i +
+            previous.j*current.j + previous.k*current.k;
+        real b = (dot < 0) ? -alpha : alpha;
+        real a = 1 - alpha;
+
+        Quaternion result(a*previous.r + b*current.r,
+                          a*previous.i + b*current.i,
+                          a*previous.j + b*current.j,
+                          a*previous.k + b*current.k);
+        result.normalize();
+        return result;
+    }
+
+    real FixedTimestep::getStepSize() const
+    {
+        return stepSize;
+    }
+
+    void FixedTimestep::setStepSize(real stepSize)
+    {
+        Assert(stepSize > 0);
+        FixedTimestep::stepSize = stepSize;
+    }
+
+    unsigned FixedTimestep::getMaxSteps() const
+    {
+        return maxSteps;
+    }
+
+    void FixedTimestep::setMaxSteps(unsigned maxSteps)
+    {
+        FixedTimestep::maxSteps = maxSteps;
+    }
+
+    unsigned FixedTimestep::getStepsTaken() const
+    {
+        return stepsTaken;
+    }
+
+    real FixedTimestep::getDroppedTime() const
+    {
+        return droppedTime;
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef PHY_TIMESTEP_H
+#define PHY_TIMESTEP_H
+
+#include <vector>
+#include "pworld.h"
+#include "world.h"
+
+namespace Phy
+{
+    /*
+     * Steps a particle world and/or a rigid body world at a fixed rate,
+     * however long the rendered frames take. Frame time is added to an
+     * accumulator and consumed in whole steps. A frame never runs more
+     * than a maximum number of steps: time beyond that is dropped, so
+     * after a hitch the simulation slows down rather than taking one
+     * huge, unstable step or falling further behind.
+     *
+     * The state before the last step is kept, so rendering can blend
+     * between it and the current state by how far the accumulator has
+     * got towards the next step.
+     */
+    class FixedTimestep
+    {
+    protected:
+        real stepSize;
+        unsigned maxSteps;
+        real accumulator;
+
+        ParticleWorld *particleWorld;
+        World *world;
+
+        // The state before the most recent step.
+        std::vector<Vector3> previousParticlePositions;
+        std::vector<Vector3> previousBodyPositions;
+        std::vector<Quaternion> previousBodyOrientations;
+
+        unsigned stepsTaken;
+        real droppedTime;
+
+        void saveState();
+        void step();
+
+    public:
+        FixedTimestep(real stepSize = ((real)1.0)/60, unsigned maxSteps = 5);
+
+        // Sets the worlds to step. Either can be NULL.
+        void setParticleWorld(ParticleWorld *particleWorld);
+        void setWorld(World *world);
+
+        /* Adds the given frame time and runs as many fixed steps as it
+         * covers, up to the maximum. Returns the number of steps run.
+         */
+        unsigned advance(real frameTime);
+
+        /* Forgets the accumulated time and makes the current state the
+         * previous state too. Call it after moving objects directly.
+         */
+        void reset();
+
+        /* How far between the previous and current state rendering
+         * should be, from 0 to 1.
+         */
+        real getAlpha() const;
+
+        Vector3 getParticlePosition(unsigned index) const;
+        Vector3 getBodyPosition(unsigned index) const;
+        Quaternion getBodyOrientation(unsigned index) const;
+
+        real getStepSize() const;
+        void setStepSize(real stepSize);
+        unsigned getMaxSteps() const;
+        void setMaxSteps(unsigned maxSteps);
+
+        // Steps run by the last call to advance.
+        unsigned getStepsTaken() const;
+        // The total frame time dropped because of the step limit.
+        real getDroppedTime() const;
+    };
+}
+
+#endif
@@ -0,0 +1,619 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "trimesh.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
+
+namespace Phy
+{
+    // The bins the surface area heuristic tries split planes between.
+    static const unsigned SAH_BINS = 16;
+
+    // Identifies the files, and the version of the tree file.
+    static const char MESH_MAGIC[4] = { 'P', 'H', 'Y', 'M' };
+    static const char TREE_MAGIC[4] = { 'P', 'H', 'Y', 'T' };
+    static const unsigned TREE_VERSION = 1;
+
+    Vector3 closestPointOnTriangle(const Vector3 &point, const Vector3 &a,
+                                   const Vector3 &b, const Vector3 &c)
+    {
+        // Works out which region of the triangle the point is over:
+        // a vertex, an edge, or the face.
+        Vector3 ab = b - a;
+        Vector3 ac = c - a;
+        Vector3 ap = point - a;
+        real d1 = ab * ap;
+        real d2 = ac * ap;
+        if(d1 <= 0 && d2 <= 0) return a;
+
+        Vector3 bp = point - b;
+        real d3 = ab * bp;
+        real d4 = ac * bp;
+        if(d3 >= 0 && d4 <= d3) return b;
+
+        real vc = d1*d4 - d3*d2;
+        if(vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab * (d1 / (d1 - d3));
+
+        Vector3 cp = point - c;
+        real d5 = ab * cp;
+        real d6 = ac * cp;
+        if(d6 >= 0 && d5 <= d6) return c;
+
+        real vb = d5*d2 - d1*d6;
+        if(vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac * (d2 / (d2 - d6));
+
+        real va = d3*d6 - d5*d4;
+        if(va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+        {
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        }
+
+        // Inside the face
+        real denom = (real)1.0 / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    // Half the surface area of the box between the given corners.
+    static real getHalfArea(const Vector3 &lower, const Vector3 &upper)
+    {
+        Vector3 size = upper - lower;
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    static void growBounds(Vector3 &lower, Vector3 &upper,
+                           const Vector3 &otherLower, const Vector3 &otherUpper)
+    {
+        for(unsigned k = 0; k < 3; k++)
+        {
+            if(otherLower[k] < lower[k]) lower[k] = otherLower[k];
+            if(otherUpper[k] > upper[k]) upper[k] = otherUpper[k];
+        }
+    }
+
+    // The squared distance from the point to the node's box.
+    static real getSquareDistance(const TriangleMesh::Node &node, const Vector3 &point)
+    {
+        real distance = 0;
+        for(unsigned k = 0; k < 3; k++)
+        {
+            real v = point[k];
+            if(v < node.minimum[k]) distance += (node.minimum[k] - v) * (node.minimum[k] - v);
+            else if(v > node.maximum[k]) distance += (v - node.maximum[k]) * (v - node.maximum[k]);
+        }
+        return distance;
+    }
+
+    /* Checks a loaded tree only refers to nodes, triangles and
+     * vertices that exist. An inner node's children follow it, the
+     * first at the next index, so they are checked to come after it,
+     * which also keeps a traversal from looping.
+     */
+    static bool isValidTree(const std::vector<TriangleMesh::Node> &nodes,
+                            const std::vector<unsigned> &indices,
+                            unsigned vertexCount)
+    {
+        unsigned nodeCount = (unsigned)nodes.size();
+        unsigned triangleCount = (unsigned)indices.size() / 3;
+        for(unsigned i = 0; i < nodeCount; i++)
+        {
+            const TriangleMesh::Node &node = nodes[i];
+            if(node.isLeaf())
+            {
+                if(node.count > triangleCount || node.first > triangleCount - node.count) return false;
+            }
+            else
+            {
+                if(i + 1 >= nodeCount || node.first <= i + 1 || node.first >= nodeCount) return false;
+            }
+        }
+        for(unsigned i = 0; i < indices.size(); i++)
+        {
+            if(indices[i] >= vertexCount) return false;
+        }
+        return true;
+    }
+
+    static bool overlaps(const TriangleMesh::Node &node,
+                         const Vector3 &minimum, const Vector3 &maximum)
+    {
+        for(unsigned k = 0; k < 3; k++)
+        {
+            if(node.minimum[k] > maximum[k] || node.maximum[k] < minimum[k]) return false;
+        }
+        return true;
+    }
+
+    TriangleMesh::TriangleMesh()
+        : hash(0)
+    {
+    }
+
+    void TriangleMesh::setTriangles(const Vector3 *vertices, unsigned vertexCount,
+                                    const unsigned *indices, unsigned triangleCount)
+    {
+        TriangleMesh::vertices.assign(vertices, vertices + vertexCount);
+        TriangleMesh::indices.assign(indices, indices + triangleCount * 3);
+        nodes.clear();
+
+        // FNV-1a over the coordinates and indices.
+        hash = 2166136261u;
+        for(unsigned i = 0; i < vertexCount; i++)
+        {
+            for(unsigned k = 0; k < 3; k++)
+            {
+                real value = vertices[i][k];
+                const unsigned char *bytes = (const unsigned char *)&value;
+                for(unsigned b = 0; b < sizeof(real); b++) hash = (hash ^ bytes[b]) * 16777619u;
+            }
+        }
+        for(unsigned i = 0; i < triangleCount * 3; i++)
+        {
+            hash = (hash ^ indices[i]) * 16777619u;
+        }
+    }
+
+    bool TriangleMesh::loadObj(const char *filename)
+    {
+        FILE *file = fopen(filename, "r");
+        if(!file) return false;
+
+        std::vector<Vector3> objVertices;
+        std::vector<unsigned> objIndices;
+        char line[1024];
+        bool valid = true;
+        while(valid && fgets(line, sizeof(line), file))
+        {
+            if(line[0] == 'v' && line[1] == ' ')
+            {
+                double x, y, z;
+                if(sscanf(line + 2, "%lf %lf %lf", &x, &y, &z) != 3) valid = false;
+                objVertices.push_back(Vector3((real)x, (real)y, (real)z));
+            }
+            else if(line[0] == 'f' && line[1] == ' ')
+            {
+                // Each vertex is v, v/vt, v//vn or v/vt/vn, counted from
+                // one, or back from the last vertex if negative.
+                unsigned face[3];
+                unsigned corners = 0;
+                char *token = strtok(line + 2, " \t\r\n");
+                while(token)
+                {
+                    long index = strtol(token, NULL, 10);
+                    if(index < 0) index += (long)objVertices.size();
+                    else index -= 1;
+                    if(index < 0 || index >= (long)objVertices.size())
+                    {
+                        valid = false;
+                        break;
+                    }
+
+                    if(corners < 3) face[corners] = (unsigned)index;
+                    else
+                    {
+                        face[1] = face[2];
+                        face[2] = (unsigned)index;
+                    }
+                    corners++;
+                    if(corners >= 3)
+                    {
+                        objIndices.push_back(face[0]);
+                        objIndices.push_back(face[1]);
+                        objIndices.push_back(face[2]);
+                    }
+                    token = strtok(NULL, " \t\r\n");
+                }
+            }
+        }
+        fclose(file);
+        if(!valid || objIndices.empty()) return false;
+
+        setTriangles(&objVertices[0], (unsigned)objVertices.size(),
+                     &objIndices[0], (unsigned)objIndices.size() / 3);
+        return true;
+    }
+
+    bool TriangleMesh::loadBinary(const char *filename)
+    {
+        FILE *file = fopen(filename, "rb");
+        if(!file) return false;
+
+        char magic[4];
+        unsigned counts[2];
+        bool valid = fread(magic, 1, 4, file) == 4 && !memcmp(magic, MESH_MAGIC, 4) &&
+                     fread(counts, sizeof(unsigned), 2, file) == 2;
+
+        std::vector<float> coordinates;
+        std::vector<unsigned> binaryIndices;
+        if(valid && counts[0] && counts[1])
+        {
+            coordinates.resize(counts[0] * 3);
+            binaryIndices.resize(counts[1] * 3);
+            valid = fread(&coordinates[0], sizeof(float), coordinates.size(), file) == coordinates.size() &&
+                    fread(&binaryIndices[0], sizeof(unsigned), binaryIndices.size(), file) == binaryIndices.size();
+        }
+        else valid = false;
+        fclose(file);
+        if(!valid) return false;
+
+        for(unsigned i = 0; i < binaryIndices.size(); i++)
+        {
+            if(binaryIndices[i] >= counts[0]) return false;
+        }
+
+        std::vector<Vector3> binaryVertices(counts[0]);
+        for(unsigned i = 0; i < counts[0]; i++)
+        {
+            binaryVertices[i] = Vector3(coordinates[i*3], coordinates[i*3 + 1], coordinates[i*3 + 2]);
+        }
+        setTriangles(&binaryVertices[0], counts[0], &binaryIndices[0], counts[1]);
+        return true;
+    }
+
+    bool TriangleMesh::saveBinary(const char *filename) const
+    {
+        FILE *file = fopen(filename, "wb");
+        if(!file) return false;
+
+        unsigned counts[2] = { getVertexCount(), getTriangleCount() };
+        std::vector<float> coordinates(vertices.size() * 3);
+        for(unsigned i = 0; i < vertices.size(); i++)
+        {
+            for(unsigned k = 0; k < 3; k++) coordinates[i*3 + k] = (float)vertices[i][k];
+        }
+
+        bool written = fwrite(MESH_MAGIC, 1, 4, file) == 4 &&
+                       fwrite(counts, sizeof(unsigned), 2, file) == 2 &&
+                       fwrite(&coordinates[0], sizeof(float), coordinates.size(), file) == coordinates.size() &&
+                       fwrite(&indices[0], sizeof(unsigned), indices.size(), file) == indices.size();
+        return (fclose(file) == 0) && written;
+    }
+
+    void TriangleMesh::build()
+    {
+        nodes.clear();
+        unsigned triangleCount = getTriangleCount();
+        if(triangleCount == 0) return;
+
+        // The bounds and centre of each triangle.
+        std::vector<Vector3> lower(triangleCount), upper(triangleCount), centres(triangleCount);
+        std::vector<unsigned> order(triangleCount);
+        for(unsigned t = 0; t < triangleCount; t++)
+        {
+            Vector3 corners[3];
+            getTriangle(t, corners);
+            lower[t] = upper[t] = corners[0];
+            growBounds(lower[t], upper[t], corners[1], corners[1]);
+            growBounds(lower[t], upper[t], corners[2], corners[2]);
+            centres[t] = (lower[t] + upper[t]) * (real)0.5;
+            order[t] = t;
+        }
+
+        nodes.reserve(triangleCount * 2);
+        nodes.push_back(Node());
+        buildNode(0, 0, triangleCount, order, lower, upper, centres);
+
+        // Put the triangles in the order of the leaves.
+        std::vector<unsigned> sorted(indices.size());
+        for(unsigned t = 0; t < triangleCount; t++)
+        {
+            for(unsigned k = 0; k < 3; k++) sorted[t*3 + k] = indices[order[t]*3 + k];
+        }
+        indices.swap(sorted);
+    }
+
+    void TriangleMesh::buildNode(unsigned node, unsigned first, unsigned count,
+                                 std::vector<unsigned> &order,
+                                 const std::vector<Vector3> &lower,
+                                 const std::vector<Vector3> &upper,
+                                 const std::vector<Vector3> &centres)
+    {
+        // The bounds of the triangles, and of their centres.
+        Vector3 nodeLower = lower[order[first]], nodeUpper = upper[order[first]];
+        Vector3 centreLower = centres[order[first]], centreUpper = centreLower;
+        for(unsigned i = first + 1; i < first + count; i++)
+        {
+            unsigned t = order[i];
+            growBounds(nodeLower, nodeUpper, lower[t], upper[t]);
+            growBounds(centreLower, centreUpper, centres[t], centres[t]);
+        }
+        for(unsigned k = 0; k < 3; k++)
+        {
+            nodes[node].minimum[k] = nodeLower[k];
+            nodes[node].maximum[k] = nodeUpper[k];
+        }
+        nodes[node].first = first;
+        nodes[node].count = count;
+        if(count == 1) return;
+
+        // Bin the centres along each axis, and find the split between
+        // bins with the least area weighted by triangle count.
+        real bestCost = REAL_MAX;
+        unsigned bestAxis = 0, bestSplit = 0;
+        for(unsigned axis = 0; axis < 3; axis++)
+        {
+            real extent = centreUpper[axis] - centreLower[axis];
+            if(extent <= 0) continue;
+            real scale = (real)SAH_BINS / extent;
+
+            unsigned binCounts[SAH_BINS] = { 0 };
+            Vector3 binLower[SAH_BINS], binUpper[SAH_BINS];
+            for(unsigned i = first; i < first + count; i++)
+            {
+                unsigned t = order[i];
+                unsigned bin = (unsigned)((centres[t][axis] - centreLower[axis]) * scale);
+                if(bin >= SAH_BINS) bin = SAH_BINS - 1;
+                if(binCounts[bin]++ == 0)
+                {
+                    binLower[bin] = lower[t];
+                    binUpper[bin] = upper[t];
+                }
+                else growBounds(binLower[bin], binUpper[bin], lower[t], upper[t]);
+            }
+
+            // Sweep from the right, then from the left, giving the cost
+            // of splitting after each bin.
+            real rightArea[SAH_BINS];
+            unsigned rightCount[SAH_BINS];
+            Vector3 sweepLower, sweepUpper;
+            unsigned sweepCount = 0;
+            for(unsigned b = SAH_BINS - 1; b > 0; b--)
+            {
+                if(binCounts[b])
+                {
+                    if(sweepCount == 0)
+                    {
+                        sweepLower = binLower[b];
+                        sweepUpper = binUpper[b];
+                    }
+                    else growBounds(sweepLower, sweepUpper, binLower[b], binUpper[b]);
+                    sweepCount += binCounts[b];
+                }
+                rightCount[b] = sweepCount;
+                rightArea[b] = sweepCount ? getHalfArea(sweepLower, sweepUpper) : 0;
+            }
+
+            sweepCount = 0;
+            for(unsigned b = 0; b < SAH_BINS - 1; b++)
+            {
+                if(binCounts[b])
+                {
+                    if(sweepCount == 0)
+                    {
+                        sweepLower = binLower[b];
+                        sweepUpper = binUpper[b];
+                    }
+                    else growBounds(sweepLower, sweepUpper, binLower[b], binUpper[b]);
+                    sweepCount += binCounts[b];
+                }
+                if(sweepCount == 0 || rightCount[b + 1] == 0) continue;
+
+                real cost = getHalfArea(sweepLower, sweepUpper) * sweepCount +
+                            rightArea[b + 1] * rightCount[b + 1];
+                if(cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+
+        // Keep a small run as a leaf if splitting it doesn't pay for
+        // visiting the extra nodes, and any run whose centres can't be
+        // split. Visiting a node is taken to cost as much as testing a
+        // triangle.
+        if(bestCost == REAL_MAX) return;
+        real area = getHalfArea(nodeLower, nodeUpper);
+        if(count <= MAX_LEAF_TRIANGLES && bestCost + area >= area * count) return;
+
+        real scale = (real)SAH_BINS / (centreUpper[bestAxis] - centreLower[bestAxis]);
+        unsigned middle = first;
+        for(unsigned i = first; i < first + count; i++)
+        {
+            unsigned t = order[i];
+            unsigned bin = (unsigned)((centres[t][bestAxis] - centreLower[bestAxis]) * scale);
+            if(bin >= SAH_BINS) bin = SAH_BINS - 1;
+            if(bin < bestSplit)
+            {
+                order[i] = order[middle];
+                order[middle] = t;
+                middle++;
+            }
+        }
+        Assert(middle > first && middle < first + count);
+
+        unsigned left = (unsigned)nodes.size();
+        nodes.push_back(Node());
+        buildNode(left, first, middle - first, order, lower, upper, centres);
+
+        unsigned right = (unsigned)nodes.size();
+        nodes.push_back(Node());
+        buildNode(right, middle, first + count - middle, order, lower, upper, centres);
+
+        nodes[node].first = right;
+        nodes[node].count = 0;
+    }
+
+    bool TriangleMesh::buildCached(const char *cacheFile)
+    {
+        if(loadTree(cacheFile)) return true;
+        build();
+        saveTree(cacheFile);
+        return false;
+    }
+
+    bool TriangleMesh::saveTree(const char *filename) const
+    {
+        if(nodes.empty()) return false;
+
+        FILE *file = fopen(filename, "wb");
+        if(!file) return false;
+
+        // The sizes check the file was written by a build with the same
+        // precision and layout.
+        unsigned header[7] = { TREE_VERSION, (unsigned)sizeof(real), (unsigned)sizeof(Node),
+                               getVertexCount(), getTriangleCount(), hash, getNodeCount() };
+        bool written = fwrite(TREE_MAGIC, 1, 4, file) == 4 &&
+                       fwrite(header, sizeof(unsigned), 7, file) == 7 &&
+                       fwrite(&nodes[0], sizeof(Node), nodes.size(), file) == nodes.size() &&
+                       fwrite(&indices[0], sizeof(unsigned), indices.size(), file) == indices.size();
+        return (fclose(file) == 0) && written;
+    }
+
+    bool TriangleMesh::loadTree(const char *filename)
+    {
+        if(indices.empty()) return false;
+
+        FILE *file = fopen(filename, "rb");
+        if(!file) return false;
+
+        char magic[4];
+        unsigned header[7];
+        bool valid = fread(magic, 1, 4, file) == 4 && !memcmp(magic, TREE_MAGIC, 4) &&
+                     fread(header, sizeof(unsigned), 7, file) == 7 &&
+                     header[0] == TREE_VERSION && header[1] == sizeof(real) &&
+                     header[2] == sizeof(Node) && header[3] == getVertexCount() &&
+                     header[4] == getTriangleCount() && header[5] == hash && header[6] > 0;
+
+        std::vector<Node> fileNodes;
+        std::vector<unsigned> fileIndices;
+        if(valid)
+        {
+            fileNodes.resize(header[6]);
+            fileIndices.resize(indices.size());
+            valid = fread(&fileNodes[0], sizeof(Node), fileNodes.size(), file) == fileNodes.size() &&
+                    fread(&fileIndices[0], sizeof(unsigned), fileIndices.size(), file) == fileIndices.size();
+        }
+        fclose(file);
+        if(!valid || !isValidTree(fileNodes, fileIndices, getVertexCount())) return false;
+
+        nodes.swap(fileNodes);
+        indices.swap(fileIndices);
+        return true;
+    }
+
+    unsigned TriangleMesh::getTriangles(const Vector3 &minimum, const Vector3 &maximum,
+                                        unsigned *triangles, unsigned limit) const
+    {
+        if(nodes.empty()) return 0;
+
+        unsigned found = 0;
+        stack.clear();
+        stack.push_back(0);
+        while(!stack.empty())
+        {
+            unsigned index = stack.back();
+            stack.pop_back();
+            const Node &node = nodes[index];
+            if(!overlaps(node, minimum, maximum)) continue;
+
+            if(!node.isLeaf())
+            {
+                stack.push_back(node.first);
+                stack.push_back(index + 1);
+                continue;
+            }
+
+            for(unsigned t = node.first; t < node.first + node.count; t++)
+            {
+                // Check the triangle's own bounds, which are often much
+                // smaller than the leaf's.
+                Vector3 corners[3];
+                getTriangle(t, corners);
+                bool outside = false;
+                for(unsigned k = 0; k < 3 && !outside; k++)
+                {
+                    outside = (corners[0][k] < minimum[k] && corners[1][k] < minimum[k] &&
+                               corners[2][k] < minimum[k]) ||
+                              (corners[0][k] > maximum[k] && corners[1][k] > maximum[k] &&
+                               corners[2][k] > maximum[k]);
+                }
+                if(outside) continue;
+
+                if(found < limit) triangles[found] = t;
+                found++;
+            }
+        }
+        return found;
+    }
+
+    bool TriangleMesh::getClosestPoint(const Vector3 &point, real maxDistance,
+                                       Vector3 *closest, unsigned *triangle) const
+    {
+        if(nodes.empty()) return false;
+
+        // Only nodes nearer than the best point so far are opened.
+        real best = maxDistance * maxDistance;
+        bool found = false;
+        stack.clear();
+        stack.push_back(0);
+        while(!stack.empty())
+        {
+            unsigned index = stack.back();
+            stack.pop_back();
+            const Node &node = nodes[index];
+            if(getSquareDistance(node, point) > best) continue;
+
+            if(!node.isLeaf())
+            {
+                stack.push_back(node.first);
+                stack.push_back(index + 1);
+                continue;
+            }
+
+            for(unsigned t = node.first; t < node.first + node.count; t++)
+            {
+                Vector3 corners[3];
+                getTriangle(t, corners);
+                Vector3 candidate = closestPointOnTriangle(point, corners[0],
+                                                           corners[1], corners[2]);
+                real distance = (point - candidate).squareMagnitude();
+                if(distance < best)
+                {
+                    best = distance;
+                    *closest = candidate;
+                    *triangle = t;
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    void TriangleMesh::getTriangle(unsigned triangle, Vector3 corners[3]) const
+    {
+        corners[0] = vertices[indices[triangle*3]];
+        corners[1] = vertices[indices[triangle*3 + 1]];
+        corners[2] = vertices[indices[triangle*3 + 2]];
+    }
+
+    Vector3 TriangleMesh::getNormal(unsigned triangle) const
+    {
+        Vector3 corners[3];
+        getTriangle(triangle, corners);
+        Vector3 normal = (corners[1] - corners[0]) % (corners[2] - corners[0]);
+        normal.normalize();
+        return normal;
+    }
+
+    unsigned TriangleMesh::getVertexCount() const
+    {
+        return (unsigned)vertices.size();
+    }
+
+    unsigned TriangleMesh::getTriangleCount() const
+    {
+        return (unsigned)indices.size() / 3;
+    }
+
+    unsigned TriangleMesh::getNodeCount() const
+    {
+        return (unsigned)nodes.size();
+    }
+
+    const TriangleMesh::Node &TriangleMesh::getNode(unsigned node) const
+    {
+        return nodes[node];
+    }
+}
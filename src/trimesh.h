@@ -0,0 +1,132 @@
+#ifndef PHY_TRIMESH_H
+#define PHY_TRIMESH_H
+
+#include <cstddef>
+#include <vector>
+#include "core.h"
+
+namespace Phy
+{
+
+    /* Returns the point of the triangle abc closest to the given point. */
+    Vector3 closestPointOnTriangle(const Vector3 &point, const Vector3 &a,
+                                   const Vector3 &b, const Vector3 &c);
+
+    /*
+     * A static triangle mesh in world space, such as a level, for
+     * bodies and particles to collide with.
+     *
+     * The triangles are kept in a bounding volume hierarchy of their
+     * own, built once, top down, splitting each node where the surface
+     * area heuristic says the two halves are cheapest to query. Its
+     * nodes are stored in one array in depth first order, so the first
+     * child of a node is the node after it, and the triangles are
+     * reordered so the triangles of a leaf are a run of the index
+     * array. Building takes a while for a large level, so the tree can
+     * be written to a cache file and read back on later runs; the file
+     * records the size and a hash of the mesh it was built for, and is
+     * only used for that mesh.
+     */
+    class TriangleMesh
+    {
+    public:
+        // The most triangles a leaf is built with, unless they can't be split.
+        static const unsigned MAX_LEAF_TRIANGLES = 4;
+
+        struct Node
+        {
+            real minimum[3];
+            real maximum[3];
+
+            /* For a leaf, the first triangle and the number of them.
+             * Otherwise count is zero, and first is the second child. */
+            unsigned first;
+            unsigned count;
+
+            bool isLeaf() const
+            {
+                return count != 0;
+            }
+        };
+
+    protected:
+        std::vector<Vector3> vertices;
+        // Three vertex indices a triangle, in the order of the tree's leaves.
+        std::vector<unsigned> indices;
+        std::vector<Node> nodes;
+
+        // A hash of the vertices and triangles as they were given, to
+        // match cache files to the mesh they were built for.
+        unsigned hash;
+
+        /* Builds the node for the given run of triangles and its
+         * children, using the triangles' bounds and centres. */
+        void buildNode(unsigned node, unsigned first, unsigned count,
+                       std::vector<unsigned> &order,
+                       const std::vector<Vector3> &lower,
+                       const std::vector<Vector3> &upper,
+                       const std::vector<Vector3> &centres);
+
+        // Traversal stack for queries, kept to avoid reallocating.
+        mutable std::vector<unsigned> stack;
+
+    public:
+        TriangleMesh();
+
+        /* Sets the mesh from the given vertices and triangles, three
+         * indices a triangle. The tree has to be built, or loaded,
+         * before the mesh is used. */
+        void setTriangles(const Vector3 *vertices, unsigned vertexCount,
+                          const unsigned *indices, unsigned triangleCount);
+
+        /* Loads the vertices and faces of a Wavefront OBJ file.
+         * Faces of more than three vertices are split into fans. */
+        bool loadObj(const char *filename);
+
+        /* Loads a mesh in the library's binary format: the four bytes
+         * PHYM, then the vertex and triangle counts as 32 bit unsigned
+         * integers, the vertices as three floats each and the
+         * triangles as three 32 bit indices each. Ogre meshes can be
+         * converted by reading their vertex and index buffers, or
+         * handed to setTriangles directly. */
+        bool loadBinary(const char *filename);
+        bool saveBinary(const char *filename) const;
+
+        // Builds the tree over the current triangles.
+        void build();
+
+        /* Reads the tree from the given cache file if it was built for
+         * this mesh, and otherwise builds it and writes the cache.
+         * Returns true if the cache was used. */
+        bool buildCached(const char *cacheFile);
+
+        bool saveTree(const char *filename) const;
+
+        /* Loads a tree saved for this mesh. Returns false, keeping the
+         * tree it had, if the file is for another mesh or refers to
+         * nodes or triangles that don't exist. */
+        bool loadTree(const char *filename);
+
+        /* Writes the triangles whose bounds overlap the given box to
+         * the given array, up to the limit, and returns how many there
+         * were, which may be more than the limit. */
+        unsigned getTriangles(const Vector3 &minimum, const Vector3 &maximum,
+                              unsigned *triangles, unsigned limit) const;
+
+        /* Finds the point of the mesh closest to the given point, if
+         * one is within the given distance. */
+        bool getClosestPoint(const Vector3 &point, real maxDistance,
+                             Vector3 *closest, unsigned *triangle) const;
+
+        void getTriangle(unsigned triangle, Vector3 corners[3]) const;
+        Vector3 getNormal(unsigned triangle) const;
+
+        unsigned getVertexCount() const;
+        unsigned getTriangleCount() const;
+        unsigned getNodeCount() const;
+        const Node &getNode(unsigned node) const;
+    };
+
+}
+
+#endif
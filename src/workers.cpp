@@ -0,0 +1,96 @@
+#include "workers.h"
+
+namespace Phy
+{
+    WorkerPool::WorkerPool(unsigned threadCount)
+        : task(0), taskCount(0), nextIndex(0), activeWorkers(0),
+          generation(0), quit(false)
+    {
+        // The calling thread is one of the workers.
+        for(unsigned i = 1; i < threadCount; i++)
+        {
+            threads.push_back(std::thread(&WorkerPool::workerLoop, this, i));
+        }
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+
+        for(std::vector<std::thread>::iterator t = threads.begin();
+            t != threads.end();
+            t++)
+        {
+            t->join();
+        }
+    }
+
+    unsigned WorkerPool::getThreadCount() const
+    {
+        return (unsigned)threads.size() + 1;
+    }
+
+    void WorkerPool::execute(unsigned thread)
+    {
+        // Hand out indices one at a time, so uneven pieces of work
+        // still balance across the threads.
+        for(;;)
+        {
+            unsigned index = nextIndex.fetch_add(1);
+            if(index >= taskCount) break;
+            task->run(index, thread);
+        }
+    }
+
+    void WorkerPool::workerLoop(unsigned thread)
+    {
+        unsigned seen = 0;
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while(!quit && generation == seen) wake.wait(lock);
+                if(quit) return;
+                seen = generation;
+            }
+
+            execute(thread);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                activeWorkers--;
+            }
+            finished.notify_one();
+        }
+    }
+
+    void WorkerPool::run(ParallelTask *task, unsigned count)
+    {
+        if(count == 0) return;
+
+        if(threads.empty() || count == 1)
+        {
+            for(unsigned i = 0; i < count; i++) task->run(i, 0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            WorkerPool::task = task;
+            taskCount = count;
+            nextIndex = 0;
+            activeWorkers = (unsigned)threads.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        execute(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while(activeWorkers > 0) finished.wait(lock);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef PHY_WORKERS_H
+#define PHY_WORKERS_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace Phy
+{
+    /*
+     * A unit of work that can be split into independent pieces. The
+     * pool calls run once for every index in [0, count), in any order
+     * and from any of its threads. The thread number is in
+     * [0, getThreadCount()) and can be used to pick per-thread scratch
+     * space.
+     */
+    class ParallelTask
+    {
+    public:
+        virtual ~ParallelTask() {}
+        virtual void run(unsigned index, unsigned thread) = 0;
+    };
+
+    /*
+     * A fixed set of worker threads that execute ParallelTasks. The
+     * thread calling run takes part in the work, so a pool created with
+     * a thread count of one runs everything serially on the caller.
+     */
+    class WorkerPool
+    {
+    protected:
+        std::vector<std::thread> threads;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+
+        ParallelTask *task;
+        unsigned taskCount;
+        std::atomic<unsigned> nextIndex;
+        unsigned activeWorkers;
+        unsigned generation;
+        bool quit;
+
+        void workerLoop(unsigned thread);
+        void execute(unsigned thread);
+
+    public:
+        WorkerPool(unsigned threadCount);
+        ~WorkerPool();
+
+        unsigned getThreadCount() const;
+
+        // Runs every index of the task and returns once they have all finished.
+        void run(ParallelTask *task, unsigned count);
+    };
+}
+
+#endif
@@ -1,34 +1,526 @@
+#include <cstring>
+#include <algorithm>
+#include <functional>
 #include "world.h"
+#include "profile.h"
+
+#define Assert(Expression) if(!(Expression)) {*(int *)0 = 0;}
     
 namespace Phy
 {
+    World::World(unsigned initialContacts, unsigned iterations)
+        : heightField(NULL), triangleMesh(NULL), broadphase(0, (real)0.1),
+          potentialContacts(initialContacts ? initialContacts : 1),
+          pairCount(0), automaticSleep(true),
+          resolver(iterations), warmStarting(true), contacts(initialContacts)
+    {
+        calculateIterations = (iterations == 0);
+        iterationsPerContact = 4;
+
+        collisionData.friction = (real)0.9;
+        collisionData.restitution = (real)0.1;
+        collisionData.tolerance = (real)0.1;
+        collisionData.reset(&contacts);
+    }
+
+    // Orders pairs by their first body, then their second.
+    static bool pairBefore(const PotentialContact &one, const PotentialContact &two)
+    {
+        if(one.body[0] != two.body[0]) return std::less<RigidBody*>()(one.body[0], two.body[0]);
+        return std::less<RigidBody*>()(one.body[1], two.body[1]);
+    }
+
     void World::startFrame()
     {
+        PHY_PROFILE_SCOPE("World::startFrame");
         for(RigidBodies::iterator b = bodies.begin();
             b != bodies.end();
             b++)
         {
+            // Sleeping bodies were cleared when they fell asleep.
+            if(!b->getAwake()) continue;
+
             b->clearAccumulators();
-            b->calculateDerivedData();
         }
+
+        // Integration already updated the bodies it moved, so this only
+        // catches bodies moved directly since the last step.
+        if(!bodies.empty()) RigidBody::calculateDerivedData(&bodies[0], (unsigned)bodies.size());
     }
 
     void World::integrate(real duration)
     {
-        for(RigidBodies::iterator b = bodies.begin();
-            b != bodies.end();
-            b++)
+        PHY_PROFILE_SCOPE("World::integrate");
+        if(bodies.empty()) return;
+        integrator.integrateRigidBodies(&bodies[0], (unsigned)bodies.size(), duration);
+    }
+
+    void World::clearShape(unsigned body)
+    {
+        Assert(body < bodies.size());
+        if(bodyShapes.size() < bodies.size())
+        {
+            CollisionShape none = { SHAPE_NONE, 0 };
+            bodyShapes.resize(bodies.size(), none);
+            bodyLeaves.resize(bodies.size(), FlatBVH<BoundingBox>::NULL_NODE);
+        }
+
+        if(bodyLeaves[body] != FlatBVH<BoundingBox>::NULL_NODE)
+        {
+            broadphase.remove(bodyLeaves[body]);
+            bodyLeaves[body] = FlatBVH<BoundingBox>::NULL_NODE;
+        }
+        bodyShapes[body].type = SHAPE_NONE;
+    }
+
+    CollisionPrimitive &World::getPrimitive(const CollisionShape &shape)
+    {
+        if(shape.type == SHAPE_BOX) return boxes[shape.index];
+        return spheres[shape.index];
+    }
+
+    BoundingBox World::getVolume(const CollisionShape &shape)
+    {
+        if(shape.type == SHAPE_SPHERE)
+        {
+            const CollisionSphere &sphere = spheres[shape.index];
+            return BoundingBox(sphere.getAxis(3),
+                               Vector3(sphere.radius, sphere.radius, sphere.radius));
+        }
+
+        // The extent of a rotated box along each world axis is the sum
+        // of its half sizes projected onto that axis.
+        const CollisionBox &box = boxes[shape.index];
+        const Matrix4 &transform = box.getTransform();
+        Vector3 extent;
+        for(unsigned i = 0; i < 3; i++)
+        {
+            const real *row = transform.data + i*4;
+            extent[i] = real_abs(row[0]) * box.halfSize.x +
+                real_abs(row[1]) * box.halfSize.y +
+                real_abs(row[2]) * box.halfSize.z;
+        }
+        return BoundingBox(box.getAxis(3), extent);
+    }
+
+    unsigned World::generateContacts()
+    {
+        PHY_PROFILE_SCOPE("World::generateContacts");
+        collisionData.reset(&contacts);
+        pairCount = 0;
+        if(bodyShapes.empty()) return 0;
+
+        unsigned shapeCount = (unsigned)bodyShapes.size();
+        {
+            PHY_PROFILE_SCOPE("World::updateBroadphase");
+            for(unsigned i = 0; i < shapeCount; i++)
+            {
+                const CollisionShape &shape = bodyShapes[i];
+                if(shape.type == SHAPE_NONE) continue;
+
+                getPrimitive(shape).calculateInternals();
+
+                // Sleeping bodies keep the leaf they had when they stopped.
+                if(bodyLeaves[i] == FlatBVH<BoundingBox>::NULL_NODE)
+                {
+                    bodyLeaves[i] = broadphase.insert(&bodies[i], getVolume(shape));
+                }
+                else if(bodies[i].getAwake())
+                {
+                    broadphase.update(bodyLeaves[i], getVolume(shape));
+                }
+            }
+        }
+
+        // Check each awake shape against the planes, the terrain and the level
+        for(unsigned i = 0; i < shapeCount; i++)
+        {
+            const CollisionShape &shape = bodyShapes[i];
+            if(shape.type == SHAPE_NONE || !bodies[i].getAwake()) continue;
+
+            for(unsigned p = 0; p < planes.size(); p++)
+            {
+                if(!collisionData.hasMoreContacts()) break;
+                if(shape.type == SHAPE_BOX)
+                {
+                    CollisionDetector::boxAndHalfSpace(boxes[shape.index], planes[p],
+                                                       &collisionData);
+                }
+                else
+                {
+                    CollisionDetector::sphereAndHalfSpace(spheres[shape.index], planes[p],
+                                                          &collisionData);
+                }
+            }
+
+            if(heightField && collisionData.hasMoreContacts())
+            {
+                if(shape.type == SHAPE_BOX)
+                {
+                    CollisionDetector::boxAndHeightField(boxes[shape.index], *heightField,
+                                                         &collisionData);
+                }
+                else
+                {
+                    CollisionDetector::sphereAndHeightField(spheres[shape.index], *heightField,
+                                                            &collisionData);
+                }
+            }
+
+            if(triangleMesh && shape.type == SHAPE_SPHERE && collisionData.hasMoreContacts())
+            {
+                CollisionDetector::sphereAndTriangleMesh(spheres[shape.index], *triangleMesh,
+                                                         &collisionData);
+            }
+        }
+
+        // and then the pairs the broadphase finds
+        // A full list may have missed pairs, so it grows until one fits.
+        unsigned numPairs;
+        while(true)
         {
-            b->integrate(duration);
+            numPairs = broadphase.getPotentialContacts(&potentialContacts[0],
+                                                       (unsigned)potentialContacts.size());
+            if(numPairs < potentialContacts.size()) break;
+            potentialContacts.resize(potentialContacts.size() * 2);
         }
+
+        // The order the tree gives the pairs in depends on the order the
+        // bodies were inserted and moved in, so they are put in body
+        // order. Then the contacts, and how they are resolved, depend
+        // only on where the bodies are, and stepping from a restored
+        // snapshot repeats the steps first taken from it.
+        for(unsigned i = 0; i < numPairs; i++)
+        {
+            PotentialContact &pair = potentialContacts[i];
+            if(std::less<RigidBody*>()(pair.body[1], pair.body[0]))
+            {
+                std::swap(pair.body[0], pair.body[1]);
+            }
+        }
+        std::sort(potentialContacts.begin(), potentialContacts.begin() + numPairs, pairBefore);
+        pairCount = numPairs;
+        {
+            PHY_PROFILE_SCOPE("World::narrowphase");
+            CollisionDetector::collidePairs(&potentialContacts[0], numPairs,
+                                            &bodies[0], &bodyShapes[0],
+                                            spheres.empty() ? NULL : &spheres[0],
+                                            boxes.empty() ? NULL : &boxes[0],
+                                            &collisionData);
+        }
+
+        PHY_PROFILE_COUNTER("contacts", collisionData.contactCount);
+        return collisionData.contactCount;
+    }
+
+    void World::resolveContacts(unsigned numContacts, real duration)
+    {
+        if(numContacts == 0)
+        {
+            contactCache.clear();
+            return;
+        }
+
+        if(calculateIterations) resolver.setIterations(numContacts * iterationsPerContact);
+        Contact *contactArray = contacts.gather();
+        if(warmStarting) contactCache.warmStart(contactArray, numContacts);
+        resolver.resolveContacts(contactArray, numContacts, duration);
+        if(warmStarting) contactCache.store(contactArray, numContacts);
+
+        // The position pass leaves the bodies it moved marked dirty.
+        RigidBody::calculateDerivedData(&bodies[0], (unsigned)bodies.size());
     }
 
     void World::runPhysics(real duration)
     {
+        PHY_PROFILE_SCOPE("World::runPhysics");
+
         // First apply the force generators
-        registry.updateForces(duration);
+        {
+            PHY_PROFILE_SCOPE("ForceRegistry::updateForces");
+            registry.updateForces(duration);
+        }
 
         // then integrate the objects
         integrate(duration);
+
+        // and resolve the contacts they are left in.
+        unsigned usedContacts = generateContacts();
+        resolveContacts(usedContacts, duration);
+
+        // Finally let the resting islands among them sleep.
+        if(automaticSleep) updateSleep(&potentialContacts[0], pairCount);
+    }
+
+    // Identifies a rigid body world snapshot, and its version.
+    static const char WORLD_MAGIC[4] = { 'P', 'H', 'Y', 'R' };
+    static const unsigned WORLD_VERSION = 2;
+
+    // Written in place of the registration count when there are none.
+    static const unsigned NO_REGISTRATIONS = 0xffffffff;
+
+    bool World::saveState(Snapshot *snapshot, const ForceGenerators *forceGenerators) const
+    {
+        PHY_PROFILE_SCOPE("World::saveState");
+        snapshot->clear();
+        unsigned bodyCount = (unsigned)bodies.size();
+
+        // The bodies hold no pointers, so they are copied as they are.
+        snapshot->write(WORLD_MAGIC, 4);
+        unsigned header[5] = { WORLD_VERSION, (unsigned)sizeof(real), (unsigned)sizeof(RigidBody),
+                               bodyCount, forceGenerators ? registry.getCount() : NO_REGISTRATIONS };
+        snapshot->write(header, sizeof(header));
+        if(bodyCount) snapshot->write(&bodies[0], bodyCount * sizeof(RigidBody));
+
+        if(forceGenerators && registry.getCount())
+        {
+            unsigned generatorCount = (unsigned)forceGenerators->size();
+            forceGeneratorIndex.build(generatorCount ? &(*forceGenerators)[0] : NULL, generatorCount);
+
+            unsigned count = registry.getCount();
+            unsigned *pairs = (unsigned *)snapshot->extend(count * 2 * sizeof(unsigned));
+            for(unsigned r = 0; r < count; r++)
+            {
+                const RigidBody *body = registry.getBody(r);
+                if(!bodyCount || body < &bodies[0] || body >= &bodies[0] + bodyCount) return false;
+                pairs[r*2] = (unsigned)(body - &bodies[0]);
+                pairs[r*2 + 1] = forceGeneratorIndex.find(registry.getForceGenerator(r));
+                if(pairs[r*2 + 1] == PointerIndex<ForceGenerator>::NOT_FOUND) return false;
+            }
+        }
+
+        // The leaves are enlarged, and only moved once a body leaves
+        // its own, so where they are depends on the frames before; the
+        // pairs the broadphase gives depend on them, so they are saved
+        // too. Each body has a flag for whether it has a leaf, then
+        // the leaf's volume, empty if it has none.
+        unsigned leafBytes = bodyCount * (sizeof(unsigned) + sizeof(BoundingBox));
+        unsigned char *leaves = snapshot->extend(leafBytes);
+        if(bodyCount) memset(leaves, 0, leafBytes);
+        unsigned *hasLeaf = (unsigned *)leaves;
+        BoundingBox *volumes = (BoundingBox *)(leaves + bodyCount * sizeof(unsigned));
+        for(unsigned i = 0; i < bodyCount && i < bodyLeaves.size(); i++)
+        {
+            if(bodyLeaves[i] == FlatBVH<BoundingBox>::NULL_NODE) continue;
+            hasLeaf[i] = 1;
+            memcpy(&volumes[i], &broadphase.getNode(bodyLeaves[i]).volume, sizeof(BoundingBox));
+        }
+
+        return contactCache.saveState(snapshot, bodyCount ? &bodies[0] : NULL, bodyCount);
+    }
+
+    bool World::restoreState(const Snapshot &snapshot, const ForceGenerators *forceGenerators)
+    {
+        PHY_PROFILE_SCOPE("World::restoreState");
+        SnapshotReader reader(snapshot);
+        const unsigned char *magic = reader.take(4);
+        unsigned header[5];
+        if(!magic || memcmp(magic, WORLD_MAGIC, 4) || !reader.read(header, sizeof(header)))
+        {
+            return false;
+        }
+
+        unsigned bodyCount = (unsigned)bodies.size();
+        if(header[0] != WORLD_VERSION || header[1] != sizeof(real) ||
+           header[2] != sizeof(RigidBody) || header[3] != bodyCount)
+        {
+            return false;
+        }
+
+        // Find and check everything before changing anything.
+        const unsigned char *state = NULL;
+        if(bodyCount)
+        {
+            state = reader.take(bodyCount * sizeof(RigidBody));
+            if(!state) return false;
+        }
+
+        unsigned registrationCount = header[4];
+        const unsigned *pairs = NULL;
+        if(registrationCount != NO_REGISTRATIONS && registrationCount)
+        {
+            pairs = (const unsigned *)reader.take(registrationCount * 2 * sizeof(unsigned));
+            if(!pairs) return false;
+            if(forceGenerators)
+            {
+                for(unsigned r = 0; r < registrationCount; r++)
+                {
+                    if(pairs[r*2] >= bodyCount ||
+                       pairs[r*2 + 1] >= forceGenerators->size()) return false;
+                }
+            }
+        }
+
+        const unsigned char *leaves = NULL;
+        if(bodyCount)
+        {
+            leaves = reader.take(bodyCount * (sizeof(unsigned) + sizeof(BoundingBox)));
+            if(!leaves) return false;
+        }
+
+        if(bodyCount) memcpy(&bodies[0], state, bodyCount * sizeof(RigidBody));
+
+        if(registrationCount != NO_REGISTRATIONS && forceGenerators)
+        {
+            registry.clear();
+            for(unsigned r = 0; r < registrationCount; r++)
+            {
+                registry.add(&bodies[pairs[r*2]], (*forceGenerators)[pairs[r*2 + 1]]);
+            }
+        }
+
+        if(!contactCache.restoreState(&reader, bodyCount ? &bodies[0] : NULL, bodyCount))
+        {
+            return false;
+        }
+
+        // Only awake bodies are refitted each step, so a body restored
+        // asleep would keep the leaf of the frames rolled back over.
+        // Every leaf is put back as it was saved, and one that had not
+        // been inserted yet is removed to be inserted by the next step.
+        for(unsigned i = 0; i < bodyCount && i < bodyLeaves.size(); i++)
+        {
+            unsigned saved;
+            memcpy(&saved, leaves + i * sizeof(unsigned), sizeof(unsigned));
+            if(!saved || bodyShapes[i].type == SHAPE_NONE)
+            {
+                if(bodyLeaves[i] != FlatBVH<BoundingBox>::NULL_NODE)
+                {
+                    broadphase.remove(bodyLeaves[i]);
+                    bodyLeaves[i] = FlatBVH<BoundingBox>::NULL_NODE;
+                }
+                continue;
+            }
+
+            BoundingBox volume((Vector3()), (Vector3()));
+            memcpy(&volume, leaves + bodyCount * sizeof(unsigned) + i * sizeof(BoundingBox),
+                   sizeof(BoundingBox));
+            if(bodyLeaves[i] == FlatBVH<BoundingBox>::NULL_NODE)
+            {
+                bodyLeaves[i] = broadphase.insert(&bodies[i], volume);
+            }
+            broadphase.setVolume(bodyLeaves[i], volume);
+        }
+        return reader.atEnd();
+    }
+
+    void World::updateSleep(const PotentialContact *pairs, unsigned numPairs)
+    {
+        PHY_PROFILE_SCOPE("World::updateSleep");
+        if(bodies.empty()) return;
+        sleepIslands.update(&bodies[0], (unsigned)bodies.size(), pairs, numPairs);
+    }
+
+    void World::setAutomaticSleep(bool automaticSleep)
+    {
+        World::automaticSleep = automaticSleep;
+    }
+
+    void World::setSphere(unsigned body, real radius)
+    {
+        clearShape(body);
+
+        CollisionSphere sphere;
+        sphere.body = &bodies[body];
+        sphere.offset.setOrientationAndPos(Quaternion(), Vector3());
+        sphere.radius = radius;
+
+        bodyShapes[body].type = SHAPE_SPHERE;
+        bodyShapes[body].index = (unsigned)spheres.size();
+        spheres.push_back(sphere);
+    }
+
+    void World::setBox(unsigned body, const Vector3 &halfSize)
+    {
+        clearShape(body);
+
+        CollisionBox box;
+        box.body = &bodies[body];
+        box.offset.setOrientationAndPos(Quaternion(), Vector3());
+        box.halfSize = halfSize;
+
+        bodyShapes[body].type = SHAPE_BOX;
+        bodyShapes[body].index = (unsigned)boxes.size();
+        boxes.push_back(box);
+    }
+
+    void World::addPlane(const Vector3 &direction, real offset)
+    {
+        CollisionPlane plane;
+        plane.direction = direction;
+        plane.offset = offset;
+        planes.push_back(plane);
+    }
+
+    void World::setHeightField(const HeightField *heightField)
+    {
+        World::heightField = heightField;
+    }
+
+    void World::setTriangleMesh(const TriangleMesh *triangleMesh)
+    {
+        World::triangleMesh = triangleMesh;
+    }
+
+    void World::setContactProperties(real friction, real restitution)
+    {
+        collisionData.friction = friction;
+        collisionData.restitution = restitution;
+    }
+
+    void World::setIterationsPerContact(unsigned iterationsPerContact)
+    {
+        World::iterationsPerContact = iterationsPerContact;
+    }
+
+    void World::setWarmStarting(bool warmStarting)
+    {
+        World::warmStarting = warmStarting;
+        if(!warmStarting) contactCache.clear();
+    }
+
+    World::RigidBodies& World::getRigidBodies()
+    {
+        return bodies;
+    }
+
+    ForceRegistry& World::getForceRegistry()
+    {
+        return registry;
+    }
+
+    BatchIntegrator& World::getIntegrator()
+    {
+        return integrator;
+    }
+
+    SleepIslands& World::getSleepIslands()
+    {
+        return sleepIslands;
+    }
+
+    ContactResolver& World::getContactResolver()
+    {
+        return resolver;
+    }
+
+    ContactCache& World::getContactCache()
+    {
+        return contactCache;
+    }
+
+    FlatBVH<BoundingBox>& World::getBroadphase()
+    {
+        return broadphase;
+    }
+
+    Contact* World::getContacts()
+    {
+        return contacts.getCount() ? contacts.gather() : NULL;
+    }
+
+    unsigned World::getContactHighWaterMark() const
+    {
+        return contacts.getHighWaterMark();
     }
 }
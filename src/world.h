@@ -3,23 +3,177 @@
 
 #include "body.h"
 #include "fgen.h"
+#include "integrator.h"
+#include "sleep.h"
+#include "collide_bvh.h"
+#include "collide_fine.h"
 
 #include <vector>
 
 namespace Phy
 {
+    /*
+     * Holds the rigid bodies of a simulation, and steps them: force
+     * generators, integration, and then contact generation and
+     * resolution for the bodies that have been given collision
+     * geometry.
+     *
+     * Contacts are found in two phases. A FlatBVH of the bodies'
+     * bounding boxes gives the pairs that may touch, and the
+     * CollisionDetector turns those pairs, and each body against each
+     * plane, the terrain and the level mesh, into contacts. The contacts are written to a
+     * ContactBuffer that grows to hold as many as a step finds, and
+     * the pair list grows the same way. The resolved contacts are kept
+     * in a ContactCache, and the impulses found for them warm start
+     * the resolver on the same contacts in the next step.
+     */
     class World
     {
     public:
         typedef std::vector<RigidBody> RigidBodies;
+        typedef std::vector<ForceGenerator*> ForceGenerators;
+
     protected:
         RigidBodies bodies;
         ForceRegistry registry;
+        BatchIntegrator integrator;
+        SleepIslands sleepIslands;
+
+        // The shape of each body, and its broadphase leaf, by body index.
+        std::vector<CollisionShape> bodyShapes;
+        std::vector<unsigned> bodyLeaves;
+        std::vector<CollisionSphere> spheres;
+        std::vector<CollisionBox> boxes;
+        // Immovable half spaces every shape is tested against.
+        std::vector<CollisionPlane> planes;
+        // The terrain, if there is one, tested against the same way.
+        const HeightField *heightField;
+        // The static level mesh, if there is one, tested against spheres.
+        const TriangleMesh *triangleMesh;
+
+        FlatBVH<BoundingBox> broadphase;
+        std::vector<PotentialContact> potentialContacts;
+        // The pairs found by the last generateContacts.
+        unsigned pairCount;
+        bool automaticSleep;
+
+        bool calculateIterations;
+        unsigned iterationsPerContact;
+        ContactResolver resolver;
+        bool warmStarting;
+        ContactCache contactCache;
+        ContactBuffer<Contact> contacts;
+        CollisionData collisionData;
+
+        // Turns force generators into indices for snapshots.
+        mutable PointerIndex<ForceGenerator> forceGeneratorIndex;
+
+        // Clears the shape of the given body, making room for it.
+        void clearShape(unsigned body);
+        CollisionPrimitive &getPrimitive(const CollisionShape &shape);
+        BoundingBox getVolume(const CollisionShape &shape);
     
     public:
+        /* Creates a world with room for the given number of contacts
+         * a step to start with. With no iteration count given, each
+         * resolver pass is allowed a number of iterations for every
+         * contact found, four unless set otherwise.
+         */
+        World(unsigned initialContacts = 4096, unsigned iterations = 0);
+
         void startFrame();
         void integrate(real duration);
+
+        /* Finds the contacts of the bodies with collision geometry,
+         * and returns the number found. */
+        unsigned generateContacts();
+
+        /* Resolves the first numContacts contacts generated, and
+         * recalculates the derived data of the bodies that moved. */
+        void resolveContacts(unsigned numContacts, real duration);
+
+        /* Steps the world: the force generators, integration, and
+         * contact generation and resolution. Unless turned off, it
+         * then puts islands of resting bodies to sleep, and wakes
+         * islands with a moving body, joining the bodies in the pairs
+         * the broadphase just found.
+         */
         void runPhysics(real duration);
+
+        /* Runs the island pass with the given pairs of touching bodies
+         * instead of the world's own, for bodies whose contacts are
+         * found elsewhere. Turn automatic sleep off first, and call it
+         * once a frame after the contacts are known.
+         */
+        void updateSleep(const PotentialContact *pairs, unsigned numPairs);
+
+        /* Turns the island pass at the end of runPhysics on (the
+         * default) or off. */
+        void setAutomaticSleep(bool automaticSleep);
+
+        /* Gives the body at the given index collision geometry,
+         * replacing any it had. The shape is attached by pointer, so
+         * add the bodies before any shapes, as with the force registry.
+         */
+        void setSphere(unsigned body, real radius);
+        void setBox(unsigned body, const Vector3 &halfSize);
+        void addPlane(const Vector3 &direction, real offset);
+
+        /* Sets the terrain every shape is tested against, or none if
+         * NULL. The heightfield is not copied, so it has to outlive
+         * the world or be replaced first. */
+        void setHeightField(const HeightField *heightField);
+
+        /* Sets the static mesh, with its tree built, that spheres are
+         * tested against, or none if NULL. As with the heightfield it
+         * is not copied. Boxes are not tested against it. */
+        void setTriangleMesh(const TriangleMesh *triangleMesh);
+
+        // Sets the friction and restitution of the contacts generated.
+        void setContactProperties(real friction, real restitution);
+
+        /* Turns warm starting from the last step's contacts on (the
+         * default) or off. Turning it off forgets the cached contacts. */
+        void setWarmStarting(bool warmStarting);
+
+        /* Sets the resolver iterations allowed for each contact, when
+         * the world was created without an iteration count. Warm
+         * started stacks hold with half the default. */
+        void setIterationsPerContact(unsigned iterationsPerContact);
+
+        RigidBodies& getRigidBodies();
+        ForceRegistry& getForceRegistry();
+        BatchIntegrator& getIntegrator();
+        SleepIslands& getSleepIslands();
+        ContactResolver& getContactResolver();
+        ContactCache& getContactCache();
+        FlatBVH<BoundingBox>& getBroadphase();
+        /* Returns the contacts of the step as one array, or NULL
+         * before any are generated. */
+        Contact* getContacts();
+
+        // Returns the most contacts generated in a single step so far.
+        unsigned getContactHighWaterMark() const;
+
+        /* Writes the state of the world to the snapshot, replacing what
+         * it held: the bodies, copied whole, and the contacts kept to
+         * warm start the next step. As with the ParticleWorld, the
+         * force registrations are only written if a list of the force
+         * generators is given to write them as positions in. Returns
+         * false if a registration refers to a generator not in it.
+         */
+        bool saveState(Snapshot *snapshot, const ForceGenerators *forceGenerators = NULL) const;
+
+        /* Puts the world back to the state in the snapshot. The world
+         * must have the same number of bodies as when it was saved;
+         * their shapes are kept. The broadphase leaves are put back
+         * as they were saved, asleep or not, so it gives the pairs it
+         * gave then, and stepping on from a restored snapshot repeats
+         * the steps first taken from it. Returns false, without
+         * changing the world, if the snapshot doesn't match it; a
+         * malformed snapshot may leave it partly restored.
+         */
+        bool restoreState(const Snapshot &snapshot, const ForceGenerators *forceGenerators = NULL);
     };
 
 }